@@ -9,37 +9,72 @@
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <libsoup/soup.h>
 
 #include "rainmaker-scenario.h"
 #include "rainmaker-scenario-xml.h"
+#include "rainmaker-scenario-bin.h"
 #include "rainmaker-request.h"
 #include "rainmaker-client.h"
 #include "rainmaker-scoreboard.h"
+#include "rainmaker-histogram.h"
+#include "rainmaker-worker.h"
+#include "rainmaker-scheduler.h"
+#include "rainmaker-reporter.h"
+#include "rainmaker-raw.h"
+#include "rainmaker-distributed.h"
+#include "rainmaker-samplelog.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #ifndef RM_MAX_CLIENTS
-#define RM_MAX_CLIENTS 100
+#define RM_MAX_CLIENTS 100000
 #endif
 
+#ifndef RM_MAX_THREADS
+#define RM_MAX_THREADS 256
+#endif
+
+#ifndef RM_MAX_PERCENTILES
+#define RM_MAX_PERCENTILES 16
+#endif
+
+#define RM_DEFAULT_PERCENTILES "50,90,99,99.9"
+
 /// Options set through command line arguments
 typedef struct _cmdlineArgs {
     guint     clients;
+    guint     threads;
     guint     repeat;
     gboolean  keepcookies;
     guint     verbosity;
+    gchar    *rateSpec;
+    gdouble   rate;
+    gchar    *durationSpec;
+    gdouble   duration;
+    gchar    *warmupSpec;
+    gdouble   warmup;
+    gchar    *percentileList;
+    gdouble   percentiles[RM_MAX_PERCENTILES];
+    guint     percentileCount;
+    guint     interval;
+    guint     metricsPort;
+    gchar    *engine;
+    gboolean  rawEngine;
+    guint     agentPort;
+    gchar    *agentAddress;
+    gchar    *agents;
+    gchar    *secretFile;
+    gchar    *secret;
+    gchar    *compileFile;
+    gchar    *samplesFile;
+    gboolean  dryRun;
     gchar    *scenarioFile;
 } cmdlineArgs;
 
-/// This struct is used to pass data to new client threads
-typedef struct _rmThreadClient {
-    rmClient   *client;
-    rmScenario *scenario;
-} rmThreadClient;
-
 /// Verbosity levels
 enum {
     VERBOSITY_SILENT,
@@ -49,6 +84,86 @@ enum {
     VERBOSITY_FULL
 };
 
+/// Parse a comma separated list of percentiles to report
+static gboolean parse_percentiles(const gchar *list, cmdlineArgs *options)
+{
+    gchar   **items, *end;
+    gdouble   p;
+    guint     i;
+    gboolean  res = TRUE;
+
+    items = g_strsplit(list, ",", -1);
+    options->percentileCount = 0;
+
+    for (i = 0; items[i] != NULL; i++) {
+        p = g_ascii_strtod(items[i], &end);
+        if (end == items[i] || *end != '\0' || p <= 0 || p > 100) {
+            g_printerr("ERROR: invalid percentile value '%s'\n", items[i]);
+            res = FALSE;
+            break;
+        }
+
+        if (options->percentileCount >= RM_MAX_PERCENTILES) {
+            g_printerr("ERROR: no more than %u percentiles can be reported\n", RM_MAX_PERCENTILES);
+            res = FALSE;
+            break;
+        }
+
+        options->percentiles[options->percentileCount++] = p;
+    }
+
+    g_strfreev(items);
+
+    return res;
+}
+
+/// Parse the target request rate for open-loop mode. The rate is a number of
+/// requests per second, optionally followed by a '/s' or '/m' unit.
+static gboolean parse_rate(const gchar *spec, cmdlineArgs *options)
+{
+    gchar   *end;
+    gdouble  rate;
+
+    rate = g_ascii_strtod(spec, &end);
+    if (end != spec && rate > 0) {
+        if (*end == '\0' || strcmp(end, "/s") == 0) {
+            options->rate = rate;
+            return TRUE;
+        } else if (strcmp(end, "/m") == 0) {
+            options->rate = rate / 60;
+            return TRUE;
+        }
+    }
+
+    g_printerr("ERROR: invalid request rate '%s', expecting N/s or N/m\n", spec);
+    return FALSE;
+}
+
+/// Read the secret shared by a coordinator and its agents from a file.
+/// Whitespace around the secret, such as a trailing new line, is ignored.
+static gboolean read_secret(cmdlineArgs *options)
+{
+    GError *error = NULL;
+
+    if (options->secretFile == NULL) {
+        g_printerr("ERROR: coordinators and agents need a shared secret, given with --secret-file\n");
+        return FALSE;
+    }
+
+    if (! g_file_get_contents(options->secretFile, &options->secret, NULL, &error)) {
+        g_printerr("ERROR: failed reading secret: %s\n", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    if (*g_strstrip(options->secret) == '\0') {
+        g_printerr("ERROR: secret file %s is empty\n", options->secretFile);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 /// Parse command line arguments
 static gboolean parse_args(int argc, char *argv[], cmdlineArgs *options)
 {
@@ -63,12 +178,42 @@ static gboolean parse_args(int argc, char *argv[], cmdlineArgs *options)
     GOptionEntry    arguments[] = {
         {"clients", 'c', 0, G_OPTION_ARG_INT, &options->clients,
             "number of concurrent clients to run", NULL},
+        {"threads", 't', 0, G_OPTION_ARG_INT, &options->threads,
+            "number of worker threads to run clients on (default: number of CPUs)", NULL},
         {"repeat", 'r', 0, G_OPTION_ARG_INT, &options->repeat,
-            "number of times to repeat entire scenario", NULL},
+            "number of times to run entire scenario (per client)", NULL},
+        {"rate", 'R', 0, G_OPTION_ARG_STRING, &options->rateSpec,
+            "open-loop mode: send requests at a constant total rate, regardless of response times", "N/s"},
+        {"duration", 'd', 0, G_OPTION_ARG_STRING, &options->durationSpec,
+            "run clients through the scenario over and over until the time is up", "N[ms|s|m|h]"},
+        {"warmup", 'w', 0, G_OPTION_ARG_STRING, &options->warmupSpec,
+            "leave responses received during the first part of the run out of the results", "N[ms|s|m|h]"},
+        {"engine", 'e', 0, G_OPTION_ARG_STRING, &options->engine,
+            "HTTP engine to use: 'soup' (default) or 'raw' for plain HTTP/1.1 throughput tests", "soup|raw"},
         {"keep-cookies", 'C', 0, G_OPTION_ARG_NONE, &options->keepcookies,
             "keep cookies between scenario repeats (per client)", NULL},
         {"verbose", 'v', 0, G_OPTION_ARG_INT, &options->verbosity,
             "produce verbose output", "level (0-4)"},
+        {"percentiles", 'p', 0, G_OPTION_ARG_STRING, &options->percentileList,
+            "latency percentiles to report (default: " RM_DEFAULT_PERCENTILES ")", "p1,p2,..."},
+        {"interval", 'i', 0, G_OPTION_ARG_INT, &options->interval,
+            "report request rate, error rate and percentiles every N seconds while running", "N"},
+        {"metrics-port", 'm', 0, G_OPTION_ARG_INT, &options->metricsPort,
+            "serve live metrics in OpenMetrics format on http://127.0.0.1:PORT/metrics", "PORT"},
+        {"agents", 'a', 0, G_OPTION_ARG_STRING, &options->agents,
+            "coordinator mode: spread clients over agents, given as a comma separated list", "host[:port],..."},
+        {"agent", 'A', 0, G_OPTION_ARG_INT, &options->agentPort,
+            "run as an agent, waiting for coordinators on PORT", "PORT"},
+        {"agent-bind", 0, 0, G_OPTION_ARG_STRING, &options->agentAddress,
+            "agent mode: IP address to listen on (default: " RM_DEFAULT_AGENT_ADDRESS ")", "ADDRESS"},
+        {"secret-file", 'k', 0, G_OPTION_ARG_FILENAME, &options->secretFile,
+            "read the secret coordinators authenticate to agents with from FILE", "FILE"},
+        {"samples", 'S', 0, G_OPTION_ARG_FILENAME, &options->samplesFile,
+            "log every response to FILE: binary, or CSV or JSON Lines by a .csv or .jsonl extension", "FILE"},
+        {"compile", 'o', 0, G_OPTION_ARG_FILENAME, &options->compileFile,
+            "compile the scenario into a binary file which loads faster, and exit", "FILE"},
+        {"dry-run", 'n', 0, G_OPTION_ARG_NONE, &options->dryRun,
+            "load the scenario, report how long it took, and exit", NULL},
         { NULL }
     };
 
@@ -87,6 +232,23 @@ static gboolean parse_args(int argc, char *argv[], cmdlineArgs *options)
         return FALSE;
     }
 
+    // Agents get everything else from the coordinator
+    if (options->agentPort > 0) {
+        if (options->agentPort > 65535) {
+            g_printerr("ERROR: invalid agent port number %u\n", options->agentPort);
+            return FALSE;
+        }
+        if (options->agentAddress == NULL) {
+            options->agentAddress = g_strdup(RM_DEFAULT_AGENT_ADDRESS);
+        }
+        return read_secret(options);
+    }
+
+    if (options->agentAddress != NULL) {
+        g_printerr("ERROR: --agent-bind is only supported in agent mode\n");
+        return FALSE;
+    }
+
     // Get remaining argument
     if (argc != 2) {
         g_printerr("ERROR: no scenario file specified, run with --help for help\n");
@@ -105,9 +267,251 @@ static gboolean parse_args(int argc, char *argv[], cmdlineArgs *options)
         return FALSE;
     }
 
+    if (options->threads > RM_MAX_THREADS) {
+        g_printerr("ERROR: number of threads must be between 1 and %u\n", RM_MAX_THREADS);
+        return FALSE;
+    }
+
+    if (options->agents != NULL) {
+        // Agents pick their own default number of threads
+        if (options->verbosity > VERBOSITY_SUMMARY) {
+            g_printerr("ERROR: verbose output is not supported in coordinator mode\n");
+            return FALSE;
+        }
+
+        if (options->samplesFile != NULL) {
+            g_printerr("ERROR: sample logs are not supported in coordinator mode\n");
+            return FALSE;
+        }
+
+        if (! options->dryRun && ! options->compileFile && ! read_secret(options)) {
+            return FALSE;
+        }
+
+    } else {
+        // Default to one worker thread per CPU. There are never more threads
+        // than clients, which are only known once the scenario is loaded
+        if (options->threads == 0) {
+            options->threads = (guint) MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+        }
+    }
+
+    if (options->durationSpec || options->warmupSpec) {
+        if ((options->durationSpec &&
+             ! rm_load_profile_parse_duration(options->durationSpec, &options->duration, &error)) ||
+            (options->warmupSpec &&
+             ! rm_load_profile_parse_duration(options->warmupSpec, &options->warmup, &error))) {
+
+            g_printerr("ERROR: %s\n", error->message);
+            g_error_free(error);
+            return FALSE;
+        }
+
+        if (options->durationSpec && options->duration <= 0) {
+            g_printerr("ERROR: duration must be more than 0\n");
+            return FALSE;
+        }
+
+        if (options->duration > 0 && options->repeat > 1) {
+            g_printerr("ERROR: --repeat cannot be used with --duration\n");
+            return FALSE;
+        }
+
+        if (options->duration > 0 && options->warmup >= options->duration) {
+            g_printerr("ERROR: warm-up must be shorter than the duration\n");
+            return FALSE;
+        }
+    }
+
+    // Run the scenario at least once
+    if (options->repeat < 1) {
+        options->repeat = 1;
+    }
+
+    if (options->engine != NULL) {
+        if (strcmp(options->engine, "raw") == 0) {
+            options->rawEngine = TRUE;
+        } else if (strcmp(options->engine, "soup") != 0) {
+            g_printerr("ERROR: unknown engine '%s', expecting 'soup' or 'raw'\n", options->engine);
+            return FALSE;
+        }
+    }
+
+    if (options->rawEngine && options->verbosity > VERBOSITY_SUMMARY) {
+        g_printerr("ERROR: verbose output is not supported by the raw engine\n");
+        return FALSE;
+    }
+
+    if (options->metricsPort > 65535) {
+        g_printerr("ERROR: invalid metrics port number %u\n", options->metricsPort);
+        return FALSE;
+    }
+
+    if (options->rateSpec && ! parse_rate(options->rateSpec, options)) {
+        return FALSE;
+    }
+
+    if (! parse_percentiles(options->percentileList ? options->percentileList : RM_DEFAULT_PERCENTILES, options)) {
+        return FALSE;
+    }
+
     return TRUE;
 }
 
+/// Print out a summary of a latency histogram, in milliseconds
+static void print_latency(const gchar *title, const rmHistogram *hist, const cmdlineArgs *options)
+{
+    guint i;
+
+    printf("%s:\n", title);
+    if (hist->count == 0) {
+        printf("  no samples\n");
+        return;
+    }
+
+    printf("  %-7s: %10.3f ms\n", "min", hist->min / 1000.0);
+    printf("  %-7s: %10.3f ms\n", "mean", rm_histogram_mean(hist) / 1000.0);
+    printf("  %-7s: %10.3f ms\n", "max", hist->max / 1000.0);
+    for (i = 0; i < options->percentileCount; i++) {
+        printf("  p%-6g: %10.3f ms\n", options->percentiles[i],
+            rm_histogram_percentile(hist, options->percentiles[i]) / 1000.0);
+    }
+}
+
+/// Print out the distribution of time spent in each request phase, and the
+/// phase taking the longest at the highest reported percentile, which is the
+/// one to look at when the tail latency goes up
+static void print_phases(const rmScoreboard *sb, const cmdlineArgs *options)
+{
+    const rmHistogram *hist;
+    gchar              label[16];
+    gdouble            top = 0;
+    guint64            value, slowestValue = 0;
+    gint               slowest = -1;
+    guint              i, j;
+
+    for (j = 0; j < options->percentileCount; j++) {
+        top = MAX(top, options->percentiles[j]);
+    }
+
+    printf("Request Phases (ms):\n");
+    printf("  %-9s %10s %10s", "phase", "count", "mean");
+    for (j = 0; j < options->percentileCount; j++) {
+        g_snprintf(label, sizeof(label), "p%g", options->percentiles[j]);
+        printf(" %10s", label);
+    }
+    printf(" %10s\n", "max");
+
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        hist = sb->phases[i];
+        if (hist->count == 0) continue;
+
+        printf("  %-9s %10" G_GUINT64_FORMAT " %10.3f", rm_scoreboard_phase_name(i), hist->count,
+            rm_histogram_mean(hist) / 1000.0);
+        for (j = 0; j < options->percentileCount; j++) {
+            printf(" %10.3f", rm_histogram_percentile(hist, options->percentiles[j]) / 1000.0);
+        }
+        printf(" %10.3f\n", hist->max / 1000.0);
+
+        value = rm_histogram_percentile(hist, top);
+        if (slowest < 0 || value > slowestValue) {
+            slowest      = i;
+            slowestValue = value;
+        }
+    }
+
+    if (slowest >= 0) {
+        printf("  Slowest phase at p%g: %s (%.3f ms)\n", top, rm_scoreboard_phase_name(slowest),
+            slowestValue / 1000.0);
+    }
+}
+
+/// Print out the time spent running each script hook, and the total time
+/// spent in scripts compared to the time spent waiting for responses
+static void print_hooks(const rmScoreboard *sb, const cmdlineArgs *options)
+{
+    const rmHistogram *hist;
+    gchar              label[16];
+    gdouble            spent = 0;
+    guint              i, j;
+
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        spent += sb->hooks[i]->total / 1e9;
+    }
+    if (spent <= 0 && sb->scriptErrors == 0) return;
+
+    printf("Script Hooks (us):\n");
+    printf("  %-13s %10s %10s", "hook", "count", "mean");
+    for (j = 0; j < options->percentileCount; j++) {
+        g_snprintf(label, sizeof(label), "p%g", options->percentiles[j]);
+        printf(" %10s", label);
+    }
+    printf(" %10s\n", "max");
+
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        hist = sb->hooks[i];
+        if (hist->count == 0) continue;
+
+        printf("  %-13s %10" G_GUINT64_FORMAT " %10.3f", rm_scoreboard_hook_name(i), hist->count,
+            rm_histogram_mean(hist) / 1000.0);
+        for (j = 0; j < options->percentileCount; j++) {
+            printf(" %10.3f", rm_histogram_percentile(hist, options->percentiles[j]) / 1000.0);
+        }
+        printf(" %10.3f\n", hist->max / 1000.0);
+    }
+
+    printf("  %.3f ms spent in scripts (%.2f%% of response time), %u errors\n", spent * 1000,
+        (sb->elapsed > 0 ? spent * 100 / sb->elapsed : 0), sb->scriptErrors);
+}
+
+/// Print out a per-request breakdown of the results. Each request is labeled
+/// by its method, URL and name (if set)
+static void print_request_stats(const rmScenario *sc, const rmScoreboard *sb, const cmdlineArgs *options)
+{
+    rmRequest      *req;
+    rmRequestStats *stats;
+    gchar          *url;
+    guint           i;
+
+    printf("Per Request:\n");
+    for (req = sc->requestTable; req < sc->requestTable + sc->requestCount; req++) {
+        stats = &sb->perRequest[req->index];
+        url   = soup_uri_to_string(req->url, FALSE);
+
+        printf("  #%-3u %s %s", req->index, g_quark_to_string(req->method), url);
+        if (req->name) printf(" (%s)", req->name);
+        printf("\n       requests: %u", stats->requests);
+        for (i = 0; i < 6; i++) {
+            if (stats->resp_codes[i] > 0) printf(", %uxx: %u", i, stats->resp_codes[i]);
+        }
+        printf("\n");
+
+        if (stats->latency != NULL && stats->latency->count > 0) {
+            printf("       mean: %.3f ms", rm_histogram_mean(stats->latency) / 1000.0);
+            for (i = 0; i < options->percentileCount; i++) {
+                printf(", p%g: %.3f ms", options->percentiles[i],
+                    rm_histogram_percentile(stats->latency, options->percentiles[i]) / 1000.0);
+            }
+            printf(", max: %.3f ms\n", stats->latency->max / 1000.0);
+        }
+
+        if (stats->expectFailed > 0) {
+            printf("       unexpected responses: %u\n", stats->expectFailed);
+            for (i = 0; i < stats->expectCount && i < req->expectCount; i++) {
+                if (stats->expectFailures[i] > 0) {
+                    printf("         %s: %u failed\n", req->expects[i]->label, stats->expectFailures[i]);
+                }
+            }
+        }
+
+        if (stats->extractMissed > 0) {
+            printf("       values not extracted: %u\n", stats->extractMissed);
+        }
+
+        g_free(url);
+    }
+}
+
 static void log_printer(SoupLogger *logger, SoupLoggerLogLevel level,
     char direction, const char *data, gpointer user_data)
 {
@@ -131,22 +535,10 @@ static SoupLogger* create_logger(cmdlineArgs *args)
     return logger;
 }
 
-static void run_client(rmThreadClient *client)
-{
-    rm_client_run_scenario(client->client, client->scenario);
-}
-
-int main(int argc, char *argv[])
+/// Print out the total scoreboard
+static void print_summary(const rmScenario *sc, const rmScoreboard *total, gdouble elapsed, const cmdlineArgs *options)
 {
-    cmdlineArgs      options;
-    rmScenario      *sc;
-    rmThreadClient **clients;
-    GThread        **threads;
-    rmScoreboard    *total;
-    GError          *err = NULL;
-    SoupLogger      *logger = NULL;
-    gint             i;
-    gboolean         failed = FALSE;
+    guint i;
 
     // Text for different HTTP response code classes
     static gchar* respcodes[] = {
@@ -158,6 +550,376 @@ int main(int argc, char *argv[])
         "Server Error"
     };
 
+    printf("Total requests: %u\n", total->requests);
+    printf("Elapsed Time:   %lf\n", total->elapsed);
+    printf("Response Codes:\n");
+    for (i = 0; i < 6; i++) {
+        if (total->resp_codes[i] > 0)
+            printf("  %uxx %-15s: %u\n", i, respcodes[i], total->resp_codes[i]);
+    }
+    if (options->rate > 0) {
+        printf("Target Rate:    %.1f req/s\n", options->rate);
+        printf("Achieved Rate:  %.1f req/s\n", total->requests / elapsed);
+        printf("Missed Slots:   %u\n", total->missedSlots);
+        print_latency("Response Time (raw)", total->latency, options);
+        print_latency("Response Time (corrected for coordinated omission)", total->corrected, options);
+    } else {
+        print_latency("Response Time", total->latency, options);
+    }
+
+    printf("Connections:    %u opened, %.1f%% of requests reused a connection\n", total->connections,
+        (total->requests > 0 && total->requests >= total->connections ?
+            (total->requests - total->connections) * 100.0 / total->requests : 0));
+    print_latency("Connect Time", total->connectTime, options);
+
+    printf("Received:       %.2f MB (%.2f MB/s)\n", total->bytesReceived / 1048576.0,
+        (elapsed > 0 ? total->bytesReceived / 1048576.0 / elapsed : 0));
+    print_latency("Time to First Byte", total->firstByte, options);
+    print_phases(total, options);
+
+    if (total->expectFailed > 0) {
+        printf("Unexpected:     %u responses did not meet their expectations\n", total->expectFailed);
+    }
+
+    if (total->extracted + total->extractMissed > 0) {
+        printf("Extracted:      %u values, %u missed, %.3f ms spent extracting (%.2f us per value)\n",
+            total->extracted, total->extractMissed, total->extractTime * 1000,
+            total->extractTime * G_USEC_PER_SEC / (total->extracted + total->extractMissed));
+    }
+
+    print_hooks(total, options);
+    print_request_stats(sc, total, options);
+}
+
+/// Print out what was received during the warm-up, which is left out of all
+/// other results
+static void print_warmup(rmScheduler *sched, const cmdlineArgs *options)
+{
+    rmScoreboard *sb;
+
+    sb = rm_scoreboard_new(sched->scenario->requestCount);
+    rm_scheduler_merge_warmup(sched, sb);
+
+    printf("Warm-up:        %u requests in the first %.1f s (%u errors), not included above\n",
+        sb->requests, options->warmup, sb->resp_codes[0] + sb->resp_codes[4] + sb->resp_codes[5]);
+    if (sb->expectFailed > 0 || sb->scriptErrors > 0) {
+        printf("                %u failed expectations, %u script errors during the warm-up\n",
+            sb->expectFailed, sb->scriptErrors);
+    }
+    if (sb->failed) {
+        printf("                a client failed during the warm-up, failing the run\n");
+    }
+    if (sb->latency->count > 0) {
+        print_latency("Warm-up Response Time", sb->latency, options);
+    }
+
+    rm_scoreboard_free(sb);
+}
+
+/// Print out the results of each load profile stage, so that latency at each
+/// step can be compared, and how close to when they were due clients were
+/// started and retired, and iterations of rate stages were started. Stage
+/// targets are a number of clients, or a rate of iterations per second.
+static void print_stages(rmScheduler *sched, const cmdlineArgs *options)
+{
+    const rmLoadStage  *stage;
+    const rmStageStats *stats;
+    rmScoreboard       *sb;
+    gchar               label[16], target[32], name[16];
+    guint               i, j, events = 0, started = 0, retired = 0;
+    gdouble             lagTotal = 0, lagMax = 0;
+
+    printf("Load Profile Stages (ms):\n");
+    printf("  %-12s %8s %8s %10s %10s %8s %10s", "stage", "target", "time", "requests", "req/s", "errors", "mean");
+    for (j = 0; j < options->percentileCount; j++) {
+        g_snprintf(label, sizeof(label), "p%g", options->percentiles[j]);
+        printf(" %10s", label);
+    }
+    printf(" %10s\n", "max");
+
+    for (i = 0; i < sched->profile->stageCount; i++) {
+        stage = &sched->profile->stages[i];
+        stats = &sched->stageStats[i];
+
+        sb = rm_scoreboard_new(sched->scenario->requestCount);
+        rm_scheduler_merge_stage(sched, i, sb);
+
+        g_snprintf(name, sizeof(name), "#%u", i);
+        g_snprintf(target, sizeof(target), (stage->type == RM_STAGE_RATE ? "%g/s" : "%g"), stage->target);
+        printf("  %-12s %8s %7.1fs %10u %10.1f %8u", (stage->name ? stage->name : name), target,
+            stage->duration, sb->requests, (stage->duration > 0 ? sb->requests / stage->duration : 0),
+            sb->resp_codes[0] + sb->resp_codes[4] + sb->resp_codes[5]);
+
+        if (sb->latency->count > 0) {
+            printf(" %10.3f", rm_histogram_mean(sb->latency) / 1000.0);
+            for (j = 0; j < options->percentileCount; j++) {
+                printf(" %10.3f", rm_histogram_percentile(sb->latency, options->percentiles[j]) / 1000.0);
+            }
+            printf(" %10.3f\n", sb->latency->max / 1000.0);
+        } else {
+            printf(" %10s\n", "-");
+        }
+
+        if (stats->missed > 0) {
+            printf("    %u iterations not started, all clients were busy\n", stats->missed);
+        }
+
+        events   += stats->events;
+        started  += stats->started;
+        retired  += stats->retired;
+        lagTotal += stats->lagTotal;
+        lagMax    = MAX(lagMax, stats->lagMax);
+
+        rm_scoreboard_free(sb);
+    }
+
+    printf("  %u starts and %u retirements, %.3f ms late on average, %.3f ms at most\n", started, retired,
+        (events > 0 ? lagTotal * 1000 / events : 0), lagMax * 1000);
+}
+
+/// Check that command line options go along with a scenario's load profile,
+/// and make sure there are enough clients for the busiest stage to run. Rate
+/// stages run as many clients at a time as there are, so more clients can be
+/// set on the command line for them.
+static gboolean check_profile(const rmScenario *sc, cmdlineArgs *options)
+{
+    guint peak = rm_load_profile_peak_clients(sc->profile);
+
+    if (options->rate > 0) {
+        g_printerr("ERROR: --rate cannot be used with a scenario which has a load profile\n");
+        return FALSE;
+    }
+
+    if (options->repeat > 1) {
+        g_printerr("ERROR: --repeat cannot be used with a scenario which has a load profile\n");
+        return FALSE;
+    }
+
+    if (peak > RM_MAX_CLIENTS) {
+        g_printerr("ERROR: load profile runs %u clients, no more than %u are allowed\n", peak, RM_MAX_CLIENTS);
+        return FALSE;
+    }
+
+    options->clients = MAX(options->clients, peak);
+
+    return TRUE;
+}
+
+/// Read a scenario from a mapped file, which is either a compiled scenario or
+/// an XML scenario
+static rmScenario* read_scenario(GMappedFile *file, GError **error)
+{
+    const gchar *data   = g_mapped_file_get_contents(file);
+    gsize        length = g_mapped_file_get_length(file);
+
+    if (rm_scenario_bin_detect(data, length)) {
+        return rm_scenario_bin_read_mapped(file, error);
+    }
+
+    return rm_scenario_xml_read_buffer(data, length, error);
+}
+
+/// Load the scenario file, compile it if asked to, and report how long it
+/// took to load in a dry run. Sets done if there is nothing left to do.
+static rmScenario* load_scenario(const cmdlineArgs *options, gboolean *done, GError **error)
+{
+    rmScenario  *sc;
+    GMappedFile *file;
+    GTimer      *timer;
+    gboolean     compiled;
+
+    *done = FALSE;
+    timer = g_timer_new();
+
+    file = g_mapped_file_new(options->scenarioFile, FALSE, error);
+    if (! file) {
+        g_timer_destroy(timer);
+        return NULL;
+    }
+
+    compiled = rm_scenario_bin_detect(g_mapped_file_get_contents(file), g_mapped_file_get_length(file));
+    sc = read_scenario(file, error);
+    g_mapped_file_unref(file);
+    g_timer_stop(timer);
+
+    if (sc == NULL) {
+        g_timer_destroy(timer);
+        return NULL;
+    }
+
+    if (options->dryRun) {
+        printf("Loaded %u requests from %s scenario in %.3f ms\n", sc->requestCount,
+            (compiled ? "compiled" : "XML"), g_timer_elapsed(timer, NULL) * 1000);
+        *done = TRUE;
+    }
+
+    if (options->compileFile) {
+        if (! rm_scenario_bin_write_file(sc, options->compileFile, error)) {
+            g_timer_destroy(timer);
+            rm_scenario_free(sc);
+            return NULL;
+        }
+        printf("Compiled %u requests into %s\n", sc->requestCount, options->compileFile);
+        *done = TRUE;
+    }
+
+    g_timer_destroy(timer);
+
+    return sc;
+}
+
+/// Run the scenario over a number of agents, and print out the merged results
+static int run_coordinator(cmdlineArgs *options)
+{
+    rmScenario      *sc;
+    rmCoordinator   *coord;
+    rmReporter      *reporter = NULL;
+    rmAgentLink     *link;
+    rmRunOptions     runOptions;
+    rmScoreboard    *total;
+    GError          *err = NULL;
+    GMappedFile     *document;
+    guint            i;
+    gboolean         failed = FALSE;
+
+    // The scenario is parsed here to fail early on errors, and the document
+    // (XML or compiled) is sent as is to all agents
+    if (! (document = g_mapped_file_new(options->scenarioFile, FALSE, &err)))
+        goto exitwitherror;
+
+    sc = read_scenario(document, &err);
+    if (! sc) {
+        g_mapped_file_unref(document);
+        goto exitwitherror;
+    }
+
+    if (sc->profile != NULL) {
+        g_printerr("ERROR: scenarios with a load profile are not supported in coordinator mode\n");
+        g_mapped_file_unref(document);
+        rm_scenario_free(sc);
+        return 1;
+    }
+
+    coord = rm_coordinator_new(sc, options->agents, options->secret, &err);
+    if (! coord) {
+        g_mapped_file_unref(document);
+        rm_scenario_free(sc);
+        goto exitwitherror;
+    }
+
+    bzero(&runOptions, sizeof(rmRunOptions));
+    runOptions.totalClients     = options->clients;
+    runOptions.threads          = options->threads;
+    runOptions.repeat           = options->repeat;
+    runOptions.keepCookies      = options->keepcookies;
+    runOptions.rate             = options->rate;
+    runOptions.duration         = options->duration;
+    runOptions.warmup           = options->warmup;
+    runOptions.rawEngine        = options->rawEngine;
+    runOptions.snapshotInterval = RM_AGENT_SNAPSHOT_INTERVAL;
+
+    printf("Waiting for %u agents... ", coord->agentCount);
+    fflush(stdout);
+
+    if (! rm_coordinator_connect(coord, g_mapped_file_get_contents(document),
+            g_mapped_file_get_length(document), &runOptions, &err)) {
+        printf("\n");
+        g_mapped_file_unref(document);
+        rm_coordinator_free(coord);
+        rm_scenario_free(sc);
+        goto exitwitherror;
+    }
+    g_mapped_file_unref(document);
+    printf("ready.\n");
+
+    // Set up live reporting, based on snapshots sent by agents
+    if (options->interval > 0 || options->metricsPort > 0) {
+        reporter = rm_reporter_new(coord->timer, (rmReporterSnapshotFunc) rm_coordinator_snapshot, coord,
+            options->interval, options->metricsPort, options->percentiles, options->percentileCount, &err);
+        if (! reporter) {
+            rm_coordinator_free(coord);
+            rm_scenario_free(sc);
+            goto exitwitherror;
+        }
+    }
+
+    if (options->interval > 0) {
+        printf("Running scenario...\n");
+    } else {
+        printf("Running scenario... ");
+    }
+    fflush(stdout);
+
+    if (reporter == NULL || rm_reporter_start(reporter, &err)) {
+        rm_coordinator_run(coord, &err);
+    }
+
+    if (reporter) rm_reporter_free(reporter);
+
+    total = rm_scoreboard_new(sc->requestCount);
+    rm_coordinator_merge_scoreboards(coord, total);
+
+    if (err != NULL) {
+        fprintf(stderr, "ERROR: %s\n", err->message);
+        g_error_free(err);
+        total->failed = TRUE;
+    }
+
+    if (total->failed) {
+        printf("TEST FAILED!\n");
+    } else {
+        printf("done.\n");
+    }
+
+    print_summary(sc, total, MAX(g_timer_elapsed(coord->timer, NULL) - options->warmup, 0), options);
+    if (options->warmup > 0) {
+        printf("Warm-up:        responses received in the first %.1f s are not included above\n",
+            options->warmup);
+    }
+
+    printf("Agents:\n");
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        if (link->result) {
+            printf("  %-21s: %u clients, %u requests\n", link->address,
+                link->options.clients, link->result->requests);
+        } else {
+            printf("  %-21s: %u clients, no result\n", link->address, link->options.clients);
+        }
+    }
+
+    failed = total->failed;
+
+    rm_coordinator_free(coord);
+    rm_scenario_free(sc);
+    rm_scoreboard_free(total);
+
+    return (failed ? 100 : 0);
+
+exitwitherror:
+    if (err != NULL) {
+        fprintf(stderr, "ERROR: %s\n", err->message);
+    }
+
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    cmdlineArgs      options;
+    rmScenario      *sc;
+    rmScheduler     *sched;
+    rmReporter      *reporter = NULL;
+    rmRawEngine     *raw = NULL;
+    rmSampleLog     *samples = NULL;
+    rmWorker        *worker;
+    rmScoreboard    *total;
+    GError          *err = NULL;
+    SoupLogger      *logger = NULL;
+    guint            i;
+    gdouble          elapsed;
+    gboolean         failed = FALSE, done;
+
     g_type_init();
     g_thread_init(NULL);
 
@@ -165,47 +927,97 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    sc = rm_scenario_xml_read_file(options.scenarioFile, &err);
+    // Agents only return if they fail to listen
+    if (options.agentPort > 0) {
+        if (! rm_agent_serve(options.agentAddress, options.agentPort, options.secret, &err)) goto exitwitherror;
+        return 0;
+    }
+
+    if (options.agents != NULL && ! options.dryRun && ! options.compileFile) {
+        return run_coordinator(&options);
+    }
+
+    sc = load_scenario(&options, &done, &err);
     if (! sc) goto exitwitherror;
 
+    if (done) {
+        rm_scenario_free(sc);
+        return 0;
+    }
+
+    if (sc->profile != NULL && ! check_profile(sc, &options)) {
+        rm_scenario_free(sc);
+        return 1;
+    }
+    options.threads = MIN(options.threads, options.clients);
+
     // Set up logger
     if (options.verbosity > VERBOSITY_SUMMARY) {
         logger = create_logger(&options);
     }
 
-    printf("Running scenario... ");
-
-    // Create and run all clients
-    clients = g_malloc(sizeof(rmThreadClient *) * options.clients);
-    threads = g_malloc(sizeof(GThread *) * options.clients);
-    for (i = 0; i < options.clients; i++) {
-        clients[i] = g_malloc(sizeof(rmThreadClient));
-        clients[i]->client   = rm_client_new();
-        clients[i]->scenario = sc;
-        if (logger) {
-            // Attach logger
-            soup_session_add_feature(clients[i]->client->session, (SoupSessionFeature *) logger);
+    // Serialize all requests up front for the raw engine
+    if (options.rawEngine) {
+        raw = rm_raw_engine_new(sc, &err);
+        if (! raw) {
+            rm_scenario_free(sc);
+            goto exitwitherror;
         }
+    }
 
-        threads[i] = g_thread_create((GThreadFunc) run_client, (gpointer) clients[i], TRUE, NULL);
+    // Create all clients and spread them between workers
+    sched = rm_scheduler_new(sc, options.threads, options.clients, raw, logger);
+    rm_scheduler_create_clients(sched, 0, options.clients, options.clients,
+        options.repeat, options.keepcookies, options.rate);
+    rm_scheduler_set_duration(sched, options.duration, options.warmup);
+
+    // Log every response for offline analysis
+    if (options.samplesFile != NULL) {
+        samples = rm_sample_log_new(options.samplesFile, sched->workerCount, &err);
+        if (! samples) {
+            rm_scheduler_free(sched);
+            if (raw) rm_raw_engine_free(raw);
+            goto exitwitherror;
+        }
+        rm_scheduler_set_sample_log(sched, samples);
     }
 
-    total = rm_scoreboard_new();
+    // Set up live reporting
+    if (options.interval > 0 || options.metricsPort > 0) {
+        reporter = rm_reporter_new(sched->timer, (rmReporterSnapshotFunc) rm_scheduler_snapshot, sched,
+            options.interval, options.metricsPort, options.percentiles, options.percentileCount, &err);
+        if (! reporter) {
+            rm_scheduler_free(sched);
+            if (samples) rm_sample_log_free(samples);
+            if (raw) rm_raw_engine_free(raw);
+            goto exitwitherror;
+        }
+    }
 
-    // Wait for all threads to finish
-    for (i = 0; i < options.clients; i++) {
-        g_thread_join(threads[i]);
+    if (options.interval > 0) {
+        printf("Running scenario...\n");
+    } else {
+        printf("Running scenario... ");
     }
+    fflush(stdout);
 
-    // Free all clients
-    for (i = 0; i < options.clients; i++) {
-        rm_scoreboard_merge(total, clients[i]->client->scoreboard);
-        rm_client_free(clients[i]->client);
-        g_free(clients[i]);
+    // Run all workers until all iterations are done
+    if ((reporter == NULL || rm_reporter_start(reporter, &err)) &&
+        (samples == NULL || rm_sample_log_start(samples, &err))) {
+        rm_scheduler_run(sched, &err);
     }
 
-    g_free(clients);
-    g_free(threads);
+    if (reporter) rm_reporter_free(reporter);
+    if (samples) rm_sample_log_stop(samples, (err == NULL ? &err : NULL));
+
+    total = rm_scoreboard_new(sc->requestCount);
+    rm_scheduler_merge_scoreboards(sched, total);
+
+    if (err != NULL) {
+        fprintf(stderr, "ERROR: %s\n", err->message);
+        g_error_free(err);
+        total->failed = TRUE;
+    }
 
     if (total->failed) {
         printf("TEST FAILED!\n");
@@ -213,17 +1025,35 @@ int main(int argc, char *argv[])
         printf("done.\n");
     }
 
-    // Print out scoreboard
-    printf("Total requests: %u\n", total->requests);
-    printf("Elapsed Time:   %lf\n", total->elapsed);
-    printf("Response Codes:\n");
-    for (i = 0; i < 6; i++) {
-        if (total->resp_codes[i] > 0)
-            printf("  %uxx %-15s: %u\n", i, respcodes[i], total->resp_codes[i]);
+    // Print out scoreboard. Rates are worked out over the time after the
+    // warm-up, as responses received during the warm-up are left out.
+    elapsed = rm_scheduler_elapsed(sched);
+    print_summary(sc, total, MAX(elapsed - options.warmup, 0), &options);
+    if (options.warmup > 0) {
+        print_warmup(sched, &options);
+    }
+    if (sched->profile != NULL) {
+        print_stages(sched, &options);
+    }
+    if (samples) {
+        printf("Samples:        %" G_GUINT64_FORMAT " written to %s, %" G_GUINT64_FORMAT
+            " dropped as the writer fell behind\n", samples->written, samples->path,
+            rm_sample_log_dropped(samples));
+    }
+
+    // Print out worker utilization, to expose imbalance between workers
+    printf("Worker Utilization:\n");
+    for (i = 0; i < sched->workerCount; i++) {
+        worker = sched->workers[i];
+        printf("  worker %-3u: %5.1f%% (%u iterations, %u stolen)\n", worker->id,
+            rm_worker_utilization(worker) * 100, worker->iterations, worker->stolen);
     }
 
     failed = total->failed;
 
+    rm_scheduler_free(sched);
+    if (samples) rm_sample_log_free(samples);
+    if (raw) rm_raw_engine_free(raw);
     if (logger) g_object_unref(logger);
     rm_scenario_free(sc);
     rm_scoreboard_free(total);
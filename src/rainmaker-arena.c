@@ -0,0 +1,104 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+
+#include "rainmaker-arena.h"
+
+/// Round a pointer up to a multiple of align, which is a power of two
+#define ALIGN_UP(p, align) ((gchar *) (((gsize) (p) + (align) - 1) & ~((gsize) (align) - 1)))
+
+rmArena* rm_arena_new()
+{
+    return g_malloc0(sizeof(rmArena));
+}
+
+/// Allocate memory from an arena, aligned to align bytes (a power of two, up
+/// to a cache line). The memory is not cleared, and lives as long as the
+/// arena.
+gpointer rm_arena_alloc(rmArena *arena, gsize size, gsize align)
+{
+    gchar *block, *ptr;
+
+    g_assert(align > 0 && (align & (align - 1)) == 0);
+
+    if (arena->next != NULL) {
+        ptr = ALIGN_UP(arena->next, align);
+        if ((gsize) (ptr - arena->next) + size <= arena->left) {
+            arena->left -= (ptr - arena->next) + size;
+            arena->next  = ptr + size;
+            return ptr;
+        }
+    }
+
+    // Allocations which would take a good part of a block get one of their
+    // own, leaving the current block to smaller ones
+    if (size > RM_ARENA_BLOCK_SIZE / 4) {
+        block = g_malloc(size + align - 1);
+        arena->blocks = g_slist_prepend(arena->blocks, block);
+        return ALIGN_UP(block, align);
+    }
+
+    block = g_malloc(RM_ARENA_BLOCK_SIZE);
+    arena->blocks = g_slist_prepend(arena->blocks, block);
+
+    ptr = ALIGN_UP(block, align);
+    arena->next = ptr + size;
+    arena->left = RM_ARENA_BLOCK_SIZE - (arena->next - block);
+
+    return ptr;
+}
+
+gpointer rm_arena_memdup(rmArena *arena, gconstpointer data, gsize size)
+{
+    gpointer copy;
+
+    copy = rm_arena_alloc(arena, MAX(size, 1), 1);
+    memcpy(copy, data, size);
+
+    return copy;
+}
+
+gchar* rm_arena_strdup(rmArena *arena, const gchar *str)
+{
+    if (str == NULL) return NULL;
+
+    return (gchar *) rm_arena_memdup(arena, str, strlen(str) + 1);
+}
+
+/// Get the arena's copy of a string, copying it into the arena the first time
+/// it is seen. Interned strings are shared, and must not be modified.
+gchar* rm_arena_intern(rmArena *arena, const gchar *str)
+{
+    gchar *copy;
+
+    if (str == NULL) return NULL;
+
+    if (arena->strings == NULL) {
+        arena->strings = g_hash_table_new(g_str_hash, g_str_equal);
+    } else if ((copy = g_hash_table_lookup(arena->strings, str)) != NULL) {
+        return copy;
+    }
+
+    copy = rm_arena_strdup(arena, str);
+    g_hash_table_insert(arena->strings, copy, copy);
+
+    return copy;
+}
+
+/// Free an arena, and all memory allocated from it
+void rm_arena_free(rmArena *arena)
+{
+    g_slist_foreach(arena->blocks, (GFunc) g_free, NULL);
+    g_slist_free(arena->blocks);
+    if (arena->strings != NULL) g_hash_table_destroy(arena->strings);
+    g_free(arena);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,46 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_ARENA_H_
+#define RAINMAKER_ARENA_H_
+
+#include <glib.h>
+
+/// Size of a CPU cache line, used to keep data written by one thread apart
+/// from data read by others
+#ifndef RM_CACHE_LINE_SIZE
+#define RM_CACHE_LINE_SIZE 64
+#endif
+
+/// Size of the blocks arena memory is carved out of. Larger allocations get
+/// a block of their own.
+#ifndef RM_ARENA_BLOCK_SIZE
+#define RM_ARENA_BLOCK_SIZE 65536
+#endif
+
+/// A bump allocator: memory is handed out from large blocks in the order it
+/// is allocated, so that data allocated together sits together, and is only
+/// released all at once when the arena is freed. Strings can be interned, so
+/// that each distinct string is stored once.
+typedef struct _rmArena {
+    GSList     *blocks;   ///< all blocks, to free them
+    gchar      *next;     ///< next free byte in the current block
+    gsize       left;     ///< bytes left in the current block
+    GHashTable *strings;  ///< interned strings, created on first use
+} rmArena;
+
+rmArena*  rm_arena_new();
+gpointer  rm_arena_alloc(rmArena *arena, gsize size, gsize align);
+gpointer  rm_arena_memdup(rmArena *arena, gconstpointer data, gsize size);
+gchar*    rm_arena_strdup(rmArena *arena, const gchar *str);
+gchar*    rm_arena_intern(rmArena *arena, const gchar *str);
+void      rm_arena_free(rmArena *arena);
+
+#endif // RAINMAKER_ARENA_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,894 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+/// Microbenchmarks for rainmaker internals. These measure the CPU cost of code
+/// that runs once per request, where it directly limits the load a single
+/// rainmaker process can generate. Build and run with 'make bench'.
+///
+/// Engine benchmarks send requests to a minimal SoupServer running in child
+/// processes on the loopback interface, so that only the cost of the client
+/// side is counted as CPU time. The server waits for the 'delay' query
+/// parameter (in ms) before responding, and sends a body of 'size' bytes.
+///
+/// The engine matrix runs clients against the server for a few seconds in a
+/// number of setups, and measures the highest request rate rainmaker reaches,
+/// the CPU time it spends per request and the memory it needs per client.
+/// Each setup runs in a fresh process (this program, run with --case), so
+/// that memory measurements are not skewed by memory freed by earlier runs.
+///
+/// Scenario load benchmarks measure the time it takes to load generated
+/// scenario documents of increasing size, which should grow linearly.
+///
+/// Scenario walk benchmarks measure the cost of going through the requests of
+/// a scenario, as clients do over and over, before and after the scenario is
+/// frozen into its arena.
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-request.h"
+#include "rainmaker-scenario.h"
+#include "rainmaker-scenario-xml.h"
+#include "rainmaker-client.h"
+#include "rainmaker-scheduler.h"
+#include "rainmaker-raw.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define BENCH_DEFAULT_ITERATIONS 200000
+#define BENCH_BODY_SIZE          1024
+#define BENCH_ENGINE_CLIENTS     16
+#define BENCH_WALK_VISITS        20000000
+#define BENCH_MATRIX_DURATION    2.0
+#define BENCH_MAX_RESPONSE_SIZE  (1024 * 1024)
+
+#ifndef RM_XML_XSD_FILE
+#define RM_XML_XSD_FILE "rainmaker-scenario-1.0.xsd"
+#endif
+
+/// Number of requests in the scenarios loaded by scenario load benchmarks
+static const guint loadSizes[] = { 1000, 10000, 100000, 0 };
+
+/// URL of the loopback server used by engine benchmarks
+static gchar *serverUrl = NULL;
+
+/// Body sent by the loopback server when a response size is asked for
+static gchar *serverBody = NULL;
+
+/// File results are written to as JSON Lines, if any
+static FILE *results = NULL;
+
+typedef void (*benchFunc)(rmRequest *request, guint iterations);
+
+typedef struct _benchCase {
+    const gchar *name;
+    benchFunc    func;
+} benchCase;
+
+/// A setup run by the engine matrix
+typedef struct _benchMatrixCase {
+    const gchar *name;
+    gboolean     raw;
+    guint        clients;
+    guint        threads;   ///< worker threads, 0 for one per CPU
+    guint        delay;     ///< time the server waits before responding, in ms
+    guint        size;      ///< response body size, 0 for a small page
+} benchMatrixCase;
+
+static const benchMatrixCase matrixCases[] = {
+    { "matrix: soup, 1 client",           FALSE,    1, 1,  0,     0 },
+    { "matrix: soup, 64 clients",         FALSE,   64, 1,  0,     0 },
+    { "matrix: soup, 64 clients, 64 KB",  FALSE,   64, 1,  0, 65536 },
+    { "matrix: soup, 1000 clients, 10ms", FALSE, 1000, 1, 10,     0 },
+    { "matrix: soup, 256 clients, all",   FALSE,  256, 0,  0,     0 },
+    { "matrix: raw, 1 client",            TRUE,     1, 1,  0,     0 },
+    { "matrix: raw, 64 clients",          TRUE,    64, 1,  0,     0 },
+    { "matrix: raw, 64 clients, 64 KB",   TRUE,    64, 1,  0, 65536 },
+    { "matrix: raw, 1000 clients, 10ms",  TRUE,  1000, 1, 10,     0 },
+    { "matrix: raw, 256 clients, all",    TRUE,   256, 0,  0,     0 },
+    { NULL }
+};
+
+/// Write a result to the results file, if any, as a JSON object on its own
+/// line, tagged with the version of the build. Members other than the
+/// section and benchmark name are given as a printf format.
+static void write_result(const gchar *section, const gchar *name, const gchar *format, ...)
+{
+    va_list args;
+
+    if (results == NULL) return;
+
+    fprintf(results, "{\"version\":\"%s\",\"section\":\"%s\",\"benchmark\":\"%s\",",
+        PACKAGE_VERSION, section, name);
+    va_start(args, format);
+    vfprintf(results, format, args);
+    va_end(args);
+    fprintf(results, "}\n");
+}
+
+/// Simulate the session filling in a response, so that resetting a message
+/// has the same work to do as it would after a real response
+static void fake_response(SoupMessage *msg)
+{
+    static const gchar body[] = "<html><body>It works!</body></html>";
+
+    soup_message_headers_append(msg->request_headers, "Cookie", "session=0123456789abcdef");
+    soup_message_headers_append(msg->response_headers, "Content-Type", "text/html");
+    soup_message_headers_append(msg->response_headers, "Server", "rainmaker-bench");
+    soup_message_body_append(msg->response_body, SOUP_MEMORY_STATIC, body, sizeof(body) - 1);
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+
+/// Add a header struct to a SoupMessage, as done before requests were
+/// compiled into templates
+static void add_header_to_message(rmHeader *header, SoupMessage *msg)
+{
+    if (header->replace) {
+        soup_message_headers_replace(msg->request_headers, header->name, header->value);
+    } else {
+        soup_message_headers_append(msg->request_headers, header->name, header->value);
+    }
+}
+
+/// Baseline: build a new message for every send from the request struct
+static void bench_message_build(rmRequest *request, guint iterations)
+{
+    SoupMessage *msg;
+    guint        i;
+
+    for (i = 0; i < iterations; i++) {
+        msg = soup_message_new_from_uri(g_quark_to_string(request->method), request->url);
+        soup_message_set_flags(msg, SOUP_MESSAGE_NO_REDIRECT);
+        soup_message_set_request(msg, g_quark_to_string(request->bodyType),
+                SOUP_MEMORY_TEMPORARY, request->body, request->bodyLength);
+        g_slist_foreach(request->headers, (GFunc) add_header_to_message, (gpointer) msg);
+
+        fake_response(msg);
+        g_object_unref(msg);
+    }
+}
+
+/// Build a new message for every send from the compiled request template
+static void bench_message_compiled(rmRequest *request, guint iterations)
+{
+    SoupMessage *msg;
+    guint        i;
+
+    for (i = 0; i < iterations; i++) {
+        msg = rm_request_new_message(request);
+        fake_response(msg);
+        g_object_unref(msg);
+    }
+}
+
+/// Reuse the same message for every send, as clients do
+static void bench_message_reuse(rmRequest *request, guint iterations)
+{
+    SoupMessage *msg;
+    guint        i;
+
+    msg = rm_request_new_message(request);
+    for (i = 0; i < iterations; i++) {
+        rm_request_reset_message(request, msg);
+        fake_response(msg);
+    }
+    g_object_unref(msg);
+}
+
+/// Send requests to the loopback server using the scheduler, with a single
+/// worker thread running a few concurrent clients. Each iteration is one
+/// request.
+static void bench_engine(gboolean useRaw, guint iterations)
+{
+    rmScenario  *scenario;
+    rmRequest   *request;
+    rmRawEngine *raw = NULL;
+    rmScheduler *sched;
+    GError      *error = NULL;
+    guint        i, perClient;
+
+    scenario = rm_scenario_new();
+    scenario->failOnHttpError = FALSE;
+    scenario->failOnTcpError  = FALSE;
+
+    request = rm_request_new("GET", serverUrl, NULL, &error);
+    g_assert(request != NULL);
+    rm_scenario_add_request(scenario, request);
+    rm_scenario_freeze(scenario);
+
+    if (useRaw) {
+        raw = rm_raw_engine_new(scenario, &error);
+        if (raw == NULL) {
+            g_printerr("ERROR: %s\n", error->message);
+            exit(2);
+        }
+    }
+
+    perClient = MAX(iterations / BENCH_ENGINE_CLIENTS, 1);
+    sched = rm_scheduler_new(scenario, 1, BENCH_ENGINE_CLIENTS, raw, NULL);
+    for (i = 0; i < BENCH_ENGINE_CLIENTS; i++) {
+        rm_scheduler_add_client(sched, rm_client_new(i, scenario, perClient, FALSE));
+    }
+
+    rm_scheduler_run(sched, NULL);
+
+    rm_scheduler_free(sched);
+    if (raw) rm_raw_engine_free(raw);
+    rm_scenario_free(scenario);
+}
+
+static void bench_engine_soup(rmRequest *request, guint iterations)
+{
+    bench_engine(FALSE, iterations);
+}
+
+static void bench_engine_raw(rmRequest *request, guint iterations)
+{
+    bench_engine(TRUE, iterations);
+}
+
+static const benchCase benchCases[] = {
+    { "message: build per send",      bench_message_build },
+    { "message: compiled per send",   bench_message_compiled },
+    { "message: reuse compiled",      bench_message_reuse },
+    { "engine: soup, loopback",       bench_engine_soup },
+    { "engine: raw, loopback",        bench_engine_raw },
+    { NULL, NULL }
+};
+
+/// Generate a scenario document with a number of requests, using the base URL
+/// and headers set in clientSetup, some request specific headers and bodies
+static GString* create_bench_scenario(guint requests)
+{
+    GString *doc;
+    guint    i;
+
+    doc = g_string_sized_new(requests * 256);
+    g_string_append(doc,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<testScenario xmlns=\"http://arr.gr/rainmaker/xmlns/scenario/1.0\">\n"
+        "  <clientSetup>\n"
+        "    <options>\n"
+        "      <option name=\"baseUrl\" value=\"http://localhost:8080/\" />\n"
+        "    </options>\n"
+        "    <headers>\n"
+        "      <header name=\"User-Agent\">rainmaker-bench</header>\n"
+        "      <header name=\"Accept\">*/*</header>\n"
+        "      <header name=\"Accept-Language\">en-us,en;q=0.5</header>\n"
+        "      <header name=\"X-Request-Source\">base</header>\n"
+        "    </headers>\n"
+        "  </clientSetup>\n");
+
+    for (i = 0; i < requests; i++) {
+        if (i % 4 == 3) {
+            g_string_append_printf(doc,
+                "  <request method=\"POST\" url=\"bench/resource/%u\" name=\"post-%u\">\n"
+                "    <headers><header name=\"X-Request-Source\" replace=\"yes\">request</header></headers>\n"
+                "    <rawData contentType=\"application/json\">{\"id\": %u}</rawData>\n"
+                "  </request>\n", i, i, i);
+        } else {
+            g_string_append_printf(doc,
+                "  <request url=\"bench/resource?id=%u\" name=\"get-%u\">\n"
+                "    <headers><header name=\"X-Request-Id\">%u</header></headers>\n"
+                "  </request>\n", i, i, i);
+        }
+    }
+
+    g_string_append(doc, "</testScenario>\n");
+
+    return doc;
+}
+
+/// Measure the time it takes to load a generated scenario of each size
+static void bench_scenario_load()
+{
+    rmScenario *scenario;
+    GString    *doc;
+    GError     *error = NULL;
+    GTimer     *timer;
+    clock_t     start;
+    gdouble     cpu;
+    guint       i;
+
+    // Use the schema in the working directory if there is one, so that
+    // 'make bench' works before the schema is installed
+    if (g_file_test(RM_XML_XSD_FILE, G_FILE_TEST_EXISTS)) {
+        rm_scenario_xml_load_schema(RM_XML_XSD_FILE, NULL);
+    }
+
+    timer = g_timer_new();
+
+    printf("\n%-32s %12s %14s %14s\n", "scenario load", "requests", "cpu ns/req", "wall ms");
+    for (i = 0; loadSizes[i] > 0; i++) {
+        doc = create_bench_scenario(loadSizes[i]);
+
+        g_timer_start(timer);
+        start = clock();
+        scenario = rm_scenario_xml_read_buffer(doc->str, doc->len, &error);
+        cpu = (gdouble) (clock() - start) / CLOCKS_PER_SEC;
+        g_timer_stop(timer);
+
+        if (scenario == NULL) {
+            g_printerr("ERROR: failed loading scenario: %s\n", error->message);
+            g_error_free(error);
+            g_string_free(doc, TRUE);
+            break;
+        }
+        g_assert(scenario->requestCount == loadSizes[i]);
+
+        printf("%-32s %12u %14.1f %14.1f\n", "scenario: xml stream", loadSizes[i],
+            cpu * 1e9 / loadSizes[i], g_timer_elapsed(timer, NULL) * 1000);
+        write_result("load", "scenario: xml stream", "\"requests\":%u,\"cpuNsPerReq\":%.1f,\"wallMs\":%.1f",
+            loadSizes[i], cpu * 1e9 / loadSizes[i], g_timer_elapsed(timer, NULL) * 1000);
+
+        rm_scenario_free(scenario);
+        g_string_free(doc, TRUE);
+    }
+
+    g_timer_destroy(timer);
+}
+
+/// Build a scenario the way loaders do, one request at a time, with memory
+/// allocated in between as parsing a document does. That memory is kept
+/// until the scenario is freed, as the heap of a running process would be.
+static rmScenario* create_walk_scenario(guint requests, GPtrArray *garbage)
+{
+    rmScenario *scenario;
+    rmRequest  *request;
+    GError     *error = NULL;
+    gchar      *url, *id;
+    guint       i;
+
+    scenario = rm_scenario_new();
+    for (i = 0; i < requests; i++) {
+        url     = g_strdup_printf("http://localhost:8080/bench/resource?id=%u", i);
+        request = rm_request_new((i % 4 == 3 ? "POST" : "GET"), url, NULL, &error);
+        g_assert(request != NULL);
+        g_free(url);
+
+        g_ptr_array_add(garbage, g_malloc(64 + (i * 37) % 512));
+        rm_request_add_header(request, "User-Agent", "rainmaker-bench", FALSE);
+        rm_request_add_header(request, "Accept", "*/*", FALSE);
+        rm_request_add_header(request, "Accept-Language", "en-us,en;q=0.5", FALSE);
+        g_ptr_array_add(garbage, g_malloc(64 + (i * 53) % 256));
+
+        id = g_strdup_printf("%u", i);
+        rm_request_add_header(request, "X-Request-Id", id, FALSE);
+        g_free(id);
+
+        if (i % 4 == 3) {
+            request->bodyType   = g_quark_from_static_string("application/json");
+            request->body       = g_strdup_printf("{\"id\": %u}", i);
+            request->bodyLength = strlen(request->body);
+            request->freeBody   = TRUE;
+        }
+        g_ptr_array_add(garbage, g_malloc(64 + (i * 71) % 1024));
+
+        rm_scenario_add_request(scenario, request);
+    }
+
+    return scenario;
+}
+
+/// Visit a request, reading the fields a client reads when sending it, as
+/// well as its header strings
+static gsize visit_request(const rmRequest *request)
+{
+    const GSList   *node;
+    const rmHeader *header;
+    gsize           sum;
+
+    sum = request->index + request->repeat + request->expectCount + request->extractCount +
+          request->bodyLength + (request->bodyTemplate != NULL) + (request->generator != NULL);
+    if (request->body != NULL) sum += request->body[0];
+
+    for (node = request->headers; node; node = node->next) {
+        header = (const rmHeader *) node->data;
+        sum += header->name[0] + header->value[0];
+    }
+
+    return sum;
+}
+
+/// Walk the requests of a scenario a number of times, from the list they are
+/// loaded into, or from the table they are frozen into
+static gsize walk_scenario(const rmScenario *scenario, guint passes)
+{
+    const GSList *node;
+    gsize         sum = 0;
+    guint         i, j;
+
+    for (i = 0; i < passes; i++) {
+        if (scenario->requestTable == NULL) {
+            for (node = scenario->requests; node; node = node->next) {
+                sum += visit_request((const rmRequest *) node->data);
+            }
+        } else {
+            for (j = 0; j < scenario->requestCount; j++) {
+                sum += visit_request(&scenario->requestTable[j]);
+            }
+        }
+    }
+
+    return sum;
+}
+
+/// Measure the time it takes to walk the requests of scenarios of each size,
+/// before and after freezing them
+static void bench_scenario_walk()
+{
+    rmScenario *scenario;
+    GPtrArray  *garbage;
+    GTimer     *timer;
+    clock_t     start;
+    gdouble     cpu;
+    gsize       sum = 0;
+    guint       i, j, passes;
+
+    timer = g_timer_new();
+
+    printf("\n%-32s %12s %14s %14s\n", "scenario walk", "requests", "cpu ns/req", "wall ns/req");
+    for (i = 0; loadSizes[i] > 0; i++) {
+        garbage  = g_ptr_array_new();
+        scenario = create_walk_scenario(loadSizes[i], garbage);
+        passes   = MAX(BENCH_WALK_VISITS / loadSizes[i], 1);
+
+        for (j = 0; j < 2; j++) {
+            if (j == 1) rm_scenario_freeze(scenario);
+            sum += walk_scenario(scenario, 1);
+
+            g_timer_start(timer);
+            start = clock();
+            sum += walk_scenario(scenario, passes);
+            cpu = (gdouble) (clock() - start) / CLOCKS_PER_SEC;
+            g_timer_stop(timer);
+
+            printf("%-32s %12u %14.2f %14.2f\n",
+                (j == 0 ? "scenario: request list" : "scenario: frozen table"), loadSizes[i],
+                cpu * 1e9 / passes / loadSizes[i],
+                g_timer_elapsed(timer, NULL) * 1e9 / passes / loadSizes[i]);
+            write_result("walk", (j == 0 ? "scenario: request list" : "scenario: frozen table"),
+                "\"requests\":%u,\"cpuNsPerReq\":%.2f,\"wallNsPerReq\":%.2f", loadSizes[i],
+                cpu * 1e9 / passes / loadSizes[i],
+                g_timer_elapsed(timer, NULL) * 1e9 / passes / loadSizes[i]);
+        }
+
+        rm_scenario_free(scenario);
+        g_ptr_array_foreach(garbage, (GFunc) g_free, NULL);
+        g_ptr_array_free(garbage, TRUE);
+    }
+
+    // Keep the walks from being optimized away
+    if (sum == 0) printf("\n");
+
+    g_timer_destroy(timer);
+}
+
+/// A response the loopback server holds back for a while
+typedef struct _benchDelayed {
+    SoupServer  *server;
+    SoupMessage *msg;
+} benchDelayed;
+
+/// Send a delayed response
+static gboolean server_unpause(benchDelayed *delayed)
+{
+    soup_server_unpause_message(delayed->server, delayed->msg);
+    return FALSE;
+}
+
+/// Free a delayed response once it has been sent
+static void server_delayed_free(benchDelayed *delayed)
+{
+    g_object_unref(delayed->msg);
+    g_free(delayed);
+}
+
+/// Loopback server request handler - respond with a small static page, or a
+/// body of the size set by the 'size' query parameter, after the time (in ms)
+/// set by the 'delay' query parameter
+static void server_handler(SoupServer *server, SoupMessage *msg, const char *path,
+    GHashTable *query, SoupClientContext *ctx, gpointer user_data)
+{
+    static const gchar  body[] = "<html><body>It works!</body></html>";
+    const gchar        *value;
+    benchDelayed       *delayed;
+    guint               delay = 0, size = 0;
+
+    if (query != NULL) {
+        if ((value = g_hash_table_lookup(query, "delay")) != NULL) delay = (guint) atoi(value);
+        if ((value = g_hash_table_lookup(query, "size")) != NULL) size = (guint) atoi(value);
+    }
+
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+    if (size > 0) {
+        soup_message_set_response(msg, "application/octet-stream", SOUP_MEMORY_STATIC, serverBody,
+            MIN(size, BENCH_MAX_RESPONSE_SIZE));
+    } else {
+        soup_message_set_response(msg, "text/html", SOUP_MEMORY_STATIC, body, sizeof(body) - 1);
+    }
+
+    if (delay > 0) {
+        delayed = g_malloc(sizeof(benchDelayed));
+        delayed->server = server;
+        delayed->msg    = g_object_ref(msg);
+
+        soup_server_pause_message(server, msg);
+        g_timeout_add_full(G_PRIORITY_DEFAULT, delay, (GSourceFunc) server_unpause, delayed,
+            (GDestroyNotify) server_delayed_free);
+    }
+}
+
+/// Start the loopback server in child processes. The server listens on a
+/// random port, which is reported back to the parent through a pipe. Once
+/// listening, the server forks one process per CPU, all accepting
+/// connections on the same socket, so that the server keeps up with the
+/// clients. All server processes are in their own process group, which the
+/// parent stops at once with stop_server().
+static pid_t start_server(guint *port)
+{
+    SoupServer  *server;
+    SoupAddress *addr;
+    gint         fds[2];
+    pid_t        pid;
+    glong        i, processes;
+
+    if (pipe(fds) != 0) return -1;
+
+    pid = fork();
+    if (pid != 0) {
+        close(fds[1]);
+        if (pid > 0 && read(fds[0], port, sizeof(guint)) != sizeof(guint)) {
+            kill(pid, SIGTERM);
+            pid = -1;
+        }
+        close(fds[0]);
+        return pid;
+    }
+
+    // Child process
+    setpgid(0, 0);
+    close(fds[0]);
+
+    serverBody = g_malloc(BENCH_MAX_RESPONSE_SIZE);
+    memset(serverBody, 'x', BENCH_MAX_RESPONSE_SIZE);
+
+    addr   = soup_address_new("127.0.0.1", 0);
+    server = soup_server_new(SOUP_SERVER_INTERFACE, addr, NULL);
+    if (server == NULL) _exit(1);
+
+    soup_server_add_handler(server, NULL, server_handler, NULL, NULL);
+    *port = soup_server_get_port(server);
+    if (write(fds[1], port, sizeof(guint)) != sizeof(guint)) _exit(1);
+    close(fds[1]);
+
+    processes = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    for (i = 1; i < processes; i++) {
+        if (fork() == 0) break;
+    }
+
+    soup_server_run(server);
+    _exit(0);
+}
+
+/// Stop all loopback server processes
+static void stop_server(pid_t server)
+{
+    kill(-server, SIGTERM);
+    waitpid(server, NULL, 0);
+}
+
+/// Read a memory size (in KB) from the process status, such as the resident
+/// set size. Returns 0 if it can't be read, as on systems without /proc.
+static glong read_memory_kb(const gchar *field)
+{
+    gchar  *status, *line;
+    glong   kb = 0;
+
+    if (! g_file_get_contents("/proc/self/status", &status, NULL, NULL)) return 0;
+
+    for (line = status; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        if (g_str_has_prefix(line, field) && line[strlen(field)] == ':') {
+            kb = atol(line + strlen(field) + 1);
+            break;
+        }
+    }
+
+    g_free(status);
+
+    return kb;
+}
+
+/// Get the CPU time (user and system) used by this process so far
+static gdouble cpu_time()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/// Run an engine matrix case for a while against the loopback server, running
+/// clients iterations back to back, and print out, on a single line: the
+/// number of worker threads, requests and errors, the CPU time and wall time
+/// it took, and how much the resident set grew at its peak, in KB. Called in
+/// a process of its own.
+static int run_matrix_case(const benchMatrixCase *mc, gdouble duration)
+{
+    rmScenario   *scenario;
+    rmRequest    *request;
+    rmRawEngine  *raw = NULL;
+    rmScheduler  *sched;
+    rmScoreboard *total;
+    GError       *error = NULL;
+    gchar        *url;
+    guint         i, threads;
+    glong         baseline;
+    gdouble       cpu;
+
+    scenario = rm_scenario_new();
+    scenario->failOnHttpError = FALSE;
+    scenario->failOnTcpError  = FALSE;
+
+    url     = g_strdup_printf("%s?delay=%u&size=%u", serverUrl, mc->delay, mc->size);
+    request = rm_request_new("GET", url, NULL, &error);
+    g_assert(request != NULL);
+    g_free(url);
+    rm_scenario_add_request(scenario, request);
+    rm_scenario_freeze(scenario);
+
+    if (mc->raw) {
+        raw = rm_raw_engine_new(scenario, &error);
+        if (raw == NULL) {
+            g_printerr("ERROR: %s\n", error->message);
+            return 2;
+        }
+    }
+
+    threads = (mc->threads > 0 ? mc->threads : (guint) MAX(sysconf(_SC_NPROCESSORS_ONLN), 1));
+    threads = MIN(threads, mc->clients);
+
+    baseline = read_memory_kb("VmRSS");
+
+    sched = rm_scheduler_new(scenario, threads, mc->clients, raw, NULL);
+    for (i = 0; i < mc->clients; i++) {
+        rm_scheduler_add_client(sched, rm_client_new(i, scenario, 1, FALSE));
+    }
+    rm_scheduler_set_duration(sched, duration, 0);
+
+    cpu = cpu_time();
+    rm_scheduler_run(sched, NULL);
+    cpu = cpu_time() - cpu;
+
+    total = rm_scoreboard_new(scenario->requestCount);
+    rm_scheduler_merge_scoreboards(sched, total);
+
+    printf("%u %u %u %f %f %ld\n", threads, total->requests,
+        total->resp_codes[0] + total->resp_codes[4] + total->resp_codes[5], cpu,
+        rm_scheduler_elapsed(sched), MAX(read_memory_kb("VmHWM") - baseline, 0));
+
+    rm_scoreboard_free(total);
+    rm_scheduler_free(sched);
+    if (raw) rm_raw_engine_free(raw);
+    rm_scenario_free(scenario);
+
+    return 0;
+}
+
+/// Run all engine matrix cases, each in a process of its own, and print out
+/// the request rate, CPU time per request and memory per client of each
+static void bench_engine_matrix(const gchar *self, guint port, gdouble duration)
+{
+    const benchMatrixCase *mc;
+    gchar                 *argv[8], *out, caseArg[16], portArg[16], durationArg[32];
+    GError                *error = NULL;
+    guint                  i, threads, requests, errors;
+    gint                   status;
+    gdouble                cpu, elapsed;
+    glong                  memory;
+
+    printf("\n%-32s %8s %8s %12s %8s %12s %12s\n", "engine matrix", "clients", "threads", "req/s",
+        "errors", "cpu us/req", "KB/client");
+
+    for (i = 0; matrixCases[i].name != NULL; i++) {
+        mc = &matrixCases[i];
+
+        g_snprintf(caseArg, sizeof(caseArg), "%u", i);
+        g_snprintf(portArg, sizeof(portArg), "%u", port);
+        g_ascii_dtostr(durationArg, sizeof(durationArg), duration);
+        argv[0] = (gchar *) self;
+        argv[1] = "--case";
+        argv[2] = caseArg;
+        argv[3] = "--port";
+        argv[4] = portArg;
+        argv[5] = "--duration";
+        argv[6] = durationArg;
+        argv[7] = NULL;
+
+        out = NULL;
+        if (! g_spawn_sync(NULL, argv, NULL, 0, NULL, NULL, &out, NULL, &status, &error) ||
+            status != 0 || out == NULL ||
+            sscanf(out, "%u %u %u %lf %lf %ld", &threads, &requests, &errors, &cpu, &elapsed, &memory) != 6) {
+
+            printf("%-32s failed%s%s\n", mc->name, (error ? ": " : ""), (error ? error->message : ""));
+            g_clear_error(&error);
+            g_free(out);
+            continue;
+        }
+        g_free(out);
+
+        printf("%-32s %8u %8u %12.1f %8u %12.2f %12.1f\n", mc->name, mc->clients, threads,
+            (elapsed > 0 ? requests / elapsed : 0), errors, (requests > 0 ? cpu * 1e6 / requests : 0),
+            (gdouble) memory / mc->clients);
+        write_result("matrix", mc->name,
+            "\"engine\":\"%s\",\"clients\":%u,\"threads\":%u,\"delayMs\":%u,\"responseBytes\":%u,"
+            "\"seconds\":%.3f,\"requests\":%u,\"errors\":%u,\"reqPerSec\":%.1f,\"cpuUsPerReq\":%.3f,"
+            "\"kbPerClient\":%.2f", (mc->raw ? "raw" : "soup"), mc->clients, threads, mc->delay, mc->size,
+            elapsed, requests, errors, (elapsed > 0 ? requests / elapsed : 0),
+            (requests > 0 ? cpu * 1e6 / requests : 0), (gdouble) memory / mc->clients);
+    }
+}
+
+/// Set up a typical request: a form POST with a few headers, some of which
+/// replace each other
+static rmRequest* create_bench_request()
+{
+    rmRequest *request;
+    GError    *error = NULL;
+
+    request = rm_request_new("POST", "http://localhost:8080/bench/resource?id=1234", NULL, &error);
+    g_assert(request != NULL);
+
+    request->bodyType   = g_quark_from_static_string("application/x-www-form-urlencoded");
+    request->body       = g_malloc(BENCH_BODY_SIZE);
+    request->bodyLength = BENCH_BODY_SIZE;
+    request->freeBody   = TRUE;
+    memset(request->body, 'x', BENCH_BODY_SIZE);
+
+    rm_request_add_header(request, "User-Agent", "rainmaker-bench", FALSE);
+    rm_request_add_header(request, "Accept", "*/*", FALSE);
+    rm_request_add_header(request, "Accept-Language", "en-us,en;q=0.5", FALSE);
+    rm_request_add_header(request, "Accept-Encoding", "identity", FALSE);
+    rm_request_add_header(request, "X-Request-Source", "base", FALSE);
+    rm_request_add_header(request, "X-Request-Source", "request", TRUE);
+    rm_request_add_header(request, "Cache-Control", "no-cache", FALSE);
+    rm_request_add_header(request, "Referer", "http://localhost:8080/bench/", FALSE);
+
+    rm_request_compile(request);
+
+    return request;
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *ctx;
+    GError         *error = NULL;
+    rmRequest      *request;
+    gchar          *output = NULL;
+    guint           iterations = BENCH_DEFAULT_ITERATIONS;
+    guint           i;
+    gint            matrixCase = -1, port = 0;
+    gdouble         duration = BENCH_MATRIX_DURATION;
+    pid_t           server;
+    clock_t         start;
+    GTimer         *timer;
+    gdouble         cpu;
+    gboolean        res;
+
+    GOptionEntry    arguments[] = {
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+            "also write results to FILE, as JSON Lines", "FILE"},
+        {"duration", 'd', 0, G_OPTION_ARG_DOUBLE, &duration,
+            "seconds to run each engine matrix case for (default: 2)", "N"},
+        {"case", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &matrixCase, NULL, NULL},
+        {"port", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &port, NULL, NULL},
+        { NULL }
+    };
+
+    g_type_init();
+
+    ctx = g_option_context_new("[iterations]");
+    g_option_context_add_main_entries(ctx, arguments, NULL);
+    res = g_option_context_parse(ctx, &argc, &argv, &error);
+    g_option_context_free(ctx);
+
+    if (! res) {
+        g_printerr("ERROR: %s\n", error->message);
+        return 1;
+    }
+
+    if (argc > 1) {
+        iterations = (guint) atoi(argv[1]);
+        if (iterations < 1) {
+            g_printerr("usage: %s [options] [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (duration <= 0) {
+        g_printerr("ERROR: duration must be more than 0\n");
+        return 1;
+    }
+
+    // Run a single engine matrix case, as asked by the parent process
+    if (matrixCase >= 0) {
+        if (matrixCase >= (gint) G_N_ELEMENTS(matrixCases) - 1 || port <= 0) return 1;
+
+        serverUrl = g_strdup_printf("http://127.0.0.1:%d/", port);
+        g_thread_init(NULL);
+
+        return run_matrix_case(&matrixCases[matrixCase], duration);
+    }
+
+    if (output != NULL && (results = fopen(output, "w")) == NULL) {
+        g_printerr("ERROR: failed opening %s for writing\n", output);
+        return 1;
+    }
+
+    // Fork the server before any threads are started
+    server = start_server((guint *) &port);
+    if (server < 0) {
+        g_printerr("ERROR: failed starting loopback server\n");
+        return 2;
+    }
+    serverUrl = g_strdup_printf("http://127.0.0.1:%u/", port);
+
+    g_thread_init(NULL);
+
+    request = create_bench_request();
+    timer   = g_timer_new();
+
+    printf("%-32s %12s %14s %14s\n", "benchmark", "iterations", "cpu ns/iter", "wall ns/iter");
+    for (i = 0; benchCases[i].name != NULL; i++) {
+        // Warm up allocator caches and interned strings
+        benchCases[i].func(request, MIN(iterations, 1000));
+
+        g_timer_start(timer);
+        start = clock();
+        benchCases[i].func(request, iterations);
+        cpu = (gdouble) (clock() - start) / CLOCKS_PER_SEC;
+        g_timer_stop(timer);
+
+        printf("%-32s %12u %14.1f %14.1f\n", benchCases[i].name, iterations,
+            cpu * 1e9 / iterations, g_timer_elapsed(timer, NULL) * 1e9 / iterations);
+        write_result("micro", benchCases[i].name, "\"iterations\":%u,\"cpuNsPerIter\":%.1f,\"wallNsPerIter\":%.1f",
+            iterations, cpu * 1e9 / iterations, g_timer_elapsed(timer, NULL) * 1e9 / iterations);
+    }
+
+    bench_engine_matrix(argv[0], (guint) port, duration);
+
+    stop_server(server);
+
+    bench_scenario_load();
+    bench_scenario_walk();
+
+    g_timer_destroy(timer);
+    rm_request_free(request);
+    g_free(serverUrl);
+    if (results) fclose(results);
+
+    return 0;
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -7,131 +7,873 @@
 /// ---------------------------------------------------------------------------
 
 #include <glib.h>
+#include <string.h>
 #include <libsoup/soup.h>
 
 #include "rainmaker-client.h"
 #include "rainmaker-scenario.h"
 #include "rainmaker-scoreboard.h"
 
-/// Create a new client and allocate relevant memory. Will also allocate
-/// the client's SoupSession and rmScoreboard
-rmClient* rm_client_new()
+/// Create a new client and allocate relevant memory. The client will run the
+/// scenario the given number of times. Sessions and scoreboards are provided
+/// by the worker running each iteration, and are not owned by the client.
+rmClient* rm_client_new(guint id, rmScenario *scenario, guint iterations, gboolean keepCookies)
 {
     rmClient *client;
+    guint     i, expects = 0, extracts = 0;
 
-    client = g_malloc(sizeof(rmClient));
-    client->session    = soup_session_sync_new();
-    client->scoreboard = rm_scoreboard_new();
+    g_assert(scenario->requestTable != NULL); // scenario is frozen
+
+    client = g_malloc0(sizeof(rmClient));
+    client->id          = id;
+    client->scenario    = scenario;
+    client->iterations  = iterations;
+    client->keepCookies = keepCookies;
+    client->stopwatch   = g_timer_new();
+    client->messages    = g_malloc0(sizeof(SoupMessage *) * scenario->requestCount);
+    client->clientCount = 1;
+    client->seed        = id * 2654435761u + 1;
+
+    // Variable values and rendering buffers are only needed if there are
+    // variables requests can reference
+    if (scenario->variables->names->len > 0) {
+        client->values       = g_malloc0(sizeof(rmValue) * scenario->variables->names->len);
+        client->scratch      = g_string_new("");
+        client->renderedBody = g_string_new("");
+    }
+
+    // Expectation and extraction state is reused by all requests
+    for (i = 0; i < scenario->requestCount; i++) {
+        expects  = MAX(expects, scenario->requestTable[i].expectCount);
+        extracts = MAX(extracts, scenario->requestTable[i].extractCount);
+    }
+    if (expects > 0) {
+        client->expectStates = g_malloc0(sizeof(rmExpectState) * expects);
+    }
+    if (extracts > 0) {
+        client->extractStates = g_malloc0(sizeof(rmExtractState) * extracts);
+    }
+
+    // Values extracted from responses, or set by scripts, are kept by the client
+    if ((extracts > 0 || scenario->scripts != NULL) && scenario->variables->names->len > 0) {
+        client->extracted = g_malloc0(sizeof(GString *) * scenario->variables->names->len);
+    }
 
     return client;
 }
 
-/// Set the client's logger object
-void rm_client_set_logger(rmClient *client, SoupLogger *logger)
+/// Free a client and related memory, including the client's cookie jar,
+/// messages, expectation state and extracted values
+void rm_client_free(rmClient *client)
 {
-    soup_session_add_feature(client->session, (SoupSessionFeature *) logger);
+    guint i, expects = 0, extracts = 0;
+
+    g_assert(client->current == NULL); // client is idle
+
+    for (i = 0; i < client->scenario->requestCount; i++) {
+        if (client->messages[i]) g_object_unref(client->messages[i]);
+    }
+    g_free(client->messages);
+
+    for (i = 0; i < client->scenario->requestCount; i++) {
+        expects  = MAX(expects, client->scenario->requestTable[i].expectCount);
+        extracts = MAX(extracts, client->scenario->requestTable[i].extractCount);
+    }
+    for (i = 0; i < expects; i++) {
+        rm_expect_state_clear(&client->expectStates[i]);
+    }
+    g_free(client->expectStates);
+
+    for (i = 0; i < extracts; i++) {
+        rm_extract_state_clear(&client->extractStates[i]);
+    }
+    g_free(client->extractStates);
+    if (client->extracted) {
+        for (i = 0; i < client->scenario->variables->names->len; i++) {
+            if (client->extracted[i]) g_string_free(client->extracted[i], TRUE);
+        }
+        g_free(client->extracted);
+    }
+
+    rm_generator_state_clear(&client->generated);
+
+    g_free(client->values);
+    if (client->scratch) g_string_free(client->scratch, TRUE);
+    if (client->renderedBody) g_string_free(client->renderedBody, TRUE);
+
+    if (client->cookieJar) g_object_unref(client->cookieJar);
+    g_timer_destroy(client->stopwatch);
+    g_free(client);
 }
 
-/// Free a client and related memory. Will also unref the client's SoupSession
-/// and free the associated scoreboard
-void rm_client_free(rmClient *client)
+static void rm_client_send_request(rmClient *client, rmRequest *request);
+
+/// Mark the start of a request phase
+static void rm_client_start_phase(rmClient *client, rmPhase phase)
 {
-    g_object_unref((gpointer) client->session);
-    rm_scoreboard_free(client->scoreboard);
-    g_free(client);
+    client->phaseStart[phase] = g_timer_elapsed(client->stopwatch, NULL);
 }
 
-/// Add a header struct to a SoupMessage. If the header's replace flag is
-/// set, will replace any existing headers with the same name.
-static void add_header_to_message(rmHeader *header, SoupMessage *msg)
+/// Mark the end of a request phase, if it has started
+static void rm_client_end_phase(rmClient *client, rmPhase phase)
 {
-    if (header->replace) {
-        soup_message_headers_replace(msg->request_headers, header->name, header->value);
-    } else {
-        soup_message_headers_append(msg->request_headers, header->name, header->value);
+    if (client->phaseStart[phase] >= 0) {
+        client->phases[phase] = g_timer_elapsed(client->stopwatch, NULL) - client->phaseStart[phase];
     }
 }
 
-/// Send a request. Will convert the rmRequest struct to a SoupMessage and send
-/// it synchronously.
-///
-/// @todo consider re-using the message objects for performance reasons
-static guint rm_client_send_request(rmClient *client, rmRequest *request)
+/// Wait for a source to fire before going on with the current request. The
+/// source is kept until it fires, so that the iteration can be cancelled.
+static void rm_client_wait(rmClient *client, GSource *source, GSourceFunc func)
 {
-    SoupMessage *msg;
-    guint        status, s;
+    g_source_set_callback(source, func, client, NULL);
+    g_source_attach(source, g_main_context_get_thread_default());
+    client->waiting = source;
+}
+
+/// Called when the source the client is waiting for has fired
+static void rm_client_wait_over(rmClient *client)
+{
+    g_source_unref(client->waiting);
+    client->waiting = NULL;
+}
 
-    msg = soup_message_new_from_uri(g_quark_to_string(request->method), request->url);
-    soup_message_set_flags(msg, SOUP_MESSAGE_NO_REDIRECT);
+/// Idle callback sending the current request
+static gboolean rm_client_send_idle(rmClient *client)
+{
+    rm_client_wait_over(client);
+    rm_client_send_request(client, client->current);
+    return FALSE;
+}
+
+/// Run a script hook, if the scenario sets one for the request (or for
+/// iterations, if request is NULL). An error raised by the hook fails the
+/// client. For postComplete hooks, next is set to where the hook says the
+/// client goes next (see rm_script_state_run()).
+static gboolean rm_client_run_hook(rmClient *client, rmScriptHook hook, rmRequest *request, SoupMessage *msg,
+    guint status, gint *next)
+{
+    rmScriptContext context;
+    GError         *error = NULL;
 
-    // Add body
-    if (request->body != NULL) {
-        g_assert(request->bodyType);
-        soup_message_set_request(msg, g_quark_to_string(request->bodyType),
-                SOUP_MEMORY_TEMPORARY, request->body, request->bodyLength);
+    context.client     = client->id;
+    context.iteration  = client->completed;
+    context.variables  = client->scenario->variables;
+    context.values     = client->values;
+    context.owned      = client->extracted;
+    context.request    = request;
+    context.msg        = msg;
+    context.body       = NULL;
+    context.bodyLength = 0;
+    context.status     = status;
+
+    // Bodies sent in parts, or rendered from a template, are not available
+    if (request != NULL && request->bodySegments == NULL && request->generator == NULL &&
+        request->bodyTemplate == NULL) {
+
+        context.body       = request->body;
+        context.bodyLength = request->bodyLength;
     }
 
-    // Add headers
-    g_slist_foreach(request->headers, (GFunc) add_header_to_message, (gpointer) msg);
+    if (! rm_script_state_run(client->script, hook, &context, client->scoreboard, next, &error)) {
+        g_printerr("ERROR: %s\n", error->message);
+        g_error_free(error);
+        client->failed = TRUE;
+        client->scoreboard->failed = TRUE;
+        return FALSE;
+    }
 
-    // Start timer
-    g_timer_start(client->scoreboard->stopwatch);
+    return TRUE;
+}
 
-    // Send request
-    status = soup_session_send_message(client->session, msg);
-    s = status / 100;
+/// Finish running the current iteration: run the postIteration hook, detach
+/// the cookie jar from the session and notify the worker running the iteration.
+/// Cancelled iterations are not counted as completed, and skip the hook.
+static void rm_client_done(rmClient *client)
+{
+    if (client->script && ! client->failed && ! client->cancelled) {
+        rm_client_run_hook(client, RM_HOOK_POST_ITERATION, NULL, NULL, 0, NULL);
+    }
 
-    // Stop timer
-    g_timer_stop(client->scoreboard->stopwatch);
+    if (client->cookieJar && client->session) {
+        soup_session_remove_feature(client->session, (SoupSessionFeature *) client->cookieJar);
+    }
+
+    if (client->failed) {
+        // A failed client does not run any more iterations
+        client->iterations = 0;
+    } else if (! client->cancelled) {
+        client->completed++;
+    }
+
+    client->cancelled  = FALSE;
+    client->current    = NULL;
+    client->session      = NULL;
+    client->raw          = NULL;
+    client->connRequests = NULL;
+    client->scoreboard   = NULL;
+    client->samples    = NULL;
+    client->script     = NULL;
+    if (client->doneFunc) client->doneFunc(client, client->doneData);
+}
+
+/// Check a response against the request's expectations, counting each
+/// expectation that was not met. Returns FALSE if any expectation was not met.
+static gboolean rm_client_check_expectations(rmClient *client, rmRequest *request, guint status,
+    SoupMessage *msg)
+{
+    gboolean met = TRUE;
+    guint    i;
+
+    for (i = 0; i < request->expectCount; i++) {
+        if (! rm_expectation_check(request->expects[i], &client->expectStates[i], status,
+                (msg ? msg->response_headers : NULL), (msg ? msg->response_body : NULL))) {
+
+            rm_scoreboard_count_expectation(client->scoreboard, request->index, i, request->expectCount);
+            met = FALSE;
+        }
+    }
+
+    if (! met) {
+        client->scoreboard->expectFailed++;
+        client->scoreboard->perRequest[request->index].expectFailed++;
+    }
+
+    return met;
+}
+
+/// Store the values extracted from a response in the client's variables, for
+/// following requests to reference. Header rules are applied here, once the
+/// response is complete; body rules have already scanned the body as it came
+/// in. A variable keeps its previous value if a rule found nothing.
+static void rm_client_extract_values(rmClient *client, rmRequest *request, SoupMessage *msg)
+{
+    rmExtraction   *ext;
+    rmExtractState *state;
+    GString        *value;
+    gdouble         started;
+    guint           i;
+
+    // The response's latency has been recorded by now, so the stopwatch is
+    // resumed to time extraction
+    started = g_timer_elapsed(client->stopwatch, NULL);
+    g_timer_continue(client->stopwatch);
+
+    for (i = 0; i < request->extractCount; i++) {
+        ext   = request->extracts[i];
+        state = &client->extractStates[i];
+        rm_extraction_finish(ext, state, (msg ? msg->response_headers : NULL));
+
+        if (! state->found) {
+            client->scoreboard->extractMissed++;
+            client->scoreboard->perRequest[request->index].extractMissed++;
+            continue;
+        }
+
+        if ((value = client->extracted[ext->variable]) == NULL) {
+            value = client->extracted[ext->variable] = g_string_sized_new(state->value->len);
+        }
+        g_string_assign(value, state->value->str);
+        client->values[ext->variable].data   = value->str;
+        client->values[ext->variable].length = value->len;
+        client->scoreboard->extracted++;
+    }
+
+    g_timer_stop(client->stopwatch);
+    client->scoreboard->extractTime += g_timer_elapsed(client->stopwatch, NULL) - started;
+}
+
+/// Count a response in the scoreboard, and figure out if it should fail the
+/// scenario according to the scenario settings. Per-request statistics are
+/// kept in a flat array indexed by the request's index. The message is NULL
+/// if the response was received by the raw engine.
+static gboolean rm_client_record_response(rmClient *client, rmRequest *request, guint status,
+    SoupMessage *msg)
+{
+    rmScenario     *scenario = client->scenario;
+    rmRequestStats *stats;
+    guint           s = status / 100;
+    guint           i;
+    guint64         usec;
+    gdouble         elapsed;
+
+    g_assert(request->index < client->scoreboard->requestCount);
+    stats = &client->scoreboard->perRequest[request->index];
 
     // Count request and response code, add elapsed time
     client->scoreboard->requests++;
+    stats->requests++;
     if (s >= 0 && s <= 5) {
         client->scoreboard->resp_codes[s]++;
+        stats->resp_codes[s]++;
     } else {
         g_printerr("WARNING: unexpected HTTP response code '%u' encountered\n", status);
     }
-    client->scoreboard->elapsed += g_timer_elapsed(client->scoreboard->stopwatch, NULL);
+    elapsed = g_timer_elapsed(client->stopwatch, NULL);
+    usec    = (guint64) (elapsed * G_USEC_PER_SEC);
+    client->scoreboard->elapsed += elapsed;
+    rm_histogram_record(client->scoreboard->latency, usec);
+
+    // Count response body bytes and time to first byte
+    client->scoreboard->bytesReceived += client->received;
+    if (client->firstByte >= 0) {
+        rm_histogram_record(client->scoreboard->firstByte, (guint64) (client->firstByte * G_USEC_PER_SEC));
+    }
+
+    // Count time spent in each phase the request went through
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        if (client->phases[i] >= 0) {
+            rm_histogram_record(client->scoreboard->phases[i], (guint64) (client->phases[i] * G_USEC_PER_SEC));
+        }
+    }
+
+    // Count connections opened for the request
+    if (client->connectTime >= 0) {
+        client->scoreboard->connections++;
+        rm_histogram_record(client->scoreboard->connectTime, (guint64) (client->connectTime * G_USEC_PER_SEC));
+    }
+
+    // Only happens once per request per scoreboard
+    if (G_UNLIKELY(stats->latency == NULL)) {
+        stats->latency = rm_histogram_new();
+    }
+    rm_histogram_record(stats->latency, usec);
+
+    if (client->samples) {
+        rm_sample_ring_push(client->samples, client->id, request->index, status, usec, client->received);
+    }
+
+    // In open-loop mode, also measure latency from the intended send time
+    if (client->interval > 0) {
+        elapsed = g_timer_elapsed(client->clock, NULL) - client->intended;
+        rm_histogram_record(client->scoreboard->corrected, (guint64) (elapsed * G_USEC_PER_SEC));
+    }
+
+    if (request->extractCount > 0) {
+        rm_client_extract_values(client, request, msg);
+    }
+
+    if (request->expectCount > 0 &&
+        ! rm_client_check_expectations(client, request, status, msg) &&
+        scenario->failOnExpectation) {
+
+        client->failed = TRUE;
+        client->scoreboard->failed = TRUE;
+    }
+
+    if ((scenario->failOnTcpError && status < 100) ||
+        (scenario->failOnHttpRedirect && status >= 300 && status < 400) ||
+        (scenario->failOnHttpError && status >= 400)) {
+
+        client->failed = TRUE;
+        client->scoreboard->failed = TRUE;
+    }
+
+    return (! client->failed);
+}
+
+/// Called when a response has been received, by either engine. Will record
+/// the response and move the client on to the next request in the scenario,
+/// if any.
+static void rm_client_response_received(rmClient *client, guint status, SoupMessage *msg)
+{
+    rmRequest *req;
+    GSource   *idle;
+    gint       next = RM_SCRIPT_NEXT;
+
+    // Stop timer
+    g_timer_stop(client->stopwatch);
+
+    // Keep track of requests sent on the connection, to close it once the
+    // max number of requests per connection is reached
+    if (client->connectTime >= 0) {
+        *client->connRequests = 1;
+    } else {
+        (*client->connRequests)++;
+    }
+    if (! client->scenario->keepAlive ||
+        (client->scenario->maxRequestsPerConn > 0 &&
+         *client->connRequests >= client->scenario->maxRequestsPerConn)) {
+        *client->connRequests = 0;
+    }
 
-    g_object_unref((gpointer) msg);
+    req = client->current;
+    if (! rm_client_record_response(client, req, status, msg)) {
+        rm_client_done(client);
+        return;
+    }
+
+    // The postComplete hook may decide where the client goes next
+    if (client->script && ! rm_client_run_hook(client, RM_HOOK_POST_COMPLETE, req, msg, status, &next)) {
+        rm_client_done(client);
+        return;
+    }
+
+    if (next >= 0) {
+        // Jump to another request (or back to the same one)
+        client->current = &client->scenario->requestTable[next];
+        client->sent    = 0;
+
+    } else if (next == RM_SCRIPT_END) {
+        client->current = NULL;
+
+    } else if (++client->sent >= req->repeat) {
+        // Repeat the current request or move on to the next one
+        client->current = (req->index + 1 < client->scenario->requestCount ? req + 1 : NULL);
+        client->sent    = 0;
+    }
+
+    if (client->current == NULL) {
+        rm_client_done(client);
 
-    return status;
+    } else if (client->current == req && client->session) {
+        // Repeating the same request means reusing the same message, which
+        // the session is not done with until this callback returns
+        idle = g_idle_source_new();
+        g_source_set_priority(idle, G_PRIORITY_HIGH);
+        rm_client_wait(client, idle, (GSourceFunc) rm_client_send_idle);
+
+    } else {
+        rm_client_send_request(client, client->current);
+    }
 }
 
-/// Run a scenario using the client.
-void rm_client_run_scenario(rmClient *client, rmScenario *scenario)
+/// Called by the session's main loop when a response has been received, or
+/// the request was cancelled
+static void rm_client_request_finished(SoupSession *session, SoupMessage *msg, gpointer user_data)
 {
-    GSList        *rlNode;
-    guint          status, i;
-    SoupCookieJar *cookieJar = NULL;
+    rmClient *client = (rmClient *) user_data;
 
-    // Enable cookie persistence if needed
-    if (scenario->persistCookies) {
-        cookieJar = soup_cookie_jar_new();
-        soup_session_add_feature(client->session, (SoupSessionFeature *) cookieJar);
+    if (client->cancelled) {
+        rm_client_done(client);
+        return;
     }
 
-    for (rlNode = scenario->requests; rlNode; rlNode = rlNode->next) {
-        rmRequest *req = (rmRequest *) rlNode->data;
-        g_assert(req != NULL);
-        g_assert(req->repeat >= 1); // request is sane
+    rm_client_end_phase(client, RM_PHASE_TRANSFER);
+    rm_client_response_received(client, msg->status_code, msg);
+}
 
-        for (i = 0; i < req->repeat; i++) {
-            status = rm_client_send_request(client, req);
+/// Called by the raw engine when a response has been received
+static void rm_client_raw_finished(rmRawConn *conn, guint status, gpointer user_data)
+{
+    rmClient *client = (rmClient *) user_data;
 
-            if ((scenario->failOnTcpError && status < 100) ||
-                (scenario->failOnHttpRedirect && status >= 300 && status < 400) ||
-                (scenario->failOnHttpError && status >= 400)) {
+    client->connectTime = conn->connectTime;
+    client->firstByte   = conn->firstByte;
+    client->received    = conn->bodyReceived;
+    memcpy(client->phases, conn->phases, sizeof(client->phases));
+    rm_client_response_received(client, status, NULL);
+}
 
-                client->scoreboard->failed = TRUE;
-                break;
+/// Called by libsoup once the final response headers have been read, which
+/// is as close as libsoup gets to telling when the first byte of the response
+/// arrived
+static void rm_client_got_headers(SoupMessage *msg, rmClient *client)
+{
+    if (client->firstByte < 0) {
+        client->firstByte = g_timer_elapsed(client->stopwatch, NULL);
+    }
+
+    rm_client_end_phase(client, RM_PHASE_WAIT);
+    rm_client_start_phase(client, RM_PHASE_TRANSFER);
+}
+
+/// Called by libsoup once the request has been fully written
+static void rm_client_wrote_body(SoupMessage *msg, rmClient *client)
+{
+    rm_client_end_phase(client, RM_PHASE_SEND);
+    rm_client_start_phase(client, RM_PHASE_WAIT);
+}
+
+/// Called by libsoup for each chunk of response body read. Strings expected
+/// in the body are searched for in each chunk as it arrives, and so are values
+/// to extract; time spent extracting is counted separately. Unless the
+/// scenario discards response bodies, the chunk is also appended to the
+/// message's response body.
+static void rm_client_got_chunk(SoupMessage *msg, SoupBuffer *chunk, rmClient *client)
+{
+    rmRequest *request = client->current;
+    gdouble    started;
+    guint      i;
+
+    client->received += chunk->length;
+
+    for (i = 0; i < request->expectCount; i++) {
+        rm_expectation_feed(request->expects[i], &client->expectStates[i],
+            (const guint8 *) chunk->data, chunk->length);
+    }
+
+    if (request->extractCount > 0) {
+        started = g_timer_elapsed(client->stopwatch, NULL);
+        for (i = 0; i < request->extractCount; i++) {
+            rm_extraction_feed(request->extracts[i], &client->extractStates[i], chunk->data, chunk->length);
+        }
+        client->scoreboard->extractTime += g_timer_elapsed(client->stopwatch, NULL) - started;
+    }
+}
+
+/// Append the next chunk of a generated request body to a message, or mark
+/// the body as complete once it has all been generated
+static void rm_client_generate_chunk(rmClient *client, rmRequest *request, SoupMessage *msg)
+{
+    const gchar *data;
+    gsize        length;
+
+    if (rm_generator_next(request->generator, &client->generated, &data, &length)) {
+        soup_message_body_append(msg->request_body, SOUP_MEMORY_STATIC, data, length);
+    } else if (request->generator->chunked) {
+        soup_message_body_complete(msg->request_body);
+    }
+}
+
+/// Start generating a request body from its beginning. Only the first chunk
+/// is generated; following ones are generated as chunks are written.
+static void rm_client_start_body(rmClient *client, rmRequest *request, SoupMessage *msg)
+{
+    soup_message_body_truncate(msg->request_body);
+    rm_generator_state_reset(&client->generated, request->generator);
+    rm_client_generate_chunk(client, request, msg);
+}
+
+/// Called by libsoup once a chunk of a generated request body has been
+/// written. Written chunks are dropped from the message, so the next chunk is
+/// generated into the same buffer, and the message never holds more than one.
+static void rm_client_wrote_chunk(SoupMessage *msg, rmClient *client)
+{
+    rm_client_generate_chunk(client, client->current, msg);
+}
+
+/// Called by libsoup if it has to send a message again, for example if a
+/// kept-alive connection was closed by the server before the request was
+/// sent. A generated body is then generated again from its beginning.
+static void rm_client_restarted(SoupMessage *msg, rmClient *client)
+{
+    rm_client_start_body(client, client->current, msg);
+}
+
+/// Called by libsoup as a new connection is being opened for a message, to
+/// measure the time it takes to open the connection (including DNS lookup and
+/// TLS handshake), and the time spent in each of these phases. Not called if
+/// the message is sent on an existing connection.
+static void rm_client_network_event(SoupMessage *msg, GSocketClientEvent event,
+    GIOStream *connection, rmClient *client)
+{
+    switch (event) {
+        case G_SOCKET_CLIENT_RESOLVING:
+        case G_SOCKET_CLIENT_CONNECTING:
+            if (client->connectStarted < 0) {
+                client->connectStarted = g_timer_elapsed(client->stopwatch, NULL);
+            }
+            rm_client_start_phase(client, (event == G_SOCKET_CLIENT_RESOLVING ? RM_PHASE_DNS : RM_PHASE_CONNECT));
+            break;
+
+        case G_SOCKET_CLIENT_RESOLVED:
+            rm_client_end_phase(client, RM_PHASE_DNS);
+            break;
+
+        case G_SOCKET_CLIENT_CONNECTED:
+            rm_client_end_phase(client, RM_PHASE_CONNECT);
+            break;
+
+        case G_SOCKET_CLIENT_TLS_HANDSHAKING:
+            rm_client_start_phase(client, RM_PHASE_TLS);
+            break;
+
+        case G_SOCKET_CLIENT_TLS_HANDSHAKED:
+            rm_client_end_phase(client, RM_PHASE_TLS);
+            break;
+
+        case G_SOCKET_CLIENT_COMPLETE:
+            if (client->connectStarted >= 0) {
+                client->connectTime = g_timer_elapsed(client->stopwatch, NULL) - client->connectStarted;
             }
+
+            // Sending starts once the connection is ready
+            rm_client_start_phase(client, RM_PHASE_SEND);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/// Queue a request for sending on the client's session. Each client keeps one
+/// message per request, created from the request's compiled template the
+/// first time the request is sent, and reset on following sends. The response
+/// is handled by rm_client_request_finished() once it arrives.
+///
+/// With the raw engine, the request's pre-serialized bytes are sent on the
+/// iteration's connection instead.
+static void rm_client_queue_request(rmClient *client, rmRequest *request)
+{
+    SoupMessage *msg;
+    guint        i;
+
+    g_assert(request->repeat >= 1); // request is sane
+
+    client->connectStarted = -1;
+    client->connectTime    = -1;
+    client->firstByte      = -1;
+    client->received       = 0;
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        client->phaseStart[i] = -1;
+        client->phases[i]     = -1;
+    }
+    for (i = 0; i < request->expectCount; i++) {
+        rm_expect_state_reset(&client->expectStates[i]);
+    }
+    for (i = 0; i < request->extractCount; i++) {
+        rm_extract_state_reset(&client->extractStates[i]);
+    }
+
+    if (client->raw) {
+        g_timer_start(client->stopwatch);
+        rm_raw_conn_send(client->raw, request->index, rm_client_raw_finished, client);
+        return;
+    }
+
+    msg = client->messages[request->index];
+    if (msg == NULL) {
+        msg = rm_request_new_message(request);
+        g_signal_connect(msg, "network-event", G_CALLBACK(rm_client_network_event), client);
+        g_signal_connect(msg, "got-headers", G_CALLBACK(rm_client_got_headers), client);
+        g_signal_connect(msg, "got-chunk", G_CALLBACK(rm_client_got_chunk), client);
+        g_signal_connect(msg, "wrote-body", G_CALLBACK(rm_client_wrote_body), client);
+
+        // Body chunks are then freed as soon as they have been counted, so
+        // large responses are never kept in memory, unless a pattern has to
+        // be matched against the whole body
+        if (client->scenario->discardResponseBody && ! request->keepBody) {
+            soup_message_body_set_accumulate(msg->response_body, FALSE);
+        }
+
+        // Generated bodies are streamed: each chunk is dropped once written,
+        // and the next one generated
+        if (request->generator != NULL) {
+            soup_message_body_set_accumulate(msg->request_body, FALSE);
+            g_signal_connect(msg, "wrote-chunk", G_CALLBACK(rm_client_wrote_chunk), client);
+            g_signal_connect(msg, "restarted", G_CALLBACK(rm_client_restarted), client);
         }
 
-        if (client->scoreboard->failed) break;
+        client->messages[request->index] = msg;
+    } else {
+        rm_request_reset_message(request, msg);
     }
 
-    if (cookieJar) g_object_unref(cookieJar);
+    // The preSend hook runs before the request is rendered, so that variables
+    // it sets are used by the request
+    if (client->script && ! rm_client_run_hook(client, RM_HOOK_PRE_SEND, request, msg, 0, NULL)) {
+        rm_client_done(client);
+        return;
+    }
+
+    // Render the parts of the request referencing variables. A URL which is
+    // not valid with the client's values fails the client.
+    if (rm_request_is_templated(request) &&
+        ! rm_request_render_message(request, msg, client->values, client->scratch, client->renderedBody)) {
+
+        g_printerr("ERROR: request URL '%s' is not valid\n", client->scratch->str);
+        client->failed = TRUE;
+        client->scoreboard->failed = TRUE;
+        rm_client_done(client);
+        return;
+    }
+
+    if (request->generator != NULL) {
+        rm_client_start_body(client, request, msg);
+    }
+
+    // Ask the server to close the connection if this is the last request on
+    // it. The session will then not reuse the connection.
+    if (! client->scenario->keepAlive ||
+        (client->scenario->maxRequestsPerConn > 0 &&
+         *client->connRequests + 1 >= client->scenario->maxRequestsPerConn)) {
+        soup_message_headers_replace(msg->request_headers, "Connection", "close");
+    }
+
+    // Start timer. Until a new connection is ready, or the request is sent on
+    // an existing connection, time spent in the session's queue counts as
+    // sending time.
+    g_timer_start(client->stopwatch);
+    rm_client_start_phase(client, RM_PHASE_SEND);
+
+    // Queue request, the session drops its own reference once it is done
+    g_object_ref(msg);
+    soup_session_queue_message(client->session, msg, rm_client_request_finished, client);
+}
+
+/// Send the current request in the client's open-loop send slot. The request
+/// is meant for the slot it was due in, which its corrected latency is
+/// measured from. If later slots have also passed while waiting for the
+/// previous response, they are skipped: each is counted as missed once, and
+/// no request is sent for it, so that a slow response is not followed by a
+/// burst of catch-up requests.
+static void rm_client_send_in_slot(rmClient *client)
+{
+    gdouble late;
+    guint   missed;
+
+    late = g_timer_elapsed(client->clock, NULL) - client->nextSend;
+
+    client->intended  = client->nextSend;
+    client->nextSend += client->interval;
+
+    if (late >= client->interval) {
+        missed = (guint) (late / client->interval);
+        client->scoreboard->missedSlots += missed;
+        client->nextSend += missed * client->interval;
+    }
+
+    rm_client_queue_request(client, client->current);
+}
+
+/// Timer callback sending a request once its send slot has arrived
+static gboolean rm_client_send_timer(rmClient *client)
+{
+    rm_client_wait_over(client);
+    rm_client_send_in_slot(client);
+    return FALSE;
+}
+
+/// Send a request. In closed-loop mode (the default) the request is sent right
+/// away. In open-loop mode, requests are sent on a fixed timeline regardless
+/// of response times: if the next send slot has not yet arrived, a timer is
+/// set on the running thread's main context to send the request on time.
+static void rm_client_send_request(rmClient *client, rmRequest *request)
+{
+    GSource *timer;
+    gdouble  wait;
+
+    if (client->interval <= 0) {
+        rm_client_queue_request(client, request);
+        return;
+    }
+
+    wait = client->nextSend - g_timer_elapsed(client->clock, NULL);
+    if (wait <= 0) {
+        rm_client_send_in_slot(client);
+        return;
+    }
+
+    // Round up to the next millisecond so that we never send early
+    timer = g_timeout_source_new((guint) (wait * 1000) + 1);
+    rm_client_wait(client, timer, (GSourceFunc) rm_client_send_timer);
+}
+
+/// Switch the client to open-loop mode, in which requests are sent on a fixed
+/// timeline, one every interval seconds, as measured by the provided clock.
+/// The first request is sent offset seconds after the clock is started, which
+/// is used to spread clients evenly over the interval.
+void rm_client_set_schedule(rmClient *client, GTimer *clock, gdouble interval, gdouble offset)
+{
+    g_assert(interval > 0);
+    g_assert(client->current == NULL); // client is idle
+
+    client->clock    = clock;
+    client->interval = interval;
+    client->nextSend = offset;
+}
+
+/// Start running the next scenario iteration using the provided session, or
+/// raw engine connection if session is NULL. Connections belong to the
+/// session, not the client, so the count of requests sent on the current
+/// connection is kept along with it by the caller. This returns immediately; the
+/// requests are sent as the main loop of the running thread's context runs,
+/// and the done callback is called once the iteration has been completed or
+/// failed.
+///
+/// Rows of data from the scenario's data feeders are assigned to the client's
+/// variables at the start of each iteration, or only at the start of the first
+/// one for client scoped feeders.
+///
+/// Script hooks are run by the provided interpreter, which is NULL if the
+/// scenario has no scripts. If a sample ring is provided, every response is
+/// also pushed into it.
+///
+/// If cookie persistence is enabled, the client's cookie jar is attached to
+/// the session for the duration of the iteration. Unless the client keeps
+/// cookies between iterations, a fresh cookie jar is used for each iteration.
+void rm_client_run_iteration(rmClient *client, SoupSession *session, rmRawConn *raw,
+                             guint *connRequests, rmScoreboard *scoreboard, rmSampleRing *samples,
+                             rmScriptState *script, rmClientDoneFunc done, gpointer user_data)
+{
+    rmScenario *scenario = client->scenario;
+    rmFeeder   *feeder;
+    GSList     *node;
+
+    g_assert(client->current == NULL); // client is idle
+    g_assert(client->iterations > 0);
+    g_assert((session == NULL) != (raw == NULL));
+
+    client->iterations--;
+    client->session      = session;
+    client->raw          = raw;
+    client->connRequests = connRequests;
+    client->scoreboard   = scoreboard;
+    client->samples      = samples;
+    client->script       = script;
+    client->current      = (scenario->requestCount > 0 ? scenario->requestTable : NULL);
+    client->sent         = 0;
+    client->doneFunc     = done;
+    client->doneData     = user_data;
+
+    for (node = scenario->feeders; node; node = node->next) {
+        feeder = (rmFeeder *) node->data;
+        if (feeder->scope == RM_FEEDER_PER_ITERATION || ! client->fed) {
+            rm_feeder_assign(feeder, client->id, client->clientCount, client->completed,
+                &client->seed, client->values);
+        }
+    }
+    client->fed = TRUE;
+
+    // Enable cookie persistence if needed (not supported by the raw engine)
+    if (scenario->persistCookies && client->session) {
+        if (client->cookieJar && ! client->keepCookies) {
+            g_object_unref(client->cookieJar);
+            client->cookieJar = NULL;
+        }
+
+        if (! client->cookieJar) {
+            client->cookieJar = soup_cookie_jar_new();
+        }
+
+        soup_session_add_feature(client->session, (SoupSessionFeature *) client->cookieJar);
+    }
+
+    if (client->script && ! rm_client_run_hook(client, RM_HOOK_PRE_ITERATION, NULL, NULL, 0, NULL)) {
+        rm_client_done(client);
+    } else if (client->current) {
+        rm_client_send_request(client, client->current);
+    } else {
+        rm_client_done(client);
+    }
+}
+
+/// Cancel the running iteration, if any. The request in flight is dropped
+/// without being recorded, and the iteration ends without running the
+/// postIteration hook or counting as completed. The done callback is called
+/// right away, or, for a request queued on a libsoup session, once the
+/// session has let go of it.
+void rm_client_cancel(rmClient *client)
+{
+    if (client->current == NULL || client->cancelled) return;
+
+    client->cancelled = TRUE;
+
+    if (client->waiting != NULL) {
+        // The request has not been sent yet
+        g_source_destroy(client->waiting);
+        rm_client_wait_over(client);
+        rm_client_done(client);
+
+    } else if (client->raw) {
+        rm_raw_conn_cancel(client->raw);
+        rm_client_done(client);
+
+    } else {
+        soup_session_cancel_message(client->session, client->messages[client->current->index],
+            SOUP_STATUS_CANCELLED);
+    }
 }
 
 // vim:ts=4:expandtab:cindent:sw=2
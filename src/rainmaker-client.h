@@ -13,16 +13,75 @@
 
 #include "rainmaker-scenario.h"
 #include "rainmaker-scoreboard.h"
+#include "rainmaker-raw.h"
+#include "rainmaker-script.h"
+#include "rainmaker-samplelog.h"
 
+struct _rmClient;
+
+/// Called when a client has walked through the entire scenario (or failed)
+typedef void (*rmClientDoneFunc)(struct _rmClient *client, gpointer user_data);
+
+/// A client is a single virtual user. It is a small state machine walking
+/// through the scenario's request list, sending one request at a time using
+/// an asynchronous session that is driven by a worker's main loop.
+///
+/// Each run through the scenario is an iteration. Iterations may run on
+/// different workers, so the session (or raw engine connection), the count of
+/// requests sent on its connection, scoreboard, sample ring and script
+/// interpreter are only set for the duration of an iteration. The cookie jar belongs to the client and is
+/// carried between iterations.
 typedef struct _rmClient {
-    SoupSession  *session;
-    rmScoreboard *scoreboard;
+    guint             id;
+    SoupSession      *session;     ///< session used by the running iteration
+    rmRawConn        *raw;         ///< raw engine connection used instead of a session
+    rmScoreboard     *scoreboard;  ///< scoreboard used by the running iteration
+    rmSampleRing     *samples;     ///< ring the running iteration's responses are logged to, or NULL
+    rmScriptState    *script;      ///< interpreter running script hooks for the running iteration
+    GTimer           *stopwatch;
+    SoupCookieJar    *cookieJar;
+    gboolean          keepCookies; ///< keep cookies between iterations
+    rmScenario       *scenario;
+    guint             iterations;  ///< iterations left to run
+    guint             completed;   ///< iterations completed
+    SoupMessage     **messages;    ///< reusable message per request, by request index
+    rmRequest        *current;     ///< request currently being sent, in the scenario's request table
+    guint             sent;        ///< times the current request was sent
+    gboolean          failed;
+    gboolean          cancelled;   ///< the running iteration is being cancelled
+    GSource          *waiting;     ///< source sending the current request later, if any
+    gdouble           connectStarted; ///< stopwatch time a connection started opening, negative if none
+    gdouble           connectTime;    ///< time it took to open a connection for the last request, negative if reused
+    guint            *connRequests;   ///< requests sent on the current connection, kept by the slot running the iteration
+    gdouble           firstByte;      ///< stopwatch time the first response byte arrived, negative if none
+    guint64           received;       ///< response body bytes received for the last request
+    gdouble           phaseStart[RM_PHASE_COUNT]; ///< stopwatch time each request phase started
+    gdouble           phases[RM_PHASE_COUNT];     ///< time spent in each request phase, negative if skipped
+    rmExpectState    *expectStates;   ///< state of each expectation on the current response
+    rmExtractState   *extractStates;  ///< state of each extraction rule on the current response
+    GString         **extracted;      ///< extracted value of each variable, by variable number
+    rmValue          *values;         ///< value of each scenario variable
+    GString          *scratch;        ///< buffer templated URLs and headers are rendered into
+    GString          *renderedBody;   ///< buffer templated request bodies are rendered into
+    rmGeneratorState  generated;      ///< state of the generated request body being sent
+    guint             clientCount;    ///< total number of clients in the run, for partitioned data feeders
+    guint32           seed;           ///< random data feeder state
+    gboolean          fed;            ///< data of client scoped feeders has been assigned
+    GTimer           *clock;       ///< open-loop mode: shared run clock
+    gdouble           interval;    ///< open-loop mode: time between sends, 0 in closed-loop mode
+    gdouble           nextSend;    ///< open-loop mode: clock time of the next send slot
+    gdouble           intended;    ///< open-loop mode: clock time the last request was meant to be sent
+    rmClientDoneFunc  doneFunc;
+    gpointer          doneData;
 } rmClient;
 
-rmClient*     rm_client_new();
-void          rm_client_set_logger(rmClient *client, SoupLogger *logger);
+rmClient*     rm_client_new(guint id, rmScenario *scenario, guint iterations, gboolean keepCookies);
+void          rm_client_set_schedule(rmClient *client, GTimer *clock, gdouble interval, gdouble offset);
 void          rm_client_free(rmClient *client);
-void          rm_client_run_scenario(rmClient *client, rmScenario *scenario);
+void          rm_client_run_iteration(rmClient *client, SoupSession *session, rmRawConn *raw,
+                                      guint *connRequests, rmScoreboard *scoreboard, rmSampleRing *samples,
+                                      rmScriptState *script, rmClientDoneFunc done, gpointer user_data);
+void          rm_client_cancel(rmClient *client);
 
 #define RAINMAKER_CLIENT_H_
 #endif
@@ -0,0 +1,864 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rainmaker-distributed.h"
+#include "rainmaker-scenario.h"
+#include "rainmaker-scenario-xml.h"
+#include "rainmaker-scenario-bin.h"
+#include "rainmaker-scheduler.h"
+#include "rainmaker-scoreboard.h"
+#include "rainmaker-wire.h"
+#include "rainmaker-raw.h"
+
+/// Version of the coordinator / agent protocol. Coordinator and agents must
+/// run the same version.
+#define PROTOCOL_VERSION 8
+
+/// Largest message accepted from the other side
+#define MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+
+/// Size of the random challenge agents send coordinators
+#define CHALLENGE_SIZE 32
+
+/// Size of the answer to a challenge, a SHA-256 digest
+#define ANSWER_SIZE 32
+
+/// Message types. Each message is sent as a 1 byte type and a 4 byte payload
+/// length in network byte order, followed by the payload.
+enum {
+    MSG_RUN = 1,    ///< coordinator: run options and scenario document
+    MSG_READY,      ///< agent: scenario loaded, waiting to start
+    MSG_START,      ///< coordinator: start running
+    MSG_SNAPSHOT,   ///< agent: running totals
+    MSG_RESULT,     ///< agent: complete scoreboard, sent when done
+    MSG_ERROR,      ///< agent: error message
+    MSG_CHALLENGE,  ///< agent: random challenge, sent first on each connection
+    MSG_AUTH        ///< coordinator: answer to the challenge
+};
+
+/// State shared between an agent and the thread running its scheduler
+typedef struct _agentRun {
+    rmScheduler   *scheduler;
+    volatile gint  done;
+    GError        *error;
+} agentRun;
+
+/// Send a message with an optional payload
+static gboolean send_message(GOutputStream *out, guint8 type, const GByteArray *payload, GError **error)
+{
+    guint8  header[5];
+    guint32 length;
+
+    length = GUINT32_TO_BE(payload ? payload->len : 0);
+    header[0] = type;
+    memcpy(header + 1, &length, sizeof(length));
+
+    if (! g_output_stream_write_all(out, header, sizeof(header), NULL, NULL, error))
+        return FALSE;
+
+    if (payload && payload->len > 0 &&
+        ! g_output_stream_write_all(out, payload->data, payload->len, NULL, NULL, error))
+        return FALSE;
+
+    return g_output_stream_flush(out, NULL, error);
+}
+
+/// Send an error message. Errors sending it are ignored, as the connection is
+/// dropped right after anyway.
+static void send_error(GOutputStream *out, const GError *error)
+{
+    GByteArray *payload;
+
+    payload = g_byte_array_new();
+    rm_wire_put_data(payload, error->message, strlen(error->message));
+    send_message(out, MSG_ERROR, payload, NULL);
+    g_byte_array_free(payload, TRUE);
+}
+
+/// Receive a message. Returns the payload, which may be empty, and sets the
+/// message type, or returns NULL on error.
+static GByteArray* receive_message(GInputStream *in, guint8 *type, GError **error)
+{
+    GByteArray *payload;
+    guint8      header[5];
+    guint32     length;
+    gsize       read;
+
+    if (! g_input_stream_read_all(in, header, sizeof(header), &read, NULL, error))
+        return NULL;
+
+    if (read < sizeof(header)) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "connection closed by peer");
+        return NULL;
+    }
+
+    memcpy(&length, header + 1, sizeof(length));
+    length = GUINT32_FROM_BE(length);
+    if (length > MAX_MESSAGE_SIZE) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "message too large (%u bytes)", length);
+        return NULL;
+    }
+
+    payload = g_byte_array_sized_new(length);
+    g_byte_array_set_size(payload, length);
+    if (! g_input_stream_read_all(in, payload->data, length, &read, NULL, error)) {
+        g_byte_array_free(payload, TRUE);
+        return NULL;
+    }
+
+    if (read < length) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "connection closed by peer");
+        g_byte_array_free(payload, TRUE);
+        return NULL;
+    }
+
+    *type = header[0];
+    return payload;
+}
+
+/// Receive a message, and fail unless it is of the expected type. Error
+/// messages sent by an agent are turned into errors.
+static GByteArray* expect_message(GInputStream *in, guint8 expected, GError **error)
+{
+    GByteArray   *payload;
+    rmWireReader  reader;
+    const guint8 *msg;
+    gsize         length;
+    guint8        type;
+
+    if ((payload = receive_message(in, &type, error)) == NULL)
+        return NULL;
+
+    if (type == expected)
+        return payload;
+
+    if (type == MSG_ERROR) {
+        rm_wire_reader_init(&reader, payload->data, payload->len);
+        msg = rm_wire_get_data(&reader, &length);
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+            "%.*s", (int) length, (msg ? (const gchar *) msg : "unknown error"));
+    } else {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "unexpected message type %u", type);
+    }
+
+    g_byte_array_free(payload, TRUE);
+    return NULL;
+}
+
+/// Work out the answer to an agent's challenge: a SHA-256 digest of the
+/// challenge followed by the shared secret, so that the secret itself is
+/// never sent, and an answer overheard can't be used again
+static void answer_challenge(const guint8 *challenge, gsize length, const gchar *secret, guint8 *answer)
+{
+    GChecksum *checksum;
+    gsize      size = ANSWER_SIZE;
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(checksum, challenge, length);
+    g_checksum_update(checksum, (const guchar *) secret, strlen(secret));
+    g_checksum_get_digest(checksum, answer, &size);
+    g_checksum_free(checksum);
+}
+
+/// Fill a buffer with random bytes from the system's random source
+static gboolean read_random(guint8 *buf, gsize length, GError **error)
+{
+    FILE  *random;
+    gsize  read = 0;
+
+    if ((random = fopen("/dev/urandom", "rb")) != NULL) {
+        read = fread(buf, 1, length, random);
+        fclose(random);
+    }
+
+    if (read < length) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AUTH,
+            "failed reading random data from /dev/urandom");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void write_run_options(GByteArray *buf, const rmRunOptions *options)
+{
+    rm_wire_put_uint(buf, PROTOCOL_VERSION);
+    rm_wire_put_uint(buf, options->clients);
+    rm_wire_put_uint(buf, options->firstClient);
+    rm_wire_put_uint(buf, options->totalClients);
+    rm_wire_put_uint(buf, options->threads);
+    rm_wire_put_uint(buf, options->repeat);
+    rm_wire_put_uint(buf, options->keepCookies);
+    rm_wire_put_double(buf, options->rate);
+    rm_wire_put_double(buf, options->duration);
+    rm_wire_put_double(buf, options->warmup);
+    rm_wire_put_uint(buf, options->rawEngine);
+    rm_wire_put_uint(buf, options->snapshotInterval);
+}
+
+static gboolean read_run_options(rmWireReader *reader, rmRunOptions *options, GError **error)
+{
+    guint64 version;
+
+    version = rm_wire_get_uint(reader);
+    if (version != PROTOCOL_VERSION) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "unsupported protocol version %" G_GUINT64_FORMAT ", expecting %u",
+            version, PROTOCOL_VERSION);
+        return FALSE;
+    }
+
+    options->clients          = (guint) rm_wire_get_uint(reader);
+    options->firstClient      = (guint) rm_wire_get_uint(reader);
+    options->totalClients     = (guint) rm_wire_get_uint(reader);
+    options->threads          = (guint) rm_wire_get_uint(reader);
+    options->repeat           = (guint) rm_wire_get_uint(reader);
+    options->keepCookies      = (rm_wire_get_uint(reader) != 0);
+    options->rate             = rm_wire_get_double(reader);
+    options->duration         = rm_wire_get_double(reader);
+    options->warmup           = rm_wire_get_double(reader);
+    options->rawEngine        = (rm_wire_get_uint(reader) != 0);
+    options->snapshotInterval = (guint) rm_wire_get_uint(reader);
+
+    if (reader->failed || options->clients == 0 ||
+        options->firstClient + options->clients > options->totalClients ||
+        ! (options->duration >= 0) || ! (options->warmup >= 0)) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "malformed run options");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// Read the scoreboard carried by a snapshot or result message
+static rmScoreboard* read_scoreboard(const GByteArray *payload, GError **error)
+{
+    rmWireReader  reader;
+    rmScoreboard *sb;
+
+    rm_wire_reader_init(&reader, payload->data, payload->len);
+    sb = rm_scoreboard_deserialize(&reader);
+    if (sb == NULL) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "malformed scoreboard");
+    }
+
+    return sb;
+}
+
+static rmAgentLink* agent_link_new(rmCoordinator *coord, const gchar *address)
+{
+    rmAgentLink *link;
+
+    link = g_malloc0(sizeof(rmAgentLink));
+    link->coordinator = coord;
+    link->address     = g_strdup(address);
+
+    return link;
+}
+
+static void agent_link_free(rmAgentLink *link)
+{
+    if (link->conn) g_object_unref(link->conn);
+    if (link->latest) rm_scoreboard_free(link->latest);
+    if (link->result) rm_scoreboard_free(link->result);
+    if (link->error) g_error_free(link->error);
+    g_free(link->address);
+    g_free(link);
+}
+
+/// Thread reading messages from an agent while the test is running, until
+/// the agent sends its result
+static gpointer agent_link_thread(rmAgentLink *link)
+{
+    GInputStream *in;
+    GByteArray   *payload;
+    rmScoreboard *sb;
+    guint8        type;
+
+    in = g_io_stream_get_input_stream(G_IO_STREAM(link->conn));
+
+    while ((payload = receive_message(in, &type, &link->error)) != NULL) {
+        if (type == MSG_SNAPSHOT) {
+            sb = read_scoreboard(payload, &link->error);
+            g_byte_array_free(payload, TRUE);
+            if (sb == NULL) break;
+
+            g_mutex_lock(link->coordinator->lock);
+            if (link->latest) rm_scoreboard_free(link->latest);
+            link->latest = sb;
+            g_mutex_unlock(link->coordinator->lock);
+
+        } else if (type == MSG_RESULT) {
+            sb = read_scoreboard(payload, &link->error);
+            g_byte_array_free(payload, TRUE);
+            if (sb == NULL) break;
+
+            if (sb->requestCount != link->coordinator->scenario->requestCount) {
+                g_set_error(&link->error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+                    "result has %u requests, expecting %u", sb->requestCount,
+                    link->coordinator->scenario->requestCount);
+                rm_scoreboard_free(sb);
+                break;
+            }
+
+            g_mutex_lock(link->coordinator->lock);
+            link->result = sb;
+            g_mutex_unlock(link->coordinator->lock);
+            break;
+
+        } else {
+            g_set_error(&link->error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+                "unexpected message type %u", type);
+            g_byte_array_free(payload, TRUE);
+            break;
+        }
+    }
+
+    g_io_stream_close(G_IO_STREAM(link->conn), NULL, NULL);
+
+    return NULL;
+}
+
+/// Set an error about a specific agent, and fail
+static gboolean agent_link_error(rmAgentLink *link, GError *cause, GError **error)
+{
+    g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+        "agent %s: %s", link->address, cause->message);
+    g_error_free(cause);
+
+    return FALSE;
+}
+
+/// Create a new coordinator for a comma separated list of agent addresses.
+/// Each address is a host name or IP address, optionally followed by a port.
+rmCoordinator* rm_coordinator_new(rmScenario *scenario, const gchar *agents, const gchar *secret,
+    GError **error)
+{
+    rmCoordinator  *coord;
+    gchar         **items;
+    guint           i, count;
+
+    items = g_strsplit(agents, ",", -1);
+    for (count = 0; items[count] != NULL; count++) {
+        g_strstrip(items[count]);
+        if (*items[count] == '\0') {
+            g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+                "empty agent address in list '%s'", agents);
+            g_strfreev(items);
+            return NULL;
+        }
+    }
+
+    coord = g_malloc0(sizeof(rmCoordinator));
+    coord->scenario   = scenario;
+    coord->secret     = g_strdup(secret);
+    coord->agentCount = count;
+    coord->agents     = g_malloc(sizeof(rmAgentLink *) * count);
+    coord->lock       = g_mutex_new();
+    coord->timer      = g_timer_new();
+
+    for (i = 0; i < count; i++) {
+        coord->agents[i] = agent_link_new(coord, items[i]);
+    }
+
+    g_strfreev(items);
+
+    return coord;
+}
+
+/// Answer the challenge an agent sends once connected, to prove the
+/// coordinator knows the shared secret
+static gboolean agent_link_authenticate(rmAgentLink *link, GError **error)
+{
+    GByteArray    *payload;
+    rmWireReader   reader;
+    const guint8  *challenge;
+    guint8         answer[ANSWER_SIZE];
+    gsize          length;
+    gboolean       res;
+
+    payload = expect_message(g_io_stream_get_input_stream(G_IO_STREAM(link->conn)), MSG_CHALLENGE, error);
+    if (payload == NULL) return FALSE;
+
+    rm_wire_reader_init(&reader, payload->data, payload->len);
+    challenge = rm_wire_get_data(&reader, &length);
+    if (challenge == NULL || length != CHALLENGE_SIZE) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+            "malformed challenge");
+        g_byte_array_free(payload, TRUE);
+        return FALSE;
+    }
+
+    answer_challenge(challenge, length, link->coordinator->secret, answer);
+    g_byte_array_free(payload, TRUE);
+
+    payload = g_byte_array_new();
+    rm_wire_put_data(payload, answer, sizeof(answer));
+    res = send_message(g_io_stream_get_output_stream(G_IO_STREAM(link->conn)), MSG_AUTH, payload, error);
+    g_byte_array_free(payload, TRUE);
+
+    return res;
+}
+
+/// Connect to all agents and send each one the scenario document and its
+/// share of the clients, then wait for all agents to be ready
+gboolean rm_coordinator_connect(rmCoordinator *coord, const gchar *document, gsize length,
+    const rmRunOptions *options, GError **error)
+{
+    GSocketClient *client;
+    GByteArray    *payload;
+    rmAgentLink   *link;
+    GError        *cause = NULL;
+    guint          i, first = 0;
+
+    if (options->totalClients < coord->agentCount) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+            "at least one client per agent is required, got %u clients for %u agents",
+            options->totalClients, coord->agentCount);
+        return FALSE;
+    }
+
+    client = g_socket_client_new();
+
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        link->options = *options;
+        link->options.firstClient = first;
+        link->options.clients     = options->totalClients / coord->agentCount +
+                                    (i < options->totalClients % coord->agentCount ? 1 : 0);
+        first += link->options.clients;
+
+        link->conn = g_socket_client_connect_to_host(client, link->address, RM_DEFAULT_AGENT_PORT, NULL, &cause);
+        if (link->conn == NULL || ! agent_link_authenticate(link, &cause)) {
+            g_object_unref(client);
+            return agent_link_error(link, cause, error);
+        }
+
+        payload = g_byte_array_new();
+        write_run_options(payload, &link->options);
+        rm_wire_put_data(payload, document, length);
+
+        if (! send_message(g_io_stream_get_output_stream(G_IO_STREAM(link->conn)), MSG_RUN, payload, &cause)) {
+            g_byte_array_free(payload, TRUE);
+            g_object_unref(client);
+            return agent_link_error(link, cause, error);
+        }
+
+        g_byte_array_free(payload, TRUE);
+    }
+
+    g_object_unref(client);
+
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        payload = expect_message(g_io_stream_get_input_stream(G_IO_STREAM(link->conn)), MSG_READY, &cause);
+        if (payload == NULL) {
+            return agent_link_error(link, cause, error);
+        }
+        g_byte_array_free(payload, TRUE);
+    }
+
+    return TRUE;
+}
+
+/// Tell all agents to start, and wait for all of them to send their results.
+/// If any agent fails, the results of the other agents are still collected.
+gboolean rm_coordinator_run(rmCoordinator *coord, GError **error)
+{
+    rmAgentLink *link;
+    guint        i;
+    gboolean     res = TRUE;
+
+    // Agents are all waiting on the barrier, so send start messages first
+    // and only then start the reader threads
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        send_message(g_io_stream_get_output_stream(G_IO_STREAM(link->conn)), MSG_START, NULL, &link->error);
+    }
+    g_timer_start(coord->timer);
+
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        if (link->error) continue;
+
+        link->thread = g_thread_create((GThreadFunc) agent_link_thread, (gpointer) link, TRUE, &link->error);
+    }
+
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        if (link->thread) {
+            g_thread_join(link->thread);
+            link->thread = NULL;
+        }
+
+        if (link->error && res) {
+            g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+                "agent %s: %s", link->address, link->error->message);
+            res = FALSE;
+        }
+    }
+
+    g_timer_stop(coord->timer);
+
+    return res;
+}
+
+/// Add the running totals last reported by all agents into a scoreboard. Can
+/// be called from any thread while the coordinator is running.
+void rm_coordinator_snapshot(rmScoreboard *target, rmCoordinator *coord)
+{
+    rmAgentLink *link;
+    guint        i;
+
+    g_mutex_lock(coord->lock);
+    for (i = 0; i < coord->agentCount; i++) {
+        link = coord->agents[i];
+        if (link->result) {
+            rm_scoreboard_snapshot(target, link->result);
+        } else if (link->latest) {
+            rm_scoreboard_snapshot(target, link->latest);
+        }
+    }
+    g_mutex_unlock(coord->lock);
+}
+
+/// Merge the results of all agents into a total scoreboard. Agents which
+/// failed to send a result mark the total as failed.
+void rm_coordinator_merge_scoreboards(rmCoordinator *coord, rmScoreboard *total)
+{
+    guint i;
+
+    for (i = 0; i < coord->agentCount; i++) {
+        if (coord->agents[i]->result) {
+            rm_scoreboard_merge(total, coord->agents[i]->result);
+        } else {
+            total->failed = TRUE;
+        }
+    }
+}
+
+void rm_coordinator_free(rmCoordinator *coord)
+{
+    guint i;
+
+    for (i = 0; i < coord->agentCount; i++) {
+        agent_link_free(coord->agents[i]);
+    }
+    g_free(coord->agents);
+
+    g_mutex_free(coord->lock);
+    g_timer_destroy(coord->timer);
+    g_free(coord->secret);
+    g_free(coord);
+}
+
+static gpointer agent_run_thread(agentRun *run)
+{
+    rm_scheduler_run(run->scheduler, &run->error);
+    g_atomic_int_set(&run->done, 1);
+
+    return NULL;
+}
+
+/// Send a snapshot of the running totals of the scheduler
+static gboolean agent_send_snapshot(GOutputStream *out, rmScheduler *sched, GError **error)
+{
+    rmScoreboard *snapshot;
+    GByteArray   *payload;
+    gboolean      res;
+
+    snapshot = rm_scoreboard_new(0);
+    rm_scheduler_snapshot(snapshot, sched);
+
+    payload = g_byte_array_new();
+    rm_scoreboard_serialize(snapshot, payload);
+    res = send_message(out, MSG_SNAPSHOT, payload, error);
+
+    g_byte_array_free(payload, TRUE);
+    rm_scoreboard_free(snapshot);
+
+    return res;
+}
+
+/// Run the scheduler until all iterations are done. Snapshots are sent to the
+/// coordinator every snapshot interval while running, and the complete
+/// scoreboard is sent when done.
+static gboolean agent_run(GOutputStream *out, rmScheduler *sched, guint snapshotInterval, GError **error)
+{
+    agentRun      run;
+    GThread      *thread;
+    rmScoreboard *total;
+    GByteArray   *payload;
+    GError       *sendError = NULL;
+    gulong        waited;
+
+    run.scheduler = sched;
+    run.done      = 0;
+    run.error     = NULL;
+
+    thread = g_thread_create((GThreadFunc) agent_run_thread, (gpointer) &run, TRUE, error);
+    if (thread == NULL) return FALSE;
+
+    // Once sending fails, keep running to completion without sending
+    while (! g_atomic_int_get(&run.done)) {
+        for (waited = 0; waited < snapshotInterval && ! g_atomic_int_get(&run.done); waited += 10) {
+            g_usleep(10 * 1000);
+        }
+
+        if (snapshotInterval > 0 && sendError == NULL && ! g_atomic_int_get(&run.done)) {
+            agent_send_snapshot(out, sched, &sendError);
+        }
+    }
+
+    g_thread_join(thread);
+
+    total = rm_scoreboard_new(sched->scenario->requestCount);
+    rm_scheduler_merge_scoreboards(sched, total);
+    if (run.error) {
+        g_printerr("ERROR: %s\n", run.error->message);
+        g_error_free(run.error);
+        total->failed = TRUE;
+    }
+
+    if (sendError == NULL) {
+        payload = g_byte_array_new();
+        rm_scoreboard_serialize(total, payload);
+        send_message(out, MSG_RESULT, payload, &sendError);
+        g_byte_array_free(payload, TRUE);
+    }
+
+    rm_scoreboard_free(total);
+
+    if (sendError != NULL) {
+        g_propagate_error(error, sendError);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// Challenge a coordinator to prove it knows the shared secret, before
+/// accepting anything else from it. The coordinator only has a few seconds to
+/// answer, so that a peer which never does can't keep the agent busy.
+static gboolean agent_authenticate(GSocketConnection *conn, const gchar *secret, GError **error)
+{
+    GSocket       *socket;
+    GByteArray    *payload;
+    rmWireReader   reader;
+    const guint8  *answer;
+    guint8         challenge[CHALLENGE_SIZE], expected[ANSWER_SIZE], diff = 0;
+    gsize          length, i;
+    gboolean       res;
+
+    if (! read_random(challenge, sizeof(challenge), error)) return FALSE;
+
+    socket = g_socket_connection_get_socket(conn);
+    g_socket_set_timeout(socket, RM_AGENT_AUTH_TIMEOUT);
+
+    payload = g_byte_array_new();
+    rm_wire_put_data(payload, challenge, sizeof(challenge));
+    res = send_message(g_io_stream_get_output_stream(G_IO_STREAM(conn)), MSG_CHALLENGE, payload, error);
+    g_byte_array_free(payload, TRUE);
+
+    if (! res ||
+        (payload = expect_message(g_io_stream_get_input_stream(G_IO_STREAM(conn)), MSG_AUTH, error)) == NULL) {
+        return FALSE;
+    }
+
+    // Compare all bytes whatever the first difference, so that the time it
+    // takes tells nothing about the expected answer
+    answer_challenge(challenge, sizeof(challenge), secret, expected);
+    rm_wire_reader_init(&reader, payload->data, payload->len);
+    answer = rm_wire_get_data(&reader, &length);
+    res = (answer != NULL && length == sizeof(expected));
+    for (i = 0; res && i < length; i++) {
+        diff |= answer[i] ^ expected[i];
+    }
+    res = (res && diff == 0);
+    g_byte_array_free(payload, TRUE);
+
+    if (! res) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AUTH,
+            "coordinator failed to authenticate, check that both use the same secret");
+        return FALSE;
+    }
+
+    g_socket_set_timeout(socket, 0);
+
+    return TRUE;
+}
+
+/// Serve a single test run for a connected coordinator, once it has proven it
+/// knows the shared secret
+static gboolean agent_serve_connection(GSocketConnection *conn, const gchar *secret, GError **error)
+{
+    GInputStream  *in;
+    GOutputStream *out;
+    GByteArray    *payload;
+    rmWireReader   reader;
+    rmRunOptions   options;
+    const guint8  *document;
+    gsize          length;
+    rmScenario    *sc = NULL;
+    rmRawEngine   *raw = NULL;
+    rmScheduler   *sched;
+    guint          threads;
+    gboolean       res;
+
+    in  = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+    out = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+
+    if (! agent_authenticate(conn, secret, error)) {
+        if ((*error)->domain == RM_ERROR_DIST && (*error)->code == RM_ERROR_DIST_AUTH) {
+            send_error(out, *error);
+        }
+        return FALSE;
+    }
+
+    if ((payload = expect_message(in, MSG_RUN, error)) == NULL)
+        return FALSE;
+
+    rm_wire_reader_init(&reader, payload->data, payload->len);
+    if (read_run_options(&reader, &options, error)) {
+        document = rm_wire_get_data(&reader, &length);
+        if (document == NULL) {
+            g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_PROTOCOL,
+                "malformed scenario document");
+        } else if (rm_scenario_bin_detect((const gchar *) document, length)) {
+            sc = rm_scenario_bin_read_buffer((const gchar *) document, length, error);
+        } else {
+            sc = rm_scenario_xml_read_buffer((const gchar *) document, length, error);
+        }
+    }
+    g_byte_array_free(payload, TRUE);
+
+    // Coordinators merge results as if all agents ran their clients the same
+    // way from start to end, which load profiles don't
+    if (sc != NULL && sc->profile != NULL) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+            "scenarios with a load profile are not supported in coordinator mode");
+        rm_scenario_free(sc);
+        sc = NULL;
+    }
+
+    if (sc != NULL && options.rawEngine) {
+        raw = rm_raw_engine_new(sc, error);
+        if (raw == NULL) {
+            rm_scenario_free(sc);
+            sc = NULL;
+        }
+    }
+
+    if (sc == NULL) {
+        send_error(out, *error);
+        return FALSE;
+    }
+
+    // Default to one worker thread per CPU, but never more than clients
+    threads = options.threads;
+    if (threads == 0) {
+        threads = (guint) MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    }
+    threads = MIN(threads, options.clients);
+
+    sched = rm_scheduler_new(sc, threads, options.clients, raw, NULL);
+    rm_scheduler_create_clients(sched, options.firstClient, options.clients, options.totalClients,
+        options.repeat, options.keepCookies, options.rate);
+    rm_scheduler_set_duration(sched, options.duration, options.warmup);
+
+    printf("Running %u clients (%u - %u of %u) on %u threads\n", options.clients,
+        options.firstClient, options.firstClient + options.clients - 1, options.totalClients, threads);
+    fflush(stdout);
+
+    // Wait on the barrier until all agents are ready
+    res = send_message(out, MSG_READY, NULL, error);
+    if (res && (payload = expect_message(in, MSG_START, error)) != NULL) {
+        g_byte_array_free(payload, TRUE);
+        res = agent_run(out, sched, options.snapshotInterval, error);
+    } else {
+        res = FALSE;
+    }
+
+    rm_scheduler_free(sched);
+    if (raw) rm_raw_engine_free(raw);
+    rm_scenario_free(sc);
+
+    return res;
+}
+
+/// Run as an agent: listen for coordinators on an IP address and port, and
+/// serve test runs one at a time for coordinators knowing the shared secret.
+/// Only returns if listening fails; errors in a test run are printed out, and
+/// the agent goes on to wait for the next coordinator.
+gboolean rm_agent_serve(const gchar *address, guint port, const gchar *secret, GError **error)
+{
+    GSocketListener   *listener;
+    GSocketConnection *conn;
+    GInetAddress      *inetAddress;
+    GSocketAddress    *socketAddress;
+    GError            *err = NULL;
+    gboolean           res;
+
+    if ((inetAddress = g_inet_address_new_from_string(address)) == NULL) {
+        g_set_error(error, RM_ERROR_DIST, RM_ERROR_DIST_AGENT,
+            "invalid agent address '%s', expecting an IP address", address);
+        return FALSE;
+    }
+
+    listener      = g_socket_listener_new();
+    socketAddress = g_inet_socket_address_new(inetAddress, (guint16) port);
+    res = g_socket_listener_add_address(listener, socketAddress, G_SOCKET_TYPE_STREAM,
+        G_SOCKET_PROTOCOL_TCP, NULL, NULL, error);
+    g_object_unref(socketAddress);
+    g_object_unref(inetAddress);
+
+    if (! res) {
+        g_object_unref(listener);
+        return FALSE;
+    }
+
+    printf("Agent listening on %s port %u\n", address, port);
+    fflush(stdout);
+
+    while (TRUE) {
+        conn = g_socket_listener_accept(listener, NULL, NULL, &err);
+        if (conn == NULL) {
+            g_printerr("ERROR: failed accepting connection: %s\n", err->message);
+            g_clear_error(&err);
+            continue;
+        }
+
+        if (agent_serve_connection(conn, secret, &err)) {
+            printf("done.\n");
+        } else {
+            g_printerr("ERROR: %s\n", err->message);
+            g_clear_error(&err);
+        }
+        fflush(stdout);
+
+        g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+        g_object_unref(conn);
+    }
+
+    g_object_unref(listener);
+    return TRUE;
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
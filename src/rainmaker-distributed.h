@@ -0,0 +1,105 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_DISTRIBUTED_H_
+#define RAINMAKER_DISTRIBUTED_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "rainmaker-scenario.h"
+#include "rainmaker-scoreboard.h"
+
+#define RM_ERROR_DIST g_quark_from_static_string("rainmaker-distributed-error")
+
+enum {
+    RM_ERROR_DIST_PROTOCOL,
+    RM_ERROR_DIST_AGENT,
+    RM_ERROR_DIST_AUTH      ///< coordinator does not know the agent's secret
+};
+
+#ifndef RM_DEFAULT_AGENT_PORT
+#define RM_DEFAULT_AGENT_PORT 7100
+#endif
+
+/// Address agents listen on by default: loopback only, as agents run any
+/// scenario they are sent
+#ifndef RM_DEFAULT_AGENT_ADDRESS
+#define RM_DEFAULT_AGENT_ADDRESS "127.0.0.1"
+#endif
+
+/// Seconds a coordinator has to authenticate once connected to an agent
+#ifndef RM_AGENT_AUTH_TIMEOUT
+#define RM_AGENT_AUTH_TIMEOUT 10
+#endif
+
+/// Milliseconds between scoreboard snapshots sent by agents while running
+#ifndef RM_AGENT_SNAPSHOT_INTERVAL
+#define RM_AGENT_SNAPSHOT_INTERVAL 1000
+#endif
+
+/// Options of a test run on a single agent
+typedef struct _rmRunOptions {
+    guint     clients;        ///< number of clients to run on the agent
+    guint     firstClient;    ///< number of the agent's first client
+    guint     totalClients;   ///< number of clients on all agents
+    guint     threads;        ///< worker threads, 0 for the agent's default
+    guint     repeat;
+    gboolean  keepCookies;
+    gdouble   rate;           ///< open-loop mode: total rate of all agents
+    gdouble   duration;       ///< time to run for, or 0 to run all iterations
+    gdouble   warmup;         ///< time responses are left out of the results for, or 0
+    gboolean  rawEngine;
+    guint     snapshotInterval;
+} rmRunOptions;
+
+struct _rmCoordinator;
+
+/// The coordinator's side of a connection to an agent
+typedef struct _rmAgentLink {
+    struct _rmCoordinator *coordinator;
+    gchar                 *address;
+    GSocketConnection     *conn;
+    GThread               *thread;
+    rmRunOptions           options;
+    rmScoreboard          *latest;   ///< last snapshot received, guarded by the coordinator lock
+    rmScoreboard          *result;   ///< final scoreboard, set once the agent is done
+    GError                *error;
+} rmAgentLink;
+
+/// The coordinator runs a scenario over several agent processes, which may be
+/// on different machines. Each agent gets the scenario document and its share
+/// of the clients, and reports back when it is ready to start. Once all
+/// agents are ready, they are all told to start at once. While running,
+/// agents send compact snapshots of their running totals, and when done they
+/// send their complete scoreboard, which is merged into the total. Agents
+/// only accept a scenario from a coordinator which proves it knows the
+/// secret shared by both.
+typedef struct _rmCoordinator {
+    rmScenario    *scenario;
+    gchar         *secret;
+    rmAgentLink  **agents;
+    guint          agentCount;
+    GMutex        *lock;
+    GTimer        *timer;     ///< started when the agents are told to start
+} rmCoordinator;
+
+rmCoordinator* rm_coordinator_new(rmScenario *scenario, const gchar *agents, const gchar *secret,
+                                  GError **error);
+gboolean       rm_coordinator_connect(rmCoordinator *coord, const gchar *document, gsize length,
+                                      const rmRunOptions *options, GError **error);
+gboolean       rm_coordinator_run(rmCoordinator *coord, GError **error);
+void           rm_coordinator_snapshot(rmScoreboard *target, rmCoordinator *coord);
+void           rm_coordinator_merge_scoreboards(rmCoordinator *coord, rmScoreboard *total);
+void           rm_coordinator_free(rmCoordinator *coord);
+
+gboolean       rm_agent_serve(const gchar *address, guint port, const gchar *secret, GError **error);
+
+#endif // RAINMAKER_DISTRIBUTED_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,300 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-expect.h"
+
+/// Compile a pattern. Responses are matched as raw bytes, as they are not
+/// necessarily valid UTF-8.
+static GRegex* compile_pattern(const gchar *pattern, GError **error)
+{
+    GRegex *regex;
+    GError *err = NULL;
+
+    regex = g_regex_new(pattern, G_REGEX_OPTIMIZE | G_REGEX_RAW, 0, &err);
+    if (regex == NULL) {
+        g_set_error(error, RM_ERROR_EXPECT, RM_ERROR_EXPECT_INVALID_PATTERN,
+            "invalid pattern '%s': %s", pattern, err->message);
+        g_error_free(err);
+    }
+
+    return regex;
+}
+
+/// Set up the Horspool skip table for the expectation's value: for each byte,
+/// how far the search window can be moved if it is the last byte in the
+/// window and the window does not match
+static void compile_skip_table(rmExpectation *exp)
+{
+    gsize i;
+
+    for (i = 0; i < 256; i++) {
+        exp->skip[i] = exp->valueLength;
+    }
+
+    for (i = 0; i + 1 < exp->valueLength; i++) {
+        exp->skip[(guint8) exp->value[i]] = exp->valueLength - 1 - i;
+    }
+}
+
+/// Look for the expectation's value in a buffer, using Horspool's algorithm
+static gboolean search(const rmExpectation *exp, const guint8 *data, gsize length)
+{
+    const guint8 *needle = (const guint8 *) exp->value;
+    gsize         m = exp->valueLength, pos = 0;
+    guint8        last;
+
+    if (length < m) return FALSE;
+
+    last = needle[m - 1];
+    while (pos <= length - m) {
+        if (data[pos + m - 1] == last && memcmp(data + pos, needle, m - 1) == 0) {
+            return TRUE;
+        }
+        pos += exp->skip[data[pos + m - 1]];
+    }
+
+    return FALSE;
+}
+
+static rmExpectation* expectation_new(rmExpectType type)
+{
+    rmExpectation *exp;
+
+    exp = g_malloc0(sizeof(rmExpectation));
+    exp->type = type;
+
+    return exp;
+}
+
+/// Create a new status code expectation. The spec is a status code (200), a
+/// class of status codes (2xx, 20x) or a range of status codes (200-204).
+rmExpectation* rm_expectation_new_status(const gchar *spec, GError **error)
+{
+    rmExpectation *exp;
+    gchar          min[4], max[4], *end;
+    guint64        upper;
+    guint          i;
+    gboolean       wildcard = FALSE, valid = TRUE;
+
+    for (i = 0; i < 3 && valid; i++) {
+        if (spec[i] == 'x' || spec[i] == 'X') {
+            wildcard = (i > 0);
+            min[i] = '0';
+            max[i] = '9';
+            valid  = wildcard;
+        } else if (g_ascii_isdigit(spec[i]) && ! wildcard) {
+            min[i] = max[i] = spec[i];
+        } else {
+            valid = FALSE;
+        }
+    }
+    min[3] = max[3] = '\0';
+
+    exp = expectation_new(RM_EXPECT_STATUS);
+    if (valid) {
+        exp->statusMin = (guint) g_ascii_strtoull(min, NULL, 10);
+        exp->statusMax = (guint) g_ascii_strtoull(max, NULL, 10);
+
+        if (spec[3] == '-' && ! wildcard) {
+            upper = g_ascii_strtoull(spec + 4, &end, 10);
+            valid = (end != spec + 4 && *end == '\0' && upper >= exp->statusMin && upper <= 599);
+            exp->statusMax = (guint) upper;
+        } else {
+            valid = (spec[3] == '\0');
+        }
+    }
+
+    if (! valid || exp->statusMin < 100 || exp->statusMax > 599) {
+        g_set_error(error, RM_ERROR_EXPECT, RM_ERROR_EXPECT_INVALID_STATUS,
+            "invalid expected status '%s', expecting a code (200), class (2xx) or range (200-204)", spec);
+        rm_expectation_free(exp);
+        return NULL;
+    }
+
+    exp->label = g_strdup_printf("status %s", spec);
+
+    return exp;
+}
+
+/// Create a new response header expectation. With no value or pattern, the
+/// header is only expected to be present.
+rmExpectation* rm_expectation_new_header(const gchar *name, const gchar *equals, const gchar *matches,
+    GError **error)
+{
+    rmExpectation *exp;
+
+    if (equals != NULL && matches != NULL) {
+        g_set_error(error, RM_ERROR_EXPECT, RM_ERROR_EXPECT_INVALID,
+            "header expectation for '%s' can either expect a value or a pattern, not both", name);
+        return NULL;
+    }
+
+    exp = expectation_new(RM_EXPECT_HEADER);
+    exp->header = g_strdup(name);
+
+    if (equals != NULL) {
+        exp->value       = g_strdup(equals);
+        exp->valueLength = strlen(equals);
+        exp->label       = g_strdup_printf("header %s = %s", name, equals);
+
+    } else if (matches != NULL) {
+        if ((exp->regex = compile_pattern(matches, error)) == NULL) {
+            rm_expectation_free(exp);
+            return NULL;
+        }
+        exp->label = g_strdup_printf("header %s ~ /%s/", name, matches);
+
+    } else {
+        exp->label = g_strdup_printf("header %s", name);
+    }
+
+    return exp;
+}
+
+/// Create a new response body expectation. A body expected to contain a
+/// string is searched as it streams in; a body expected to match a pattern
+/// has to be kept in memory until the response is complete.
+rmExpectation* rm_expectation_new_body(const gchar *contains, const gchar *matches, GError **error)
+{
+    rmExpectation *exp;
+
+    if ((contains == NULL) == (matches == NULL)) {
+        g_set_error(error, RM_ERROR_EXPECT, RM_ERROR_EXPECT_INVALID,
+            "body expectation must either expect a string or a pattern");
+        return NULL;
+    }
+
+    if (contains != NULL) {
+        exp = expectation_new(RM_EXPECT_BODY_CONTAINS);
+        exp->value       = g_strdup(contains);
+        exp->valueLength = strlen(contains);
+        exp->label       = g_strdup_printf("body contains \"%s\"", contains);
+        compile_skip_table(exp);
+
+    } else {
+        exp = expectation_new(RM_EXPECT_BODY_MATCHES);
+        if ((exp->regex = compile_pattern(matches, error)) == NULL) {
+            rm_expectation_free(exp);
+            return NULL;
+        }
+        exp->label = g_strdup_printf("body ~ /%s/", matches);
+    }
+
+    return exp;
+}
+
+void rm_expectation_free(rmExpectation *exp)
+{
+    if (exp->regex) g_regex_unref(exp->regex);
+    g_free(exp->label);
+    g_free(exp->header);
+    g_free(exp->value);
+    g_free(exp);
+}
+
+/// Reset the state of an expectation before a new response is received. The
+/// carry buffer is kept for reuse.
+void rm_expect_state_reset(rmExpectState *state)
+{
+    state->found       = FALSE;
+    state->carryLength = 0;
+}
+
+/// Free memory held by an expectation state
+void rm_expect_state_clear(rmExpectState *state)
+{
+    g_free(state->carry);
+    state->carry       = NULL;
+    state->carryLength = 0;
+    state->carrySize   = 0;
+}
+
+/// Feed a chunk of response body to a body string expectation. The chunk is
+/// searched for the string, along with the end of the previous chunk, in case
+/// the string was split between chunks. Nothing is searched once the string
+/// has been found.
+void rm_expectation_feed(const rmExpectation *exp, rmExpectState *state, const guint8 *data, gsize length)
+{
+    gsize m = exp->valueLength, take, keep;
+
+    if (exp->type != RM_EXPECT_BODY_CONTAINS || state->found || m == 0) return;
+
+    // The carry buffer holds up to m - 1 bytes of the previous chunks, plus
+    // up to m - 1 bytes of the new chunk to look for a match across them
+    if (state->carrySize < 2 * m) {
+        state->carry     = g_realloc(state->carry, 2 * m);
+        state->carrySize = 2 * m;
+    }
+
+    take = MIN(length, m - 1);
+    if (state->carryLength > 0) {
+        memcpy(state->carry + state->carryLength, data, take);
+        if (search(exp, state->carry, state->carryLength + take)) {
+            state->found = TRUE;
+            return;
+        }
+    }
+
+    if (search(exp, data, length)) {
+        state->found = TRUE;
+        return;
+    }
+
+    // Keep the last m - 1 bytes seen
+    if (length >= m - 1) {
+        memcpy(state->carry, data + length - (m - 1), m - 1);
+        state->carryLength = m - 1;
+    } else {
+        if (state->carryLength == 0) memcpy(state->carry, data, take);
+        keep = MIN(state->carryLength + take, m - 1);
+        memmove(state->carry, state->carry + (state->carryLength + take - keep), keep);
+        state->carryLength = keep;
+    }
+}
+
+/// Check whether a response meets an expectation. Headers and body may be
+/// NULL if they are not available (the raw engine does not keep them), in
+/// which case expectations on them fail.
+gboolean rm_expectation_check(const rmExpectation *exp, const rmExpectState *state, guint status,
+    SoupMessageHeaders *headers, SoupMessageBody *body)
+{
+    const gchar *value;
+    SoupBuffer  *flat;
+    gboolean     res;
+
+    switch (exp->type) {
+        case RM_EXPECT_STATUS:
+            return (status >= exp->statusMin && status <= exp->statusMax);
+
+        case RM_EXPECT_HEADER:
+            if (headers == NULL) return FALSE;
+            value = soup_message_headers_get_one(headers, exp->header);
+            if (value == NULL) return FALSE;
+            if (exp->value) return (strcmp(value, exp->value) == 0);
+            if (exp->regex) return g_regex_match(exp->regex, value, 0, NULL);
+            return TRUE;
+
+        case RM_EXPECT_BODY_CONTAINS:
+            return (state->found || exp->valueLength == 0);
+
+        case RM_EXPECT_BODY_MATCHES:
+            if (body == NULL) return FALSE;
+            flat = soup_message_body_flatten(body);
+            res  = g_regex_match_full(exp->regex, flat->data, (gssize) flat->length, 0, 0, NULL, NULL);
+            soup_buffer_free(flat);
+            return res;
+    }
+
+    g_return_val_if_reached(FALSE);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
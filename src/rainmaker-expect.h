@@ -0,0 +1,73 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_EXPECT_H_
+#define RAINMAKER_EXPECT_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+/// Error Quark for expectation related errors
+#define RM_ERROR_EXPECT g_quark_from_static_string("rainmaker-expect-error")
+
+/// Expectation error codes
+enum {
+    RM_ERROR_EXPECT_INVALID_STATUS,
+    RM_ERROR_EXPECT_INVALID_PATTERN,
+    RM_ERROR_EXPECT_INVALID
+};
+
+typedef enum {
+    RM_EXPECT_STATUS,          ///< status code in a range
+    RM_EXPECT_HEADER,          ///< header present, equal to or matching a value
+    RM_EXPECT_BODY_CONTAINS,   ///< body contains a string, checked as it streams in
+    RM_EXPECT_BODY_MATCHES     ///< body matches a pattern, needs the full body
+} rmExpectType;
+
+/// An expectation on the response to a request. Expectations are compiled
+/// once when the scenario is loaded: patterns are compiled into regular
+/// expressions, and strings searched for in the body get a skip table for
+/// Boyer-Moore-Horspool search, so they can be looked for in each body chunk
+/// as it arrives without keeping the body.
+typedef struct _rmExpectation {
+    rmExpectType  type;
+    gchar        *label;        ///< description used in reports
+    guint         statusMin;
+    guint         statusMax;
+    gchar        *header;       ///< header name
+    gchar        *value;        ///< header value or body string
+    gsize         valueLength;
+    GRegex       *regex;
+    gsize         skip[256];    ///< Horspool bad character skip table
+} rmExpectation;
+
+/// Per-response state of a body expectation. The last bytes of each chunk are
+/// carried over to the next, to find strings split between chunks.
+typedef struct _rmExpectState {
+    gboolean  found;
+    guint8   *carry;
+    gsize     carryLength;
+    gsize     carrySize;
+} rmExpectState;
+
+rmExpectation* rm_expectation_new_status(const gchar *spec, GError **error);
+rmExpectation* rm_expectation_new_header(const gchar *name, const gchar *equals, const gchar *matches,
+                                         GError **error);
+rmExpectation* rm_expectation_new_body(const gchar *contains, const gchar *matches, GError **error);
+void           rm_expectation_free(rmExpectation *exp);
+
+void           rm_expect_state_reset(rmExpectState *state);
+void           rm_expect_state_clear(rmExpectState *state);
+void           rm_expectation_feed(const rmExpectation *exp, rmExpectState *state,
+                                   const guint8 *data, gsize length);
+gboolean       rm_expectation_check(const rmExpectation *exp, const rmExpectState *state, guint status,
+                                    SoupMessageHeaders *headers, SoupMessageBody *body);
+
+#endif // RAINMAKER_EXPECT_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
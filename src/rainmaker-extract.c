@@ -0,0 +1,557 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-extract.h"
+
+/// JSON scanner states
+enum {
+    JSON_VALUE,       ///< expecting a value
+    JSON_KEY,         ///< expecting a member name or the end of an object
+    JSON_KEY_STRING,  ///< in a member name
+    JSON_COLON,       ///< expecting the colon following a member name
+    JSON_STRING,      ///< in a string value
+    JSON_LITERAL,     ///< in a number, true, false or null
+    JSON_AFTER        ///< expecting a comma or the end of a container
+};
+
+static rmExtraction* extraction_new(rmExtractType type, guint variable)
+{
+    rmExtraction *ext;
+
+    ext = g_malloc0(sizeof(rmExtraction));
+    ext->type     = type;
+    ext->variable = variable;
+
+    return ext;
+}
+
+/// Compile a pattern. Responses are matched as raw bytes, as they are not
+/// necessarily valid UTF-8.
+static GRegex* compile_pattern(const gchar *pattern, GError **error)
+{
+    GRegex *regex;
+    GError *err = NULL;
+
+    regex = g_regex_new(pattern, G_REGEX_OPTIMIZE | G_REGEX_RAW, 0, &err);
+    if (regex == NULL) {
+        g_set_error(error, RM_ERROR_EXTRACT, RM_ERROR_EXTRACT_INVALID_PATTERN,
+            "invalid pattern '%s': %s", pattern, err->message);
+        g_error_free(err);
+    }
+
+    return regex;
+}
+
+/// Create a rule extracting the value of a response header. With a pattern,
+/// only the part of the value matching the pattern is extracted.
+rmExtraction* rm_extraction_new_header(const gchar *name, const gchar *matches, guint variable,
+    GError **error)
+{
+    rmExtraction *ext;
+
+    ext = extraction_new(RM_EXTRACT_HEADER, variable);
+    ext->header = g_strdup(name);
+
+    if (matches != NULL) {
+        if ((ext->regex = compile_pattern(matches, error)) == NULL) {
+            rm_extraction_free(ext);
+            return NULL;
+        }
+        ext->label = g_strdup_printf("header %s ~ /%s/", name, matches);
+    } else {
+        ext->label = g_strdup_printf("header %s", name);
+    }
+
+    return ext;
+}
+
+/// Create a rule extracting the part of the response body matching a pattern.
+/// The body is matched as it streams in, keeping no more than the last
+/// RM_EXTRACT_WINDOW bytes of it.
+rmExtraction* rm_extraction_new_body(const gchar *matches, guint variable, GError **error)
+{
+    rmExtraction *ext;
+
+    ext = extraction_new(RM_EXTRACT_BODY, variable);
+    if ((ext->regex = compile_pattern(matches, error)) == NULL) {
+        rm_extraction_free(ext);
+        return NULL;
+    }
+    ext->label = g_strdup_printf("body ~ /%s/", matches);
+
+    return ext;
+}
+
+/// Parse a JSON path: $ followed by any number of .name, ['name'] and [index]
+/// steps
+static gboolean parse_json_path(rmExtraction *ext, const gchar *path)
+{
+    GArray      *steps;
+    rmJsonStep   step;
+    const gchar *pos = path, *end;
+    gchar       *endNum;
+    gboolean     valid = (*pos++ == '$');
+
+    steps = g_array_new(FALSE, TRUE, sizeof(rmJsonStep));
+
+    while (valid && *pos != '\0') {
+        memset(&step, 0, sizeof(step));
+
+        if (*pos == '.') {
+            end = ++pos;
+            while (*end != '\0' && *end != '.' && *end != '[') end++;
+            valid = (end > pos);
+            step.key = g_strndup(pos, end - pos);
+            pos = end;
+
+        } else if (*pos == '[' && (pos[1] == '\'' || pos[1] == '"')) {
+            end = strchr(pos + 2, pos[1]);
+            valid = (end != NULL && end[1] == ']');
+            if (valid) {
+                step.key = g_strndup(pos + 2, end - pos - 2);
+                pos = end + 2;
+            }
+
+        } else if (*pos == '[' && g_ascii_isdigit(pos[1])) {
+            step.index = (guint) g_ascii_strtoull(pos + 1, &endNum, 10);
+            valid = (*endNum == ']');
+            pos = endNum + 1;
+
+        } else {
+            valid = FALSE;
+        }
+
+        if (step.key != NULL) step.keyLength = strlen(step.key);
+        g_array_append_val(steps, step);
+    }
+
+    ext->stepCount = steps->len;
+    ext->steps     = (rmJsonStep *) g_array_free(steps, FALSE);
+
+    return valid;
+}
+
+/// Create a rule extracting a scalar value from a JSON response body. The body
+/// is scanned as it streams in, without being kept, and scanning stops as soon
+/// as the value has been found. Paths are a subset of JSONPath: $ followed by
+/// member names (.name or ['name']) and array indexes ([0]).
+rmExtraction* rm_extraction_new_json(const gchar *path, guint variable, GError **error)
+{
+    rmExtraction *ext;
+
+    ext = extraction_new(RM_EXTRACT_JSON, variable);
+    if (! parse_json_path(ext, path) || ext->stepCount >= RM_EXTRACT_JSON_MAX_DEPTH) {
+        g_set_error(error, RM_ERROR_EXTRACT, RM_ERROR_EXTRACT_INVALID_PATH,
+            "invalid JSON path '%s', expecting $ followed by .name, ['name'] or [index] steps", path);
+        rm_extraction_free(ext);
+        return NULL;
+    }
+    ext->path  = g_strdup(path);
+    ext->label = g_strdup_printf("json %s", path);
+
+    return ext;
+}
+
+void rm_extraction_free(rmExtraction *ext)
+{
+    guint i;
+
+    for (i = 0; i < ext->stepCount; i++) {
+        g_free(ext->steps[i].key);
+    }
+    g_free(ext->steps);
+    g_free(ext->path);
+
+    if (ext->regex) g_regex_unref(ext->regex);
+    g_free(ext->header);
+    g_free(ext->label);
+    g_free(ext);
+}
+
+/// Reset the state of a rule before a new response is received. Buffers are
+/// kept for reuse.
+void rm_extract_state_reset(rmExtractState *state)
+{
+    state->done    = FALSE;
+    state->found   = FALSE;
+    state->scan    = JSON_VALUE;
+    state->depth   = 0;
+    state->matched = 0;
+    state->index   = 0;
+    state->arrays  = 0;
+    state->onPath  = TRUE;
+    state->capture = FALSE;
+    state->escape  = FALSE;
+    state->unicodeDigits = 0;
+    state->highSurrogate = 0;
+
+    if (state->value == NULL) state->value = g_string_new("");
+    g_string_truncate(state->value, 0);
+    if (state->window != NULL) g_string_truncate(state->window, 0);
+}
+
+/// Free memory held by a rule state
+void rm_extract_state_clear(rmExtractState *state)
+{
+    if (state->value != NULL) g_string_free(state->value, TRUE);
+    if (state->window != NULL) g_string_free(state->window, TRUE);
+    state->value  = NULL;
+    state->window = NULL;
+}
+
+/// Keep the part of a string matched by a pattern: its first capturing group,
+/// or the whole match if the pattern has no groups
+static gboolean set_match(const rmExtraction *ext, rmExtractState *state, const GMatchInfo *info)
+{
+    gint group, start, end;
+
+    group = (g_regex_get_capture_count(ext->regex) > 0 ? 1 : 0);
+    if (! g_match_info_fetch_pos(info, group, &start, &end) || start < 0) return FALSE;
+
+    g_string_truncate(state->value, 0);
+    g_string_append_len(state->value, g_match_info_get_string(info) + start, end - start);
+
+    return TRUE;
+}
+
+/// Match a pattern against the body seen so far, keeping only its tail
+/// between chunks
+static void feed_pattern(const rmExtraction *ext, rmExtractState *state, const gchar *data, gsize length)
+{
+    GMatchInfo *info = NULL;
+
+    if (state->window == NULL) state->window = g_string_sized_new(RM_EXTRACT_WINDOW);
+    g_string_append_len(state->window, data, length);
+
+    if (g_regex_match_full(ext->regex, state->window->str, (gssize) state->window->len, 0, 0, &info, NULL)) {
+        state->found = set_match(ext, state, info);
+        state->done  = state->found;
+    }
+    g_match_info_free(info);
+
+    if (! state->done && state->window->len > RM_EXTRACT_WINDOW) {
+        g_string_erase(state->window, 0, state->window->len - RM_EXTRACT_WINDOW);
+    }
+}
+
+static void json_not_found(rmExtractState *state)
+{
+    state->done  = TRUE;
+    state->found = FALSE;
+}
+
+/// Check whether the current element of the innermost array is on the path
+static gboolean json_element_on_path(const rmExtraction *ext, const rmExtractState *state)
+{
+    const rmJsonStep *step;
+
+    if (state->depth != state->matched || state->depth > ext->stepCount) return FALSE;
+
+    step = &ext->steps[state->depth - 1];
+    return (step->key == NULL && step->index == state->index);
+}
+
+static gboolean json_in_array(const rmExtractState *state)
+{
+    return (state->depth > 0 && (state->arrays & ((guint64) 1 << (state->depth - 1))) != 0);
+}
+
+/// Close the innermost container. If it was on the path, the value is not in
+/// the document.
+static void json_close(rmExtractState *state)
+{
+    state->depth--;
+    state->scan = JSON_AFTER;
+
+    if (state->depth < state->matched || state->depth == 0) {
+        json_not_found(state);
+    }
+}
+
+/// A value has been fully scanned
+static void json_value_end(rmExtractState *state)
+{
+    if (state->capture) {
+        state->found = TRUE;
+        state->done  = TRUE;
+    } else if (state->depth == 0) {
+        json_not_found(state);
+    }
+    state->scan = JSON_AFTER;
+}
+
+/// Append a character of a \u escape sequence, combining surrogate pairs
+static void json_append_unicode(rmExtractState *state)
+{
+    gchar    utf8[6];
+    gunichar c = state->unicode;
+
+    if (c >= 0xd800 && c < 0xdc00) {
+        state->highSurrogate = c;
+        return;
+    }
+
+    if (c >= 0xdc00 && c < 0xe000 && state->highSurrogate != 0) {
+        c = 0x10000 + ((state->highSurrogate - 0xd800) << 10) + (c - 0xdc00);
+    }
+    state->highSurrogate = 0;
+
+    g_string_append_len(state->value, utf8, g_unichar_to_utf8(c, utf8));
+}
+
+static void json_append_escape(GString *value, gchar c)
+{
+    switch (c) {
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        default: break;
+    }
+    g_string_append_c(value, c);
+}
+
+/// Start scanning a value
+static void json_value_start(const rmExtraction *ext, rmExtractState *state, gchar c)
+{
+    state->capture = (state->onPath && state->depth == ext->stepCount);
+
+    if (c == '{' || c == '[') {
+        // Containers are not extracted
+        if (state->capture || state->depth == RM_EXTRACT_JSON_MAX_DEPTH) {
+            json_not_found(state);
+            return;
+        }
+
+        if (c == '[') {
+            state->arrays |= ((guint64) 1 << state->depth);
+        } else {
+            state->arrays &= ~((guint64) 1 << state->depth);
+        }
+        state->depth++;
+
+        if (state->onPath) {
+            state->matched = state->depth;
+            state->index   = 0;
+        }
+
+        if (c == '{') {
+            state->scan = JSON_KEY;
+        } else {
+            state->onPath = json_element_on_path(ext, state);
+            state->scan   = JSON_VALUE;
+        }
+        return;
+    }
+
+    // A scalar on the path, where the path goes on, means the value is not there
+    if (state->onPath && ! state->capture) {
+        json_not_found(state);
+        return;
+    }
+
+    if (c == '"') {
+        state->scan   = JSON_STRING;
+        state->escape = FALSE;
+        state->unicodeDigits = 0;
+        state->highSurrogate = 0;
+    } else {
+        state->scan = JSON_LITERAL;
+        if (state->capture) g_string_append_c(state->value, c);
+    }
+}
+
+/// Scan a chunk of a JSON document, keeping track of where in the document
+/// the scanner is relative to the path, until the value is found or known not
+/// to be in the document. Only containers on the path are tracked; everything
+/// else is skipped with as little work as possible.
+static void feed_json(const rmExtraction *ext, rmExtractState *state, const gchar *data, gsize length)
+{
+    const rmJsonStep *step;
+    gsize             i;
+    gchar             c;
+    gint              digit;
+
+    for (i = 0; i < length && ! state->done; i++) {
+        c = data[i];
+
+        switch (state->scan) {
+            case JSON_VALUE:
+                if (g_ascii_isspace(c)) break;
+                if (c == ']' && json_in_array(state)) {
+                    json_close(state);
+                    break;
+                }
+                json_value_start(ext, state, c);
+                break;
+
+            case JSON_STRING:
+                // Skip through strings which are not extracted
+                if (! state->capture && ! state->escape && state->unicodeDigits == 0) {
+                    while (i < length && data[i] != '"' && data[i] != '\\') i++;
+                    if (i == length) break;
+                    c = data[i];
+                }
+
+                if (state->unicodeDigits > 0) {
+                    digit = g_ascii_xdigit_value(c);
+                    state->unicode = (state->unicode << 4) | (guint) MAX(digit, 0);
+                    if (--state->unicodeDigits == 0 && state->capture) json_append_unicode(state);
+
+                } else if (state->escape) {
+                    state->escape = FALSE;
+                    if (c == 'u') {
+                        state->unicode       = 0;
+                        state->unicodeDigits = 4;
+                    } else if (state->capture) {
+                        json_append_escape(state->value, c);
+                    }
+
+                } else if (c == '\\') {
+                    state->escape = TRUE;
+
+                } else if (c == '"') {
+                    json_value_end(state);
+
+                } else if (state->capture) {
+                    g_string_append_c(state->value, c);
+                }
+                break;
+
+            case JSON_LITERAL:
+                if (c == ',' || c == '}' || c == ']' || g_ascii_isspace(c)) {
+                    json_value_end(state);
+                    i--; // the character is scanned again, following the value
+                } else if (state->capture) {
+                    g_string_append_c(state->value, c);
+                }
+                break;
+
+            case JSON_AFTER:
+                if (g_ascii_isspace(c)) break;
+                if (c == ',') {
+                    if (json_in_array(state)) {
+                        if (state->depth == state->matched) state->index++;
+                        state->onPath = json_element_on_path(ext, state);
+                        state->scan   = JSON_VALUE;
+                    } else {
+                        state->scan = JSON_KEY;
+                    }
+                } else if (c == '}' || c == ']') {
+                    json_close(state);
+                } else {
+                    json_not_found(state);
+                }
+                break;
+
+            case JSON_KEY:
+                if (g_ascii_isspace(c)) break;
+                if (c == '}') {
+                    json_close(state);
+                } else if (c == '"') {
+                    step = (state->depth <= ext->stepCount ? &ext->steps[state->depth - 1] : NULL);
+                    state->keyMatch = (state->depth == state->matched && step != NULL && step->key != NULL);
+                    state->keyPos   = 0;
+                    state->escape   = FALSE;
+                    state->scan     = JSON_KEY_STRING;
+                } else {
+                    json_not_found(state);
+                }
+                break;
+
+            case JSON_KEY_STRING:
+                // Member names are compared as they appear in the document
+                if (c == '"' && ! state->escape) {
+                    step = (state->keyMatch ? &ext->steps[state->depth - 1] : NULL);
+                    state->keyMatch = (step != NULL && state->keyPos == step->keyLength);
+                    state->scan = JSON_COLON;
+                    break;
+                }
+
+                state->escape = (c == '\\' && ! state->escape);
+                if (state->keyMatch) {
+                    step = &ext->steps[state->depth - 1];
+                    state->keyMatch = (state->keyPos < step->keyLength && step->key[state->keyPos] == c);
+                    state->keyPos++;
+                }
+                break;
+
+            case JSON_COLON:
+                if (g_ascii_isspace(c)) break;
+                if (c == ':') {
+                    state->onPath = state->keyMatch;
+                    state->scan   = JSON_VALUE;
+                } else {
+                    json_not_found(state);
+                }
+                break;
+        }
+    }
+}
+
+/// Feed a chunk of response body to a body or JSON rule. Nothing is done once
+/// the rule is done.
+void rm_extraction_feed(const rmExtraction *ext, rmExtractState *state, const gchar *data, gsize length)
+{
+    if (state->done) return;
+
+    switch (ext->type) {
+        case RM_EXTRACT_BODY:
+            feed_pattern(ext, state, data, length);
+            break;
+
+        case RM_EXTRACT_JSON:
+            feed_json(ext, state, data, length);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/// Finish extracting a value once a response is complete: header rules are
+/// applied to the response headers, and a JSON document made of a single
+/// scalar value ends with the body.
+void rm_extraction_finish(const rmExtraction *ext, rmExtractState *state, SoupMessageHeaders *headers)
+{
+    const gchar *value;
+    GMatchInfo  *info = NULL;
+
+    if (state->done) return;
+
+    switch (ext->type) {
+        case RM_EXTRACT_HEADER:
+            value = (headers ? soup_message_headers_get_one(headers, ext->header) : NULL);
+            if (value == NULL) break;
+
+            if (ext->regex == NULL) {
+                g_string_assign(state->value, value);
+                state->found = TRUE;
+            } else if (g_regex_match(ext->regex, value, 0, &info)) {
+                state->found = set_match(ext, state, info);
+            }
+            g_match_info_free(info);
+            break;
+
+        case RM_EXTRACT_JSON:
+            state->found = (state->scan == JSON_LITERAL && state->capture);
+            break;
+
+        default:
+            break;
+    }
+
+    state->done = TRUE;
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
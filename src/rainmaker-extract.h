@@ -0,0 +1,97 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_EXTRACT_H_
+#define RAINMAKER_EXTRACT_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+/// Error Quark for value extraction related errors
+#define RM_ERROR_EXTRACT g_quark_from_static_string("rainmaker-extract-error")
+
+/// Value extraction error codes
+enum {
+    RM_ERROR_EXTRACT_INVALID,
+    RM_ERROR_EXTRACT_INVALID_PATTERN,
+    RM_ERROR_EXTRACT_INVALID_PATH
+};
+
+/// How much of the response body, in bytes, a pattern is matched against at a
+/// time. A body pattern only matches values which fit in this window.
+#define RM_EXTRACT_WINDOW 4096
+
+/// Max nesting depth of JSON documents values can be extracted from
+#define RM_EXTRACT_JSON_MAX_DEPTH 64
+
+/// Types of extraction rules
+typedef enum {
+    RM_EXTRACT_HEADER,   ///< value of a response header, optionally matched against a pattern
+    RM_EXTRACT_BODY,     ///< part of the response body matching a pattern
+    RM_EXTRACT_JSON      ///< scalar value at a path in a JSON response body
+} rmExtractType;
+
+/// A step of a JSON path: an object member or an array element
+typedef struct _rmJsonStep {
+    gchar  *key;      ///< member name, NULL for an array element
+    gsize   keyLength;
+    guint   index;    ///< array element index
+} rmJsonStep;
+
+/// A rule extracting a value from a response into a variable. Patterns
+/// extract their first capturing group, or the whole match if they have
+/// none.
+typedef struct _rmExtraction {
+    rmExtractType  type;
+    guint          variable;   ///< number of the variable the value is stored in
+    gchar         *label;      ///< description of the rule, for reporting
+    gchar         *header;     ///< header name, for header rules
+    GRegex        *regex;      ///< pattern, for header and body rules
+    gchar         *path;       ///< path, for JSON rules
+    rmJsonStep    *steps;      ///< parsed path
+    guint          stepCount;
+} rmExtraction;
+
+/// State of an extraction rule while a response streams in. A client keeps
+/// one state per rule, reused for all responses, so that extracting values
+/// does not allocate memory once buffers have grown enough.
+typedef struct _rmExtractState {
+    gboolean  done;        ///< value found, or known not to be there; nothing more is scanned
+    gboolean  found;
+    GString  *value;       ///< extracted value
+    GString  *window;      ///< body rules: tail of the body seen so far
+
+    // JSON scanner state
+    guint     scan;
+    guint     depth;       ///< number of open containers
+    guint     matched;     ///< number of open containers on the path
+    guint     index;       ///< index of the current element in the innermost array on the path
+    guint64   arrays;      ///< bit set for each open container which is an array
+    gboolean  onPath;      ///< the value about to be scanned is on the path
+    gboolean  capture;     ///< the value being scanned is the one extracted
+    gboolean  escape;      ///< the previous string byte was a backslash
+    gboolean  keyMatch;    ///< the member name being scanned matches the path so far
+    gsize     keyPos;
+    guint     unicode;     ///< \u escape sequence being decoded
+    guint     unicodeDigits;
+    guint     highSurrogate;
+} rmExtractState;
+
+rmExtraction* rm_extraction_new_header(const gchar *name, const gchar *matches, guint variable,
+                                       GError **error);
+rmExtraction* rm_extraction_new_body(const gchar *matches, guint variable, GError **error);
+rmExtraction* rm_extraction_new_json(const gchar *path, guint variable, GError **error);
+void          rm_extraction_free(rmExtraction *ext);
+void          rm_extract_state_reset(rmExtractState *state);
+void          rm_extract_state_clear(rmExtractState *state);
+void          rm_extraction_feed(const rmExtraction *ext, rmExtractState *state, const gchar *data, gsize length);
+void          rm_extraction_finish(const rmExtraction *ext, rmExtractState *state, SoupMessageHeaders *headers);
+
+#endif // RAINMAKER_EXTRACT_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,529 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+
+#include "rainmaker-feeder.h"
+
+/// Key / value pair found on a JSONL line
+typedef struct _jsonField {
+    rmValue key;
+    rmValue value;
+} jsonField;
+
+static void set_format_error(GError **error, const rmFeeder *feeder, guint row, const gchar *message)
+{
+    g_set_error(error, RM_ERROR_FEEDER, RM_ERROR_FEEDER_FORMAT,
+        "data file '%s', row %u: %s", feeder->filename, row, message);
+}
+
+/// Keep an unescaped copy of a value, owned by the feeder
+static void set_decoded_value(rmFeeder *feeder, rmValue *value, GString *decoded)
+{
+    value->length = decoded->len;
+    value->data   = g_string_free(decoded, FALSE);
+    feeder->decoded = g_slist_prepend(feeder->decoded, (gpointer) value->data);
+}
+
+static void add_column(GPtrArray *columns, const rmValue *name)
+{
+    g_ptr_array_add(columns, g_strndup(name->data, name->length));
+}
+
+/// Parse a CSV field. Quoted fields may contain commas, line breaks and
+/// quotes, which are doubled. Returns a pointer to the character following the
+/// field, or NULL on error.
+static const gchar* parse_csv_field(rmFeeder *feeder, const gchar *pos, const gchar *end, rmValue *value,
+    guint row, GError **error)
+{
+    const gchar *start;
+    GString     *decoded = NULL;
+
+    if (pos == end || *pos != '"') {
+        start = pos;
+        while (pos < end && *pos != ',' && *pos != '\n' && *pos != '\r') pos++;
+        value->data   = start;
+        value->length = pos - start;
+        return pos;
+    }
+
+    start = ++pos;
+    for (;;) {
+        if (pos == end) {
+            set_format_error(error, feeder, row, "unterminated quoted field");
+            if (decoded != NULL) g_string_free(decoded, TRUE);
+            return NULL;
+        }
+
+        if (*pos == '"') {
+            if (pos + 1 < end && pos[1] == '"') {
+                // Escaped quote: the value cannot point into the file any more
+                if (decoded == NULL) decoded = g_string_new_len(start, pos - start);
+                g_string_append_c(decoded, '"');
+                pos += 2;
+                continue;
+            }
+            break;
+        }
+
+        if (decoded != NULL) g_string_append_c(decoded, *pos);
+        pos++;
+    }
+
+    if (decoded != NULL) {
+        set_decoded_value(feeder, value, decoded);
+    } else {
+        value->data   = start;
+        value->length = pos - start;
+    }
+    pos++;
+
+    if (pos < end && *pos != ',' && *pos != '\n' && *pos != '\r') {
+        set_format_error(error, feeder, row, "unexpected character after quoted field");
+        return NULL;
+    }
+
+    return pos;
+}
+
+/// Parse CSV data. The first row holds column names.
+static gboolean parse_csv(rmFeeder *feeder, const gchar *pos, const gchar *end, GPtrArray *columns,
+    GArray *values, GError **error)
+{
+    rmValue value;
+    guint   row = 0, fields;
+
+    while (pos < end) {
+        // Skip empty lines
+        if (*pos == '\n' || *pos == '\r') {
+            pos++;
+            continue;
+        }
+
+        row++;
+        fields = 0;
+        for (;;) {
+            if ((pos = parse_csv_field(feeder, pos, end, &value, row, error)) == NULL) {
+                return FALSE;
+            }
+
+            if (row == 1) {
+                add_column(columns, &value);
+            } else {
+                g_array_append_val(values, value);
+            }
+            fields++;
+
+            if (pos < end && *pos == ',') {
+                pos++;
+            } else {
+                break;
+            }
+        }
+
+        if (row > 1 && fields != columns->len) {
+            g_set_error(error, RM_ERROR_FEEDER, RM_ERROR_FEEDER_FORMAT,
+                "data file '%s', row %u: expecting %u fields, found %u",
+                feeder->filename, row, columns->len, fields);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static const gchar* skip_space(const gchar *pos, const gchar *end)
+{
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) pos++;
+    return pos;
+}
+
+/// Read 4 hex digits of a JSON \u escape sequence. Returns -1 if they are not
+/// valid.
+static gint parse_hex4(const gchar *pos, const gchar *end)
+{
+    gint value = 0, digit, i;
+
+    if (end - pos < 4) return -1;
+
+    for (i = 0; i < 4; i++) {
+        if ((digit = g_ascii_xdigit_value(pos[i])) < 0) return -1;
+        value = (value << 4) | digit;
+    }
+
+    return value;
+}
+
+/// Parse a JSON string. Strings with no escape sequences point into the file.
+/// Returns a pointer to the character following the string, or NULL on
+/// error.
+static const gchar* parse_json_string(rmFeeder *feeder, const gchar *pos, const gchar *end, rmValue *value,
+    guint row, GError **error)
+{
+    const gchar *start;
+    GString     *decoded = NULL;
+    gchar        utf8[6];
+    gint         code, low;
+
+    start = ++pos;
+    while (pos < end && *pos != '"') {
+        if (*pos != '\\') {
+            if (decoded != NULL) g_string_append_c(decoded, *pos);
+            pos++;
+            continue;
+        }
+
+        if (decoded == NULL) decoded = g_string_new_len(start, pos - start);
+        if (++pos == end) break;
+
+        switch (*pos) {
+            case 'b': g_string_append_c(decoded, '\b'); break;
+            case 'f': g_string_append_c(decoded, '\f'); break;
+            case 'n': g_string_append_c(decoded, '\n'); break;
+            case 'r': g_string_append_c(decoded, '\r'); break;
+            case 't': g_string_append_c(decoded, '\t'); break;
+            case 'u':
+                if ((code = parse_hex4(pos + 1, end)) < 0) {
+                    set_format_error(error, feeder, row, "invalid \\u escape sequence");
+                    g_string_free(decoded, TRUE);
+                    return NULL;
+                }
+                pos += 4;
+
+                // Combine surrogate pairs
+                if (code >= 0xd800 && code < 0xdc00 && end - pos > 6 && pos[1] == '\\' && pos[2] == 'u' &&
+                    (low = parse_hex4(pos + 3, end)) >= 0xdc00 && low < 0xe000) {
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    pos += 6;
+                }
+                g_string_append_len(decoded, utf8, g_unichar_to_utf8((gunichar) code, utf8));
+                break;
+            default:
+                g_string_append_c(decoded, *pos);
+                break;
+        }
+        pos++;
+    }
+
+    if (pos == end) {
+        set_format_error(error, feeder, row, "unterminated string");
+        if (decoded != NULL) g_string_free(decoded, TRUE);
+        return NULL;
+    }
+
+    if (decoded != NULL) {
+        set_decoded_value(feeder, value, decoded);
+    } else {
+        value->data   = start;
+        value->length = pos - start;
+    }
+
+    return pos + 1;
+}
+
+/// Parse a JSON value. Strings are unquoted, and other scalars are kept as
+/// they appear in the file; null is an unset value. Nested objects and arrays
+/// are not supported.
+static const gchar* parse_json_value(rmFeeder *feeder, const gchar *pos, const gchar *end, rmValue *value,
+    guint row, GError **error)
+{
+    const gchar *start;
+
+    if (pos < end && *pos == '"') {
+        return parse_json_string(feeder, pos, end, value, row, error);
+    }
+
+    if (pos < end && (*pos == '{' || *pos == '[')) {
+        set_format_error(error, feeder, row, "nested objects and arrays are not supported");
+        return NULL;
+    }
+
+    start = pos;
+    while (pos < end && *pos != ',' && *pos != '}' && *pos != ' ' && *pos != '\t' && *pos != '\r') pos++;
+
+    if (pos == start) {
+        set_format_error(error, feeder, row, "expecting a value");
+        return NULL;
+    }
+
+    if (pos - start == 4 && memcmp(start, "null", 4) == 0) {
+        value->data   = NULL;
+        value->length = 0;
+    } else {
+        value->data   = start;
+        value->length = pos - start;
+    }
+
+    return pos;
+}
+
+/// Parse a line of JSONL data, holding a flat JSON object, into a list of
+/// fields
+static gboolean parse_json_line(rmFeeder *feeder, const gchar *pos, const gchar *end, GArray *fields,
+    guint row, GError **error)
+{
+    jsonField field;
+
+    g_array_set_size(fields, 0);
+
+    pos = skip_space(pos, end);
+    if (pos == end || *pos != '{') {
+        set_format_error(error, feeder, row, "expecting a JSON object");
+        return FALSE;
+    }
+    pos = skip_space(pos + 1, end);
+
+    while (pos < end && *pos != '}') {
+        if (fields->len > 0) {
+            if (*pos != ',') {
+                set_format_error(error, feeder, row, "expecting ',' or '}'");
+                return FALSE;
+            }
+            pos = skip_space(pos + 1, end);
+        }
+
+        if (pos == end || *pos != '"') {
+            set_format_error(error, feeder, row, "expecting a field name");
+            return FALSE;
+        }
+        if ((pos = parse_json_string(feeder, pos, end, &field.key, row, error)) == NULL) return FALSE;
+
+        pos = skip_space(pos, end);
+        if (pos == end || *pos != ':') {
+            set_format_error(error, feeder, row, "expecting ':'");
+            return FALSE;
+        }
+
+        pos = skip_space(pos + 1, end);
+        if ((pos = parse_json_value(feeder, pos, end, &field.value, row, error)) == NULL) return FALSE;
+        pos = skip_space(pos, end);
+
+        g_array_append_val(fields, field);
+    }
+
+    if (pos == end || skip_space(pos + 1, end) != end) {
+        set_format_error(error, feeder, row, "expecting a single JSON object per line");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// Look up a column by name
+static gint find_column(GPtrArray *columns, const rmValue *name)
+{
+    const gchar *column;
+    guint        i;
+
+    for (i = 0; i < columns->len; i++) {
+        column = g_ptr_array_index(columns, i);
+        if (strlen(column) == name->length && memcmp(column, name->data, name->length) == 0) {
+            return (gint) i;
+        }
+    }
+
+    return -1;
+}
+
+/// Parse JSONL data. Columns are the fields of the object on the first line;
+/// later lines may leave fields out, but may not add new ones.
+static gboolean parse_jsonl(rmFeeder *feeder, const gchar *pos, const gchar *end, GPtrArray *columns,
+    GArray *values, GError **error)
+{
+    const gchar *eol;
+    GArray      *fields;
+    jsonField   *field;
+    rmValue      unset = { NULL, 0 };
+    guint        row = 0, first, i;
+    gint         column;
+    gboolean     res = TRUE;
+
+    fields = g_array_new(FALSE, FALSE, sizeof(jsonField));
+
+    while (pos < end && res) {
+        if ((eol = memchr(pos, '\n', end - pos)) == NULL) eol = end;
+
+        if (skip_space(pos, eol) == eol) {
+            pos = eol + 1;
+            continue;
+        }
+
+        row++;
+        if (! (res = parse_json_line(feeder, pos, eol, fields, row, error))) break;
+        pos = eol + 1;
+
+        first = values->len;
+        if (row == 1) {
+            for (i = 0; i < fields->len; i++) {
+                field = &g_array_index(fields, jsonField, i);
+                if (find_column(columns, &field->key) >= 0) {
+                    set_format_error(error, feeder, row, "duplicate field");
+                    res = FALSE;
+                    break;
+                }
+                add_column(columns, &field->key);
+            }
+        }
+
+        for (i = 0; i < columns->len; i++) {
+            g_array_append_val(values, unset);
+        }
+
+        for (i = 0; i < fields->len && res; i++) {
+            field  = &g_array_index(fields, jsonField, i);
+            column = find_column(columns, &field->key);
+            if (column < 0) {
+                g_set_error(error, RM_ERROR_FEEDER, RM_ERROR_FEEDER_FORMAT,
+                    "data file '%s', row %u: field '%.*s' is not on the first row",
+                    feeder->filename, row, (int) field->key.length, field->key.data);
+                res = FALSE;
+                break;
+            }
+            g_array_index(values, rmValue, first + column) = field->value;
+        }
+    }
+
+    g_array_free(fields, TRUE);
+
+    return res;
+}
+
+/// Create a new data feeder: map a data file into memory and index its rows.
+/// The data is not copied; values point into the mapped file, except for
+/// values with escape sequences, of which unescaped copies are kept.
+rmFeeder* rm_feeder_new(const gchar *name, const gchar *filename, rmFeederFormat format,
+    rmFeederMode mode, rmFeederScope scope, GError **error)
+{
+    rmFeeder    *feeder;
+    GPtrArray   *columns;
+    GArray      *values;
+    const gchar *data;
+    gsize        length;
+    gboolean     res;
+
+    feeder = g_malloc0(sizeof(rmFeeder));
+    feeder->name     = g_strdup(name);
+    feeder->filename = g_strdup(filename);
+    feeder->format   = format;
+    feeder->mode     = mode;
+    feeder->scope    = scope;
+
+    if ((feeder->file = g_mapped_file_new(filename, FALSE, error)) == NULL) {
+        rm_feeder_free(feeder);
+        return NULL;
+    }
+
+    data   = g_mapped_file_get_contents(feeder->file);
+    length = g_mapped_file_get_length(feeder->file);
+
+    columns = g_ptr_array_new();
+    values  = g_array_new(FALSE, FALSE, sizeof(rmValue));
+
+    if (format == RM_FEEDER_CSV) {
+        res = parse_csv(feeder, data, data + length, columns, values, error);
+    } else {
+        res = parse_jsonl(feeder, data, data + length, columns, values, error);
+    }
+
+    g_ptr_array_add(columns, NULL);
+    feeder->columnCount = columns->len - 1;
+    feeder->columns     = (gchar **) g_ptr_array_free(columns, FALSE);
+    feeder->rowCount    = (feeder->columnCount > 0 ? values->len / feeder->columnCount : 0);
+    feeder->values      = (rmValue *) g_array_free(values, FALSE);
+
+    if (res && feeder->rowCount == 0) {
+        g_set_error(error, RM_ERROR_FEEDER, RM_ERROR_FEEDER_EMPTY,
+            "data file '%s' has no data rows", filename);
+        res = FALSE;
+    }
+
+    if (! res) {
+        rm_feeder_free(feeder);
+        return NULL;
+    }
+
+    return feeder;
+}
+
+/// Define a variable for each of the feeder's columns. Each variable can only
+/// be fed by one feeder.
+gboolean rm_feeder_bind(rmFeeder *feeder, rmVarTable *vars, GError **error)
+{
+    guint i;
+
+    feeder->variables = g_malloc(sizeof(guint) * feeder->columnCount);
+
+    for (i = 0; i < feeder->columnCount; i++) {
+        if (rm_var_table_lookup(vars, feeder->columns[i]) >= 0) {
+            g_set_error(error, RM_ERROR_TEMPLATE, RM_ERROR_TEMPLATE_DUPLICATE_VARIABLE,
+                "variable '%s' of data feeder '%s' is already defined", feeder->columns[i], feeder->name);
+            return FALSE;
+        }
+        feeder->variables[i] = rm_var_table_add(vars, feeder->columns[i]);
+    }
+
+    return TRUE;
+}
+
+/// Assign a row of data to a client's variables. Client is the client's number
+/// out of clientCount clients, iteration the number of rows already assigned
+/// to it, and seed the state of its random number generator.
+void rm_feeder_assign(rmFeeder *feeder, guint client, guint clientCount, guint iteration,
+    guint32 *seed, rmValue *values)
+{
+    const rmValue *rowValues;
+    guint32        x;
+    guint          row, i;
+
+    switch (feeder->mode) {
+        case RM_FEEDER_SEQUENTIAL:
+            row = (guint) g_atomic_int_exchange_and_add(&feeder->cursor, 1) % feeder->rowCount;
+            break;
+
+        case RM_FEEDER_RANDOM:
+            // xorshift32
+            x = *seed;
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            *seed = x;
+            row = x % feeder->rowCount;
+            break;
+
+        case RM_FEEDER_PARTITIONED:
+        default:
+            row = (client + iteration * MAX(clientCount, 1)) % feeder->rowCount;
+            break;
+    }
+
+    rowValues = feeder->values + (gsize) row * feeder->columnCount;
+    for (i = 0; i < feeder->columnCount; i++) {
+        values[feeder->variables[i]] = rowValues[i];
+    }
+}
+
+void rm_feeder_free(rmFeeder *feeder)
+{
+    GSList *node;
+
+    for (node = feeder->decoded; node; node = node->next) {
+        g_free(node->data);
+    }
+    g_slist_free(feeder->decoded);
+
+    if (feeder->file != NULL) g_mapped_file_unref(feeder->file);
+    g_strfreev(feeder->columns);
+    g_free(feeder->variables);
+    g_free(feeder->values);
+    g_free(feeder->filename);
+    g_free(feeder->name);
+    g_free(feeder);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,81 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_FEEDER_H_
+#define RAINMAKER_FEEDER_H_
+
+#include <glib.h>
+
+#include "rainmaker-template.h"
+#include "rainmaker-arena.h"
+
+/// Error Quark for data feeder related errors
+#define RM_ERROR_FEEDER g_quark_from_static_string("rainmaker-feeder-error")
+
+/// Data feeder error codes
+enum {
+    RM_ERROR_FEEDER_IO,
+    RM_ERROR_FEEDER_FORMAT,
+    RM_ERROR_FEEDER_EMPTY,
+    RM_ERROR_FEEDER_INVALID
+};
+
+/// Data file formats
+typedef enum {
+    RM_FEEDER_CSV,     ///< comma separated values, column names in the first row
+    RM_FEEDER_JSONL    ///< one flat JSON object per line
+} rmFeederFormat;
+
+/// How rows are assigned to clients
+typedef enum {
+    RM_FEEDER_SEQUENTIAL,   ///< all clients share a cursor going through the rows
+    RM_FEEDER_RANDOM,       ///< each client picks rows at random
+    RM_FEEDER_PARTITIONED   ///< client i of n gets rows i, i + n, i + 2n...
+} rmFeederMode;
+
+/// When rows are assigned to clients
+typedef enum {
+    RM_FEEDER_PER_CLIENT,   ///< once, when the client starts
+    RM_FEEDER_PER_ITERATION ///< at the start of each scenario iteration
+} rmFeederScope;
+
+/// A data feeder: a data file, mapped into memory and indexed once, which
+/// feeds values into scenario variables. Values point into the mapped file,
+/// so assigning a row does not copy any data.
+typedef struct _rmFeeder {
+    gchar          *name;
+    gchar          *filename;
+    rmFeederFormat  format;
+    rmFeederMode    mode;
+    rmFeederScope   scope;
+    GMappedFile    *file;
+    gchar         **columns;       ///< column names
+    guint           columnCount;
+    guint          *variables;     ///< scenario variable number of each column
+    guint           rowCount;
+    rmValue        *values;        ///< rowCount rows of columnCount values
+    GSList         *decoded;       ///< values which had to be unescaped, and cannot point into the file
+
+    // The cursor is the only field written once clients run, by all of them.
+    // It is padded to a cache line of its own, so that taking a row doesn't
+    // invalidate the line holding the fields other threads read along with it.
+    gchar           cursorPad[RM_CACHE_LINE_SIZE];
+    volatile gint   cursor;        ///< next row, in sequential mode
+    gchar           cursorPadEnd[RM_CACHE_LINE_SIZE - sizeof(gint)];
+} rmFeeder;
+
+rmFeeder*   rm_feeder_new(const gchar *name, const gchar *filename, rmFeederFormat format,
+                          rmFeederMode mode, rmFeederScope scope, GError **error);
+gboolean    rm_feeder_bind(rmFeeder *feeder, rmVarTable *vars, GError **error);
+void        rm_feeder_assign(rmFeeder *feeder, guint client, guint clientCount, guint iteration,
+                             guint32 *seed, rmValue *values);
+void        rm_feeder_free(rmFeeder *feeder);
+
+#endif // RAINMAKER_FEEDER_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,169 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "rainmaker-generator.h"
+
+/// Create a body generator. Repeating content is laid out once into a block
+/// of whole repetitions of the string, so that consecutive chunks continue
+/// the repetition seamlessly.
+rmGenerator* rm_generator_new(guint64 size, rmGeneratorPattern pattern, const gchar *text,
+    gboolean chunked, GError **error)
+{
+    rmGenerator *gen;
+    gsize        textLength, i;
+
+    gen = g_malloc0(sizeof(rmGenerator));
+    gen->size    = size;
+    gen->pattern = pattern;
+    gen->chunked = chunked;
+
+    switch (pattern) {
+        case RM_GENERATOR_ZERO:
+            gen->blockSize = RM_GENERATOR_CHUNK_SIZE;
+            gen->block     = g_malloc0(gen->blockSize);
+            break;
+
+        case RM_GENERATOR_REPEAT:
+            textLength = (text != NULL ? strlen(text) : 0);
+            if (textLength == 0) {
+                g_set_error(error, RM_ERROR_GENERATOR, RM_ERROR_GENERATOR_INVALID_PATTERN,
+                    "generated data with the 'repeat' pattern needs a string to repeat");
+                rm_generator_free(gen);
+                return NULL;
+            }
+
+            gen->text      = g_strdup(text);
+            gen->blockSize = MAX(RM_GENERATOR_CHUNK_SIZE / textLength, 1) * textLength;
+            gen->block     = g_malloc(gen->blockSize);
+            for (i = 0; i < gen->blockSize; i += textLength) {
+                memcpy(gen->block + i, text, textLength);
+            }
+            break;
+
+        case RM_GENERATOR_RANDOM:
+            gen->blockSize = RM_GENERATOR_CHUNK_SIZE;
+            break;
+    }
+
+    return gen;
+}
+
+/// Parse a body size: a number of bytes, optionally followed by a K, M or G
+/// (binary) unit, as in '512', '64K' or '1GB'. Sizes which don't fit in 64
+/// bits are rejected.
+gboolean rm_generator_parse_size(const gchar *str, guint64 *size)
+{
+    gchar   *end;
+    guint64  value;
+    guint    shift = 0;
+
+    if (str == NULL || ! g_ascii_isdigit(*str)) return FALSE;
+
+    errno = 0;
+    value = g_ascii_strtoull(str, &end, 10);
+    if (errno == ERANGE) return FALSE;
+
+    switch (g_ascii_toupper(*end)) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (g_ascii_toupper(*end) == 'B') end++;
+    if (*end != '\0') return FALSE;
+
+    if (value > (G_MAXUINT64 >> shift)) return FALSE;
+    value <<= shift;
+
+    *size = value;
+
+    return TRUE;
+}
+
+gboolean rm_generator_parse_pattern(const gchar *str, rmGeneratorPattern *pattern)
+{
+    if (str == NULL || strcmp(str, "random") == 0) {
+        *pattern = RM_GENERATOR_RANDOM;
+    } else if (strcmp(str, "zero") == 0) {
+        *pattern = RM_GENERATOR_ZERO;
+    } else if (strcmp(str, "repeat") == 0) {
+        *pattern = RM_GENERATOR_REPEAT;
+    } else {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void rm_generator_free(rmGenerator *gen)
+{
+    g_free(gen->text);
+    g_free(gen->block);
+    g_free(gen);
+}
+
+/// Start generating a new body. The random state carries on from the
+/// previous body, so that bodies differ.
+void rm_generator_state_reset(rmGeneratorState *state, const rmGenerator *gen)
+{
+    state->remaining = gen->size;
+    if (state->seed == 0) {
+        state->seed = ((guint64) g_random_int() << 32) | g_random_int() | 1;
+    }
+}
+
+/// Fill a buffer with pseudo-random bytes, eight at a time, using xorshift64*
+static void fill_random(guint64 *seed, guint64 *words, gsize count)
+{
+    guint64 x = *seed;
+    gsize   i;
+
+    for (i = 0; i < count; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        words[i] = x * G_GUINT64_CONSTANT(2685821657736338717);
+    }
+
+    *seed = x;
+}
+
+/// Get the next chunk of a body being generated. The chunk is valid until the
+/// next call. Returns FALSE once the whole body has been generated.
+gboolean rm_generator_next(const rmGenerator *gen, rmGeneratorState *state, const gchar **data,
+    gsize *length)
+{
+    if (state->remaining == 0) return FALSE;
+
+    *length = (gsize) MIN(state->remaining, (guint64) gen->blockSize);
+    state->remaining -= *length;
+
+    if (gen->pattern == RM_GENERATOR_RANDOM) {
+        if (state->buffer == NULL) {
+            state->buffer = g_malloc((RM_GENERATOR_CHUNK_SIZE + 7) & ~7);
+        }
+        fill_random(&state->seed, (guint64 *) state->buffer, (*length + 7) / 8);
+        *data = state->buffer;
+    } else {
+        *data = gen->block;
+    }
+
+    return TRUE;
+}
+
+void rm_generator_state_clear(rmGeneratorState *state)
+{
+    g_free(state->buffer);
+    state->buffer = NULL;
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,67 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_GENERATOR_H_
+#define RAINMAKER_GENERATOR_H_
+
+#include <glib.h>
+
+/// Error Quark for body generator related errors
+#define RM_ERROR_GENERATOR g_quark_from_static_string("rainmaker-generator-error")
+
+/// Body generator error codes
+enum {
+    RM_ERROR_GENERATOR_INVALID_SIZE,
+    RM_ERROR_GENERATOR_INVALID_PATTERN
+};
+
+/// Size of the chunks generated bodies are produced and sent in
+#ifndef RM_GENERATOR_CHUNK_SIZE
+#define RM_GENERATOR_CHUNK_SIZE 65536
+#endif
+
+/// Content of generated bodies
+typedef enum {
+    RM_GENERATOR_RANDOM,   ///< pseudo-random bytes, different for each chunk
+    RM_GENERATOR_ZERO,     ///< zero bytes
+    RM_GENERATOR_REPEAT    ///< a string, repeated
+} rmGeneratorPattern;
+
+/// A request body produced while it is sent, one chunk at a time, so that
+/// bodies of any size take no more memory than a chunk. Zero and repeating
+/// content is generated once into a block shared by all clients; random
+/// content is generated for each chunk into a buffer owned by the client.
+typedef struct _rmGenerator {
+    guint64             size;       ///< body size in bytes
+    rmGeneratorPattern  pattern;
+    gchar              *text;       ///< repeated string, for the repeat pattern
+    gboolean            chunked;    ///< send with chunked transfer encoding rather than a Content-Length
+    gchar              *block;      ///< content of every chunk, unless random
+    gsize               blockSize;
+} rmGenerator;
+
+/// State of a body being generated for a message
+typedef struct _rmGeneratorState {
+    guint64   remaining;   ///< bytes left to generate
+    guint64   seed;        ///< random pattern state
+    gchar    *buffer;      ///< random content of the current chunk, allocated on first use
+} rmGeneratorState;
+
+rmGenerator*  rm_generator_new(guint64 size, rmGeneratorPattern pattern, const gchar *text,
+                               gboolean chunked, GError **error);
+gboolean      rm_generator_parse_size(const gchar *str, guint64 *size);
+gboolean      rm_generator_parse_pattern(const gchar *str, rmGeneratorPattern *pattern);
+void          rm_generator_free(rmGenerator *gen);
+void          rm_generator_state_reset(rmGeneratorState *state, const rmGenerator *gen);
+gboolean      rm_generator_next(const rmGenerator *gen, rmGeneratorState *state, const gchar **data,
+                                gsize *length);
+void          rm_generator_state_clear(rmGeneratorState *state);
+
+#endif // RAINMAKER_GENERATOR_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
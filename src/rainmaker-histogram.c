@@ -0,0 +1,252 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+
+#include "rainmaker-histogram.h"
+
+/// Get the number of bits required to store a value
+static inline guint bit_length(guint64 value)
+{
+#ifdef __GNUC__
+    return (value == 0 ? 0 : 64 - __builtin_clzll(value));
+#else
+    guint bits = 0;
+    while (value) {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+#endif
+}
+
+/// Get the counts array index for a value. The bucket is picked by the
+/// magnitude of the value, and the sub-bucket by its top bits.
+static inline guint counts_index(guint64 value)
+{
+    guint bucket, sub;
+
+    bucket = bit_length(value | (RM_HISTOGRAM_SUB_BUCKET_COUNT - 1)) - RM_HISTOGRAM_SUB_BUCKET_BITS;
+    if (G_UNLIKELY(bucket >= RM_HISTOGRAM_BUCKETS)) {
+        return RM_HISTOGRAM_COUNTS - 1;
+    }
+
+    sub = (guint) (value >> bucket);
+
+    return ((bucket + 1) << (RM_HISTOGRAM_SUB_BUCKET_BITS - 1)) + sub - RM_HISTOGRAM_SUB_BUCKET_HALF;
+}
+
+/// Get the lowest value counted in the same sub-bucket as the counts array
+/// index, and the size of the sub-bucket. This is the reverse of
+/// counts_index()
+static guint64 lowest_equivalent_value(guint index, guint64 *size)
+{
+    gint  bucket;
+    guint sub;
+
+    bucket = (gint) (index >> (RM_HISTOGRAM_SUB_BUCKET_BITS - 1)) - 1;
+    sub    = (index & (RM_HISTOGRAM_SUB_BUCKET_HALF - 1)) + RM_HISTOGRAM_SUB_BUCKET_HALF;
+    if (bucket < 0) {
+        sub -= RM_HISTOGRAM_SUB_BUCKET_HALF;
+        bucket = 0;
+    }
+
+    if (size != NULL) *size = G_GUINT64_CONSTANT(1) << bucket;
+
+    return ((guint64) sub) << bucket;
+}
+
+/// Get the highest value counted in the same sub-bucket as the counts array
+/// index
+static guint64 highest_equivalent_value(guint index)
+{
+    guint64 lowest, size;
+
+    lowest = lowest_equivalent_value(index, &size);
+
+    return lowest + size - 1;
+}
+
+/// Allocate a new, empty histogram
+rmHistogram* rm_histogram_new()
+{
+    rmHistogram *hist;
+
+    hist = g_malloc(sizeof(rmHistogram));
+    rm_histogram_reset(hist);
+
+    return hist;
+}
+
+/// Record a value (in microseconds) in the histogram
+void rm_histogram_record(rmHistogram *hist, guint64 value)
+{
+    hist->counts[counts_index(value)]++;
+    hist->count++;
+    hist->total += value;
+    if (value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+}
+
+/// Merge the counts of one histogram into another by adding up buckets
+void rm_histogram_merge(rmHistogram *target, const rmHistogram *src)
+{
+    guint i;
+
+    g_assert(target != NULL);
+    g_assert(src != NULL);
+
+    if (src->count == 0) return;
+
+    for (i = 0; i < RM_HISTOGRAM_COUNTS; i++) {
+        target->counts[i] += src->counts[i];
+    }
+
+    target->count += src->count;
+    target->total += src->total;
+    target->min    = MIN(target->min, src->min);
+    target->max    = MAX(target->max, src->max);
+}
+
+/// Set a histogram to the difference between two histograms of the same
+/// series, taken at different times. Used to get the values recorded in an
+/// interval out of two cumulative snapshots. As individual values are not
+/// known, min and max are set to the bounds of the lowest and highest
+/// non-empty sub-buckets.
+void rm_histogram_diff(rmHistogram *target, const rmHistogram *newer, const rmHistogram *older)
+{
+    guint i;
+
+    rm_histogram_reset(target);
+
+    for (i = 0; i < RM_HISTOGRAM_COUNTS; i++) {
+        if (newer->counts[i] <= older->counts[i]) continue;
+
+        target->counts[i] = newer->counts[i] - older->counts[i];
+        target->count    += target->counts[i];
+
+        if (target->min == G_MAXUINT64) {
+            target->min = lowest_equivalent_value(i, NULL);
+        }
+        target->max = highest_equivalent_value(i);
+    }
+
+    if (newer->total > older->total) {
+        target->total = newer->total - older->total;
+    }
+}
+
+/// Clear all recorded values
+void rm_histogram_reset(rmHistogram *hist)
+{
+    memset(hist, 0, sizeof(rmHistogram));
+    hist->min = G_MAXUINT64;
+}
+
+/// Get the value at a given percentile (0 - 100). The value returned is the
+/// highest value equivalent to the recorded values at that percentile, but
+/// never more than the largest recorded value.
+guint64 rm_histogram_percentile(const rmHistogram *hist, gdouble percentile)
+{
+    guint64 target, seen = 0;
+    gdouble rank;
+    guint   i;
+
+    if (hist->count == 0) return 0;
+
+    percentile = CLAMP(percentile, 0, 100);
+    rank   = (percentile / 100) * hist->count;
+    target = (guint64) rank;
+    if (target < rank) target++;
+    target = CLAMP(target, 1, hist->count);
+
+    for (i = 0; i < RM_HISTOGRAM_COUNTS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) {
+            return CLAMP(highest_equivalent_value(i), hist->min, hist->max);
+        }
+    }
+
+    return hist->max;
+}
+
+/// Get the mean of all recorded values
+gdouble rm_histogram_mean(const rmHistogram *hist)
+{
+    if (hist->count == 0) return 0;
+
+    return (gdouble) hist->total / hist->count;
+}
+
+/// Append a compact binary representation of the histogram to a buffer. Only
+/// non-empty sub-buckets are written, each as the distance from the previous
+/// non-empty sub-bucket followed by its count, so a typical latency histogram
+/// takes a few hundred bytes rather than the full counts array.
+void rm_histogram_serialize(const rmHistogram *hist, GByteArray *buf)
+{
+    guint i, used = 0, last = 0;
+
+    for (i = 0; i < RM_HISTOGRAM_COUNTS; i++) {
+        if (hist->counts[i]) used++;
+    }
+
+    rm_wire_put_uint(buf, hist->count);
+    rm_wire_put_uint(buf, hist->min);
+    rm_wire_put_uint(buf, hist->max);
+    rm_wire_put_uint(buf, hist->total);
+    rm_wire_put_uint(buf, used);
+
+    for (i = 0; i < RM_HISTOGRAM_COUNTS; i++) {
+        if (hist->counts[i] == 0) continue;
+        rm_wire_put_uint(buf, i - last);
+        rm_wire_put_uint(buf, hist->counts[i]);
+        last = i;
+    }
+}
+
+/// Read a histogram written by rm_histogram_serialize(), replacing all values
+/// recorded in hist. Returns FALSE if the data is malformed.
+gboolean rm_histogram_deserialize(rmHistogram *hist, rmWireReader *reader)
+{
+    guint64 used, index = 0, seen = 0;
+    guint64 i;
+
+    rm_histogram_reset(hist);
+
+    hist->count = rm_wire_get_uint(reader);
+    hist->min   = rm_wire_get_uint(reader);
+    hist->max   = rm_wire_get_uint(reader);
+    hist->total = rm_wire_get_uint(reader);
+    used        = rm_wire_get_uint(reader);
+
+    for (i = 0; i < used && ! reader->failed; i++) {
+        index += rm_wire_get_uint(reader);
+        if (index >= RM_HISTOGRAM_COUNTS) {
+            reader->failed = TRUE;
+            break;
+        }
+
+        hist->counts[index] = rm_wire_get_uint(reader);
+        seen += hist->counts[index];
+    }
+
+    if (reader->failed || seen != hist->count) {
+        rm_histogram_reset(hist);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void rm_histogram_free(rmHistogram *hist)
+{
+    g_free(hist);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,52 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_HISTOGRAM_H_
+#define RAINMAKER_HISTOGRAM_H_
+
+#include <glib.h>
+
+#include "rainmaker-wire.h"
+
+/// Number of bits used for sub-buckets. Each bucket covers a power-of-2 range
+/// of values, split into 2^(bits - 1) linear sub-buckets, giving a relative
+/// precision of better than 1% with 8 bits (HDR-style, 2 significant digits)
+#define RM_HISTOGRAM_SUB_BUCKET_BITS  8
+#define RM_HISTOGRAM_SUB_BUCKET_COUNT (1 << RM_HISTOGRAM_SUB_BUCKET_BITS)
+#define RM_HISTOGRAM_SUB_BUCKET_HALF  (RM_HISTOGRAM_SUB_BUCKET_COUNT >> 1)
+
+/// Number of buckets. Values are recorded in microseconds, and with 26
+/// buckets the largest trackable value is 2^33 usec (a bit over 2 hours).
+/// Larger values are counted in the last sub-bucket.
+#define RM_HISTOGRAM_BUCKETS          26
+#define RM_HISTOGRAM_COUNTS           ((RM_HISTOGRAM_BUCKETS + 1) * RM_HISTOGRAM_SUB_BUCKET_HALF)
+
+/// Fixed-size, log-bucketed histogram of latency values in microseconds.
+/// Recording a value is O(1) and never allocates memory.
+typedef struct _rmHistogram {
+    guint64  count;
+    guint64  min;
+    guint64  max;
+    guint64  total;
+    guint64  counts[RM_HISTOGRAM_COUNTS];
+} rmHistogram;
+
+rmHistogram*  rm_histogram_new();
+void          rm_histogram_record(rmHistogram *hist, guint64 value);
+void          rm_histogram_merge(rmHistogram *target, const rmHistogram *src);
+void          rm_histogram_diff(rmHistogram *target, const rmHistogram *newer, const rmHistogram *older);
+void          rm_histogram_reset(rmHistogram *hist);
+guint64       rm_histogram_percentile(const rmHistogram *hist, gdouble percentile);
+gdouble       rm_histogram_mean(const rmHistogram *hist);
+void          rm_histogram_serialize(const rmHistogram *hist, GByteArray *buf);
+gboolean      rm_histogram_deserialize(rmHistogram *hist, rmWireReader *reader);
+void          rm_histogram_free(rmHistogram *hist);
+
+#endif // RAINMAKER_HISTOGRAM_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,219 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+/// Load profiles. A profile is a list of stages, each of which sets either
+/// the number of clients running or the rate iterations start at over time.
+/// The functions here work out, from the stage alone, exactly when the next
+/// client should start or retire, or when the next iteration should start,
+/// so that the scheduler can sleep until then instead of polling the level.
+
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+#include "rainmaker-profile.h"
+
+/// Slack for rounding errors when a level is compared to a whole number
+#define LEVEL_EPSILON 1e-9
+
+/// Create a new, empty load profile
+rmLoadProfile* rm_load_profile_new()
+{
+    return g_malloc0(sizeof(rmLoadProfile));
+}
+
+/// Add a stage to the end of a profile. The stage starts at the level the
+/// previous stage ended at, if it is of the same type, or at zero otherwise.
+/// The ramp time is clamped to the stage's duration.
+void rm_load_profile_add_stage(rmLoadProfile *profile, const gchar *name, rmLoadStageType type,
+    gdouble duration, gdouble ramp, gdouble target)
+{
+    rmLoadStage *stage, *prev;
+
+    profile->stages = g_renew(rmLoadStage, profile->stages, profile->stageCount + 1);
+    prev  = (profile->stageCount > 0 ? &profile->stages[profile->stageCount - 1] : NULL);
+    stage = &profile->stages[profile->stageCount++];
+
+    stage->name     = g_strdup(name);
+    stage->type     = type;
+    stage->start    = profile->duration;
+    stage->duration = MAX(duration, 0);
+    stage->ramp     = CLAMP(ramp, 0, stage->duration);
+    stage->from     = (prev != NULL && prev->type == type ? prev->target : 0);
+    stage->target   = MAX(target, 0);
+
+    profile->duration += stage->duration;
+}
+
+/// Get the highest number of clients any stage of a profile runs
+guint rm_load_profile_peak_clients(const rmLoadProfile *profile)
+{
+    gdouble peak = 0;
+    guint   i;
+
+    for (i = 0; i < profile->stageCount; i++) {
+        if (profile->stages[i].type == RM_STAGE_CLIENTS) {
+            peak = MAX(peak, MAX(profile->stages[i].from, profile->stages[i].target));
+        }
+    }
+
+    return (guint) ceil(peak - LEVEL_EPSILON);
+}
+
+/// Free a load profile
+void rm_load_profile_free(rmLoadProfile *profile)
+{
+    guint i;
+
+    for (i = 0; i < profile->stageCount; i++) {
+        g_free(profile->stages[i].name);
+    }
+    g_free(profile->stages);
+    g_free(profile);
+}
+
+/// Parse a duration: a number of seconds, optionally followed by an 'ms',
+/// 's', 'm' or 'h' unit
+gboolean rm_load_profile_parse_duration(const gchar *spec, gdouble *seconds, GError **error)
+{
+    gchar   *end;
+    gdouble  value;
+
+    value = g_ascii_strtod(spec, &end);
+    if (end != spec && value >= 0) {
+        if (*end == '\0' || strcmp(end, "s") == 0) {
+            *seconds = value;
+            return TRUE;
+        } else if (strcmp(end, "ms") == 0) {
+            *seconds = value / 1000;
+            return TRUE;
+        } else if (strcmp(end, "m") == 0) {
+            *seconds = value * 60;
+            return TRUE;
+        } else if (strcmp(end, "h") == 0) {
+            *seconds = value * 3600;
+            return TRUE;
+        }
+    }
+
+    g_set_error(error, RM_ERROR_PROFILE, RM_ERROR_PROFILE_INVALID,
+        "invalid duration '%s', expecting a number of ms, s, m or h", spec);
+    return FALSE;
+}
+
+/// Parse a rate: a number of iterations per second, optionally followed by a
+/// '/s' or '/m' unit
+gboolean rm_load_profile_parse_rate(const gchar *spec, gdouble *rate, GError **error)
+{
+    gchar   *end;
+    gdouble  value;
+
+    value = g_ascii_strtod(spec, &end);
+    if (end != spec && value >= 0) {
+        if (*end == '\0' || strcmp(end, "/s") == 0) {
+            *rate = value;
+            return TRUE;
+        } else if (strcmp(end, "/m") == 0) {
+            *rate = value / 60;
+            return TRUE;
+        }
+    }
+
+    g_set_error(error, RM_ERROR_PROFILE, RM_ERROR_PROFILE_INVALID,
+        "invalid rate '%s', expecting N/s or N/m", spec);
+    return FALSE;
+}
+
+/// Get the level of a stage at time t since the start of the stage
+static gdouble stage_level(const rmLoadStage *stage, gdouble t)
+{
+    if (t >= stage->ramp) return stage->target;
+    if (t <= 0) return stage->from;
+
+    return stage->from + (stage->target - stage->from) * t / stage->ramp;
+}
+
+/// Get the number of clients a stage runs at time t since the start of the
+/// stage. Clients are only added once the level reaches the next whole
+/// number when ramping up, and only retired once it reaches the one below
+/// when ramping down, so that the number never goes back and forth.
+guint rm_load_stage_clients(const rmLoadStage *stage, gdouble t)
+{
+    gdouble level = stage_level(stage, t);
+
+    if (stage->target >= stage->from) {
+        return (guint) floor(level + LEVEL_EPSILON);
+    }
+
+    return (guint) ceil(level - LEVEL_EPSILON);
+}
+
+/// Find the next time the number of clients of a stage changes, given the
+/// current number and the time since the start of the stage. Sets next to
+/// the new number of clients, which is one more or one less than the
+/// current one while ramping, or any number right away if the current one is
+/// off, as it is when a stage jumps to its target. Returns the time since
+/// the start of the stage, or a negative value if the number of clients does
+/// not change again during the stage.
+gdouble rm_load_stage_next_change(const rmLoadStage *stage, guint current, gdouble t, guint *next)
+{
+    guint   want = rm_load_stage_clients(stage, t);
+    gdouble at;
+
+    if (want != current) {
+        *next = want;
+        return t;
+    }
+
+    if (t >= stage->ramp || stage->target == stage->from) return -1;
+
+    if (stage->target > stage->from) {
+        if (current + 1 > stage->target + LEVEL_EPSILON) return -1;
+        *next = current + 1;
+        at = stage->ramp * (*next - stage->from) / (stage->target - stage->from);
+    } else {
+        if (current == 0 || current - 1 < stage->target - LEVEL_EPSILON) return -1;
+        *next = current - 1;
+        at = stage->ramp * (stage->from - *next) / (stage->from - stage->target);
+    }
+
+    return MAX(at, t);
+}
+
+/// Find the time the n-th iteration (counting from 1) of a rate stage
+/// starts, since the start of the stage. Arrivals are spaced so that their
+/// count always follows the integral of the rate, which makes them exact
+/// along ramps instead of drifting. Returns a negative value if there is no
+/// such arrival during the stage.
+gdouble rm_load_stage_arrival(const rmLoadStage *stage, guint64 n)
+{
+    gdouble a = stage->from, slope, k = (gdouble) n, rampArrivals = 0, t;
+
+    if (stage->ramp > 0) {
+        // Arrivals along the ramp: n(t) = a * t + slope * t^2 / 2
+        rampArrivals = (stage->from + stage->target) / 2 * stage->ramp;
+        if (k <= rampArrivals) {
+            slope = (stage->target - stage->from) / stage->ramp;
+            if (fabs(slope) < LEVEL_EPSILON) {
+                t = k / a;
+            } else {
+                t = (sqrt(MAX(a * a + 2 * slope * k, 0)) - a) / slope;
+            }
+            return MIN(t, stage->ramp);
+        }
+        k -= rampArrivals;
+    }
+
+    if (stage->target <= 0) return -1;
+
+    t = stage->ramp + k / stage->target;
+
+    return (t < stage->duration ? t : -1);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
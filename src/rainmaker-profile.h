@@ -0,0 +1,64 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_PROFILE_H_
+#define RAINMAKER_PROFILE_H_
+
+#include <glib.h>
+
+/// Error Quark for load profile related errors
+#define RM_ERROR_PROFILE g_quark_from_static_string("rainmaker-profile-error")
+
+/// Load profile error codes
+enum {
+    RM_ERROR_PROFILE_INVALID
+};
+
+/// What the level of a stage is
+typedef enum {
+    RM_STAGE_CLIENTS,   ///< number of clients running iterations back to back
+    RM_STAGE_RATE       ///< number of iterations started per second
+} rmLoadStageType;
+
+/// A stage of a load profile. The level goes linearly from where the
+/// previous stage left it to the stage's target over the ramp time, and is
+/// then held until the end of the stage: a ramp time equal to the duration
+/// ramps up or down over the whole stage, and no ramp time jumps right to the
+/// target, as in a spike. All times are in seconds.
+typedef struct _rmLoadStage {
+    gchar           *name;      ///< name the stage is reported by, or NULL
+    rmLoadStageType  type;
+    gdouble          start;     ///< time the stage starts, since the start of the run
+    gdouble          duration;
+    gdouble          ramp;
+    gdouble          from;      ///< level at the start of the stage
+    gdouble          target;    ///< level reached at the end of the ramp
+} rmLoadStage;
+
+/// A load profile: stages run one after the other, starting and retiring
+/// clients, or starting iterations at a given rate, over time
+typedef struct _rmLoadProfile {
+    rmLoadStage *stages;
+    guint        stageCount;
+    gdouble      duration;  ///< total duration of all stages
+} rmLoadProfile;
+
+rmLoadProfile*  rm_load_profile_new();
+void            rm_load_profile_add_stage(rmLoadProfile *profile, const gchar *name, rmLoadStageType type,
+                                          gdouble duration, gdouble ramp, gdouble target);
+guint           rm_load_profile_peak_clients(const rmLoadProfile *profile);
+void            rm_load_profile_free(rmLoadProfile *profile);
+gboolean        rm_load_profile_parse_duration(const gchar *spec, gdouble *seconds, GError **error);
+gboolean        rm_load_profile_parse_rate(const gchar *spec, gdouble *rate, GError **error);
+guint           rm_load_stage_clients(const rmLoadStage *stage, gdouble t);
+gdouble         rm_load_stage_next_change(const rmLoadStage *stage, guint current, gdouble t, guint *next);
+gdouble         rm_load_stage_arrival(const rmLoadStage *stage, guint64 n);
+
+#endif // RAINMAKER_PROFILE_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
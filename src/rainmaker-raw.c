@@ -0,0 +1,912 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rainmaker-raw.h"
+#include "rainmaker-scenario.h"
+#include "rainmaker-request.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/// Max number of events handled per epoll_wait() call
+#define RM_RAW_MAX_EVENTS 64
+
+/// Max number of buffers written per sendmsg() call
+#define RM_RAW_MAX_IOV 16
+
+/// Peer closed its side of the connection, on kernels older than 2.6.17
+#ifndef EPOLLRDHUP
+#define EPOLLRDHUP 0x2000
+#endif
+
+struct _rmRawPoller {
+    GSource  source;
+    GPollFD  pollfd;
+    gint     epfd;
+};
+
+static void raw_conn_handle_event(rmRawConn *conn, guint32 events);
+
+/// Get the monotonic clock time in microseconds
+static gint64 monotonic_usec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((gint64) ts.tv_sec * G_USEC_PER_SEC) + (ts.tv_nsec / 1000);
+}
+
+/// Append a header line to a serialized request. Host and Content-Length are
+/// set by the engine, so they are skipped.
+static void serialize_header(const char *name, const char *value, gpointer head)
+{
+    if (g_ascii_strcasecmp(name, "Host") == 0 ||
+        g_ascii_strcasecmp(name, "Content-Length") == 0) return;
+
+    g_string_append_printf((GString *) head, "%s: %s\r\n", name, value);
+}
+
+/// Resolve the server address of a request
+static gboolean resolve_template(rmRawTemplate *tmpl, const SoupURI *url, GError **error)
+{
+    struct addrinfo  hints, *res;
+    gchar            port[8];
+    gint             rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    g_snprintf(port, sizeof(port), "%u", url->port);
+
+    rc = getaddrinfo(url->host, port, &hints, &res);
+    if (rc != 0) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_RESOLVE,
+            "unable to resolve '%s': %s", url->host, gai_strerror(rc));
+        return FALSE;
+    }
+
+    g_assert(res->ai_addrlen <= sizeof(tmpl->addr));
+    memcpy(&tmpl->addr, res->ai_addr, res->ai_addrlen);
+    tmpl->addrLength = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return TRUE;
+}
+
+/// Serialize a compiled request into its wire bytes
+static gboolean serialize_request(rmRawTemplate *tmpl, const rmRequest *request, gboolean keepAlive,
+    GError **error)
+{
+    GString *head;
+    gchar   *path;
+    guint    i;
+
+    if (request->url->scheme != SOUP_URI_SCHEME_HTTP) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+            "the raw engine only supports plain HTTP URLs, request #%u is %s",
+            request->index, request->url->scheme);
+        return FALSE;
+    }
+
+    if (rm_request_is_templated(request)) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+            "the raw engine sends pre-serialized requests, request #%u references variables",
+            request->index);
+        return FALSE;
+    }
+
+    if (request->generator != NULL) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+            "the raw engine sends pre-serialized requests, request #%u has a generated body",
+            request->index);
+        return FALSE;
+    }
+
+    if (request->preSend != NULL || request->postComplete != NULL) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+            "the raw engine does not run request hooks, request #%u runs %s",
+            request->index, (request->preSend ? request->preSend : request->postComplete));
+        return FALSE;
+    }
+
+    if (request->extractCount > 0) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+            "the raw engine does not extract values from responses, request #%u extracts %s",
+            request->index, request->extracts[0]->label);
+        return FALSE;
+    }
+
+    for (i = 0; i < request->expectCount; i++) {
+        if (request->expects[i]->type != RM_EXPECT_STATUS) {
+            g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+                "the raw engine only checks response status codes, request #%u expects %s",
+                request->index, request->expects[i]->label);
+            return FALSE;
+        }
+    }
+
+    if (! resolve_template(tmpl, request->url, error)) {
+        return FALSE;
+    }
+
+    head = g_string_sized_new(512);
+    path = soup_uri_to_string(request->url, TRUE);
+
+    g_string_append_printf(head, "%s %s HTTP/1.1\r\n", request->methodName, path);
+    if (strchr(request->url->host, ':') != NULL) {
+        g_string_append_printf(head, "Host: [%s]", request->url->host);
+    } else {
+        g_string_append_printf(head, "Host: %s", request->url->host);
+    }
+    if (! soup_uri_uses_default_port(request->url)) {
+        g_string_append_printf(head, ":%u", request->url->port);
+    }
+    g_string_append(head, "\r\n");
+
+    soup_message_headers_foreach(request->compiledHeaders, serialize_header, (gpointer) head);
+
+    if (request->body != NULL) {
+        g_string_append_printf(head, "Content-Length: %" G_GSIZE_FORMAT "\r\n", rm_request_content_length(request));
+    }
+    if (! keepAlive) {
+        g_string_append(head, "Connection: close\r\n");
+    }
+    g_string_append(head, "\r\n");
+
+    tmpl->headLength = head->len;
+    tmpl->head       = g_string_free(head, FALSE);
+    tmpl->bodyLength = rm_request_content_length(request);
+    if (request->bodySegmentCount > 0) {
+        tmpl->segments     = request->bodySegments;
+        tmpl->segmentCount = request->bodySegmentCount;
+    } else if (request->body != NULL) {
+        tmpl->bodySegment.data   = request->body;
+        tmpl->bodySegment.length = request->bodyLength;
+        tmpl->segments     = &tmpl->bodySegment;
+        tmpl->segmentCount = 1;
+    }
+    tmpl->noBody     = (request->methodName == SOUP_METHOD_HEAD);
+
+    g_free(path);
+
+    return TRUE;
+}
+
+/// Create the raw engine for a scenario. All requests are serialized and their
+/// server addresses resolved up front. Fails if the scenario uses features
+/// the raw engine does not support. The scenario's keep-alive options are
+/// applied; as each connection only sends one request at a time, the limit of
+/// connections per host does not apply.
+rmRawEngine* rm_raw_engine_new(rmScenario *scenario, GError **error)
+{
+    rmRawEngine *engine;
+    rmRequest   *request;
+    guint        i;
+
+    if (scenario->persistCookies) {
+        g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNSUPPORTED,
+            "cookie persistence is not supported by the raw engine");
+        return NULL;
+    }
+
+    g_assert(scenario->requestTable != NULL); // scenario is frozen
+
+    engine = g_malloc0(sizeof(rmRawEngine));
+    engine->templates     = g_malloc0(sizeof(rmRawTemplate) * scenario->requestCount);
+    engine->templateCount = scenario->requestCount;
+    engine->keepAlive          = scenario->keepAlive;
+    engine->maxRequestsPerConn = scenario->maxRequestsPerConn;
+
+    for (i = 0; i < scenario->requestCount; i++) {
+        request = &scenario->requestTable[i];
+        if (! serialize_request(&engine->templates[request->index], request,
+                engine->keepAlive, error)) {
+            rm_raw_engine_free(engine);
+            return NULL;
+        }
+    }
+
+    return engine;
+}
+
+void rm_raw_engine_free(rmRawEngine *engine)
+{
+    guint i;
+
+    for (i = 0; i < engine->templateCount; i++) {
+        g_free(engine->templates[i].head);
+    }
+    g_free(engine->templates);
+    g_free(engine);
+}
+
+static gboolean poller_prepare(GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean poller_check(GSource *source)
+{
+    rmRawPoller *poller = (rmRawPoller *) source;
+
+    return ((poller->pollfd.revents & G_IO_IN) != 0);
+}
+
+/// Handle all ready connections. The epoll descriptor is polled by the main
+/// loop, so epoll_wait() never blocks here.
+static gboolean poller_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    rmRawPoller        *poller = (rmRawPoller *) source;
+    struct epoll_event  events[RM_RAW_MAX_EVENTS];
+    gint                n, i;
+
+    n = epoll_wait(poller->epfd, events, RM_RAW_MAX_EVENTS, 0);
+    for (i = 0; i < n; i++) {
+        raw_conn_handle_event((rmRawConn *) events[i].data.ptr, events[i].events);
+    }
+
+    return TRUE;
+}
+
+static GSourceFuncs pollerFuncs = {
+    poller_prepare,
+    poller_check,
+    poller_dispatch,
+    NULL
+};
+
+/// Create a poller and attach it to a main context
+rmRawPoller* rm_raw_poller_new(GMainContext *context)
+{
+    rmRawPoller *poller;
+
+    poller = (rmRawPoller *) g_source_new(&pollerFuncs, sizeof(rmRawPoller));
+    poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+    g_assert(poller->epfd >= 0);
+
+    poller->pollfd.fd     = poller->epfd;
+    poller->pollfd.events = G_IO_IN;
+    g_source_add_poll((GSource *) poller, &poller->pollfd);
+    g_source_attach((GSource *) poller, context);
+
+    return poller;
+}
+
+void rm_raw_poller_free(rmRawPoller *poller)
+{
+    close(poller->epfd);
+    g_source_destroy((GSource *) poller);
+    g_source_unref((GSource *) poller);
+}
+
+/// Set the events a connection is waiting for
+static void raw_conn_watch(rmRawConn *conn, guint32 events, gboolean add)
+{
+    struct epoll_event ev;
+
+    ev.events   = events;
+    ev.data.ptr = conn;
+    epoll_ctl(conn->poller->epfd, (add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD), conn->fd, &ev);
+}
+
+/// Close the connection's socket, if open. This also removes it from epoll.
+static void raw_conn_close(rmRawConn *conn)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->connected = NULL;
+}
+
+/// Idle callback notifying the caller of a request that failed while it was
+/// being sent
+static gboolean raw_conn_complete_idle(rmRawConn *conn)
+{
+    g_source_unref(conn->completing);
+    conn->completing = NULL;
+
+    conn->func(conn, conn->status, conn->userData);
+    return FALSE;
+}
+
+/// Finish the current request and notify the caller. The callback may send
+/// the next request on this connection right away, so the connection must not
+/// be touched after it returns. If the request failed right away, while still
+/// in rm_raw_conn_send(), the caller is notified from an idle callback, so
+/// that repeated failures don't recurse.
+static void raw_conn_complete(rmRawConn *conn, guint status)
+{
+    GSource *idle;
+
+    conn->state        = RM_RAW_CONN_IDLE;
+    conn->bufferLength = 0;
+    conn->target       = NULL;
+
+    // A kept-alive connection is only watched for the server closing it
+    if (conn->fd >= 0) raw_conn_watch(conn, EPOLLRDHUP, FALSE);
+
+    if (conn->sending) {
+        conn->status = status;
+        idle = g_idle_source_new();
+        g_source_set_callback(idle, (GSourceFunc) raw_conn_complete_idle, conn, NULL);
+        g_source_attach(idle, g_source_get_context((GSource *) conn->poller));
+        conn->completing = idle;
+        return;
+    }
+
+    conn->func(conn, status, conn->userData);
+}
+
+/// Fail the current request, closing the connection
+static void raw_conn_fail(rmRawConn *conn, guint status)
+{
+    raw_conn_close(conn);
+    raw_conn_complete(conn, status);
+}
+
+static void raw_conn_connect(rmRawConn *conn);
+
+/// Handle a connection closed or reset by the server before any part of the
+/// response was received. A kept-alive connection may have been closed by the
+/// server while idle, so the request is retried once on a new connection.
+static void raw_conn_lost(rmRawConn *conn)
+{
+    if (conn->reused && conn->received == 0) {
+        raw_conn_close(conn);
+        raw_conn_connect(conn);
+    } else {
+        raw_conn_fail(conn, SOUP_STATUS_IO_ERROR);
+    }
+}
+
+/// End the current request phase, and start the next one
+static void raw_conn_end_phase(rmRawConn *conn, rmPhase phase, gint64 now)
+{
+    conn->phases[phase] = (now - conn->phaseStart) / (gdouble) G_USEC_PER_SEC;
+    conn->phaseStart    = now;
+}
+
+/// Reset the response parser
+static void raw_conn_reset_parser(rmRawConn *conn)
+{
+    conn->parseState    = RM_RAW_PARSE_STATUS_LINE;
+    conn->status        = 0;
+    conn->keepAlive     = TRUE;
+    conn->chunked       = FALSE;
+    conn->contentLength = -1;
+    conn->remaining     = 0;
+    conn->received      = 0;
+    conn->bufferLength  = 0;
+}
+
+/// Write as much of the request as the socket will take, using a single
+/// sendmsg() call for the head and body segments
+static void raw_conn_write(rmRawConn *conn)
+{
+    const rmRawTemplate *tmpl = conn->target;
+    const rmBodySegment *segment;
+    struct iovec         iov[RM_RAW_MAX_IOV];
+    struct msghdr        msg;
+    gint                 iovcnt;
+    gsize                total, pos, skip;
+    guint                i;
+    ssize_t              n;
+
+    total = tmpl->headLength + tmpl->bodyLength;
+
+    while (conn->written < total) {
+        // Point at what is left of the head, and of as many body segments
+        // as fit in one call
+        iovcnt = 0;
+        if (conn->written < tmpl->headLength) {
+            iov[iovcnt].iov_base = tmpl->head + conn->written;
+            iov[iovcnt].iov_len  = tmpl->headLength - conn->written;
+            iovcnt++;
+        }
+
+        pos = tmpl->headLength;
+        for (i = 0; i < tmpl->segmentCount && iovcnt < RM_RAW_MAX_IOV; i++) {
+            segment = &tmpl->segments[i];
+            if (segment->length > 0 && conn->written < pos + segment->length) {
+                skip = (conn->written > pos ? conn->written - pos : 0);
+                iov[iovcnt].iov_base = (gpointer) (segment->data + skip);
+                iov[iovcnt].iov_len  = segment->length - skip;
+                iovcnt++;
+            }
+            pos += segment->length;
+        }
+
+        // Like writev(), but a connection reset by the server fails with EPIPE
+        // instead of raising SIGPIPE, which would kill the process
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = iovcnt;
+        n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->state = RM_RAW_CONN_WRITING;
+                raw_conn_watch(conn, EPOLLOUT, FALSE);
+                return;
+            }
+            raw_conn_lost(conn);
+            return;
+        }
+
+        conn->written += (gsize) n;
+    }
+
+    // Request fully written, wait for the response
+    raw_conn_end_phase(conn, RM_PHASE_SEND, monotonic_usec());
+    conn->state = RM_RAW_CONN_READING;
+    raw_conn_reset_parser(conn);
+    raw_conn_watch(conn, EPOLLIN, FALSE);
+}
+
+/// Open a new connection to the target server
+static void raw_conn_connect(rmRawConn *conn)
+{
+    const rmRawTemplate *tmpl = conn->target;
+    gint                 one = 1;
+
+    conn->reused       = FALSE;
+    conn->written      = 0;
+    conn->requests     = 1;
+    conn->connectStart = monotonic_usec();
+    conn->phaseStart   = conn->connectStart;
+
+    conn->fd = socket(tmpl->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        raw_conn_complete(conn, SOUP_STATUS_CANT_CONNECT);
+        return;
+    }
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    conn->connected = tmpl;
+
+    if (connect(conn->fd, (const struct sockaddr *) &tmpl->addr, tmpl->addrLength) == 0) {
+        raw_conn_end_phase(conn, RM_PHASE_CONNECT, monotonic_usec());
+        conn->connectTime = conn->phases[RM_PHASE_CONNECT];
+        raw_conn_watch(conn, 0, TRUE);
+        raw_conn_write(conn);
+
+    } else if (errno == EINPROGRESS) {
+        conn->state = RM_RAW_CONN_CONNECTING;
+        raw_conn_watch(conn, EPOLLOUT, TRUE);
+
+    } else {
+        raw_conn_fail(conn, SOUP_STATUS_CANT_CONNECT);
+    }
+}
+
+/// Parse the status line of a response
+static gboolean parse_status_line(rmRawConn *conn, const gchar *line)
+{
+    gchar *end;
+    gulong status;
+
+    if (strncmp(line, "HTTP/1.", 7) != 0 || line[7] == '\0' || line[8] != ' ') {
+        return FALSE;
+    }
+
+    // HTTP/1.0 servers close the connection unless asked otherwise
+    conn->keepAlive = (line[7] != '0');
+
+    status = strtoul(line + 9, &end, 10);
+    if (end == line + 9 || status < 100 || status > 999) {
+        return FALSE;
+    }
+    conn->status = (guint) status;
+
+    return TRUE;
+}
+
+/// Parse a response header line. Only headers which affect framing and
+/// connection reuse are of interest.
+static gboolean parse_header_line(rmRawConn *conn, gchar *line)
+{
+    gchar *value, *end;
+
+    value = strchr(line, ':');
+    if (value == NULL) return FALSE;
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') value++;
+
+    if (g_ascii_strcasecmp(line, "Content-Length") == 0) {
+        conn->contentLength = g_ascii_strtoll(value, &end, 10);
+        if (end == value || conn->contentLength < 0) return FALSE;
+
+    } else if (g_ascii_strcasecmp(line, "Transfer-Encoding") == 0) {
+        conn->chunked = (g_ascii_strncasecmp(value, "chunked", 7) == 0);
+
+    } else if (g_ascii_strcasecmp(line, "Connection") == 0) {
+        if (g_ascii_strncasecmp(value, "close", 5) == 0) {
+            conn->keepAlive = FALSE;
+        } else if (g_ascii_strncasecmp(value, "keep-alive", 10) == 0) {
+            conn->keepAlive = TRUE;
+        }
+    }
+
+    return TRUE;
+}
+
+/// Called at the end of the response headers, to figure out how the body is
+/// framed. Returns FALSE if the response is complete.
+static gboolean start_body(rmRawConn *conn)
+{
+    if (conn->target->noBody || conn->status == 204 || conn->status == 304) {
+        return FALSE;
+    }
+
+    if (conn->chunked) {
+        conn->parseState = RM_RAW_PARSE_CHUNK_SIZE;
+    } else if (conn->contentLength >= 0) {
+        if (conn->contentLength == 0) return FALSE;
+        conn->parseState = RM_RAW_PARSE_BODY_LENGTH;
+        conn->remaining  = (guint64) conn->contentLength;
+    } else {
+        conn->parseState = RM_RAW_PARSE_BODY_UNTIL_CLOSE;
+        conn->keepAlive  = FALSE;
+    }
+
+    return TRUE;
+}
+
+/// Finish a response which has been fully received. The connection is closed
+/// if the server or the scenario options say so.
+static void raw_conn_response_done(rmRawConn *conn)
+{
+    raw_conn_end_phase(conn, RM_PHASE_TRANSFER, monotonic_usec());
+
+    if (! conn->keepAlive || ! conn->engine->keepAlive ||
+        (conn->engine->maxRequestsPerConn > 0 && conn->requests >= conn->engine->maxRequestsPerConn)) {
+        raw_conn_close(conn);
+    }
+    raw_conn_complete(conn, conn->status);
+}
+
+/// Run the response parser over the data in the read buffer. Lines are parsed
+/// in place; body data is only counted. Unparsed data (a partial line) is
+/// moved to the start of the buffer. Returns FALSE if the response has been
+/// completed or failed, in which case the connection must not be touched.
+static gboolean raw_conn_parse(rmRawConn *conn)
+{
+    gchar   *data = conn->buffer, *line, *eol;
+    gsize    pos = 0, len = conn->bufferLength;
+    guint64  take;
+    gchar   *end;
+
+    while (pos < len) {
+        switch (conn->parseState) {
+            case RM_RAW_PARSE_BODY_LENGTH:
+            case RM_RAW_PARSE_CHUNK_DATA:
+                take = MIN(conn->remaining, (guint64) (len - pos));
+                conn->remaining    -= take;
+                conn->bodyReceived += take;
+                pos += (gsize) take;
+                if (conn->remaining > 0) break;
+
+                if (conn->parseState == RM_RAW_PARSE_CHUNK_DATA) {
+                    conn->parseState = RM_RAW_PARSE_CHUNK_END;
+                } else {
+                    raw_conn_response_done(conn);
+                    return FALSE;
+                }
+                break;
+
+            case RM_RAW_PARSE_BODY_UNTIL_CLOSE:
+                conn->bodyReceived += len - pos;
+                pos = len;
+                break;
+
+            default:
+                // Line based states
+                line = data + pos;
+                eol  = memchr(line, '\n', len - pos);
+                if (eol == NULL) {
+                    if (pos == 0 && len == RM_RAW_BUFFER_SIZE) {
+                        // Line too long to ever fit in the buffer
+                        raw_conn_fail(conn, SOUP_STATUS_MALFORMED);
+                        return FALSE;
+                    }
+                    memmove(data, line, len - pos);
+                    conn->bufferLength = len - pos;
+                    return TRUE;
+                }
+
+                pos = (eol - data) + 1;
+                if (eol > line && *(eol - 1) == '\r') eol--;
+                *eol = '\0';
+
+                switch (conn->parseState) {
+                    case RM_RAW_PARSE_STATUS_LINE:
+                        if (! parse_status_line(conn, line)) {
+                            raw_conn_fail(conn, SOUP_STATUS_MALFORMED);
+                            return FALSE;
+                        }
+                        conn->parseState = RM_RAW_PARSE_HEADERS;
+                        break;
+
+                    case RM_RAW_PARSE_HEADERS:
+                        if (*line != '\0') {
+                            if (! parse_header_line(conn, line)) {
+                                raw_conn_fail(conn, SOUP_STATUS_MALFORMED);
+                                return FALSE;
+                            }
+                        } else if (conn->status < 200) {
+                            // Interim response, the real one follows
+                            conn->parseState    = RM_RAW_PARSE_STATUS_LINE;
+                            conn->chunked       = FALSE;
+                            conn->contentLength = -1;
+                        } else if (! start_body(conn)) {
+                            raw_conn_response_done(conn);
+                            return FALSE;
+                        }
+                        break;
+
+                    case RM_RAW_PARSE_CHUNK_SIZE:
+                        conn->remaining = g_ascii_strtoull(line, &end, 16);
+                        if (end == line) {
+                            raw_conn_fail(conn, SOUP_STATUS_MALFORMED);
+                            return FALSE;
+                        }
+                        conn->parseState = (conn->remaining > 0 ?
+                            RM_RAW_PARSE_CHUNK_DATA : RM_RAW_PARSE_TRAILER);
+                        break;
+
+                    case RM_RAW_PARSE_CHUNK_END:
+                        conn->parseState = RM_RAW_PARSE_CHUNK_SIZE;
+                        break;
+
+                    case RM_RAW_PARSE_TRAILER:
+                        if (*line == '\0') {
+                            raw_conn_response_done(conn);
+                            return FALSE;
+                        }
+                        break;
+
+                    default:
+                        g_assert_not_reached();
+                }
+                break;
+        }
+    }
+
+    conn->bufferLength = 0;
+    return TRUE;
+}
+
+/// Read all available response data and run it through the parser
+static void raw_conn_read(rmRawConn *conn)
+{
+    ssize_t n;
+    gint64  now;
+
+    for (;;) {
+        n = read(conn->fd, conn->buffer + conn->bufferLength, RM_RAW_BUFFER_SIZE - conn->bufferLength);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            raw_conn_lost(conn);
+            return;
+        }
+
+        if (n == 0) {
+            // Connection closed by the server
+            if (conn->parseState == RM_RAW_PARSE_BODY_UNTIL_CLOSE) {
+                raw_conn_response_done(conn);
+            } else {
+                raw_conn_lost(conn);
+            }
+            return;
+        }
+
+        if (conn->firstByte < 0) {
+            now = monotonic_usec();
+            conn->firstByte = (now - conn->sendStart) / (gdouble) G_USEC_PER_SEC;
+            raw_conn_end_phase(conn, RM_PHASE_WAIT, now);
+        }
+
+        conn->received     += (guint64) n;
+        conn->bufferLength += (gsize) n;
+        if (! raw_conn_parse(conn)) return;
+    }
+}
+
+/// Handle an epoll event on a connection
+static void raw_conn_handle_event(rmRawConn *conn, guint32 events)
+{
+    gint      err = 0;
+    socklen_t errlen = sizeof(err);
+
+    switch (conn->state) {
+        case RM_RAW_CONN_CONNECTING:
+            getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+            if (err != 0) {
+                raw_conn_fail(conn, SOUP_STATUS_CANT_CONNECT);
+            } else {
+                raw_conn_end_phase(conn, RM_PHASE_CONNECT, monotonic_usec());
+                conn->connectTime = conn->phases[RM_PHASE_CONNECT];
+                raw_conn_write(conn);
+            }
+            break;
+
+        case RM_RAW_CONN_WRITING:
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                raw_conn_lost(conn);
+            } else {
+                raw_conn_write(conn);
+            }
+            break;
+
+        case RM_RAW_CONN_READING:
+            raw_conn_read(conn);
+            break;
+
+        case RM_RAW_CONN_IDLE:
+            // The server closed or reset a kept-alive connection. Close it,
+            // or epoll would keep reporting it, and reconnect on the next send.
+            if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                raw_conn_close(conn);
+            }
+            break;
+    }
+}
+
+/// Create a new connection, driven by a worker's poller. The socket is only
+/// opened once the first request is sent.
+rmRawConn* rm_raw_conn_new(rmRawEngine *engine, rmRawPoller *poller)
+{
+    rmRawConn *conn;
+
+    conn = g_malloc0(sizeof(rmRawConn));
+    conn->engine = engine;
+    conn->poller = poller;
+    conn->fd     = -1;
+    conn->state  = RM_RAW_CONN_IDLE;
+
+    return conn;
+}
+
+/// Send a request on a connection. The open connection is kept alive and
+/// reused if the request goes to the same server as the last one, otherwise
+/// a new connection is opened. The callback is called once the response has
+/// been received, or the request failed.
+void rm_raw_conn_send(rmRawConn *conn, guint request, rmRawResponseFunc func, gpointer user_data)
+{
+    const rmRawTemplate *tmpl;
+    guint                i;
+
+    g_assert(conn->state == RM_RAW_CONN_IDLE);
+    g_assert(request < conn->engine->templateCount);
+
+    tmpl = &conn->engine->templates[request];
+    conn->target       = tmpl;
+    conn->func         = func;
+    conn->userData     = user_data;
+    conn->received     = 0;
+    conn->bodyReceived = 0;
+    conn->connectTime  = -1;
+    conn->firstByte    = -1;
+    conn->sendStart    = monotonic_usec();
+    conn->phaseStart   = conn->sendStart;
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        conn->phases[i] = -1;
+    }
+
+    if (conn->fd >= 0 && conn->connected != NULL &&
+        (conn->connected->addrLength != tmpl->addrLength ||
+         memcmp(&conn->connected->addr, &tmpl->addr, tmpl->addrLength) != 0)) {
+        raw_conn_close(conn);
+    }
+
+    conn->sending = TRUE;
+    if (conn->fd < 0) {
+        raw_conn_connect(conn);
+    } else {
+        conn->reused  = TRUE;
+        conn->written = 0;
+        conn->requests++;
+        raw_conn_write(conn);
+    }
+    conn->sending = FALSE;
+}
+
+/// Cancel the request being sent on a connection, if any. The connection is
+/// closed, as the response may still be on its way, and the callback is not
+/// called.
+void rm_raw_conn_cancel(rmRawConn *conn)
+{
+    if (conn->completing != NULL) {
+        g_source_destroy(conn->completing);
+        g_source_unref(conn->completing);
+        conn->completing = NULL;
+    }
+
+    if (conn->target == NULL) return;
+
+    raw_conn_close(conn);
+    conn->state        = RM_RAW_CONN_IDLE;
+    conn->bufferLength = 0;
+    conn->target       = NULL;
+}
+
+void rm_raw_conn_free(rmRawConn *conn)
+{
+    rm_raw_conn_cancel(conn);
+    raw_conn_close(conn);
+    g_free(conn);
+}
+
+#else // HAVE_SYS_EPOLL_H
+
+rmRawEngine* rm_raw_engine_new(rmScenario *scenario, GError **error)
+{
+    g_set_error(error, RM_ERROR_RAW, RM_ERROR_RAW_UNAVAILABLE,
+        "the raw engine is not available on this platform");
+    return NULL;
+}
+
+void rm_raw_engine_free(rmRawEngine *engine)
+{
+    g_free(engine);
+}
+
+rmRawPoller* rm_raw_poller_new(GMainContext *context)
+{
+    g_return_val_if_reached(NULL);
+}
+
+void rm_raw_poller_free(rmRawPoller *poller)
+{
+}
+
+rmRawConn* rm_raw_conn_new(rmRawEngine *engine, rmRawPoller *poller)
+{
+    g_return_val_if_reached(NULL);
+}
+
+void rm_raw_conn_send(rmRawConn *conn, guint request, rmRawResponseFunc func, gpointer user_data)
+{
+    g_return_if_reached();
+}
+
+void rm_raw_conn_cancel(rmRawConn *conn)
+{
+}
+
+void rm_raw_conn_free(rmRawConn *conn)
+{
+    g_free(conn);
+}
+
+#endif // HAVE_SYS_EPOLL_H
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,144 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_RAW_H_
+#define RAINMAKER_RAW_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "rainmaker-scenario.h"
+#include "rainmaker-scoreboard.h"
+
+/// Error Quark for raw engine errors
+#define RM_ERROR_RAW g_quark_from_static_string("rainmaker-raw-error")
+
+/// Raw engine error codes
+enum {
+    RM_ERROR_RAW_UNAVAILABLE,
+    RM_ERROR_RAW_UNSUPPORTED,
+    RM_ERROR_RAW_RESOLVE
+};
+
+/// Size of the per-connection read buffer. The status line and each response
+/// header line must fit in it; body data is never kept.
+#ifndef RM_RAW_BUFFER_SIZE
+#define RM_RAW_BUFFER_SIZE 16384
+#endif
+
+/// A request serialized into its exact wire bytes, ready to be written as is.
+/// The body is not copied - its segments point to the request's body, or to
+/// the files it uploads.
+typedef struct _rmRawTemplate {
+    struct sockaddr_storage  addr;        ///< resolved server address
+    socklen_t                addrLength;
+    gchar                   *head;        ///< request line and headers
+    gsize                    headLength;
+    const rmBodySegment     *segments;    ///< body segments, in order
+    guint                    segmentCount;
+    rmBodySegment            bodySegment; ///< single segment of a body which is not segmented
+    gsize                    bodyLength;  ///< size of all segments
+    gboolean                 noBody;      ///< response has no body (HEAD request)
+} rmRawTemplate;
+
+/// The raw engine is an alternative to libsoup for raw throughput tests. It
+/// supports plain HTTP/1.1 with keep-alive, writing requests serialized up
+/// front with writev() over non-blocking sockets, and parsing responses with
+/// a minimal incremental parser that skips over response bodies. Features
+/// which need a full HTTP stack (HTTPS, cookies, logging) are not supported.
+///
+/// The engine holds one template per scenario request, indexed by request
+/// index, and is shared read-only by all workers.
+typedef struct _rmRawEngine {
+    rmRawTemplate *templates;
+    guint          templateCount;
+    gboolean       keepAlive;
+    guint          maxRequestsPerConn; ///< 0 for no limit
+} rmRawEngine;
+
+/// Each worker drives its connections with a single epoll instance, which is
+/// wrapped as a GSource on the worker's main context
+typedef struct _rmRawPoller rmRawPoller;
+
+struct _rmRawConn;
+
+/// Called when a response has been received, or the request failed. The
+/// status is an HTTP status code, or a libsoup transport error code. Timing
+/// and size of the response can be read from the connection.
+typedef void (*rmRawResponseFunc)(struct _rmRawConn *conn, guint status, gpointer user_data);
+
+/// Connection states
+typedef enum {
+    RM_RAW_CONN_IDLE,
+    RM_RAW_CONN_CONNECTING,
+    RM_RAW_CONN_WRITING,
+    RM_RAW_CONN_READING
+} rmRawConnState;
+
+/// Response parser states
+typedef enum {
+    RM_RAW_PARSE_STATUS_LINE,
+    RM_RAW_PARSE_HEADERS,
+    RM_RAW_PARSE_BODY_LENGTH,
+    RM_RAW_PARSE_BODY_UNTIL_CLOSE,
+    RM_RAW_PARSE_CHUNK_SIZE,
+    RM_RAW_PARSE_CHUNK_DATA,
+    RM_RAW_PARSE_CHUNK_END,
+    RM_RAW_PARSE_TRAILER
+} rmRawParseState;
+
+/// A single keep-alive connection, sending one request at a time. Each worker
+/// slot has its own connection.
+typedef struct _rmRawConn {
+    rmRawEngine         *engine;
+    rmRawPoller         *poller;
+    gint                 fd;
+    rmRawConnState       state;
+    const rmRawTemplate *target;      ///< template of the request being sent
+    const rmRawTemplate *connected;   ///< template the connection was opened for
+    gboolean             reused;      ///< request was sent on a kept-alive connection
+    gboolean             sending;     ///< inside rm_raw_conn_send()
+    GSource             *completing;  ///< idle source notifying the caller of a failure, if pending
+    gsize                written;     ///< bytes of the request written so far
+    guint                requests;    ///< requests sent on the open connection
+    gint64               sendStart;
+    gint64               connectStart;
+    gdouble              connectTime; ///< negative if the connection was reused
+    gdouble              firstByte;   ///< time from send to the first response byte, negative if none
+    gint64               phaseStart;  ///< time the current request phase started
+    gdouble              phases[RM_PHASE_COUNT]; ///< time spent in each phase, negative if skipped
+    rmRawResponseFunc    func;
+    gpointer             userData;
+
+    // Response parser
+    rmRawParseState      parseState;
+    guint                status;
+    gboolean             keepAlive;
+    gboolean             chunked;
+    gint64               contentLength; ///< -1 if unknown
+    guint64              remaining;     ///< body bytes left in content or chunk
+    guint64              received;      ///< response bytes received
+    guint64              bodyReceived;  ///< response body bytes received
+    gsize                bufferLength;
+    gchar                buffer[RM_RAW_BUFFER_SIZE];
+} rmRawConn;
+
+rmRawEngine*  rm_raw_engine_new(rmScenario *scenario, GError **error);
+void          rm_raw_engine_free(rmRawEngine *engine);
+rmRawPoller*  rm_raw_poller_new(GMainContext *context);
+void          rm_raw_poller_free(rmRawPoller *poller);
+rmRawConn*    rm_raw_conn_new(rmRawEngine *engine, rmRawPoller *poller);
+void          rm_raw_conn_send(rmRawConn *conn, guint request, rmRawResponseFunc func, gpointer user_data);
+void          rm_raw_conn_cancel(rmRawConn *conn);
+void          rm_raw_conn_free(rmRawConn *conn);
+
+#endif // RAINMAKER_RAW_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,318 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <stdio.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-reporter.h"
+#include "rainmaker-scoreboard.h"
+#include "rainmaker-histogram.h"
+
+#define OPENMETRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/// Labels of response code classes in metrics
+static const gchar *codeClasses[] = { "error", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+/// Take a snapshot of the running totals
+static rmScoreboard* reporter_snapshot(rmReporter *reporter)
+{
+    rmScoreboard *snapshot;
+
+    snapshot = rm_scoreboard_new(0);
+    reporter->snapshotFunc(snapshot, reporter->snapshotData);
+
+    return snapshot;
+}
+
+/// Get the number of failed responses on a scoreboard: connection errors,
+/// client errors and server errors
+static guint count_errors(const rmScoreboard *sb)
+{
+    return sb->resp_codes[0] + sb->resp_codes[4] + sb->resp_codes[5];
+}
+
+/// Called every interval on the reporter thread. Prints out the request rate,
+/// error rate and latency percentiles of responses received since the last
+/// call.
+static gboolean reporter_interval_timer(rmReporter *reporter)
+{
+    rmScoreboard *current;
+    gdouble       now, elapsed;
+    guint         requests, errors, i;
+
+    current = reporter_snapshot(reporter);
+    now     = g_timer_elapsed(reporter->clock, NULL);
+    elapsed = now - reporter->lastTime;
+
+    requests = current->requests - reporter->last->requests;
+    errors   = count_errors(current) - count_errors(reporter->last);
+    rm_histogram_diff(reporter->intervalLatency, current->latency, reporter->last->latency);
+    reporter->intervalRate = (elapsed > 0 ? requests / elapsed : 0);
+
+    printf("[%8.1fs] %9.1f req/s, errors: %5.2f%%", now, reporter->intervalRate,
+        (requests > 0 ? errors * 100.0 / requests : 0));
+    for (i = 0; i < reporter->percentileCount; i++) {
+        printf(", p%g: %.3f ms", reporter->percentiles[i],
+            rm_histogram_percentile(reporter->intervalLatency, reporter->percentiles[i]) / 1000.0);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    rm_scoreboard_free(reporter->last);
+    reporter->last     = current;
+    reporter->lastTime = now;
+
+    return TRUE;
+}
+
+/// Serve the running totals in OpenMetrics text format. Counters and the
+/// latency summary are cumulative since the start of the run; the rate and
+/// latency of the last reporting interval are exposed as gauges.
+static void reporter_metrics_handler(SoupServer *server, SoupMessage *msg, const char *path,
+    GHashTable *query, SoupClientContext *ctx, gpointer user_data)
+{
+    rmReporter   *reporter = (rmReporter *) user_data;
+    rmScoreboard *current;
+    rmHistogram  *hist;
+    GString      *out;
+    rmPhase       phase;
+    rmScriptHook  hook;
+    guint         i;
+
+    if (msg->method != SOUP_METHOD_GET && msg->method != SOUP_METHOD_HEAD) {
+        soup_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+        return;
+    }
+
+    current = reporter_snapshot(reporter);
+    out     = g_string_sized_new(2048);
+
+    g_string_append(out, "# TYPE rainmaker_requests counter\n"
+                         "# HELP rainmaker_requests Responses received, including connection errors.\n");
+    g_string_append_printf(out, "rainmaker_requests_total %u\n", current->requests);
+
+    g_string_append(out, "# TYPE rainmaker_responses counter\n"
+                         "# HELP rainmaker_responses Responses received by status code class.\n");
+    for (i = 0; i < 6; i++) {
+        g_string_append_printf(out, "rainmaker_responses_total{class=\"%s\"} %u\n",
+            codeClasses[i], current->resp_codes[i]);
+    }
+
+    g_string_append(out, "# TYPE rainmaker_connections counter\n"
+                         "# HELP rainmaker_connections Connections opened.\n");
+    g_string_append_printf(out, "rainmaker_connections_total %u\n", current->connections);
+
+    g_string_append(out, "# TYPE rainmaker_received_bytes counter\n"
+                         "# UNIT rainmaker_received_bytes bytes\n"
+                         "# HELP rainmaker_received_bytes Response body bytes received.\n");
+    g_string_append_printf(out, "rainmaker_received_bytes_total %" G_GUINT64_FORMAT "\n", current->bytesReceived);
+
+    g_string_append(out, "# TYPE rainmaker_expectation_failures counter\n"
+                         "# HELP rainmaker_expectation_failures Responses not meeting their expectations.\n");
+    g_string_append_printf(out, "rainmaker_expectation_failures_total %u\n", current->expectFailed);
+
+    g_string_append(out, "# TYPE rainmaker_extracted_values counter\n"
+                         "# HELP rainmaker_extracted_values Values extracted from responses.\n");
+    g_string_append_printf(out, "rainmaker_extracted_values_total %u\n", current->extracted);
+
+    g_string_append(out, "# TYPE rainmaker_extraction_misses counter\n"
+                         "# HELP rainmaker_extraction_misses Values extraction rules did not find.\n");
+    g_string_append_printf(out, "rainmaker_extraction_misses_total %u\n", current->extractMissed);
+
+    g_string_append(out, "# TYPE rainmaker_extraction_seconds counter\n"
+                         "# UNIT rainmaker_extraction_seconds seconds\n"
+                         "# HELP rainmaker_extraction_seconds Time spent extracting values from responses.\n");
+    g_string_append_printf(out, "rainmaker_extraction_seconds_total %.6f\n", current->extractTime);
+
+    g_string_append(out, "# TYPE rainmaker_missed_slots counter\n"
+                         "# HELP rainmaker_missed_slots Open-loop send slots missed by clients.\n");
+    g_string_append_printf(out, "rainmaker_missed_slots_total %u\n", current->missedSlots);
+
+    g_string_append(out, "# TYPE rainmaker_response_time_seconds summary\n"
+                         "# UNIT rainmaker_response_time_seconds seconds\n"
+                         "# HELP rainmaker_response_time_seconds Response time since the start of the run.\n");
+    for (i = 0; i < reporter->percentileCount; i++) {
+        g_string_append_printf(out, "rainmaker_response_time_seconds{quantile=\"%g\"} %.6f\n",
+            reporter->percentiles[i] / 100,
+            rm_histogram_percentile(current->latency, reporter->percentiles[i]) / 1000000.0);
+    }
+    g_string_append_printf(out, "rainmaker_response_time_seconds_sum %.6f\n",
+        current->latency->total / 1000000.0);
+    g_string_append_printf(out, "rainmaker_response_time_seconds_count %" G_GUINT64_FORMAT "\n",
+        current->latency->count);
+
+    g_string_append(out, "# TYPE rainmaker_phase_seconds summary\n"
+                         "# UNIT rainmaker_phase_seconds seconds\n"
+                         "# HELP rainmaker_phase_seconds Time spent in each request phase since the start of the run.\n");
+    for (phase = 0; phase < RM_PHASE_COUNT; phase++) {
+        hist = current->phases[phase];
+        for (i = 0; i < reporter->percentileCount; i++) {
+            g_string_append_printf(out, "rainmaker_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+                rm_scoreboard_phase_name(phase), reporter->percentiles[i] / 100,
+                rm_histogram_percentile(hist, reporter->percentiles[i]) / 1000000.0);
+        }
+        g_string_append_printf(out, "rainmaker_phase_seconds_sum{phase=\"%s\"} %.6f\n",
+            rm_scoreboard_phase_name(phase), hist->total / 1000000.0);
+        g_string_append_printf(out, "rainmaker_phase_seconds_count{phase=\"%s\"} %" G_GUINT64_FORMAT "\n",
+            rm_scoreboard_phase_name(phase), hist->count);
+    }
+
+    g_string_append(out, "# TYPE rainmaker_script_errors counter\n"
+                         "# HELP rainmaker_script_errors Errors raised by script hooks.\n");
+    g_string_append_printf(out, "rainmaker_script_errors_total %u\n", current->scriptErrors);
+
+    g_string_append(out, "# TYPE rainmaker_script_hook_seconds summary\n"
+                         "# UNIT rainmaker_script_hook_seconds seconds\n"
+                         "# HELP rainmaker_script_hook_seconds Time spent running each script hook since the start of the run.\n");
+    for (hook = 0; hook < RM_HOOK_COUNT; hook++) {
+        hist = current->hooks[hook];
+        g_string_append_printf(out, "rainmaker_script_hook_seconds_sum{hook=\"%s\"} %.9f\n",
+            rm_scoreboard_hook_name(hook), hist->total / 1e9);
+        g_string_append_printf(out, "rainmaker_script_hook_seconds_count{hook=\"%s\"} %" G_GUINT64_FORMAT "\n",
+            rm_scoreboard_hook_name(hook), hist->count);
+    }
+
+    if (reporter->interval > 0) {
+        g_string_append(out, "# TYPE rainmaker_interval_request_rate gauge\n"
+                             "# HELP rainmaker_interval_request_rate Requests per second in the last reporting interval.\n");
+        g_string_append_printf(out, "rainmaker_interval_request_rate %.3f\n", reporter->intervalRate);
+
+        g_string_append(out, "# TYPE rainmaker_interval_response_time_seconds gauge\n"
+                             "# UNIT rainmaker_interval_response_time_seconds seconds\n"
+                             "# HELP rainmaker_interval_response_time_seconds Response time percentiles in the last reporting interval.\n");
+        for (i = 0; i < reporter->percentileCount; i++) {
+            g_string_append_printf(out, "rainmaker_interval_response_time_seconds{quantile=\"%g\"} %.6f\n",
+                reporter->percentiles[i] / 100,
+                rm_histogram_percentile(reporter->intervalLatency, reporter->percentiles[i]) / 1000000.0);
+        }
+    }
+
+    g_string_append(out, "# EOF\n");
+
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+    soup_message_set_response(msg, OPENMETRICS_CONTENT_TYPE, SOUP_MEMORY_TAKE, out->str, out->len);
+
+    g_string_free(out, FALSE);
+    rm_scoreboard_free(current);
+}
+
+/// Reporter thread main function
+static gpointer reporter_thread_main(rmReporter *reporter)
+{
+    g_main_context_push_thread_default(reporter->context);
+    g_main_loop_run(reporter->loop);
+    g_main_context_pop_thread_default(reporter->context);
+
+    return NULL;
+}
+
+/// Quit the reporter main loop. Called on the reporter thread.
+static gboolean reporter_quit(rmReporter *reporter)
+{
+    g_main_loop_quit(reporter->loop);
+    return FALSE;
+}
+
+/// Create a new reporter. If metricsPort is not 0, the metrics server is
+/// bound to that port on the loopback interface right away, so that a busy
+/// port is reported before the test starts. Snapshots of the running totals
+/// are taken by calling func, and the clock is expected to be started when
+/// the test starts.
+rmReporter* rm_reporter_new(GTimer *clock, rmReporterSnapshotFunc func, gpointer data,
+    guint interval, guint metricsPort, const gdouble *percentiles, guint percentileCount,
+    GError **error)
+{
+    rmReporter  *reporter;
+    SoupAddress *addr;
+    GSource     *timer;
+
+    reporter = g_malloc0(sizeof(rmReporter));
+    reporter->clock           = clock;
+    reporter->snapshotFunc    = func;
+    reporter->snapshotData    = data;
+    reporter->interval        = interval;
+    reporter->percentiles     = percentiles;
+    reporter->percentileCount = percentileCount;
+    reporter->context         = g_main_context_new();
+    reporter->loop            = g_main_loop_new(reporter->context, FALSE);
+    reporter->last            = rm_scoreboard_new(0);
+    reporter->intervalLatency = rm_histogram_new();
+
+    if (interval > 0) {
+        timer = g_timeout_source_new_seconds(interval);
+        g_source_set_callback(timer, (GSourceFunc) reporter_interval_timer, reporter, NULL);
+        g_source_attach(timer, reporter->context);
+        g_source_unref(timer);
+    }
+
+    if (metricsPort > 0) {
+        addr = soup_address_new("127.0.0.1", metricsPort);
+        reporter->server = soup_server_new(SOUP_SERVER_INTERFACE, addr,
+                                           SOUP_SERVER_PORT, metricsPort,
+                                           SOUP_SERVER_ASYNC_CONTEXT, reporter->context,
+                                           NULL);
+        g_object_unref(addr);
+
+        if (reporter->server == NULL) {
+            g_set_error(error, RM_ERROR_REPORTER, RM_ERROR_REPORTER_LISTEN,
+                "unable to listen for metrics requests on 127.0.0.1:%u", metricsPort);
+            rm_reporter_free(reporter);
+            return NULL;
+        }
+
+        soup_server_add_handler(reporter->server, "/metrics", reporter_metrics_handler, reporter, NULL);
+        soup_server_run_async(reporter->server);
+    }
+
+    return reporter;
+}
+
+/// Start the reporter thread. Should be called right before the test starts.
+gboolean rm_reporter_start(rmReporter *reporter, GError **error)
+{
+    g_assert(reporter->thread == NULL);
+
+    reporter->thread = g_thread_create((GThreadFunc) reporter_thread_main, (gpointer) reporter, TRUE, error);
+
+    return (reporter->thread != NULL);
+}
+
+/// Stop the reporter thread and wait for it to exit
+void rm_reporter_stop(rmReporter *reporter)
+{
+    GSource *idle;
+
+    if (reporter->thread == NULL) return;
+
+    idle = g_idle_source_new();
+    g_source_set_callback(idle, (GSourceFunc) reporter_quit, reporter, NULL);
+    g_source_attach(idle, reporter->context);
+    g_source_unref(idle);
+
+    g_thread_join(reporter->thread);
+    reporter->thread = NULL;
+}
+
+void rm_reporter_free(rmReporter *reporter)
+{
+    rm_reporter_stop(reporter);
+
+    if (reporter->server != NULL) {
+        soup_server_quit(reporter->server);
+        g_object_unref(reporter->server);
+    }
+
+    g_main_loop_unref(reporter->loop);
+    g_main_context_unref(reporter->context);
+    rm_scoreboard_free(reporter->last);
+    rm_histogram_free(reporter->intervalLatency);
+    g_free(reporter);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,60 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_REPORTER_H_
+#define RAINMAKER_REPORTER_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-scoreboard.h"
+
+#define RM_ERROR_REPORTER g_quark_from_static_string("rainmaker-reporter-error")
+
+enum {
+    RM_ERROR_REPORTER_LISTEN
+};
+
+/// Function called to add a snapshot of the running totals into target
+typedef void (*rmReporterSnapshotFunc)(rmScoreboard *target, gpointer data);
+
+/// The reporter runs in its own thread while the test is running. Every
+/// interval it takes a snapshot of the running totals and prints the
+/// request rate, error rate and latency percentiles for the last interval. It
+/// can also serve the running totals in OpenMetrics text format over HTTP on
+/// the loopback interface, to be scraped by a monitoring system.
+///
+/// When running locally, snapshots are taken without locking the workers (see
+/// rm_scheduler_snapshot()), so reporting never slows down the test.
+typedef struct _rmReporter {
+    GTimer                 *clock;          ///< started when the test starts
+    rmReporterSnapshotFunc  snapshotFunc;
+    gpointer                snapshotData;
+    guint                   interval;       ///< seconds between reports, 0 to disable
+    const gdouble          *percentiles;
+    guint                   percentileCount;
+    GThread                *thread;
+    GMainContext           *context;
+    GMainLoop              *loop;
+    SoupServer             *server;         ///< metrics server, or NULL
+    rmScoreboard           *last;           ///< snapshot taken at the end of the last interval
+    gdouble                 lastTime;
+    gdouble                 intervalRate;   ///< request rate in the last interval
+    rmHistogram            *intervalLatency;
+} rmReporter;
+
+rmReporter*   rm_reporter_new(GTimer *clock, rmReporterSnapshotFunc func, gpointer data,
+                              guint interval, guint metricsPort, const gdouble *percentiles,
+                              guint percentileCount, GError **error);
+gboolean      rm_reporter_start(rmReporter *reporter, GError **error);
+void          rm_reporter_stop(rmReporter *reporter);
+void          rm_reporter_free(rmReporter *reporter);
+
+#endif // RAINMAKER_REPORTER_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
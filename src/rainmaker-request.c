@@ -7,6 +7,7 @@
 /// ---------------------------------------------------------------------------
 
 #include <glib.h>
+#include <string.h>
 #include <libsoup/soup.h>
 
 #include "rainmaker-request.h"
@@ -45,6 +46,7 @@ rmHeader* rm_header_new(const gchar *name, const gchar *value)
     header->name  = g_strdup(name);
     header->value = g_strdup(value);
     header->replace = FALSE;
+    header->valueTemplate = NULL;
 
     return header;
 }
@@ -53,6 +55,7 @@ void rm_header_free(rmHeader *header)
 {
     g_free(header->name);
     g_free(header->value);
+    if (header->valueTemplate != NULL) rm_template_free(header->valueTemplate);
     g_free(header);
 }
 
@@ -80,15 +83,38 @@ void rm_request_param_free(rmRequestParam *param)
     // TODO: this needs to be type aware once we have other types than string
     if (param->name != NULL) g_free(param->name);
     if (param->strValue != NULL) g_free(param->strValue);
+    g_free(param->contentType);
+    g_free(param->fileName);
 
     g_free(param);
 }
 
+/// Append a URL encoded string to a form body. Variable references (${name})
+/// are left as they are, to be rendered when the request is sent.
+static void append_encoded(GString *body, const gchar *str)
+{
+    const gchar *ref, *close;
+    gchar       *part, *encstr;
+
+    while ((ref = strstr(str, "${")) != NULL && (close = strchr(ref, '}')) != NULL) {
+        part   = g_strndup(str, ref - str);
+        encstr = soup_uri_encode(part, NULL);
+        g_string_append(body, encstr);
+        g_string_append_len(body, ref, close + 1 - ref);
+        g_free(encstr);
+        g_free(part);
+        str = close + 1;
+    }
+
+    encstr = soup_uri_encode(str, NULL);
+    g_string_append(body, encstr);
+    g_free(encstr);
+}
+
 static gchar* encode_params_urlencoded(const GSList *params, gsize *bodyLength, GError **error)
 {
     GSList  *ptr;
     GString *body;
-    gchar   *encstr;
 
     body = g_string_new("");
 
@@ -105,15 +131,13 @@ static gchar* encode_params_urlencoded(const GSList *params, gsize *bodyLength,
         }
 
         // Add encoded parameter name
-        encstr = soup_uri_encode(param->name, NULL);
-        g_string_append_printf(body, "%s%s=", (body->len > 0 ? "&" : ""), encstr);
-        g_free(encstr);
+        if (body->len > 0) g_string_append_c(body, '&');
+        append_encoded(body, param->name);
+        g_string_append_c(body, '=');
 
         // Add encoded parameter value, depending on type
         // TODO handle different types, for now all are string
-        encstr = soup_uri_encode(param->strValue, NULL);
-        g_string_append_printf(body, "%s", encstr);
-        g_free(encstr);
+        append_encoded(body, param->strValue);
     }
 
     if (*error != NULL) {
@@ -125,6 +149,163 @@ static gchar* encode_params_urlencoded(const GSList *params, gsize *bodyLength,
     return g_string_free(body, FALSE);
 }
 
+/// Append a quoted parameter or file name to a multipart part header. Quotes
+/// and line breaks are percent encoded, as browsers do.
+static void append_quoted(GString *out, const gchar *str)
+{
+    g_string_append_c(out, '"');
+    for (; *str != '\0'; str++) {
+        switch (*str) {
+            case '"':  g_string_append(out, "%22"); break;
+            case '\r': g_string_append(out, "%0D"); break;
+            case '\n': g_string_append(out, "%0A"); break;
+            default:   g_string_append_c(out, *str); break;
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+/// Set the body of a request to a multipart/form-data encoding of parameters.
+/// Part headers and string values are built once into the request's body.
+/// File contents are not read but memory mapped, and sent from the mapping as
+/// body segments between the parts built around them, so that large uploads
+/// are never copied; all clients share the request's mapping, and the kernel's
+/// page cache holds a single copy of a file however many requests map it.
+/// Without file parameters the body is a single buffer, like any other body.
+gboolean rm_request_set_multipart_body(rmRequest *request, const GSList *params, GError **error)
+{
+    const GSList         *node;
+    const rmRequestParam *param;
+    GString              *body;
+    GArray               *files;
+    gchar                *boundary, *contentType, *basename;
+    gsize                 start, end;
+    guint                 i;
+
+    boundary = g_strdup_printf("rainmaker-%08x%08x%08x%08x",
+        g_random_int(), g_random_int(), g_random_int(), g_random_int());
+    body  = g_string_new("");
+    files = g_array_new(FALSE, FALSE, sizeof(gsize));
+
+    for (node = params; node; node = node->next) {
+        param = (const rmRequestParam *) node->data;
+
+        if (param->type > RM_REQUEST_PARAM_STRING && param->type != RM_REQUEST_PARAM_FILE) {
+            g_set_error(error, RM_ERROR_REQ, RM_ERROR_REQ_INVALID_ENCTYPE,
+                "parameters of type '%s' cannot be encoded using %s",
+                rmRequestParamTypeNames[param->type], "multipart/form-data");
+            g_string_free(body, TRUE);
+            g_array_free(files, TRUE);
+            g_free(boundary);
+            return FALSE;
+        }
+
+        g_string_append_printf(body, "--%s\r\nContent-Disposition: form-data; name=", boundary);
+        append_quoted(body, param->name);
+
+        if (param->type == RM_REQUEST_PARAM_FILE) {
+            basename = g_path_get_basename(param->filePath);
+            g_string_append(body, "; filename=");
+            append_quoted(body, (param->fileName != NULL ? param->fileName : basename));
+            g_string_append_printf(body, "\r\nContent-Type: %s\r\n\r\n",
+                (param->contentType != NULL ? param->contentType : "application/octet-stream"));
+            g_array_append_val(files, body->len);
+            g_free(basename);
+
+        } else {
+            g_string_append(body, "\r\n\r\n");
+            g_string_append(body, param->strValue);
+        }
+
+        g_string_append(body, "\r\n");
+    }
+    g_string_append_printf(body, "--%s--\r\n", boundary);
+
+    contentType = g_strdup_printf("multipart/form-data; boundary=%s", boundary);
+    request->bodyType   = g_quark_from_string(contentType);
+    request->bodyLength = body->len;
+    request->body       = g_string_free(body, FALSE);
+    request->freeBody   = TRUE;
+    g_free(contentType);
+    g_free(boundary);
+
+    // Each file goes between the part headers before it and the rest of the
+    // body after it
+    start = 0;
+    for (node = params, i = 0; node; node = node->next) {
+        param = (const rmRequestParam *) node->data;
+        if (param->type != RM_REQUEST_PARAM_FILE) continue;
+
+        end = g_array_index(files, gsize, i++);
+        rm_request_add_body_text(request, start, end - start);
+        if (! rm_request_add_body_file(request, param->filePath, error)) {
+            g_array_free(files, TRUE);
+            return FALSE;
+        }
+        start = end;
+    }
+    if (files->len > 0) {
+        rm_request_add_body_text(request, start, request->bodyLength - start);
+    }
+    g_array_free(files, TRUE);
+
+    return TRUE;
+}
+
+static void add_body_segment(rmRequest *request, const rmBodySegment *segment)
+{
+    request->bodySegments = g_realloc(request->bodySegments,
+        sizeof(rmBodySegment) * (request->bodySegmentCount + 1));
+    request->bodySegments[request->bodySegmentCount++] = *segment;
+}
+
+/// Add a segment of the request's body to the segments the body is sent in.
+/// The body must not be modified from here on.
+void rm_request_add_body_text(rmRequest *request, gsize offset, gsize length)
+{
+    rmBodySegment segment = { NULL, 0, NULL, NULL };
+
+    g_assert(offset + length <= request->bodyLength);
+    if (length == 0) return;
+
+    segment.data   = request->body + offset;
+    segment.length = length;
+    add_body_segment(request, &segment);
+}
+
+/// Add a file to the segments a request's body is sent in. The file is memory
+/// mapped for as long as the request exists.
+gboolean rm_request_add_body_file(rmRequest *request, const gchar *filename, GError **error)
+{
+    rmBodySegment segment;
+
+    if ((segment.file = g_mapped_file_new(filename, FALSE, error)) == NULL) {
+        return FALSE;
+    }
+    segment.data     = g_mapped_file_get_contents(segment.file);
+    segment.length   = g_mapped_file_get_length(segment.file);
+    segment.filename = g_strdup(filename);
+    add_body_segment(request, &segment);
+
+    return TRUE;
+}
+
+/// Get the size in bytes of the body sent for a request
+gsize rm_request_content_length(const rmRequest *request)
+{
+    gsize length = 0;
+    guint i;
+
+    if (request->generator != NULL) return (gsize) request->generator->size;
+    if (request->bodySegmentCount == 0) return request->bodyLength;
+
+    for (i = 0; i < request->bodySegmentCount; i++) {
+        length += request->bodySegments[i].length;
+    }
+
+    return length;
+}
+
 gchar* rm_request_encode_params(const GSList *params, GQuark encoding, gsize *bodyLength, GError **error)
 {
     gchar *body;
@@ -132,10 +313,9 @@ gchar* rm_request_encode_params(const GSList *params, GQuark encoding, gsize *bo
     if (encoding == g_quark_from_static_string("application/x-www-form-urlencoded")) {
         body = encode_params_urlencoded(params, bodyLength, error);
 
-    } else if (encoding == g_quark_from_static_string("multipart/form-data") ||
-               encoding == g_quark_from_static_string("application/json")) {
+    } else if (encoding == g_quark_from_static_string("application/json")) {
 
-        // TODO: implement handling of these encoding types
+        // TODO: implement handling of this encoding type
         g_set_error(error, RM_ERROR_REQ, RM_ERROR_REQ_INVALID_ENCTYPE,
             "unknown or not-yet-implemented form encoding method: '%s'",
             g_quark_to_string(encoding));
@@ -166,7 +346,33 @@ rmRequest* rm_request_new(const gchar *method, gchar *url, const SoupURI *baseUr
     req->body       = NULL;
     req->bodyLength = 0;
     req->freeBody   = FALSE;
+    req->bodySegments     = NULL;
+    req->bodySegmentCount = 0;
+    req->generator        = NULL;
     req->repeat     = 1;
+    req->index      = 0;
+    req->name       = NULL;
+    req->frozen     = FALSE;
+    req->preSend      = NULL;
+    req->postComplete = NULL;
+
+    req->expects     = NULL;
+    req->expectCount = 0;
+    req->keepBody    = FALSE;
+    req->formBody    = FALSE;
+
+    req->extracts     = NULL;
+    req->extractCount = 0;
+
+    req->urlTemplate      = NULL;
+    req->templateBase     = NULL;
+    req->templatedHeaders = NULL;
+    req->bodyTemplate     = NULL;
+
+    req->methodName      = NULL;
+    req->compiledHeaders = NULL;
+    req->bodyBuffer      = NULL;
+    req->segmentBuffers  = NULL;
 
     if (baseUrl == NULL) {
         req->url = soup_uri_new(url);
@@ -192,16 +398,397 @@ void rm_header_copy_to_request(rmHeader *header, rmRequest *dest)
     rm_request_add_header(dest, header->name, header->value, header->replace);
 }
 
+/// Add a header struct to the compiled header set of a request. If the
+/// header's replace flag is set, will replace any existing headers with the
+/// same name.
+static void compile_header(rmHeader *header, SoupMessageHeaders *headers)
+{
+    if (header->replace) {
+        soup_message_headers_replace(headers, header->name, header->value);
+    } else {
+        soup_message_headers_append(headers, header->name, header->value);
+    }
+}
+
+/// Copy a header from a compiled header set to a message
+static void copy_compiled_header(const char *name, const char *value, gpointer headers)
+{
+    soup_message_headers_append((SoupMessageHeaders *) headers, name, value);
+}
+
+/// Compile templates for the parts of a request which reference variables:
+/// the URL, given as it appeared in the scenario before being resolved against
+/// the base URL, header values and the body. Parts referencing no variables
+/// are left alone. This must be called before rm_request_compile(), which
+/// leaves templated parts out of the compiled request.
+gboolean rm_request_compile_templates(rmRequest *request, const gchar *url, const SoupURI *baseUrl,
+    const rmVarTable *vars, GError **error)
+{
+    GSList   *node;
+    rmHeader *header;
+    GError   *err = NULL;
+
+    g_assert(request->compiledHeaders == NULL); // not compiled yet
+
+    request->urlTemplate = rm_template_compile(url, strlen(url), vars, 0, &err);
+    if (err != NULL) {
+        g_propagate_error(error, err);
+        return FALSE;
+    }
+    if (request->urlTemplate != NULL && baseUrl != NULL) {
+        request->templateBase = soup_uri_copy((SoupURI *) baseUrl);
+    }
+
+    for (node = request->headers; node; node = node->next) {
+        header = (rmHeader *) node->data;
+        header->valueTemplate = rm_template_compile(header->value, strlen(header->value), vars, 0, &err);
+        if (err != NULL) {
+            g_propagate_error(error, err);
+            return FALSE;
+        }
+        if (header->valueTemplate != NULL) {
+            request->templatedHeaders = g_slist_append(request->templatedHeaders, header);
+        }
+    }
+
+    request->bodyTemplate = rm_template_compile(request->body, request->bodyLength, vars,
+        (request->formBody ? RM_TEMPLATE_FORM_ENCODE : 0), &err);
+    if (err != NULL) {
+        g_propagate_error(error, err);
+        return FALSE;
+    }
+
+    // Segments point into the body, which can't be rendered
+    if (request->bodyTemplate != NULL && request->bodySegmentCount > 0) {
+        g_set_error(error, RM_ERROR_REQ, RM_ERROR_REQ_TEMPLATED_UPLOAD,
+            "variables can't be referenced in the body of a request uploading files");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// Check whether any part of a request has to be rendered for each send
+gboolean rm_request_is_templated(const rmRequest *request)
+{
+    return (request->urlTemplate != NULL || request->templatedHeaders != NULL ||
+            request->bodyTemplate != NULL);
+}
+
+/// Build a list in an arena, with the nodes laid out one after the other
+static GSList* arena_list_new(rmArena *arena, guint length)
+{
+    GSList *nodes;
+    guint   i;
+
+    if (length == 0) return NULL;
+
+    nodes = rm_arena_alloc(arena, sizeof(GSList) * length, sizeof(gpointer));
+    for (i = 0; i < length; i++) {
+        nodes[i].next = (i + 1 < length ? &nodes[i + 1] : NULL);
+    }
+
+    return nodes;
+}
+
+/// Move a request into an arena, so that the requests of a scenario can be
+/// laid out next to each other and walked without chasing pointers all over
+/// the heap. The request struct is copied to dest, which is typically an
+/// element of an array allocated from the arena, and the original struct is
+/// freed. The header list, headers and name are copied into the arena, with
+/// header names and values interned, as are bodies owned by the request;
+/// bodies pointing into other memory (such as a mapped compiled scenario)
+/// stay where they are. The request must not be compiled yet, as compiled
+/// bodies point to the body, and should be compiled once moved.
+void rm_request_freeze(rmRequest *request, rmRequest *dest, rmArena *arena)
+{
+    GSList   *node, *headers, *templated;
+    rmHeader *header, *copies;
+    gchar    *body;
+    guint     i, count, templatedCount = 0;
+
+    g_assert(request->compiledHeaders == NULL); // not compiled yet
+    g_assert(! request->frozen);
+
+    *dest = *request;
+    dest->frozen = TRUE;
+
+    count = g_slist_length(request->headers);
+    copies    = (count > 0 ? rm_arena_alloc(arena, sizeof(rmHeader) * count, sizeof(gpointer)) : NULL);
+    headers   = arena_list_new(arena, count);
+    templated = arena_list_new(arena, g_slist_length(request->templatedHeaders));
+
+    for (node = request->headers, i = 0; node; node = node->next, i++) {
+        header = (rmHeader *) node->data;
+        copies[i].name          = rm_arena_intern(arena, header->name);
+        copies[i].value         = rm_arena_intern(arena, header->value);
+        copies[i].replace       = header->replace;
+        copies[i].valueTemplate = header->valueTemplate;
+        headers[i].data = &copies[i];
+        if (header->valueTemplate != NULL) {
+            templated[templatedCount++].data = &copies[i];
+        }
+
+        // The template now belongs to the copy
+        header->valueTemplate = NULL;
+    }
+    dest->headers          = headers;
+    dest->templatedHeaders = templated;
+    rm_gslist_free_full(request->headers, (GDestroyNotify) rm_header_free);
+    g_slist_free(request->templatedHeaders);
+
+    dest->name         = rm_arena_strdup(arena, request->name);
+    dest->preSend      = rm_arena_strdup(arena, request->preSend);
+    dest->postComplete = rm_arena_strdup(arena, request->postComplete);
+    g_free(request->name);
+    g_free(request->preSend);
+    g_free(request->postComplete);
+
+    if (request->freeBody && request->body != NULL) {
+        body = rm_arena_alloc(arena, request->bodyLength + 1, 1);
+        memcpy(body, request->body, request->bodyLength);
+        body[request->bodyLength] = '\0';
+
+        // Segments of the body sent as it is point into it
+        for (i = 0; i < request->bodySegmentCount; i++) {
+            if (request->bodySegments[i].file == NULL && request->bodySegments[i].data != NULL) {
+                dest->bodySegments[i].data = body + (request->bodySegments[i].data - request->body);
+            }
+        }
+
+        g_free(request->body);
+        dest->body     = body;
+        dest->freeBody = FALSE;
+    }
+
+    g_free(request);
+}
+
+/// Compile a request into a ready-to-send template. All the work which is the
+/// same for every message sent for the request is done once: the method name
+/// is interned, the content type and headers are merged into a single header
+/// set, resolving replace flags, and the body is wrapped in a buffer which is
+/// shared by all messages without copying, as are the segments of a body sent
+/// in segments. Templated headers and body are
+/// rendered by rm_request_render_message() instead.
+void rm_request_compile(rmRequest *request)
+{
+    GSList *node;
+    guint   i;
+
+    g_assert(request->compiledHeaders == NULL); // not compiled yet
+
+    request->methodName      = g_intern_string(g_quark_to_string(request->method));
+    request->compiledHeaders = soup_message_headers_new(SOUP_MESSAGE_HEADERS_REQUEST);
+
+    if (request->body != NULL) {
+        g_assert(request->bodyType);
+        soup_message_headers_set_content_type(request->compiledHeaders,
+            g_quark_to_string(request->bodyType), NULL);
+
+        // The body lives as long as the request, which outlives all messages.
+        // Empty segments (empty files) are left out, as libsoup rejects them.
+        if (request->bodySegmentCount > 0) {
+            request->segmentBuffers = g_malloc0(sizeof(SoupBuffer *) * request->bodySegmentCount);
+            for (i = 0; i < request->bodySegmentCount; i++) {
+                if (request->bodySegments[i].length == 0) continue;
+                request->segmentBuffers[i] = soup_buffer_new(SOUP_MEMORY_STATIC,
+                    request->bodySegments[i].data, request->bodySegments[i].length);
+            }
+
+        } else if (request->bodyTemplate == NULL) {
+            request->bodyBuffer = soup_buffer_new(SOUP_MEMORY_STATIC, request->body, request->bodyLength);
+        }
+
+    } else if (request->generator != NULL) {
+        // Generated bodies are streamed by the client, which only needs the
+        // framing headers
+        g_assert(request->bodyType);
+        soup_message_headers_set_content_type(request->compiledHeaders,
+            g_quark_to_string(request->bodyType), NULL);
+        if (request->generator->chunked) {
+            soup_message_headers_set_encoding(request->compiledHeaders, SOUP_ENCODING_CHUNKED);
+        } else {
+            soup_message_headers_set_content_length(request->compiledHeaders, request->generator->size);
+        }
+    }
+
+    for (node = request->headers; node; node = node->next) {
+        if (((rmHeader *) node->data)->valueTemplate == NULL) {
+            compile_header((rmHeader *) node->data, request->compiledHeaders);
+        }
+    }
+}
+
+/// Create a new message from a compiled request
+SoupMessage* rm_request_new_message(const rmRequest *request)
+{
+    SoupMessage *msg;
+    guint        i;
+
+    g_assert(request->compiledHeaders != NULL); // request is compiled
+
+    msg = soup_message_new_from_uri(request->methodName, request->url);
+    soup_message_set_flags(msg, SOUP_MESSAGE_NO_REDIRECT);
+
+    if (request->bodyBuffer != NULL) {
+        soup_message_body_append_buffer(msg->request_body, request->bodyBuffer);
+    }
+    for (i = 0; request->segmentBuffers != NULL && i < request->bodySegmentCount; i++) {
+        if (request->segmentBuffers[i] != NULL) {
+            soup_message_body_append_buffer(msg->request_body, request->segmentBuffers[i]);
+        }
+    }
+
+    soup_message_headers_foreach(request->compiledHeaders, copy_compiled_header,
+        (gpointer) msg->request_headers);
+
+    return msg;
+}
+
+/// Prepare a message created by rm_request_new_message() to be sent again.
+/// The previous response is dropped, and request headers are restored from
+/// the template, as the session adds headers of its own (e.g. cookies) to
+/// the request when sending it. The request body is kept as is.
+void rm_request_reset_message(const rmRequest *request, SoupMessage *msg)
+{
+    soup_message_headers_clear(msg->request_headers);
+    soup_message_headers_foreach(request->compiledHeaders, copy_compiled_header,
+        (gpointer) msg->request_headers);
+
+    soup_message_headers_clear(msg->response_headers);
+    soup_message_body_truncate(msg->response_body);
+    soup_message_set_status(msg, SOUP_STATUS_NONE);
+}
+
+/// Render the templated parts of a request into a message, prepared by
+/// rm_request_new_message() or rm_request_reset_message(), using the given
+/// variable values. The scratch string is used for rendering the URL and
+/// headers, and the body is rendered into the body string, which the message
+/// points to and which must not be modified until the message has been sent.
+/// Both strings are meant to be reused, so that rendering does not allocate
+/// memory for them once they have grown enough. Returns FALSE if the rendered
+/// URL is not valid.
+gboolean rm_request_render_message(const rmRequest *request, SoupMessage *msg, const rmValue *values,
+    GString *scratch, GString *body)
+{
+    GSList   *node;
+    rmHeader *header;
+    SoupURI  *uri;
+    gboolean  valid;
+
+    if (request->urlTemplate != NULL) {
+        g_string_truncate(scratch, 0);
+        rm_template_render(request->urlTemplate, values, scratch);
+
+        if (request->templateBase == NULL) {
+            uri = soup_uri_new(scratch->str);
+        } else {
+            uri = soup_uri_new_with_base(request->templateBase, scratch->str);
+        }
+
+        valid = SOUP_URI_VALID_FOR_HTTP(uri);
+        if (valid) soup_message_set_uri(msg, uri);
+        if (uri != NULL) soup_uri_free(uri);
+        if (! valid) return FALSE;
+    }
+
+    for (node = request->templatedHeaders; node; node = node->next) {
+        header = (rmHeader *) node->data;
+
+        g_string_truncate(scratch, 0);
+        rm_template_render(header->valueTemplate, values, scratch);
+        if (header->replace) {
+            soup_message_headers_replace(msg->request_headers, header->name, scratch->str);
+        } else {
+            soup_message_headers_append(msg->request_headers, header->name, scratch->str);
+        }
+    }
+
+    if (request->bodyTemplate != NULL) {
+        g_string_truncate(body, 0);
+        rm_template_render(request->bodyTemplate, values, body);
+        soup_message_body_truncate(msg->request_body);
+        soup_message_body_append(msg->request_body, SOUP_MEMORY_STATIC, body->str, body->len);
+    }
+
+    return TRUE;
+}
+
+/// Add an expectation on the response to a request. The request takes
+/// ownership of the expectation.
+void rm_request_add_expectation(rmRequest *request, rmExpectation *exp)
+{
+    request->expects = g_realloc(request->expects, sizeof(rmExpectation *) * (request->expectCount + 1));
+    request->expects[request->expectCount++] = exp;
+
+    if (exp->type == RM_EXPECT_BODY_MATCHES) {
+        request->keepBody = TRUE;
+    }
+}
+
+/// Add a rule extracting a value from the response to a request. The request
+/// takes ownership of the rule.
+void rm_request_add_extraction(rmRequest *request, rmExtraction *ext)
+{
+    request->extracts = g_realloc(request->extracts, sizeof(rmExtraction *) * (request->extractCount + 1));
+    request->extracts[request->extractCount++] = ext;
+}
+
 /// Free a request struct and all related memory. Will also free the URL if set,
-/// the list of headers, and if set to do so, the request body.
+/// the list of headers, and if set to do so, the request body. Of a frozen
+/// request, only memory outside the arena it lives in is freed.
 void rm_request_free(rmRequest *req)
 {
+    GSList *node;
+    guint   i;
+
     if (req->url != NULL) soup_uri_free(req->url);
+    if (req->templateBase != NULL) soup_uri_free(req->templateBase);
+    if (req->urlTemplate != NULL) rm_template_free(req->urlTemplate);
+    if (req->bodyTemplate != NULL) rm_template_free(req->bodyTemplate);
+
+    if (req->compiledHeaders != NULL) soup_message_headers_free(req->compiledHeaders);
+    if (req->bodyBuffer != NULL) soup_buffer_free(req->bodyBuffer);
+
+    for (i = 0; i < req->bodySegmentCount; i++) {
+        if (req->segmentBuffers && req->segmentBuffers[i]) soup_buffer_free(req->segmentBuffers[i]);
+        if (req->bodySegments[i].file) g_mapped_file_unref(req->bodySegments[i].file);
+        g_free(req->bodySegments[i].filename);
+    }
+    g_free(req->segmentBuffers);
+    g_free(req->bodySegments);
+    if (req->generator != NULL) rm_generator_free(req->generator);
+
+    for (i = 0; i < req->expectCount; i++) {
+        rm_expectation_free(req->expects[i]);
+    }
+    g_free(req->expects);
+
+    for (i = 0; i < req->extractCount; i++) {
+        rm_extraction_free(req->extracts[i]);
+    }
+    g_free(req->extracts);
+
+    if (req->frozen) {
+        // Everything else is released along with the arena
+        for (node = req->headers; node; node = node->next) {
+            if (((rmHeader *) node->data)->valueTemplate != NULL) {
+                rm_template_free(((rmHeader *) node->data)->valueTemplate);
+            }
+        }
+        return;
+    }
+
+    g_slist_free(req->templatedHeaders);
     rm_gslist_free_full(req->headers, (GDestroyNotify) rm_header_free);
 
     if (req->freeBody && req->body != NULL)
         g_free(req->body);
 
+    g_free(req->name);
+    g_free(req->preSend);
+    g_free(req->postComplete);
     g_free(req);
 }
 
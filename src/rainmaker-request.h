@@ -11,12 +11,29 @@
 
 #ifndef RAINMAKER_REQUEST_H_
 
+#include "rainmaker-expect.h"
+#include "rainmaker-template.h"
+#include "rainmaker-extract.h"
+#include "rainmaker-generator.h"
+#include "rainmaker-arena.h"
+
 typedef struct _rmHeader {
-    gchar    *name;
-    gchar    *value;
-    gboolean  replace;
+    gchar      *name;
+    gchar      *value;
+    gboolean    replace;
+    rmTemplate *valueTemplate; ///< set if the value references variables
 } rmHeader;
 
+/// A segment of a request body made of several parts, such as a multipart
+/// body with file uploads. Segments point either into the request's body, or
+/// into a memory mapped file which is sent as it is, without being copied.
+typedef struct _rmBodySegment {
+    const gchar *data;
+    gsize        length;
+    GMappedFile *file;      ///< set for file segments
+    gchar       *filename;  ///< set for file segments
+} rmBodySegment;
+
 typedef enum {
     RM_REQUEST_PARAM_INT,
     RM_REQUEST_PARAM_FLOAT,
@@ -40,9 +57,14 @@ typedef struct _rmRequestParam {
         GSList         *objectValue;
         gchar          *filePath;
     };
+    gchar              *contentType;  ///< file parameters: content type of the file
+    gchar              *fileName;     ///< file parameters: file name sent to the server, if not the path's
 } rmRequestParam;
 
-/// Rainmaker request struct
+/// Rainmaker request struct. Once a request is fully set up, it is compiled
+/// into a ready-to-send template (see rm_request_compile()), after which it
+/// should not be modified. Requests of a loaded scenario are frozen into the
+/// scenario's arena (see rm_request_freeze()).
 typedef struct _rmRequest {
     GQuark    method;      ///< request method
     SoupURI  *url;         ///< request URL
@@ -51,7 +73,35 @@ typedef struct _rmRequest {
     gchar    *body;        ///< request body
     gsize     bodyLength;  ///< request body size in bytes
     gboolean  freeBody;    ///< do we need to free the body when done?
+    rmBodySegment *bodySegments;     ///< set if the body is sent in segments rather than as a whole
+    guint          bodySegmentCount;
+    rmGenerator   *generator;        ///< set if the body is generated while it is sent
     guint     repeat;      ///< how many times to repeat the request
+    guint     index;       ///< position of the request in the scenario
+    gchar    *name;        ///< optional request name, for reporting
+    gboolean  frozen;      ///< struct, headers, name, hooks and body live in an arena
+    gchar    *preSend;      ///< name of the script function run before sending the request, if any
+    gchar    *postComplete; ///< name of the script function run after receiving the response, if any
+
+    rmExpectation **expects;     ///< expectations on the response
+    guint           expectCount;
+    gboolean        keepBody;    ///< an expectation needs the full response body
+    gboolean        formBody;    ///< body is form-encoded, and so are variable values rendered into it
+    rmExtraction  **extracts;    ///< values extracted from the response into variables
+    guint           extractCount;
+
+    // Templates for the parts of the request referencing variables, set by
+    // rm_request_compile_templates(). These parts are rendered for each send.
+    rmTemplate *urlTemplate;
+    SoupURI    *templateBase;     ///< base URL the rendered URL is resolved against
+    GSList     *templatedHeaders; ///< headers with a value template, left out of the compiled headers
+    rmTemplate *bodyTemplate;
+
+    // Compiled template, set by rm_request_compile()
+    const gchar        *methodName;      ///< interned method name
+    SoupMessageHeaders *compiledHeaders; ///< all headers, replace flags resolved
+    SoupBuffer         *bodyBuffer;      ///< body shared by all messages
+    SoupBuffer        **segmentBuffers;  ///< body segments shared by all messages
 } rmRequest;
 
 /// Error Quark for request related errors
@@ -60,7 +110,8 @@ typedef struct _rmRequest {
 /// Request related error codes
 enum {
     RM_ERROR_REQ_INVALID_URI,
-    RM_ERROR_REQ_INVALID_ENCTYPE
+    RM_ERROR_REQ_INVALID_ENCTYPE,
+    RM_ERROR_REQ_TEMPLATED_UPLOAD
 };
 
 rmHeader*       rm_header_new(const gchar *name, const gchar *value);
@@ -69,8 +120,23 @@ void            rm_header_free(rmHeader *header);
 rmRequestParam* rm_request_param_new(rmRequestParamType type);
 void            rm_request_param_free(rmRequestParam *param);
 gchar*          rm_request_encode_params(const GSList *params, GQuark encoding, gsize *bodyLength, GError **error);
+gboolean        rm_request_set_multipart_body(rmRequest *request, const GSList *params, GError **error);
+void            rm_request_add_body_text(rmRequest *request, gsize offset, gsize length);
+gboolean        rm_request_add_body_file(rmRequest *request, const gchar *filename, GError **error);
+gsize           rm_request_content_length(const rmRequest *request);
 rmRequest*      rm_request_new(const gchar *method, gchar *url, const SoupURI *baseUrl, GError **error);
 void            rm_request_add_header(rmRequest *request, const gchar *name, const gchar *value, gboolean reaplce);
+void            rm_request_add_expectation(rmRequest *request, rmExpectation *exp);
+void            rm_request_add_extraction(rmRequest *request, rmExtraction *ext);
+gboolean        rm_request_compile_templates(rmRequest *request, const gchar *url, const SoupURI *baseUrl,
+                                             const rmVarTable *vars, GError **error);
+gboolean        rm_request_is_templated(const rmRequest *request);
+void            rm_request_freeze(rmRequest *request, rmRequest *dest, rmArena *arena);
+void            rm_request_compile(rmRequest *request);
+SoupMessage*    rm_request_new_message(const rmRequest *request);
+void            rm_request_reset_message(const rmRequest *request, SoupMessage *msg);
+gboolean        rm_request_render_message(const rmRequest *request, SoupMessage *msg, const rmValue *values,
+                                          GString *scratch, GString *body);
 void            rm_request_free(rmRequest *req);
 
 // This can go away if we decide to bump the glib version requirement to 2.28
@@ -0,0 +1,324 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rainmaker-samplelog.h"
+
+/// Longest a sample formatted as text can be
+#define SAMPLE_MAX_LENGTH 192
+
+/// Size of a sample in binary sample logs
+#define SAMPLE_RECORD_SIZE 32
+
+/// Size of the header of binary sample logs: magic, version, record size and
+/// the wall clock time the run started, in us since the epoch
+#define SAMPLE_HEADER_SIZE 24
+
+/// Get the monotonic clock time in microseconds
+static gint64 monotonic_usec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/// Create a new sample log writing into a file, with a ring for each of a
+/// number of producers. The file is created, or truncated, right away. The
+/// format is picked by the file's extension: '.csv' for CSV, '.jsonl' for
+/// JSON Lines, and the compact binary format for anything else.
+rmSampleLog* rm_sample_log_new(const gchar *path, guint rings, GError **error)
+{
+    rmSampleLog *log;
+    guint        i;
+    gint         fd;
+
+    g_assert(rings > 0);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        g_set_error(error, RM_ERROR_SAMPLELOG, RM_ERROR_SAMPLELOG_OPEN,
+            "failed opening sample log '%s': %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    log = g_malloc0(sizeof(rmSampleLog));
+    log->path      = g_strdup(path);
+    log->fd        = fd;
+    log->ringCount = rings;
+    log->arena     = rm_arena_new();
+    log->rings     = rm_arena_alloc(log->arena, sizeof(rmSampleRing) * rings, RM_CACHE_LINE_SIZE);
+    memset(log->rings, 0, sizeof(rmSampleRing) * rings);
+    log->buffer    = g_malloc(RM_SAMPLE_LOG_BUFFER_SIZE);
+
+    if (g_str_has_suffix(path, ".csv")) {
+        log->format = RM_SAMPLE_LOG_CSV;
+    } else if (g_str_has_suffix(path, ".jsonl")) {
+        log->format = RM_SAMPLE_LOG_JSONL;
+    } else {
+        log->format = RM_SAMPLE_LOG_BINARY;
+    }
+
+    for (i = 0; i < rings; i++) {
+        log->rings[i].samples = g_malloc(sizeof(rmSample) * RM_SAMPLE_RING_SIZE);
+    }
+
+    return log;
+}
+
+/// Get one of the log's rings. Each ring must only be pushed to from a single
+/// thread at a time.
+rmSampleRing* rm_sample_log_ring(rmSampleLog *log, guint index)
+{
+    g_assert(index < log->ringCount);
+
+    return &log->rings[index];
+}
+
+/// Write the output buffer out to the file. After a write error, output is
+/// dropped, but the rings are still drained so that producers don't notice.
+static void sample_log_flush(rmSampleLog *log, guint buffered)
+{
+    gsize   done = 0;
+    gssize  res;
+
+    while (log->error == NULL && done < log->bufferLength) {
+        res = write(log->fd, log->buffer + done, log->bufferLength - done);
+        if (res < 0 && errno != EINTR) {
+            g_set_error(&log->error, RM_ERROR_SAMPLELOG, RM_ERROR_SAMPLELOG_WRITE,
+                "failed writing sample log '%s': %s", log->path, g_strerror(errno));
+        } else if (res > 0) {
+            done += res;
+        }
+    }
+
+    if (log->error == NULL) log->written += buffered;
+
+    log->bufferLength = 0;
+    log->flushed      = monotonic_usec();
+}
+
+/// Append a sample to the output buffer, in the log's format
+static void sample_log_format(rmSampleLog *log, const rmSample *sample)
+{
+    gchar   *out = log->buffer + log->bufferLength;
+    guint64  u64;
+    guint32  u32;
+
+    switch (log->format) {
+        case RM_SAMPLE_LOG_BINARY:
+            u64 = GUINT64_TO_LE((guint64) sample->timestamp); memcpy(out, &u64, 8);
+            u64 = GUINT64_TO_LE(sample->bytes);               memcpy(out + 8, &u64, 8);
+            u32 = GUINT32_TO_LE(sample->latency);             memcpy(out + 16, &u32, 4);
+            u32 = GUINT32_TO_LE(sample->client);              memcpy(out + 20, &u32, 4);
+            u32 = GUINT32_TO_LE(sample->request);             memcpy(out + 24, &u32, 4);
+            u32 = GUINT32_TO_LE(sample->status);              memcpy(out + 28, &u32, 4);
+            log->bufferLength += SAMPLE_RECORD_SIZE;
+            break;
+
+        case RM_SAMPLE_LOG_CSV:
+            log->bufferLength += g_snprintf(out, SAMPLE_MAX_LENGTH,
+                "%" G_GINT64_FORMAT ",%u,%u,%u,%u,%" G_GUINT64_FORMAT "\n", sample->timestamp,
+                sample->client, sample->request, sample->status, sample->latency, sample->bytes);
+            break;
+
+        case RM_SAMPLE_LOG_JSONL:
+            log->bufferLength += g_snprintf(out, SAMPLE_MAX_LENGTH,
+                "{\"time\":%" G_GINT64_FORMAT ",\"client\":%u,\"request\":%u,\"status\":%u,"
+                "\"latency\":%u,\"bytes\":%" G_GUINT64_FORMAT "}\n", sample->timestamp,
+                sample->client, sample->request, sample->status, sample->latency, sample->bytes);
+            break;
+    }
+}
+
+/// Take all samples out of a ring into the output buffer, writing the buffer
+/// out whenever it fills up. Slots are handed back to the producer before
+/// each write, so that it can go on while the writer waits for the disk.
+/// Returns the number of samples taken out.
+static guint sample_log_drain(rmSampleLog *log, rmSampleRing *ring, guint *buffered)
+{
+    guint start = (guint) ring->tail, tail = start;
+    guint head  = (guint) g_atomic_int_get(&ring->head);
+
+    for (; tail != head; tail++) {
+        if (log->bufferLength + SAMPLE_MAX_LENGTH > RM_SAMPLE_LOG_BUFFER_SIZE) {
+            g_atomic_int_set(&ring->tail, (gint) tail);
+            sample_log_flush(log, *buffered);
+            *buffered = 0;
+        }
+
+        sample_log_format(log, &ring->samples[tail & (RM_SAMPLE_RING_SIZE - 1)]);
+        (*buffered)++;
+    }
+
+    g_atomic_int_set(&ring->tail, (gint) tail);
+
+    return head - start;
+}
+
+/// Writer thread main function. Goes over all rings every interval, or right
+/// away if a ring was getting full, and writes output out once the buffer is
+/// half full, or has been kept for too long. Once the log is stopping, the
+/// rings are drained one last time: all producers are done by then.
+static gpointer sample_log_main(rmSampleLog *log)
+{
+    gboolean stopping;
+    guint    i, drained, busiest, buffered = 0;
+
+    do {
+        stopping = g_atomic_int_get(&log->stopping);
+
+        busiest = 0;
+        for (i = 0; i < log->ringCount; i++) {
+            drained = sample_log_drain(log, &log->rings[i], &buffered);
+            busiest = MAX(busiest, drained);
+        }
+
+        if (stopping || log->bufferLength >= RM_SAMPLE_LOG_BUFFER_SIZE / 2 ||
+            monotonic_usec() - log->flushed >= (gint64) RM_SAMPLE_LOG_FLUSH_INTERVAL * 1000) {
+
+            sample_log_flush(log, buffered);
+            buffered = 0;
+        }
+
+        if (! stopping && busiest < RM_SAMPLE_RING_SIZE / 2) {
+            g_usleep(RM_SAMPLE_LOG_INTERVAL * 1000);
+        }
+    } while (! stopping);
+
+    return NULL;
+}
+
+/// Start the writer thread, at the start of the run. Sample timestamps are
+/// relative to this time. Binary logs start with a header, and CSV logs with
+/// a line of column names.
+gboolean rm_sample_log_start(rmSampleLog *log, GError **error)
+{
+    GTimeVal  now;
+    gint64    start;
+    guint32   u32;
+    guint     i;
+
+    g_assert(log->writer == NULL);
+
+    g_get_current_time(&now);
+    start = (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+
+    log->flushed = monotonic_usec();
+    for (i = 0; i < log->ringCount; i++) {
+        log->rings[i].origin = log->flushed;
+    }
+
+    if (log->format == RM_SAMPLE_LOG_BINARY) {
+        memcpy(log->buffer, RM_SAMPLE_LOG_MAGIC, 8);
+        u32 = GUINT32_TO_LE(RM_SAMPLE_LOG_VERSION); memcpy(log->buffer + 8, &u32, 4);
+        u32 = GUINT32_TO_LE(SAMPLE_RECORD_SIZE);    memcpy(log->buffer + 12, &u32, 4);
+        start = GINT64_TO_LE(start);                memcpy(log->buffer + 16, &start, 8);
+        log->bufferLength = SAMPLE_HEADER_SIZE;
+    } else if (log->format == RM_SAMPLE_LOG_CSV) {
+        log->bufferLength = g_strlcpy(log->buffer, "time,client,request,status,latency,bytes\n",
+                                      RM_SAMPLE_LOG_BUFFER_SIZE);
+    }
+
+    log->writer = g_thread_create((GThreadFunc) sample_log_main, (gpointer) log, TRUE, error);
+
+    return (log->writer != NULL);
+}
+
+/// Stop the writer thread once the run is over, writing out all samples left
+/// in the rings, and close the file. All producers must be done. Returns FALSE
+/// if writing the file failed.
+gboolean rm_sample_log_stop(rmSampleLog *log, GError **error)
+{
+    if (log->writer != NULL) {
+        g_atomic_int_set(&log->stopping, 1);
+        g_thread_join(log->writer);
+        log->writer = NULL;
+    }
+
+    if (log->fd >= 0) {
+        if (close(log->fd) != 0 && log->error == NULL) {
+            g_set_error(&log->error, RM_ERROR_SAMPLELOG, RM_ERROR_SAMPLELOG_WRITE,
+                "failed writing sample log '%s': %s", log->path, g_strerror(errno));
+        }
+        log->fd = -1;
+    }
+
+    if (log->error != NULL) {
+        g_propagate_error(error, g_error_copy(log->error));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/// Get the number of samples dropped as rings were full. Only accurate once
+/// the log has been stopped.
+guint64 rm_sample_log_dropped(const rmSampleLog *log)
+{
+    guint64 dropped = 0;
+    guint   i;
+
+    for (i = 0; i < log->ringCount; i++) {
+        dropped += log->rings[i].dropped;
+    }
+
+    return dropped;
+}
+
+/// Free a sample log, stopping it first if needed
+void rm_sample_log_free(rmSampleLog *log)
+{
+    guint i;
+
+    rm_sample_log_stop(log, NULL);
+
+    for (i = 0; i < log->ringCount; i++) {
+        g_free(log->rings[i].samples);
+    }
+    rm_arena_free(log->arena);
+    g_free(log->buffer);
+    if (log->error) g_error_free(log->error);
+    g_free(log->path);
+    g_free(log);
+}
+
+/// Push a response into a ring. The sample is stamped with the time the
+/// request was sent, worked out from its latency. Never blocks: if the writer
+/// has fallen behind and the ring is full, the sample is dropped and counted.
+void rm_sample_ring_push(rmSampleRing *ring, guint client, guint request, guint status,
+                         guint64 latency, guint64 bytes)
+{
+    rmSample *sample;
+    guint     head = (guint) ring->head;
+
+    if (head - (guint) g_atomic_int_get(&ring->tail) >= RM_SAMPLE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    sample = &ring->samples[head & (RM_SAMPLE_RING_SIZE - 1)];
+    sample->timestamp = monotonic_usec() - ring->origin - (gint64) latency;
+    sample->bytes     = bytes;
+    sample->latency   = (guint32) MIN(latency, G_MAXUINT32);
+    sample->client    = client;
+    sample->request   = request;
+    sample->status    = status;
+
+    // Publish the sample only once it has been written
+    g_atomic_int_set(&ring->head, (gint) (head + 1));
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
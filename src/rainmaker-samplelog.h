@@ -0,0 +1,122 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_SAMPLELOG_H_
+#define RAINMAKER_SAMPLELOG_H_
+
+#include <glib.h>
+
+#include "rainmaker-arena.h"
+
+/// Error Quark for sample log related errors
+#define RM_ERROR_SAMPLELOG g_quark_from_static_string("rainmaker-samplelog-error")
+
+/// Sample log error codes
+enum {
+    RM_ERROR_SAMPLELOG_OPEN,
+    RM_ERROR_SAMPLELOG_WRITE
+};
+
+/// Number of samples each ring holds. Must be a power of two.
+#ifndef RM_SAMPLE_RING_SIZE
+#define RM_SAMPLE_RING_SIZE 65536
+#endif
+
+/// Time (in ms) the writer sleeps between passes over the rings
+#ifndef RM_SAMPLE_LOG_INTERVAL
+#define RM_SAMPLE_LOG_INTERVAL 10
+#endif
+
+/// Size of the writer's output buffer. Output is written in chunks of at
+/// least half this size while samples keep coming.
+#ifndef RM_SAMPLE_LOG_BUFFER_SIZE
+#define RM_SAMPLE_LOG_BUFFER_SIZE (1024 * 1024)
+#endif
+
+/// Longest time (in ms) output is kept in the writer's buffer
+#ifndef RM_SAMPLE_LOG_FLUSH_INTERVAL
+#define RM_SAMPLE_LOG_FLUSH_INTERVAL 1000
+#endif
+
+/// Magic string at the start of binary sample logs
+#define RM_SAMPLE_LOG_MAGIC "RMSAMPLE"
+
+/// Version of the binary sample log format
+#define RM_SAMPLE_LOG_VERSION 1
+
+/// A single response, as recorded in the sample log
+typedef struct _rmSample {
+    gint64   timestamp;  ///< time the request was sent, in us since the start of the run
+    guint64  bytes;      ///< response body bytes received
+    guint32  latency;    ///< response time, in us
+    guint32  client;
+    guint32  request;    ///< index of the request in the scenario
+    guint32  status;     ///< HTTP status code, or libsoup transport error code
+} rmSample;
+
+/// Formats sample logs are written in
+typedef enum {
+    RM_SAMPLE_LOG_BINARY,   ///< header followed by fixed size little-endian records
+    RM_SAMPLE_LOG_CSV,
+    RM_SAMPLE_LOG_JSONL     ///< one JSON object per line
+} rmSampleLogFormat;
+
+struct _rmSampleLog;
+
+/// A single producer, single consumer ring of samples. Each worker pushes the
+/// samples of all clients it runs into its own ring, and only the writer
+/// thread takes them out, so neither side ever takes a lock. A sample pushed
+/// while the ring is full is dropped and counted, rather than waiting for the
+/// writer. The head is only written by the producer and the tail only by the
+/// writer; each is padded to a cache line of its own, and rings are allocated
+/// aligned to cache lines, so that neither shares a line with the other, nor
+/// with the neighbouring rings.
+typedef struct _rmSampleRing {
+    volatile gint         head;      ///< number of samples pushed
+    guint                 dropped;   ///< samples dropped as the ring was full, written by the producer
+    gint64                origin;    ///< monotonic time the run started, in us
+    rmSample             *samples;
+    gchar                 headPad[RM_CACHE_LINE_SIZE - 2 * sizeof(gint) - sizeof(gint64) -
+                                  sizeof(rmSample *)];
+    volatile gint         tail;      ///< number of samples taken out by the writer
+    gchar                 tailPad[RM_CACHE_LINE_SIZE - sizeof(gint)];
+} rmSampleRing;
+
+/// A sample log writes every response received during a run into a file for
+/// offline analysis. A background thread drains the rings of all workers
+/// every now and then, formats their samples into a large buffer, and writes
+/// the buffer out once it is half full, so that the file is written in large
+/// sequential chunks and workers never wait on disk I/O.
+typedef struct _rmSampleLog {
+    gchar                *path;
+    rmSampleLogFormat     format;
+    gint                  fd;
+    rmArena              *arena;     ///< holds the rings, aligned to cache lines
+    rmSampleRing         *rings;
+    guint                 ringCount;
+    GThread              *writer;
+    volatile gint         stopping;
+    gchar                *buffer;
+    gsize                 bufferLength;
+    gint64                flushed;   ///< monotonic time the buffer was last written out, in us
+    guint64               written;   ///< samples written to the file
+    GError               *error;     ///< first write error, after which output is discarded
+} rmSampleLog;
+
+rmSampleLog*  rm_sample_log_new(const gchar *path, guint rings, GError **error);
+rmSampleRing* rm_sample_log_ring(rmSampleLog *log, guint index);
+gboolean      rm_sample_log_start(rmSampleLog *log, GError **error);
+gboolean      rm_sample_log_stop(rmSampleLog *log, GError **error);
+guint64       rm_sample_log_dropped(const rmSampleLog *log);
+void          rm_sample_log_free(rmSampleLog *log);
+void          rm_sample_ring_push(rmSampleRing *ring, guint client, guint request, guint status,
+                                  guint64 latency, guint64 bytes);
+
+#endif // RAINMAKER_SAMPLELOG_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,1068 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+/// Compiled scenarios. A scenario loaded from XML (and validated) can be
+/// written out in a compact binary format, which loads without any parsing:
+/// the file is memory mapped, its tables are read in place, and request
+/// bodies are used directly from the mapping without being copied.
+
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-scenario.h"
+#include "rainmaker-scenario-bin.h"
+
+#define BIN_MAGIC "RMSC"
+#define BIN_NONE  G_MAXUINT32
+
+/// Flags for boolean scenario options
+enum {
+    BIN_PERSIST_COOKIES       = 1 << 0,
+    BIN_FAIL_ON_HTTP_ERROR    = 1 << 1,
+    BIN_FAIL_ON_HTTP_REDIRECT = 1 << 2,
+    BIN_FAIL_ON_TCP_ERROR     = 1 << 3,
+    BIN_KEEP_ALIVE            = 1 << 4,
+    BIN_DISCARD_RESPONSE_BODY = 1 << 5,
+    BIN_FAIL_ON_EXPECTATION   = 1 << 6
+};
+
+/// Flags for boolean request options
+enum {
+    BIN_FORM_BODY         = 1 << 0,
+    BIN_GENERATED_CHUNKED = 1 << 1
+};
+
+/// File header. It is followed by the request, header, expectation, extraction,
+/// body segment, feeder, variable, script and load profile stage tables, the
+/// string pool and the request body data (which also holds script sources),
+/// in this order. All fields are
+/// 32 bit little endian unsigned integers, so that the tables are aligned in
+/// a mapped file and can be read in place. Strings are offsets into the
+/// string pool, which holds each distinct string once, NUL terminated.
+typedef struct _rmBinHeader {
+    gchar    magic[4];
+    guint32  version;
+    guint32  flags;
+    guint32  maxConnsPerHost;
+    guint32  maxRequestsPerConn;
+    guint32  requestCount;
+    guint32  headerCount;
+    guint32  expectCount;
+    guint32  extractCount;
+    guint32  segmentCount;
+    guint32  feederCount;
+    guint32  variableCount;
+    guint32  scriptCount;
+    guint32  stageCount;
+    guint32  preIteration;  ///< string, or BIN_NONE
+    guint32  postIteration; ///< string, or BIN_NONE
+    guint32  poolLength;
+    guint32  dataLength;
+} rmBinHeader;
+
+typedef struct _rmBinRequest {
+    guint32  method;       ///< string
+    guint32  url;          ///< string, always an absolute URL
+    guint32  name;         ///< string, or BIN_NONE
+    guint32  bodyType;     ///< string, or BIN_NONE
+    guint32  bodyOffset;   ///< offset of the body in the body data, or BIN_NONE
+    guint32  bodyLength;
+    guint32  repeat;
+    guint32  firstHeader;  ///< index of the request's first header in the header table
+    guint32  headerCount;
+    guint32  firstExpect;  ///< index of the request's first expectation in the expectation table
+    guint32  expectCount;
+    guint32  urlTemplate;  ///< string, the URL as it appeared in the scenario if it references variables, or BIN_NONE
+    guint32  baseUrl;      ///< string, the base URL the URL template is resolved against, or BIN_NONE
+    guint32  flags;
+    guint32  firstExtract; ///< index of the request's first extraction rule in the extraction table
+    guint32  extractCount;
+    guint32  firstSegment; ///< index of the request's first body segment in the segment table
+    guint32  segmentCount; ///< 0 unless the body is sent in segments
+    guint32  generator;    ///< pattern of a generated body, or BIN_NONE
+    guint32  generatorText; ///< string, or BIN_NONE
+    guint32  generatorSize[2]; ///< size of a generated body, low 32 bits first
+    guint32  preSend;      ///< string, or BIN_NONE
+    guint32  postComplete; ///< string, or BIN_NONE
+} rmBinRequest;
+
+typedef struct _rmBinHeaderEntry {
+    guint32  name;         ///< string
+    guint32  value;        ///< string
+    guint32  replace;
+} rmBinHeaderEntry;
+
+/// An expectation. Status expectations keep the lowest and highest expected
+/// status as their first two arguments; header expectations keep the header
+/// name, value and pattern, and body expectations keep the string and the
+/// pattern, all of which are strings or BIN_NONE.
+typedef struct _rmBinExpect {
+    guint32  type;
+    guint32  label;        ///< string
+    guint32  args[3];
+} rmBinExpect;
+
+/// A value extraction rule. Header rules keep the header name and pattern as
+/// their arguments, body rules keep the pattern and JSON rules keep the path.
+typedef struct _rmBinExtract {
+    guint32  type;
+    guint32  variable;     ///< string, name of the variable the value is stored in
+    guint32  args[2];      ///< strings, or BIN_NONE
+} rmBinExtract;
+
+/// A segment of a request body sent in segments: either a part of the
+/// request's body data, or a file. Like data files, uploaded files are not
+/// compiled into the scenario, and are mapped again with the scenario.
+typedef struct _rmBinSegment {
+    guint32  file;         ///< string, or BIN_NONE for a part of the body data
+    guint32  offset;       ///< offset of the part in the request's body data
+    guint32  length;
+} rmBinSegment;
+
+/// A data feeder. Data files are not compiled into the scenario, and are
+/// loaded again with the scenario.
+typedef struct _rmBinFeeder {
+    guint32  name;         ///< string
+    guint32  file;         ///< string
+    guint32  format;
+    guint32  mode;
+    guint32  scope;
+} rmBinFeeder;
+
+/// A script. Scripts are kept as source, and compiled again when the scenario
+/// is loaded, as bytecode is specific to the Lua build it was compiled with.
+typedef struct _rmBinScript {
+    guint32  offset;       ///< offset of the source in the body data
+    guint32  length;
+} rmBinScript;
+
+/// A load profile stage. Times are kept in microseconds, and the target level
+/// in thousandths, so that fractional rates are kept.
+typedef struct _rmBinStage {
+    guint32  name;         ///< string, or BIN_NONE
+    guint32  type;
+    guint32  duration[2];  ///< low 32 bits first
+    guint32  ramp[2];      ///< low 32 bits first
+    guint32  target;
+} rmBinStage;
+
+/// State of a scenario being compiled
+typedef struct _rmBinWriter {
+    GByteArray *requests;
+    GByteArray *headers;
+    GByteArray *expects;
+    GByteArray *extracts;
+    GByteArray *segments;
+    GByteArray *feeders;
+    GByteArray *variables;
+    GByteArray *scripts;
+    GByteArray *stages;
+    GByteArray *pool;
+    GByteArray *data;
+    GHashTable *strings;   ///< offset of each string already in the pool
+    const rmVarTable *varTable;
+    guint32     headerCount;
+    guint32     expectCount;
+    guint32     extractCount;
+    guint32     segmentCount;
+} rmBinWriter;
+
+static void put_u32(GByteArray *buf, guint32 value)
+{
+    guint32 le = GUINT32_TO_LE(value);
+    g_byte_array_append(buf, (const guint8 *) &le, sizeof(le));
+}
+
+/// Add a string to the pool, unless it is already there, and return its offset
+static guint32 pool_string(rmBinWriter *writer, const gchar *str)
+{
+    gpointer offset;
+    guint32  pos;
+
+    if (str == NULL) return BIN_NONE;
+
+    if (g_hash_table_lookup_extended(writer->strings, str, NULL, &offset)) {
+        return GPOINTER_TO_UINT(offset);
+    }
+
+    pos = writer->pool->len;
+    g_byte_array_append(writer->pool, (const guint8 *) str, strlen(str) + 1);
+    g_hash_table_insert(writer->strings, g_strdup(str), GUINT_TO_POINTER(pos));
+
+    return pos;
+}
+
+/// Write an expectation into the expectation table
+static void write_expectation(rmBinWriter *writer, const rmExpectation *exp)
+{
+    const gchar *pattern = (exp->regex ? g_regex_get_pattern(exp->regex) : NULL);
+
+    put_u32(writer->expects, exp->type);
+    put_u32(writer->expects, pool_string(writer, exp->label));
+
+    switch (exp->type) {
+        case RM_EXPECT_STATUS:
+            put_u32(writer->expects, exp->statusMin);
+            put_u32(writer->expects, exp->statusMax);
+            put_u32(writer->expects, BIN_NONE);
+            break;
+
+        case RM_EXPECT_HEADER:
+            put_u32(writer->expects, pool_string(writer, exp->header));
+            put_u32(writer->expects, pool_string(writer, exp->value));
+            put_u32(writer->expects, pool_string(writer, pattern));
+            break;
+
+        case RM_EXPECT_BODY_CONTAINS:
+        case RM_EXPECT_BODY_MATCHES:
+            put_u32(writer->expects, pool_string(writer, exp->value));
+            put_u32(writer->expects, pool_string(writer, pattern));
+            put_u32(writer->expects, BIN_NONE);
+            break;
+    }
+
+    writer->expectCount++;
+}
+
+/// Write a value extraction rule into the extraction table
+static void write_extraction(rmBinWriter *writer, const rmExtraction *ext)
+{
+    const gchar *pattern = (ext->regex ? g_regex_get_pattern(ext->regex) : NULL);
+
+    put_u32(writer->extracts, ext->type);
+    put_u32(writer->extracts, pool_string(writer, g_ptr_array_index(writer->varTable->names, ext->variable)));
+
+    switch (ext->type) {
+        case RM_EXTRACT_HEADER:
+            put_u32(writer->extracts, pool_string(writer, ext->header));
+            put_u32(writer->extracts, pool_string(writer, pattern));
+            break;
+
+        case RM_EXTRACT_BODY:
+            put_u32(writer->extracts, pool_string(writer, pattern));
+            put_u32(writer->extracts, BIN_NONE);
+            break;
+
+        case RM_EXTRACT_JSON:
+            put_u32(writer->extracts, pool_string(writer, ext->path));
+            put_u32(writer->extracts, BIN_NONE);
+            break;
+    }
+
+    writer->extractCount++;
+}
+
+/// Write a body segment into the segment table
+static void write_segment(rmBinWriter *writer, const rmRequest *request, const rmBodySegment *segment)
+{
+    if (segment->file != NULL) {
+        put_u32(writer->segments, pool_string(writer, segment->filename));
+        put_u32(writer->segments, 0);
+        put_u32(writer->segments, 0);
+    } else {
+        put_u32(writer->segments, BIN_NONE);
+        put_u32(writer->segments, (guint32) (segment->data - request->body));
+        put_u32(writer->segments, (guint32) segment->length);
+    }
+
+    writer->segmentCount++;
+}
+
+/// Write a request into the request table, along with its headers,
+/// expectations, extraction rules and body
+static void write_request(rmBinWriter *writer, const rmRequest *request)
+{
+    const GSList   *node;
+    const rmHeader *header;
+    gchar          *url, *baseUrl = NULL;
+    guint32         firstHeader, firstExpect, firstExtract, firstSegment;
+    guint           i;
+
+    firstHeader = writer->headerCount;
+    for (node = request->headers; node; node = node->next) {
+        header = (const rmHeader *) node->data;
+        put_u32(writer->headers, pool_string(writer, header->name));
+        put_u32(writer->headers, pool_string(writer, header->value));
+        put_u32(writer->headers, header->replace);
+        writer->headerCount++;
+    }
+
+    firstExpect = writer->expectCount;
+    for (i = 0; i < request->expectCount; i++) {
+        write_expectation(writer, request->expects[i]);
+    }
+
+    firstExtract = writer->extractCount;
+    for (i = 0; i < request->extractCount; i++) {
+        write_extraction(writer, request->extracts[i]);
+    }
+
+    firstSegment = writer->segmentCount;
+    for (i = 0; i < request->bodySegmentCount; i++) {
+        write_segment(writer, request, &request->bodySegments[i]);
+    }
+
+    url = soup_uri_to_string(request->url, FALSE);
+    put_u32(writer->requests, pool_string(writer, g_quark_to_string(request->method)));
+    put_u32(writer->requests, pool_string(writer, url));
+    put_u32(writer->requests, pool_string(writer, request->name));
+    g_free(url);
+
+    if (request->body != NULL) {
+        put_u32(writer->requests, pool_string(writer, g_quark_to_string(request->bodyType)));
+        put_u32(writer->requests, writer->data->len);
+        put_u32(writer->requests, (guint32) request->bodyLength);
+        g_byte_array_append(writer->data, (const guint8 *) request->body, request->bodyLength);
+    } else if (request->generator != NULL) {
+        put_u32(writer->requests, pool_string(writer, g_quark_to_string(request->bodyType)));
+        put_u32(writer->requests, BIN_NONE);
+        put_u32(writer->requests, 0);
+    } else {
+        put_u32(writer->requests, BIN_NONE);
+        put_u32(writer->requests, BIN_NONE);
+        put_u32(writer->requests, 0);
+    }
+
+    put_u32(writer->requests, request->repeat);
+    put_u32(writer->requests, firstHeader);
+    put_u32(writer->requests, writer->headerCount - firstHeader);
+    put_u32(writer->requests, firstExpect);
+    put_u32(writer->requests, writer->expectCount - firstExpect);
+
+    if (request->urlTemplate != NULL && request->templateBase != NULL) {
+        baseUrl = soup_uri_to_string(request->templateBase, FALSE);
+    }
+    put_u32(writer->requests, pool_string(writer, (request->urlTemplate ? request->urlTemplate->source : NULL)));
+    put_u32(writer->requests, pool_string(writer, baseUrl));
+    put_u32(writer->requests, (request->formBody ? BIN_FORM_BODY : 0) |
+        (request->generator && request->generator->chunked ? BIN_GENERATED_CHUNKED : 0));
+    put_u32(writer->requests, firstExtract);
+    put_u32(writer->requests, writer->extractCount - firstExtract);
+    put_u32(writer->requests, firstSegment);
+    put_u32(writer->requests, writer->segmentCount - firstSegment);
+
+    if (request->generator != NULL) {
+        put_u32(writer->requests, request->generator->pattern);
+        put_u32(writer->requests, pool_string(writer, request->generator->text));
+        put_u32(writer->requests, (guint32) (request->generator->size & G_MAXUINT32));
+        put_u32(writer->requests, (guint32) (request->generator->size >> 32));
+    } else {
+        put_u32(writer->requests, BIN_NONE);
+        put_u32(writer->requests, BIN_NONE);
+        put_u32(writer->requests, 0);
+        put_u32(writer->requests, 0);
+    }
+
+    put_u32(writer->requests, pool_string(writer, request->preSend));
+    put_u32(writer->requests, pool_string(writer, request->postComplete));
+    g_free(baseUrl);
+}
+
+/// Write a data feeder into the feeder table
+static void write_feeder(rmBinWriter *writer, const rmFeeder *feeder)
+{
+    put_u32(writer->feeders, pool_string(writer, feeder->name));
+    put_u32(writer->feeders, pool_string(writer, feeder->filename));
+    put_u32(writer->feeders, feeder->format);
+    put_u32(writer->feeders, feeder->mode);
+    put_u32(writer->feeders, feeder->scope);
+}
+
+/// Write a script's source into the script table
+static void write_script(rmBinWriter *writer, const gchar *source)
+{
+    gsize length = strlen(source);
+
+    put_u32(writer->scripts, writer->data->len);
+    put_u32(writer->scripts, (guint32) length);
+    g_byte_array_append(writer->data, (const guint8 *) source, length);
+}
+
+/// Write a time in seconds as a 64 bit number of microseconds
+static void put_usec(GByteArray *buf, gdouble seconds)
+{
+    guint64 usec = (guint64) (seconds * G_USEC_PER_SEC + 0.5);
+
+    put_u32(buf, (guint32) (usec & G_MAXUINT32));
+    put_u32(buf, (guint32) (usec >> 32));
+}
+
+/// Write a load profile stage into the stage table
+static void write_stage(rmBinWriter *writer, const rmLoadStage *stage)
+{
+    put_u32(writer->stages, pool_string(writer, stage->name));
+    put_u32(writer->stages, stage->type);
+    put_usec(writer->stages, stage->duration);
+    put_usec(writer->stages, stage->ramp);
+    put_u32(writer->stages, (guint32) MIN(stage->target * 1000 + 0.5, G_MAXUINT32));
+}
+
+/// Compile a scenario into a binary file, which can be loaded later on with
+/// rm_scenario_bin_read_mapped()
+gboolean rm_scenario_bin_write_file(const rmScenario *scenario, const gchar *filename, GError **error)
+{
+    rmBinWriter  writer;
+    rmBinHeader  header;
+    GByteArray  *out;
+    GSList      *node;
+    gboolean     res = FALSE;
+    guint32      flags = 0;
+    guint        i;
+
+    writer.requests    = g_byte_array_new();
+    writer.headers     = g_byte_array_new();
+    writer.expects     = g_byte_array_new();
+    writer.extracts    = g_byte_array_new();
+    writer.segments    = g_byte_array_new();
+    writer.feeders     = g_byte_array_new();
+    writer.variables   = g_byte_array_new();
+    writer.scripts     = g_byte_array_new();
+    writer.stages      = g_byte_array_new();
+    writer.pool        = g_byte_array_new();
+    writer.data        = g_byte_array_new();
+    writer.strings     = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    writer.varTable    = scenario->variables;
+    writer.headerCount = 0;
+    writer.expectCount = 0;
+    writer.extractCount = 0;
+    writer.segmentCount = 0;
+
+    for (node = scenario->feeders; node; node = node->next) {
+        write_feeder(&writer, (const rmFeeder *) node->data);
+    }
+
+    for (i = 0; i < scenario->requestCount; i++) {
+        write_request(&writer, &scenario->requestTable[i]);
+    }
+
+    // Variables are written in order, so that they keep their numbers, and
+    // variables only set by scripts are defined too
+    for (i = 0; i < scenario->variables->names->len; i++) {
+        put_u32(writer.variables, pool_string(&writer, g_ptr_array_index(scenario->variables->names, i)));
+    }
+
+    for (i = 0; scenario->scripts && i < scenario->scripts->sources->len; i++) {
+        write_script(&writer, g_ptr_array_index(scenario->scripts->sources, i));
+    }
+
+    for (i = 0; scenario->profile && i < scenario->profile->stageCount; i++) {
+        write_stage(&writer, &scenario->profile->stages[i]);
+    }
+
+    if (scenario->persistCookies)      flags |= BIN_PERSIST_COOKIES;
+    if (scenario->failOnHttpError)     flags |= BIN_FAIL_ON_HTTP_ERROR;
+    if (scenario->failOnHttpRedirect)  flags |= BIN_FAIL_ON_HTTP_REDIRECT;
+    if (scenario->failOnTcpError)      flags |= BIN_FAIL_ON_TCP_ERROR;
+    if (scenario->keepAlive)           flags |= BIN_KEEP_ALIVE;
+    if (scenario->discardResponseBody) flags |= BIN_DISCARD_RESPONSE_BODY;
+    if (scenario->failOnExpectation)   flags |= BIN_FAIL_ON_EXPECTATION;
+
+    memcpy(header.magic, BIN_MAGIC, sizeof(header.magic));
+    header.version            = GUINT32_TO_LE(RM_SCENARIO_BIN_VERSION);
+    header.flags              = GUINT32_TO_LE(flags);
+    header.maxConnsPerHost    = GUINT32_TO_LE(scenario->maxConnsPerHost);
+    header.maxRequestsPerConn = GUINT32_TO_LE(scenario->maxRequestsPerConn);
+    header.requestCount       = GUINT32_TO_LE(scenario->requestCount);
+    header.headerCount        = GUINT32_TO_LE(writer.headerCount);
+    header.expectCount        = GUINT32_TO_LE(writer.expectCount);
+    header.extractCount       = GUINT32_TO_LE(writer.extractCount);
+    header.segmentCount       = GUINT32_TO_LE(writer.segmentCount);
+    header.feederCount        = GUINT32_TO_LE(g_slist_length(scenario->feeders));
+    header.variableCount      = GUINT32_TO_LE(scenario->variables->names->len);
+    header.scriptCount        = GUINT32_TO_LE(scenario->scripts ? scenario->scripts->sources->len : 0);
+    header.stageCount         = GUINT32_TO_LE(scenario->profile ? scenario->profile->stageCount : 0);
+    header.preIteration       = GUINT32_TO_LE(pool_string(&writer,
+                                    (scenario->scripts ? scenario->scripts->preIteration : NULL)));
+    header.postIteration      = GUINT32_TO_LE(pool_string(&writer,
+                                    (scenario->scripts ? scenario->scripts->postIteration : NULL)));
+    header.poolLength         = GUINT32_TO_LE(writer.pool->len);
+    header.dataLength         = GUINT32_TO_LE(writer.data->len);
+
+    out = g_byte_array_sized_new(sizeof(header) + writer.requests->len + writer.headers->len +
+        writer.expects->len + writer.extracts->len + writer.segments->len + writer.feeders->len +
+        writer.variables->len + writer.scripts->len + writer.stages->len + writer.pool->len +
+        writer.data->len);
+    g_byte_array_append(out, (const guint8 *) &header, sizeof(header));
+    g_byte_array_append(out, writer.requests->data, writer.requests->len);
+    g_byte_array_append(out, writer.headers->data, writer.headers->len);
+    g_byte_array_append(out, writer.expects->data, writer.expects->len);
+    g_byte_array_append(out, writer.extracts->data, writer.extracts->len);
+    g_byte_array_append(out, writer.segments->data, writer.segments->len);
+    g_byte_array_append(out, writer.feeders->data, writer.feeders->len);
+    g_byte_array_append(out, writer.variables->data, writer.variables->len);
+    g_byte_array_append(out, writer.scripts->data, writer.scripts->len);
+    g_byte_array_append(out, writer.stages->data, writer.stages->len);
+    g_byte_array_append(out, writer.pool->data, writer.pool->len);
+    g_byte_array_append(out, writer.data->data, writer.data->len);
+
+    if (out->len > G_MAXUINT32) {
+        g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_FORMAT,
+            "scenario is too large to be compiled");
+    } else {
+        res = g_file_set_contents(filename, (const gchar *) out->data, out->len, error);
+    }
+
+    g_byte_array_free(out, TRUE);
+    g_byte_array_free(writer.requests, TRUE);
+    g_byte_array_free(writer.headers, TRUE);
+    g_byte_array_free(writer.expects, TRUE);
+    g_byte_array_free(writer.extracts, TRUE);
+    g_byte_array_free(writer.segments, TRUE);
+    g_byte_array_free(writer.feeders, TRUE);
+    g_byte_array_free(writer.variables, TRUE);
+    g_byte_array_free(writer.scripts, TRUE);
+    g_byte_array_free(writer.stages, TRUE);
+    g_byte_array_free(writer.pool, TRUE);
+    g_byte_array_free(writer.data, TRUE);
+    g_hash_table_destroy(writer.strings);
+
+    return res;
+}
+
+/// Tell whether a buffer holds a compiled scenario
+gboolean rm_scenario_bin_detect(const gchar *data, gsize length)
+{
+    return (data != NULL && length >= sizeof(rmBinHeader) && memcmp(data, BIN_MAGIC, 4) == 0);
+}
+
+/// Tables of a compiled scenario being read, pointing into the file
+typedef struct _rmBinReader {
+    const rmBinRequest     *requests;
+    const rmBinHeaderEntry *headers;
+    const rmBinExpect      *expects;
+    const rmBinExtract     *extracts;
+    const rmBinSegment     *segments;
+    const rmBinFeeder      *feeders;
+    const guint32          *variables;
+    const rmBinScript      *scripts;
+    const rmBinStage       *stages;
+    const gchar            *pool;
+    const gchar            *data;
+    guint32                 headerCount;
+    guint32                 expectCount;
+    guint32                 extractCount;
+    guint32                 segmentCount;
+    guint32                 feederCount;
+    guint32                 variableCount;
+    guint32                 scriptCount;
+    guint32                 stageCount;
+    guint32                 poolLength;
+    guint32                 dataLength;
+    gboolean                failed;
+} rmBinReader;
+
+/// Get a string from the pool. The pool ends with a NUL byte, so any offset
+/// within it points to a terminated string. Returns NULL if the string is not
+/// set, or is invalid, in which case the reader is marked as failed.
+static const gchar* get_string(rmBinReader *reader, guint32 le, gboolean optional)
+{
+    guint32 offset = GUINT32_FROM_LE(le);
+
+    if (offset == BIN_NONE && optional) return NULL;
+    if (offset >= reader->poolLength) {
+        reader->failed = TRUE;
+        return NULL;
+    }
+
+    return reader->pool + offset;
+}
+
+/// Read an expectation from the expectation table
+static rmExpectation* read_expectation(rmBinReader *reader, const rmBinExpect *rec, GError **error)
+{
+    rmExpectation *exp = NULL;
+    const gchar   *label, *args[3];
+    gchar         *spec;
+    guint32        type = GUINT32_FROM_LE(rec->type);
+
+    label = get_string(reader, rec->label, FALSE);
+    if (type != RM_EXPECT_STATUS) {
+        args[0] = get_string(reader, rec->args[0], (type != RM_EXPECT_HEADER));
+        args[1] = get_string(reader, rec->args[1], TRUE);
+        args[2] = get_string(reader, rec->args[2], TRUE);
+    }
+    if (reader->failed) return NULL;
+
+    switch (type) {
+        case RM_EXPECT_STATUS:
+            spec = g_strdup_printf("%u-%u", GUINT32_FROM_LE(rec->args[0]), GUINT32_FROM_LE(rec->args[1]));
+            exp  = rm_expectation_new_status(spec, error);
+            g_free(spec);
+            break;
+
+        case RM_EXPECT_HEADER:
+            exp = rm_expectation_new_header(args[0], args[1], args[2], error);
+            break;
+
+        case RM_EXPECT_BODY_CONTAINS:
+        case RM_EXPECT_BODY_MATCHES:
+            exp = rm_expectation_new_body(args[0], args[1], error);
+            break;
+
+        default:
+            reader->failed = TRUE;
+            break;
+    }
+
+    if (exp == NULL || reader->failed) {
+        if (exp) rm_expectation_free(exp);
+        return NULL;
+    }
+
+    g_free(exp->label);
+    exp->label = g_strdup(label);
+
+    return exp;
+}
+
+/// Read a value extraction rule from the extraction table, defining the
+/// variable it stores its value in
+static rmExtraction* read_extraction(rmBinReader *reader, const rmBinExtract *rec, rmVarTable *vars,
+    GError **error)
+{
+    rmExtraction *ext = NULL;
+    const gchar  *variable, *args[2];
+    guint32       type = GUINT32_FROM_LE(rec->type);
+    guint         var;
+
+    variable = get_string(reader, rec->variable, FALSE);
+    args[0]  = get_string(reader, rec->args[0], FALSE);
+    args[1]  = get_string(reader, rec->args[1], TRUE);
+    if (reader->failed) return NULL;
+
+    var = rm_var_table_add(vars, variable);
+    switch (type) {
+        case RM_EXTRACT_HEADER:
+            ext = rm_extraction_new_header(args[0], args[1], var, error);
+            break;
+
+        case RM_EXTRACT_BODY:
+            ext = rm_extraction_new_body(args[0], var, error);
+            break;
+
+        case RM_EXTRACT_JSON:
+            ext = rm_extraction_new_json(args[0], var, error);
+            break;
+
+        default:
+            reader->failed = TRUE;
+            break;
+    }
+
+    return ext;
+}
+
+/// Read a data feeder from the feeder table, and load its data file
+static rmFeeder* read_feeder(rmBinReader *reader, const rmBinFeeder *rec, GError **error)
+{
+    const gchar *name, *file;
+    guint32      format, mode, scope;
+
+    name   = get_string(reader, rec->name, FALSE);
+    file   = get_string(reader, rec->file, FALSE);
+    format = GUINT32_FROM_LE(rec->format);
+    mode   = GUINT32_FROM_LE(rec->mode);
+    scope  = GUINT32_FROM_LE(rec->scope);
+
+    if (reader->failed || format > RM_FEEDER_JSONL || mode > RM_FEEDER_PARTITIONED ||
+        scope > RM_FEEDER_PER_ITERATION) {
+        reader->failed = TRUE;
+        return NULL;
+    }
+
+    return rm_feeder_new(name, file, format, mode, scope, error);
+}
+
+/// Read a request from the request table. Request bodies are not copied, and
+/// point into the compiled scenario's body data; uploaded files are mapped. Templates are compiled again
+/// against the scenario's variables, once the request's extraction rules have
+/// defined theirs.
+static rmRequest* read_request(rmBinReader *reader, const rmBinRequest *rec, rmVarTable *vars,
+    GError **error)
+{
+    const rmBinHeaderEntry *hdr;
+    rmRequest              *req;
+    rmExpectation          *exp;
+    rmExtraction           *ext;
+    const rmBinSegment     *seg;
+    const gchar            *method, *file, *text, *url, *name, *bodyType, *urlTemplate, *base;
+    const gchar            *preSend, *postComplete;
+    SoupURI                *baseUrl = NULL;
+    guint32                 first, count, offset, length, i;
+
+    method      = get_string(reader, rec->method, FALSE);
+    url         = get_string(reader, rec->url, FALSE);
+    name        = get_string(reader, rec->name, TRUE);
+    bodyType    = get_string(reader, rec->bodyType, TRUE);
+    urlTemplate = get_string(reader, rec->urlTemplate, TRUE);
+    base        = get_string(reader, rec->baseUrl, TRUE);
+    preSend      = get_string(reader, rec->preSend, TRUE);
+    postComplete = get_string(reader, rec->postComplete, TRUE);
+    if (reader->failed) return NULL;
+
+    req = rm_request_new(method, (gchar *) url, NULL, error);
+    if (req == NULL) return NULL;
+
+    req->name     = g_strdup(name);
+    req->preSend      = g_strdup(preSend);
+    req->postComplete = g_strdup(postComplete);
+    req->repeat   = GUINT32_FROM_LE(rec->repeat);
+    req->formBody = ((GUINT32_FROM_LE(rec->flags) & BIN_FORM_BODY) != 0);
+    if (req->repeat < 1) reader->failed = TRUE;
+
+    offset = GUINT32_FROM_LE(rec->bodyOffset);
+    length = GUINT32_FROM_LE(rec->bodyLength);
+    if (GUINT32_FROM_LE(rec->generator) != BIN_NONE) {
+        text = get_string(reader, rec->generatorText, TRUE);
+        if (bodyType == NULL || offset != BIN_NONE || GUINT32_FROM_LE(rec->generator) > RM_GENERATOR_REPEAT) {
+            reader->failed = TRUE;
+        } else {
+            req->bodyType  = g_quark_from_string(bodyType);
+            req->generator = rm_generator_new(
+                ((guint64) GUINT32_FROM_LE(rec->generatorSize[1]) << 32) | GUINT32_FROM_LE(rec->generatorSize[0]),
+                GUINT32_FROM_LE(rec->generator), text,
+                (GUINT32_FROM_LE(rec->flags) & BIN_GENERATED_CHUNKED) != 0, error);
+            if (req->generator == NULL) reader->failed = TRUE;
+        }
+
+    } else if (offset != BIN_NONE) {
+        if (bodyType == NULL || offset > reader->dataLength || length > reader->dataLength - offset) {
+            reader->failed = TRUE;
+        } else {
+            req->bodyType   = g_quark_from_string(bodyType);
+            req->body       = (gchar *) reader->data + offset;
+            req->bodyLength = length;
+            req->freeBody   = FALSE;
+        }
+    }
+
+    first = GUINT32_FROM_LE(rec->firstHeader);
+    count = GUINT32_FROM_LE(rec->headerCount);
+    if (first > reader->headerCount || count > reader->headerCount - first) {
+        reader->failed = TRUE;
+        count = 0;
+    }
+    for (i = 0; i < count && ! reader->failed; i++) {
+        hdr = &reader->headers[first + i];
+        rm_request_add_header(req, get_string(reader, hdr->name, FALSE),
+            get_string(reader, hdr->value, FALSE), GUINT32_FROM_LE(hdr->replace) != 0);
+    }
+
+    first = GUINT32_FROM_LE(rec->firstExpect);
+    count = GUINT32_FROM_LE(rec->expectCount);
+    if (first > reader->expectCount || count > reader->expectCount - first) {
+        reader->failed = TRUE;
+        count = 0;
+    }
+    for (i = 0; i < count && ! reader->failed; i++) {
+        if ((exp = read_expectation(reader, &reader->expects[first + i], error)) == NULL) {
+            reader->failed = TRUE;
+            break;
+        }
+        rm_request_add_expectation(req, exp);
+    }
+
+    first = GUINT32_FROM_LE(rec->firstExtract);
+    count = GUINT32_FROM_LE(rec->extractCount);
+    if (first > reader->extractCount || count > reader->extractCount - first) {
+        reader->failed = TRUE;
+        count = 0;
+    }
+    for (i = 0; i < count && ! reader->failed; i++) {
+        if ((ext = read_extraction(reader, &reader->extracts[first + i], vars, error)) == NULL) {
+            reader->failed = TRUE;
+            break;
+        }
+        rm_request_add_extraction(req, ext);
+    }
+
+    first = GUINT32_FROM_LE(rec->firstSegment);
+    count = GUINT32_FROM_LE(rec->segmentCount);
+    if (first > reader->segmentCount || count > reader->segmentCount - first) {
+        reader->failed = TRUE;
+        count = 0;
+    }
+    for (i = 0; i < count && ! reader->failed; i++) {
+        seg    = &reader->segments[first + i];
+        file   = get_string(reader, seg->file, TRUE);
+        offset = GUINT32_FROM_LE(seg->offset);
+        length = GUINT32_FROM_LE(seg->length);
+
+        if (reader->failed) {
+            break;
+        } else if (file != NULL) {
+            if (! rm_request_add_body_file(req, file, error)) reader->failed = TRUE;
+        } else if (req->body == NULL || offset > req->bodyLength || length > req->bodyLength - offset) {
+            reader->failed = TRUE;
+        } else {
+            rm_request_add_body_text(req, offset, length);
+        }
+    }
+
+    if (! reader->failed) {
+        if (base != NULL) baseUrl = soup_uri_new(base);
+        if (! rm_request_compile_templates(req, (urlTemplate ? urlTemplate : url), baseUrl, vars, error)) {
+            reader->failed = TRUE;
+        }
+        if (baseUrl != NULL) soup_uri_free(baseUrl);
+    }
+
+    if (reader->failed) {
+        rm_request_free(req);
+        return NULL;
+    }
+
+    return req;
+}
+
+/// Read the scripts of a compiled scenario from the script table, compiling
+/// them again, along with the names of the iteration hooks. Scripts are set
+/// up if there are any, or if anything names a hook, so that they are checked
+/// to define it.
+static gboolean read_scripts(rmBinReader *reader, const rmBinHeader *header, rmScenario *scenario,
+    GError **error)
+{
+    const gchar *preIteration, *postIteration;
+    guint32      offset, length, i;
+
+    preIteration  = get_string(reader, header->preIteration, TRUE);
+    postIteration = get_string(reader, header->postIteration, TRUE);
+    if (reader->failed) return FALSE;
+
+    if (reader->scriptCount > 0 || preIteration != NULL || postIteration != NULL) {
+        scenario->scripts = rm_scripts_new();
+        scenario->scripts->preIteration  = g_strdup(preIteration);
+        scenario->scripts->postIteration = g_strdup(postIteration);
+    }
+
+    for (i = 0; i < reader->scriptCount; i++) {
+        offset = GUINT32_FROM_LE(reader->scripts[i].offset);
+        length = GUINT32_FROM_LE(reader->scripts[i].length);
+        if (offset > reader->dataLength || length > reader->dataLength - offset) {
+            reader->failed = TRUE;
+            return FALSE;
+        }
+
+        if (! rm_scripts_add(scenario->scripts, NULL, reader->data + offset, length, error)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/// Read a time in microseconds, as written by put_usec(), in seconds
+static gdouble get_usec(const guint32 *value)
+{
+    return (GUINT32_FROM_LE(value[0]) | ((guint64) GUINT32_FROM_LE(value[1]) << 32)) / (gdouble) G_USEC_PER_SEC;
+}
+
+/// Read the load profile of a compiled scenario from the stage table, if it
+/// has any stages
+static gboolean read_stages(rmBinReader *reader, rmScenario *scenario)
+{
+    const rmBinStage *rec;
+    const gchar      *name;
+    guint32           type, i;
+
+    for (i = 0; i < reader->stageCount; i++) {
+        rec  = &reader->stages[i];
+        name = get_string(reader, rec->name, TRUE);
+        type = GUINT32_FROM_LE(rec->type);
+        if (reader->failed || (type != RM_STAGE_CLIENTS && type != RM_STAGE_RATE)) {
+            reader->failed = TRUE;
+            return FALSE;
+        }
+
+        if (scenario->profile == NULL) {
+            scenario->profile = rm_load_profile_new();
+        }
+        rm_load_profile_add_stage(scenario->profile, name, (rmLoadStageType) type, get_usec(rec->duration),
+            get_usec(rec->ramp), GUINT32_FROM_LE(rec->target) / 1000.0);
+    }
+
+    return TRUE;
+}
+
+/// Build a scenario out of a compiled scenario held in memory. The memory has
+/// to be kept as long as the scenario is used, as request bodies point into
+/// it.
+static rmScenario* read_scenario(const gchar *data, gsize length, GError **error)
+{
+    const rmBinHeader *header = (const rmBinHeader *) data;
+    rmBinReader        reader;
+    rmScenario        *scenario;
+    rmRequest         *req;
+    rmFeeder          *feeder;
+    const gchar       *name;
+    guint64            expected;
+    guint32            flags, requestCount, i;
+
+    if (! rm_scenario_bin_detect(data, length)) {
+        g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_FORMAT,
+            "not a compiled scenario");
+        return NULL;
+    }
+
+    if (GUINT32_FROM_LE(header->version) != RM_SCENARIO_BIN_VERSION) {
+        g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_VERSION,
+            "compiled scenario format version %u is not supported, expecting %u. Compile the scenario again",
+            GUINT32_FROM_LE(header->version), RM_SCENARIO_BIN_VERSION);
+        return NULL;
+    }
+
+    requestCount       = GUINT32_FROM_LE(header->requestCount);
+    reader.headerCount = GUINT32_FROM_LE(header->headerCount);
+    reader.expectCount = GUINT32_FROM_LE(header->expectCount);
+    reader.extractCount = GUINT32_FROM_LE(header->extractCount);
+    reader.segmentCount = GUINT32_FROM_LE(header->segmentCount);
+    reader.feederCount = GUINT32_FROM_LE(header->feederCount);
+    reader.variableCount = GUINT32_FROM_LE(header->variableCount);
+    reader.scriptCount = GUINT32_FROM_LE(header->scriptCount);
+    reader.stageCount  = GUINT32_FROM_LE(header->stageCount);
+    reader.poolLength  = GUINT32_FROM_LE(header->poolLength);
+    reader.dataLength  = GUINT32_FROM_LE(header->dataLength);
+    reader.failed      = FALSE;
+
+    expected = sizeof(rmBinHeader) +
+        (guint64) requestCount * sizeof(rmBinRequest) +
+        (guint64) reader.headerCount * sizeof(rmBinHeaderEntry) +
+        (guint64) reader.expectCount * sizeof(rmBinExpect) +
+        (guint64) reader.extractCount * sizeof(rmBinExtract) +
+        (guint64) reader.segmentCount * sizeof(rmBinSegment) +
+        (guint64) reader.feederCount * sizeof(rmBinFeeder) +
+        (guint64) reader.variableCount * sizeof(guint32) +
+        (guint64) reader.scriptCount * sizeof(rmBinScript) +
+        (guint64) reader.stageCount * sizeof(rmBinStage) +
+        reader.poolLength + reader.dataLength;
+
+    if (expected != length ||
+        (reader.poolLength > 0 && data[length - reader.dataLength - 1] != '\0')) {
+        g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_FORMAT,
+            "compiled scenario is truncated or corrupt");
+        return NULL;
+    }
+
+    reader.requests = (const rmBinRequest *) (data + sizeof(rmBinHeader));
+    reader.headers  = (const rmBinHeaderEntry *) (reader.requests + requestCount);
+    reader.expects  = (const rmBinExpect *) (reader.headers + reader.headerCount);
+    reader.extracts = (const rmBinExtract *) (reader.expects + reader.expectCount);
+    reader.segments = (const rmBinSegment *) (reader.extracts + reader.extractCount);
+    reader.feeders  = (const rmBinFeeder *) (reader.segments + reader.segmentCount);
+    reader.variables = (const guint32 *) (reader.feeders + reader.feederCount);
+    reader.scripts  = (const rmBinScript *) (reader.variables + reader.variableCount);
+    reader.stages   = (const rmBinStage *) (reader.scripts + reader.scriptCount);
+    reader.pool     = (const gchar *) (reader.stages + reader.stageCount);
+    reader.data     = reader.pool + reader.poolLength;
+
+    flags = GUINT32_FROM_LE(header->flags);
+
+    scenario = rm_scenario_new();
+    scenario->persistCookies      = ((flags & BIN_PERSIST_COOKIES) != 0);
+    scenario->failOnHttpError     = ((flags & BIN_FAIL_ON_HTTP_ERROR) != 0);
+    scenario->failOnHttpRedirect  = ((flags & BIN_FAIL_ON_HTTP_REDIRECT) != 0);
+    scenario->failOnTcpError      = ((flags & BIN_FAIL_ON_TCP_ERROR) != 0);
+    scenario->keepAlive           = ((flags & BIN_KEEP_ALIVE) != 0);
+    scenario->discardResponseBody = ((flags & BIN_DISCARD_RESPONSE_BODY) != 0);
+    scenario->failOnExpectation   = ((flags & BIN_FAIL_ON_EXPECTATION) != 0);
+    scenario->maxConnsPerHost     = GUINT32_FROM_LE(header->maxConnsPerHost);
+    scenario->maxRequestsPerConn  = GUINT32_FROM_LE(header->maxRequestsPerConn);
+
+    for (i = 0; i < reader.variableCount && ! reader.failed; i++) {
+        name = get_string(&reader, reader.variables[i], FALSE);
+        if (name != NULL) rm_var_table_add(scenario->variables, name);
+    }
+
+    if (reader.failed || ! read_scripts(&reader, header, scenario, error) || ! read_stages(&reader, scenario)) {
+        if (error == NULL || *error == NULL) {
+            g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_FORMAT,
+                "compiled scenario is corrupt: invalid variable, script or load profile stage");
+        }
+        rm_scenario_free(scenario);
+        return NULL;
+    }
+
+    for (i = 0; i < reader.feederCount; i++) {
+        feeder = read_feeder(&reader, &reader.feeders[i], error);
+        if (feeder == NULL || ! rm_scenario_add_feeder(scenario, feeder, error)) {
+            if (error == NULL || *error == NULL) {
+                g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_FORMAT,
+                    "compiled scenario is corrupt: invalid feeder #%u", i);
+            }
+            rm_scenario_free(scenario);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < requestCount; i++) {
+        req = read_request(&reader, &reader.requests[i], scenario->variables, error);
+        if (req == NULL) {
+            if (error == NULL || *error == NULL) {
+                g_set_error(error, RM_ERROR_SCENARIO_BIN, RM_ERROR_SCENARIO_BIN_FORMAT,
+                    "compiled scenario is corrupt: invalid request #%u", i);
+            }
+            rm_scenario_free(scenario);
+            return NULL;
+        }
+
+        if ((req->preSend || req->postComplete) && scenario->scripts == NULL) {
+            scenario->scripts = rm_scripts_new();
+        }
+        rm_scenario_add_request(scenario, req);
+    }
+
+    rm_scenario_freeze(scenario);
+
+    if (scenario->scripts != NULL &&
+        ! rm_scripts_check(scenario->scripts, scenario->requestTable, scenario->requestCount, error)) {
+
+        rm_scenario_free(scenario);
+        return NULL;
+    }
+
+    return scenario;
+}
+
+/// Load a compiled scenario from a mapped file. The scenario keeps a
+/// reference to the mapping, which holds the request bodies.
+rmScenario* rm_scenario_bin_read_mapped(GMappedFile *file, GError **error)
+{
+    rmScenario *scenario;
+
+    scenario = read_scenario(g_mapped_file_get_contents(file), g_mapped_file_get_length(file), error);
+    if (scenario != NULL) {
+        scenario->storage     = g_mapped_file_ref(file);
+        scenario->storageFree = (GDestroyNotify) g_mapped_file_unref;
+    }
+
+    return scenario;
+}
+
+/// Load a compiled scenario from a buffer, which is copied. This is used by
+/// agents to load a compiled scenario received from the coordinator.
+rmScenario* rm_scenario_bin_read_buffer(const gchar *data, gsize length, GError **error)
+{
+    rmScenario *scenario;
+    gchar      *copy;
+
+    copy = g_malloc(length);
+    memcpy(copy, data, length);
+
+    scenario = read_scenario(copy, length, error);
+    if (scenario != NULL) {
+        scenario->storage     = copy;
+        scenario->storageFree = g_free;
+    } else {
+        g_free(copy);
+    }
+
+    return scenario;
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
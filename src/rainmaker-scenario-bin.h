@@ -0,0 +1,35 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_SCENARIO_BIN_H_
+
+#include <glib.h>
+
+#include "rainmaker-scenario.h"
+
+#define RM_ERROR_SCENARIO_BIN g_quark_from_static_string("rainmaker-scenario-bin-error")
+
+enum {
+    RM_ERROR_SCENARIO_BIN_IO,
+    RM_ERROR_SCENARIO_BIN_FORMAT,
+    RM_ERROR_SCENARIO_BIN_VERSION
+};
+
+/// Version of the compiled scenario format. Compiled scenarios of other
+/// versions are rejected, and have to be compiled again.
+#define RM_SCENARIO_BIN_VERSION 7
+
+gboolean    rm_scenario_bin_write_file(const rmScenario *scenario, const gchar *filename, GError **error);
+gboolean    rm_scenario_bin_detect(const gchar *data, gsize length);
+rmScenario* rm_scenario_bin_read_mapped(GMappedFile *file, GError **error);
+rmScenario* rm_scenario_bin_read_buffer(const gchar *data, gsize length, GError **error);
+
+#define RAINMAKER_SCENARIO_BIN_H_
+#endif
+
+// vim:ts=4:expandtab:cindent:sw=2
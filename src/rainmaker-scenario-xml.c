@@ -10,8 +10,7 @@
 #include <errno.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
-#include <libxml/xpath.h>
-#include <libxml/xpathInternals.h>
+#include <libxml/xmlreader.h>
 #include <libxml/xmlschemas.h>
 #include <glib.h>
 
@@ -38,51 +37,23 @@
 #define XML_ATTR_TO_BOOLEAN(v) (xmlStrcmp(v, BAD_CAST "yes") == 0 || xmlStrcmp(v, BAD_CAST "true") == 0)
 #define XML_IF_NODE_NAME(nd, nm) if (xmlStrcmp(nd->name, BAD_CAST nm) == 0)
 
-/// Read request headers from XML tree. This will use XPath to grab both the
-/// default client headers as well as the request specific headers and set them
-static gboolean read_request_headers_xml(xmlNode *node, rmRequest *request, GError **error)
+/// Read a 'headers' XML element into a list of header structs, appended in
+/// document order to the provided list
+static gboolean read_headers_xml(xmlNode *node, GSList **headers, GError **error)
 {
-    xmlXPathContextPtr  xpathCtx;
-    xmlXPathObjectPtr   xpath;
-    xmlNodeSetPtr       nodes;
-    xmlChar            *attr, *value;
-    gboolean            replace;
-    guint               i;
-
-    const xmlChar *xpathExpr = BAD_CAST "//rm:clientSetup/rm:headers/rm:header | rm:headers/rm:header";
+    xmlNode  *child;
+    xmlChar  *attr, *value;
+    GSList   *list = NULL;
+    rmHeader *header;
+    gboolean  replace;
 
     g_assert(node->type == XML_ELEMENT_NODE);
+    g_assert(xmlStrcmp(node->name, BAD_CAST "headers") == 0);
 
-    // Use xPath to grab all "header" nodes
-    xpathCtx = xmlXPathNewContext(node->doc);
-    if (xpathCtx == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_ALLOC,
-            "unable to allocate XPath context");
-        return FALSE;
-    }
-    xpathCtx->node = node;
-
-    // Register XML namespace
-    if(xmlXPathRegisterNs(xpathCtx, BAD_CAST "rm", BAD_CAST RM_XML_NS) != 0) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_ALLOC,
-            "unable to register XML namespace '%s' in XPath context", RM_XML_NS);
-        xmlXPathFreeContext(xpathCtx);
-        return FALSE;
-    }
-
-    xpath = xmlXPathEvalExpression(xpathExpr, xpathCtx);
-    if (xpath == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_ALLOC,
-            "unable to evaluate XPath expression '%s'", xpathExpr);
-        xmlXPathFreeContext(xpathCtx);
-        return FALSE;
-    }
-
-    nodes = xpath->nodesetval;
-    for (i = 0; nodes && i < nodes->nodeNr; i++) {
-        g_assert(nodes->nodeTab[i]);
+    for (child = node->children; child; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE) continue;
 
-        attr = xmlGetProp(nodes->nodeTab[i], BAD_CAST "replace");
+        attr = xmlGetProp(child, BAD_CAST "replace");
         if (attr != NULL) {
             replace = XML_ATTR_TO_BOOLEAN(attr);
             xmlFree(attr);
@@ -90,23 +61,23 @@ static gboolean read_request_headers_xml(xmlNode *node, rmRequest *request, GErr
             replace = FALSE;
         }
 
-        attr = xmlGetProp(nodes->nodeTab[i], BAD_CAST "name");
+        attr = xmlGetProp(child, BAD_CAST "name");
         if (attr == NULL) {
             g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "missing required attribute 'name' on header XML element in line %hu", nodes->nodeTab[i]->line);
-            xmlXPathFreeContext(xpathCtx);
-            xmlXPathFreeObject(xpath);
+                "missing required attribute 'name' on header XML element in line %hu", child->line);
+            rm_gslist_free_full(list, (GDestroyNotify) rm_header_free);
             return FALSE;
         }
 
-        value = xmlNodeListGetString(node->doc, nodes->nodeTab[i]->children, 1);
-        rm_request_add_header(request, (const gchar *) attr, (const gchar *) value, replace);
+        value  = xmlNodeListGetString(node->doc, child->children, 1);
+        header = rm_header_new((const gchar *) attr, (const gchar *) value);
+        header->replace = replace;
+        list = g_slist_prepend(list, header);
         xmlFree(attr);
         xmlFree(value);
     }
 
-    xmlXPathFreeContext(xpathCtx);
-    xmlXPathFreeObject(xpath);
+    *headers = g_slist_concat(*headers, g_slist_reverse(list));
 
     return TRUE;
 }
@@ -117,6 +88,7 @@ static gboolean read_request_body_form_data(xmlNode *node, rmRequest *request, G
     rmRequestParam *param;
     xmlChar        *attr, *value;
     xmlNode        *child;
+    gboolean        encoded;
 
     g_assert(node->type == XML_ELEMENT_NODE);
     g_assert(xmlStrcmp(node->name, BAD_CAST "formData") == 0);
@@ -142,6 +114,24 @@ static gboolean read_request_body_form_data(xmlNode *node, rmRequest *request, G
                 break;
             }
 
+            // File parameters upload the contents of a file
+            if ((value = xmlGetProp(child, BAD_CAST "file")) != NULL) {
+                param = rm_request_param_new(RM_REQUEST_PARAM_FILE);
+                param->name     = (gchar *) attr;
+                param->filePath = (gchar *) value;
+                if ((attr = xmlGetProp(child, BAD_CAST "contentType")) != NULL) {
+                    param->contentType = g_strdup((const gchar *) attr);
+                    xmlFree(attr);
+                }
+                if ((attr = xmlGetProp(child, BAD_CAST "filename")) != NULL) {
+                    param->fileName = g_strdup((const gchar *) attr);
+                    xmlFree(attr);
+                }
+
+                params = g_slist_append(params, (gpointer) param);
+                continue;
+            }
+
             // Get param value
             value = xmlNodeListGetString(child->doc, child->children, 1);
             if (value == NULL) {
@@ -169,13 +159,21 @@ static gboolean read_request_body_form_data(xmlNode *node, rmRequest *request, G
         return FALSE;
     }
 
-    // Encode parameters as request body
+    // Encode parameters as request body. Multipart bodies are not form
+    // encoded, and may be made of several segments if files are uploaded.
+    if (request->bodyType == g_quark_from_static_string("multipart/form-data")) {
+        encoded = rm_request_set_multipart_body(request, params, error);
+        rm_gslist_free_full(params, (GDestroyNotify) rm_request_param_free);
+        return encoded;
+    }
+
     request->body = rm_request_encode_params(params, request->bodyType, &request->bodyLength, error);
     rm_gslist_free_full(params, (GDestroyNotify) rm_request_param_free);
     if (request->body == NULL) {
         return FALSE;
     }
     request->freeBody = TRUE;
+    request->formBody = TRUE;
 
     return TRUE;
 }
@@ -243,15 +241,178 @@ static gboolean read_request_body_raw_data(xmlNode *node, rmRequest *request, GE
     return TRUE;
 }
 
-static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUrl, GError **error)
+/// Read a generated request body. Nothing is generated here; the body is
+/// produced chunk by chunk as the request is sent.
+static gboolean read_request_body_generated_data(xmlNode *node, rmRequest *request, GError **error)
+{
+    xmlChar            *attr, *text;
+    guint64             size;
+    rmGeneratorPattern  pattern;
+    gboolean            chunked = FALSE;
+
+    g_assert(node->type == XML_ELEMENT_NODE);
+    g_assert(xmlStrcmp(node->name, BAD_CAST "generatedData") == 0);
+
+    attr = xmlGetProp(node, BAD_CAST "size");
+    if (! rm_generator_parse_size((const gchar *) attr, &size)) {
+        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+            "invalid or missing generated data size '%s' in line %u, expecting a number of bytes "
+            "optionally followed by K, M or G", (attr ? (const gchar *) attr : ""), node->line);
+        xmlFree(attr);
+        return FALSE;
+    }
+    xmlFree(attr);
+
+    attr = xmlGetProp(node, BAD_CAST "pattern");
+    if (! rm_generator_parse_pattern((const gchar *) attr, &pattern)) {
+        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+            "unknown generated data pattern '%s' in line %u", attr, node->line);
+        xmlFree(attr);
+        return FALSE;
+    }
+    xmlFree(attr);
+
+    if ((attr = xmlGetProp(node, BAD_CAST "chunked"))) {
+        chunked = XML_ATTR_TO_BOOLEAN(attr);
+        xmlFree(attr);
+    }
+
+    text = xmlNodeListGetString(node->doc, node->children, 1);
+    request->generator = rm_generator_new(size, pattern, (const gchar *) text, chunked, error);
+    xmlFree(text);
+    if (request->generator == NULL) {
+        return FALSE;
+    }
+
+    attr = xmlGetProp(node, BAD_CAST "contentType");
+    if (attr != NULL) {
+        request->bodyType = g_quark_from_string((const gchar *) attr);
+        xmlFree(attr);
+    } else {
+        request->bodyType = g_quark_from_static_string("application/octet-stream");
+    }
+
+    return TRUE;
+}
+
+/// Read the expectations on the response to a request. Expectations are
+/// compiled here, so nothing has to be parsed while responses come in.
+static gboolean read_request_expect_xml(xmlNode *node, rmRequest *request, GError **error)
+{
+    rmExpectation *exp;
+    xmlNode       *child;
+    xmlChar       *name, *equals, *matches;
+
+    g_assert(node->type == XML_ELEMENT_NODE);
+    g_assert(xmlStrcmp(node->name, BAD_CAST "expect") == 0);
+
+    for (child = node->children; child; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE) continue;
+
+        exp = NULL;
+        XML_IF_NODE_NAME(child, "status") {
+            name = xmlGetProp(child, BAD_CAST "code");
+            exp  = rm_expectation_new_status((const gchar *) name, error);
+            xmlFree(name);
+
+        } else XML_IF_NODE_NAME(child, "header") {
+            name    = xmlGetProp(child, BAD_CAST "name");
+            equals  = xmlGetProp(child, BAD_CAST "equals");
+            matches = xmlGetProp(child, BAD_CAST "matches");
+            exp = rm_expectation_new_header((const gchar *) name, (const gchar *) equals,
+                (const gchar *) matches, error);
+            xmlFree(name);
+            xmlFree(equals);
+            xmlFree(matches);
+
+        } else XML_IF_NODE_NAME(child, "body") {
+            equals  = xmlGetProp(child, BAD_CAST "contains");
+            matches = xmlGetProp(child, BAD_CAST "matches");
+            exp = rm_expectation_new_body((const gchar *) equals, (const gchar *) matches, error);
+            xmlFree(equals);
+            xmlFree(matches);
+
+        } else {
+            g_printerr("WARNING: unrecognized XML element '%s'\n", child->name);
+            continue;
+        }
+
+        if (exp == NULL) return FALSE;
+        rm_request_add_expectation(request, exp);
+    }
+
+    return TRUE;
+}
+
+/// Read the rules extracting values from the response to a request. Each rule
+/// defines the variable it stores its value in, which later requests - and
+/// following iterations of this one - can reference.
+static gboolean read_request_extract_xml(xmlNode *node, rmRequest *request, rmVarTable *vars,
+    GError **error)
+{
+    rmExtraction *ext;
+    xmlNode      *child;
+    xmlChar      *var, *name, *matches, *path;
+    guint         variable;
+
+    g_assert(node->type == XML_ELEMENT_NODE);
+    g_assert(xmlStrcmp(node->name, BAD_CAST "extract") == 0);
+
+    for (child = node->children; child; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE) continue;
+
+        if ((var = xmlGetProp(child, BAD_CAST "var")) == NULL) {
+            g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+                "required property 'var' is missing for extract rule '%s' in line %u",
+                child->name, child->line);
+            return FALSE;
+        }
+        variable = rm_var_table_add(vars, (const gchar *) var);
+        xmlFree(var);
+
+        XML_IF_NODE_NAME(child, "header") {
+            name    = xmlGetProp(child, BAD_CAST "name");
+            matches = xmlGetProp(child, BAD_CAST "matches");
+            ext = rm_extraction_new_header((const gchar *) name, (const gchar *) matches, variable, error);
+            xmlFree(name);
+            xmlFree(matches);
+
+        } else XML_IF_NODE_NAME(child, "body") {
+            matches = xmlGetProp(child, BAD_CAST "matches");
+            ext = rm_extraction_new_body((const gchar *) matches, variable, error);
+            xmlFree(matches);
+
+        } else XML_IF_NODE_NAME(child, "json") {
+            path = xmlGetProp(child, BAD_CAST "path");
+            ext  = rm_extraction_new_json((const gchar *) path, variable, error);
+            xmlFree(path);
+
+        } else {
+            g_printerr("WARNING: unrecognized XML element '%s'\n", child->name);
+            continue;
+        }
+
+        if (ext == NULL) return FALSE;
+        rm_request_add_extraction(request, ext);
+    }
+
+    return TRUE;
+}
+
+/// Read a request element into a new request. The clientSetup headers are
+/// added before the request's own headers. Variable references in the URL,
+/// headers and body are compiled once the request is fully read, so they may
+/// reference values extracted by the request itself in an earlier iteration.
+static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUrl, const GSList *baseHeaders,
+    rmVarTable *vars, GError **error)
 {
     rmRequest *req;
-    xmlChar   *attr;
+    xmlChar   *attr, *url;
     xmlNode   *child;
 
     g_assert(node->type == XML_ELEMENT_NODE);
 
-    if ((attr = xmlGetProp(node, BAD_CAST "url")) == NULL) {
+    if ((url = xmlGetProp(node, BAD_CAST "url")) == NULL) {
         // URI property is missing, check base request
         if (baseUrl == NULL) {
             // No base URL defined
@@ -261,14 +422,14 @@ static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUr
 
         } else {
             // Set request URL to blank string == base URL
-            attr = xmlStrdup(BAD_CAST "");
+            url = xmlStrdup(BAD_CAST "");
         }
     }
 
     // Create the request, we will set the method later
-    req = rm_request_new(NULL, (gchar *) attr, baseUrl, error);
-    xmlFree(attr);
+    req = rm_request_new(NULL, (gchar *) url, baseUrl, error);
     if (req == NULL) {
+        xmlFree(url);
         return NULL;
     }
 
@@ -293,10 +454,32 @@ static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUr
             g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
                 "request repeat count must be larger than 0");
             rm_request_free(req);
+            xmlFree(url);
             return NULL;
         }
     }
 
+    // Set the (optional) request name, used for reporting
+    if ((attr = xmlGetProp(node, BAD_CAST "name"))) {
+        req->name = g_strdup((const gchar *) attr);
+        xmlFree(attr);
+    }
+
+    // Set the (optional) script hooks, which are looked up once the scenario is loaded
+    if ((attr = xmlGetProp(node, BAD_CAST "preSend"))) {
+        req->preSend = g_strdup((const gchar *) attr);
+        xmlFree(attr);
+    }
+    if ((attr = xmlGetProp(node, BAD_CAST "postComplete"))) {
+        req->postComplete = g_strdup((const gchar *) attr);
+        xmlFree(attr);
+    }
+
+    // Add base request headers, any request-specific headers follow
+    for (; baseHeaders; baseHeaders = baseHeaders->next) {
+        rm_header_copy_to_request((rmHeader *) baseHeaders->data, req);
+    }
+
     // Iterate over child nodes to handle them
     for (child = node->children; child; child = child->next) {
         if (child->type == XML_ELEMENT_NODE) {
@@ -310,8 +493,25 @@ static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUr
                 if (! read_request_body_form_data(child, req, error))
                     break;
 
+            } else XML_IF_NODE_NAME(child, "generatedData") {
+                // Read a generated body
+                if (! read_request_body_generated_data(child, req, error))
+                    break;
+
+            } else XML_IF_NODE_NAME(child, "expect") {
+                // Read the response expectations
+                if (! read_request_expect_xml(child, req, error))
+                    break;
+
+            } else XML_IF_NODE_NAME(child, "extract") {
+                // Read the value extraction rules
+                if (! read_request_extract_xml(child, req, vars, error))
+                    break;
+
             } else XML_IF_NODE_NAME(child, "headers") {
-                // Headers are read later using XPath (FIXME?)
+                // Read the request-specific headers
+                if (! read_headers_xml(child, &req->headers, error))
+                    break;
 
             } else {
                 g_printerr("WARNING: unrecognized XML element '%s'\n", child->name);
@@ -319,13 +519,12 @@ static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUr
         }
     }
 
-    if (*error != NULL) {
-        rm_request_free(req);
-        return NULL;
+    if (*error == NULL) {
+        rm_request_compile_templates(req, (const gchar *) url, baseUrl, vars, error);
     }
+    xmlFree(url);
 
-    // Add base request headers and then read any request-specific headers
-    if (! read_request_headers_xml(node, req, error)) {
+    if (*error != NULL) {
         rm_request_free(req);
         return NULL;
     }
@@ -333,24 +532,90 @@ static rmRequest* new_request_from_xml_node(xmlNode *node, const SoupURI *baseUr
     return req;
 }
 
-static gboolean read_request_xml_add_req(xmlNode *node, rmScenario *scenario, const SoupURI *baseUrl, GError **error)
+static gboolean read_request_xml_add_req(xmlNode *node, rmScenario *scenario, const SoupURI *baseUrl,
+    const GSList *baseHeaders, GError **error)
 {
     rmRequest *req;
 
-    req = new_request_from_xml_node(node, baseUrl, error);
+    req = new_request_from_xml_node(node, baseUrl, baseHeaders, scenario->variables, error);
     if (! req) {
         return FALSE;
     }
 
+    // Requests with hooks need scripts, which are checked to define them
+    if ((req->preSend || req->postComplete) && scenario->scripts == NULL) {
+        scenario->scripts = rm_scripts_new();
+    }
+
     rm_scenario_add_request(scenario, req);
 
     return TRUE;
 }
 
+/// Read a 'script' element. The script is compiled right away, and run by
+/// each worker before it starts. Variables only set by scripts are defined
+/// by listing them in the 'variables' attribute, separated by spaces.
 static gboolean read_script_xml(xmlNode *node, rmScenario *scenario, GError **error)
 {
+    xmlChar  *type, *source, *attr;
+    gchar   **names;
+    gboolean  ret;
+    guint     i;
+
     g_assert(node->type == XML_ELEMENT_NODE);
 
+    if ((attr = xmlGetProp(node, BAD_CAST "variables"))) {
+        names = g_strsplit_set((const gchar *) attr, " \t\r\n", -1);
+        for (i = 0; names[i] != NULL; i++) {
+            if (*names[i] != '\0') rm_var_table_add(scenario->variables, names[i]);
+        }
+        g_strfreev(names);
+        xmlFree(attr);
+    }
+
+    if (scenario->scripts == NULL) {
+        scenario->scripts = rm_scripts_new();
+    }
+
+    type   = xmlGetProp(node, BAD_CAST "type");
+    source = xmlNodeListGetString(node->doc, node->children, 1);
+    ret = rm_scripts_add(scenario->scripts, (const gchar *) type, (source ? (const gchar *) source : ""),
+        (source ? (gsize) xmlStrlen(source) : 0), error);
+    xmlFree(type);
+    xmlFree(source);
+
+    return ret;
+}
+
+/// Set the name of the function run by an iteration hook
+static void set_iteration_hook(rmScenario *scenario, rmScriptHook hook, const xmlChar *value)
+{
+    gchar **name;
+
+    if (scenario->scripts == NULL) {
+        scenario->scripts = rm_scripts_new();
+    }
+
+    name = (hook == RM_HOOK_PRE_ITERATION ? &scenario->scripts->preIteration : &scenario->scripts->postIteration);
+    g_free(*name);
+    *name = g_strdup((const gchar *) value);
+}
+
+/// Read the value of a numeric option, which must be a non-negative integer
+static gboolean read_option_uint(const xmlChar *name, const xmlChar *value, guint *target, GError **error)
+{
+    gchar   *end;
+    guint64  n;
+
+    n = g_ascii_strtoull((const gchar *) value, &end, 10);
+    if (end == (const gchar *) value || *end != '\0' || n > G_MAXUINT) {
+        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+            "option '%s' must be a non-negative integer, got '%s'", name, value);
+        return FALSE;
+    }
+
+    *target = (guint) n;
+
     return TRUE;
 }
 
@@ -398,6 +663,35 @@ static gboolean read_options_xml(xmlNode *node, rmScenario *scenario, SoupURI **
         } else if (xmlStrcmp(attr, BAD_CAST "failOnHttpRedirect") == 0) {
             scenario->failOnHttpRedirect = XML_ATTR_TO_BOOLEAN(value);
 
+        } else if (xmlStrcmp(attr, BAD_CAST "keepAlive") == 0) {
+            scenario->keepAlive = XML_ATTR_TO_BOOLEAN(value);
+
+        } else if (xmlStrcmp(attr, BAD_CAST "maxConnsPerHost") == 0) {
+            if (! read_option_uint(attr, value, &scenario->maxConnsPerHost, error)) {
+                xmlFree(attr);
+                xmlFree(value);
+                return FALSE;
+            }
+
+        } else if (xmlStrcmp(attr, BAD_CAST "maxRequestsPerConn") == 0) {
+            if (! read_option_uint(attr, value, &scenario->maxRequestsPerConn, error)) {
+                xmlFree(attr);
+                xmlFree(value);
+                return FALSE;
+            }
+
+        } else if (xmlStrcmp(attr, BAD_CAST "discardResponseBody") == 0) {
+            scenario->discardResponseBody = XML_ATTR_TO_BOOLEAN(value);
+
+        } else if (xmlStrcmp(attr, BAD_CAST "failOnExpectation") == 0) {
+            scenario->failOnExpectation = XML_ATTR_TO_BOOLEAN(value);
+
+        } else if (xmlStrcmp(attr, BAD_CAST "preIteration") == 0) {
+            set_iteration_hook(scenario, RM_HOOK_PRE_ITERATION, value);
+
+        } else if (xmlStrcmp(attr, BAD_CAST "postIteration") == 0) {
+            set_iteration_hook(scenario, RM_HOOK_POST_ITERATION, value);
+
         } else if (xmlStrcmp(attr, BAD_CAST "baseUrl") == 0) {
             g_assert(*baseUrl == NULL);
             *baseUrl = soup_uri_new((const char *) value);
@@ -414,10 +708,75 @@ static gboolean read_options_xml(xmlNode *node, rmScenario *scenario, SoupURI **
     return TRUE;
 }
 
-/// Read the 'clientSetup' XML element. In the case of this element, we are only
-/// interested in the 'options' child element of it, as the 'headers' child
-/// element is read later using XPath
-static gboolean read_client_setup_xml(xmlNode *node, rmScenario *scenario, SoupURI **baseUrl, GError **error)
+/// Read the 'feeders' XML element. Each feeder's data file is mapped and
+/// indexed right away, and defines a variable for each of its columns.
+static gboolean read_feeders_xml(xmlNode *node, rmScenario *scenario, GError **error)
+{
+    xmlNode       *child;
+    xmlChar       *name, *file, *attr;
+    rmFeeder      *feeder;
+    rmFeederFormat format;
+    rmFeederMode   mode;
+    rmFeederScope  scope;
+
+    g_assert(node->type == XML_ELEMENT_NODE);
+    g_assert(xmlStrcmp(node->name, BAD_CAST "feeders") == 0);
+
+    for (child = node->children; child; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE) continue;
+
+        name = xmlGetProp(child, BAD_CAST "name");
+        file = xmlGetProp(child, BAD_CAST "file");
+        if (name == NULL || file == NULL) {
+            g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+                "missing required attribute 'name' or 'file' on feeder XML element in line %u", child->line);
+            xmlFree(name);
+            xmlFree(file);
+            return FALSE;
+        }
+
+        // The format defaults to JSONL for .jsonl files, and CSV otherwise
+        if ((attr = xmlGetProp(child, BAD_CAST "format")) != NULL) {
+            format = (xmlStrcmp(attr, BAD_CAST "jsonl") == 0 ? RM_FEEDER_JSONL : RM_FEEDER_CSV);
+            xmlFree(attr);
+        } else {
+            format = (g_str_has_suffix((const gchar *) file, ".jsonl") ? RM_FEEDER_JSONL : RM_FEEDER_CSV);
+        }
+
+        mode = RM_FEEDER_SEQUENTIAL;
+        if ((attr = xmlGetProp(child, BAD_CAST "mode")) != NULL) {
+            if (xmlStrcmp(attr, BAD_CAST "random") == 0) {
+                mode = RM_FEEDER_RANDOM;
+            } else if (xmlStrcmp(attr, BAD_CAST "partitioned") == 0) {
+                mode = RM_FEEDER_PARTITIONED;
+            }
+            xmlFree(attr);
+        }
+
+        scope = RM_FEEDER_PER_ITERATION;
+        if ((attr = xmlGetProp(child, BAD_CAST "scope")) != NULL) {
+            if (xmlStrcmp(attr, BAD_CAST "client") == 0) {
+                scope = RM_FEEDER_PER_CLIENT;
+            }
+            xmlFree(attr);
+        }
+
+        feeder = rm_feeder_new((const gchar *) name, (const gchar *) file, format, mode, scope, error);
+        xmlFree(name);
+        xmlFree(file);
+
+        if (feeder == NULL || ! rm_scenario_add_feeder(scenario, feeder, error)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/// Read the 'clientSetup' XML element: scenario options, data feeders, and
+/// the base headers which are added to every request that follows
+static gboolean read_client_setup_xml(xmlNode *node, rmScenario *scenario, SoupURI **baseUrl,
+    GSList **baseHeaders, GError **error)
 {
     xmlNode *child;
 
@@ -431,6 +790,16 @@ static gboolean read_client_setup_xml(xmlNode *node, rmScenario *scenario, SoupU
                 if (! read_options_xml(child, scenario, baseUrl, error)) {
                     return FALSE;
                 }
+
+            } else XML_IF_NODE_NAME(child, "headers") {
+                if (! read_headers_xml(child, baseHeaders, error)) {
+                    return FALSE;
+                }
+
+            } else XML_IF_NODE_NAME(child, "feeders") {
+                if (! read_feeders_xml(child, scenario, error)) {
+                    return FALSE;
+                }
             }
         }
     }
@@ -438,137 +807,219 @@ static gboolean read_client_setup_xml(xmlNode *node, rmScenario *scenario, SoupU
     return TRUE;
 }
 
-/// Validate the input XML file using an XML Schema file
-static gboolean validate_scenario_xml(const xmlDocPtr doc, GError **error)
+/// Read the 'loadProfile' XML element. Each stage sets either a number of
+/// clients or an iteration rate, which is reached over the stage's ramp
+/// time (by default, the whole stage) and held until the end of the stage.
+static gboolean read_load_profile_xml(xmlNode *node, rmScenario *scenario, GError **error)
 {
-    xmlDocPtr              schemaDoc  = NULL;
-    xmlSchemaParserCtxtPtr parserCtxt = NULL;
-    xmlSchemaPtr           schema     = NULL;
-    xmlSchemaValidCtxtPtr  validCtxt  = NULL;
-    int                    status;
-
-    schemaDoc = xmlReadFile(RM_DATA_DIR RM_XML_XSD_FILE, NULL, XML_PARSE_NONET);
-    if (schemaDoc == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "error reading XML schema file '%s'", RM_DATA_DIR RM_XML_XSD_FILE);
-        goto returnWithError;
-    }
+    xmlNode         *child;
+    xmlChar         *name, *clients, *rate, *attr;
+    rmLoadStageType  type;
+    gdouble          duration, ramp, target;
+    gboolean         ok;
 
-    parserCtxt = xmlSchemaNewDocParserCtxt(schemaDoc);
-    if (parserCtxt == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "unable to create XML parser context from schema doc");
-        goto returnWithError;
-    }
+    g_assert(node->type == XML_ELEMENT_NODE);
+    g_assert(xmlStrcmp(node->name, BAD_CAST "loadProfile") == 0);
 
-    schema = xmlSchemaParse(parserCtxt);
-    if (schema == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "XML schema '%s' is invalid", RM_DATA_DIR RM_XML_XSD_FILE);
-        goto returnWithError;
+    if (scenario->profile == NULL) {
+        scenario->profile = rm_load_profile_new();
     }
 
-    validCtxt = xmlSchemaNewValidCtxt(schema);
-    if (validCtxt == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "unable to create XML schema validation context from schema doc");
-        goto returnWithError;
-    }
+    for (child = node->children; child; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE) continue;
 
-    // Validate document
-    status = xmlSchemaValidateDoc(validCtxt, doc);
-    if (status < 0) {
-        // Internal parser error
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "an internal schema validator error has occurred");
-        goto returnWithError;
-    } else if (status > 0) {
-        // Validation error
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
-                "the provided scenario file is not valid");
-        goto returnWithError;
-    }
+        clients = xmlGetProp(child, BAD_CAST "clients");
+        rate    = xmlGetProp(child, BAD_CAST "rate");
+        if ((clients == NULL) == (rate == NULL)) {
+            g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+                "stage XML element in line %u must have either a 'clients' or a 'rate' attribute", child->line);
+            xmlFree(clients);
+            xmlFree(rate);
+            return FALSE;
+        }
 
-    xmlFreeDoc(schemaDoc);
-    xmlSchemaFreeParserCtxt(parserCtxt);
-    xmlSchemaFree(schema);
-    xmlSchemaFreeValidCtxt(validCtxt);
+        if (clients != NULL) {
+            type   = RM_STAGE_CLIENTS;
+            target = g_ascii_strtod((const gchar *) clients, NULL);
+            ok     = TRUE;
+        } else {
+            type   = RM_STAGE_RATE;
+            ok     = rm_load_profile_parse_rate((const gchar *) rate, &target, error);
+        }
+        xmlFree(clients);
+        xmlFree(rate);
+
+        duration = 0;
+        if (ok && (attr = xmlGetProp(child, BAD_CAST "duration")) != NULL) {
+            ok = rm_load_profile_parse_duration((const gchar *) attr, &duration, error);
+            xmlFree(attr);
+        }
+
+        ramp = duration;
+        if (ok && (attr = xmlGetProp(child, BAD_CAST "ramp")) != NULL) {
+            ok = rm_load_profile_parse_duration((const gchar *) attr, &ramp, error);
+            xmlFree(attr);
+        }
+
+        if (! ok) return FALSE;
+
+        name = xmlGetProp(child, BAD_CAST "name");
+        rm_load_profile_add_stage(scenario->profile, (const gchar *) name, type, duration, ramp, target);
+        xmlFree(name);
+    }
 
     return TRUE;
+}
+
+/// Parsed XML schema scenarios are validated against. Loaded once, and
+/// never changed or freed after that.
+static xmlSchemaPtr scenarioSchema = NULL;
+G_LOCK_DEFINE_STATIC(scenarioSchema);
 
-returnWithError:
-    if (schemaDoc != NULL)  xmlFreeDoc(schemaDoc);
-    if (parserCtxt != NULL) xmlSchemaFreeParserCtxt(parserCtxt);
-    if (schema != NULL)     xmlSchemaFree(schema);
-    if (validCtxt != NULL)  xmlSchemaFreeValidCtxt(validCtxt);
+/// Load the XML schema scenarios are validated against from a file, unless a
+/// schema has already been loaded. The schema is otherwise loaded from the
+/// data directory when the first scenario is read.
+gboolean rm_scenario_xml_load_schema(const gchar *filename, GError **error)
+{
+    xmlSchemaParserCtxtPtr parserCtxt;
+    gboolean               loaded;
+
+    G_LOCK(scenarioSchema);
+    if (scenarioSchema == NULL) {
+        parserCtxt = xmlSchemaNewParserCtxt(filename);
+        if (parserCtxt == NULL) {
+            g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+                "unable to create XML schema parser context");
+        } else {
+            scenarioSchema = xmlSchemaParse(parserCtxt);
+            if (scenarioSchema == NULL) {
+                g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+                    "error reading XML schema file '%s'", filename);
+            }
+            xmlSchemaFreeParserCtxt(parserCtxt);
+        }
+    }
+    loaded = (scenarioSchema != NULL);
+    G_UNLOCK(scenarioSchema);
 
-    return FALSE;
+    return loaded;
 }
 
-/// Read a scenario XML file from an open stream and return a scenario struct
-static rmScenario *read_scenario_from_xml_stream(FILE *file, GError **error)
+/// Read a scenario from an XML reader and return a scenario struct. The
+/// document is streamed: each top level element is expanded, read and then
+/// dropped by the reader, so only one request is held in memory at a time,
+/// and the document is validated against the schema as it is read. The
+/// clientSetup element comes before all requests, so its base URL and
+/// headers are resolved once and applied to each request as it is read.
+/// The reader is freed.
+static rmScenario *read_scenario_from_xml_reader(xmlTextReaderPtr reader, GError **error)
 {
-    xmlParserCtxtPtr  xmlCtx;
-    xmlDocPtr         xmlDoc;
-    xmlNode          *root_node, *cur_node;
+    xmlNode          *cur_node;
     rmScenario       *scenario    = NULL;
     SoupURI          *baseUrl     = NULL;
+    GSList           *baseHeaders = NULL;
+    gint              ret;
 
-    // Read XML from open stream
-    if ((xmlCtx = xmlNewParserCtxt()) == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_ALLOC,
-            "failed creating XML parser context");
+    if (! rm_scenario_xml_load_schema(RM_DATA_DIR RM_XML_XSD_FILE, error)) {
+        xmlFreeTextReader(reader);
         return NULL;
     }
 
-    if ((xmlDoc = xmlCtxtReadFd(xmlCtx, fileno(file), "/", "utf8", 0)) == NULL) {
-        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_PARSE,
-            "failed to parse open XML file");
+    if (xmlTextReaderSetSchema(reader, scenarioSchema) != 0) {
+        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+            "unable to create XML schema validation context");
+        xmlFreeTextReader(reader);
         return NULL;
     }
 
-    xmlFreeParserCtxt(xmlCtx);
+    scenario = rm_scenario_new();
 
-    // Validate XML according to schema
-    if (validate_scenario_xml(xmlDoc, error)) {
-        // Iterate tree and read data into memory
-        root_node = xmlDocGetRootElement(xmlDoc);
-        scenario = rm_scenario_new();
+    ret = xmlTextReaderRead(reader);
+    while (ret == 1 && xmlTextReaderIsValid(reader) == 1) {
+        if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT || xmlTextReaderDepth(reader) != 1) {
+            ret = xmlTextReaderRead(reader);
+            continue;
+        }
 
-        for (cur_node = root_node->children; cur_node; cur_node = cur_node->next) {
-            if (cur_node->type == XML_ELEMENT_NODE) {
-                XML_IF_NODE_NAME(cur_node, "request") {
-                    // Read a request object
-                    if (! read_request_xml_add_req(cur_node, scenario, baseUrl, error))
-                        break;
+        if ((cur_node = xmlTextReaderExpand(reader)) == NULL) {
+            ret = -1;
+            break;
+        }
+
+        XML_IF_NODE_NAME(cur_node, "request") {
+            // Read a request object
+            if (! read_request_xml_add_req(cur_node, scenario, baseUrl, baseHeaders, error))
+                break;
 
-                } else XML_IF_NODE_NAME(cur_node, "script") {
-                    // Read a script element
-                    if (! read_script_xml(cur_node, scenario, error))
-                        break;
+        } else XML_IF_NODE_NAME(cur_node, "script") {
+            // Read a script element
+            if (! read_script_xml(cur_node, scenario, error))
+                break;
 
-                } else XML_IF_NODE_NAME(cur_node, "clientSetup") {
-                    // Read the 'options' section
-                    if (! read_client_setup_xml(cur_node, scenario, &baseUrl, error))
-                        break;
+        } else XML_IF_NODE_NAME(cur_node, "clientSetup") {
+            // Read the 'options', 'feeders' and 'headers' sections
+            if (! read_client_setup_xml(cur_node, scenario, &baseUrl, &baseHeaders, error))
+                break;
 
-                } else {
-                    g_printerr("WARNING: unrecognized XML element '%s'\n", cur_node->name);
-                }
-            }
+        } else XML_IF_NODE_NAME(cur_node, "loadProfile") {
+            // Read the stages of the load profile
+            if (! read_load_profile_xml(cur_node, scenario, error))
+                break;
+
+        } else {
+            g_printerr("WARNING: unrecognized XML element '%s'\n", cur_node->name);
+        }
+
+        // Skip to the next sibling, dropping the element just read
+        ret = xmlTextReaderNext(reader);
+    }
+
+    if (*error == NULL) {
+        if (xmlTextReaderIsValid(reader) != 1) {
+            g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_VALIDATE,
+                "the provided scenario file is not valid");
+        } else if (ret != 0) {
+            g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_PARSE,
+                "failed to parse XML scenario document");
         }
     }
 
-    if (*error != NULL && scenario != NULL) {
+    if (*error != NULL) {
         rm_scenario_free(scenario);
         scenario = NULL;
+    } else {
+        rm_scenario_freeze(scenario);
+
+        // Make sure scripts run, and define all the hooks they are named for
+        if (scenario->scripts != NULL &&
+            ! rm_scripts_check(scenario->scripts, scenario->requestTable, scenario->requestCount, error)) {
+
+            rm_scenario_free(scenario);
+            scenario = NULL;
+        }
     }
 
     if (baseUrl != NULL) soup_uri_free(baseUrl);
-    xmlFreeDoc(xmlDoc);
+    rm_gslist_free_full(baseHeaders, (GDestroyNotify) rm_header_free);
+    xmlFreeTextReader(reader);
+
     return scenario;
 }
 
+/// Read a scenario XML file from an open stream and return a scenario struct
+static rmScenario *read_scenario_from_xml_stream(FILE *file, GError **error)
+{
+    xmlTextReaderPtr reader;
+
+    if ((reader = xmlReaderForFd(fileno(file), "/", "utf8", 0)) == NULL) {
+        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_ALLOC,
+            "failed creating XML reader");
+        return NULL;
+    }
+
+    return read_scenario_from_xml_reader(reader, error);
+}
+
 /// Read scenario from XML file and return a new scenario struct
 rmScenario *rm_scenario_xml_read_file(char *filename, GError **error)
 {
@@ -597,4 +1048,20 @@ rmScenario *rm_scenario_xml_read_file(char *filename, GError **error)
     return scenario;
 }
 
+/// Read scenario from an XML document held in memory and return a new
+/// scenario struct. This is used by agents to load a scenario document
+/// received from the coordinator
+rmScenario *rm_scenario_xml_read_buffer(const gchar *data, gsize length, GError **error)
+{
+    xmlTextReaderPtr reader;
+
+    if ((reader = xmlReaderForMemory(data, (int) length, "/", "utf8", 0)) == NULL) {
+        g_set_error(error, RM_ERROR_XML, RM_ERROR_XML_ALLOC,
+            "failed creating XML reader");
+        return NULL;
+    }
+
+    return read_scenario_from_xml_reader(reader, error);
+}
+
 // vim:ts=4:expandtab:cindent:sw=2
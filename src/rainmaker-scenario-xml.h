@@ -19,7 +19,9 @@ enum {
     RM_ERROR_XML_VALIDATE
 };
 
+gboolean    rm_scenario_xml_load_schema(const gchar *filename, GError **error);
 rmScenario *rm_scenario_xml_read_file(char *filename, GError **error);
+rmScenario *rm_scenario_xml_read_buffer(const gchar *data, gsize length, GError **error);
 
 #define RAINMAKER_SCENARIO_XML_H_
 #endif
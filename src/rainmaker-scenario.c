@@ -27,10 +27,25 @@ rmScenario* rm_scenario_new()
 
     scn = g_malloc(sizeof(rmScenario));
     scn->requests           = NULL;
+    scn->lastRequest        = NULL;
+    scn->requestTable       = NULL;
+    scn->requestCount       = 0;
     scn->persistCookies     = FALSE;
     scn->failOnHttpError    = TRUE;
     scn->failOnHttpRedirect = FALSE;
     scn->failOnTcpError     = TRUE;
+    scn->keepAlive          = TRUE;
+    scn->maxConnsPerHost    = 0;
+    scn->maxRequestsPerConn = 0;
+    scn->discardResponseBody = FALSE;
+    scn->failOnExpectation  = TRUE;
+    scn->variables          = rm_var_table_new();
+    scn->feeders            = NULL;
+    scn->storage            = NULL;
+    scn->storageFree        = NULL;
+    scn->arena              = NULL;
+    scn->scripts            = NULL;
+    scn->profile            = NULL;
 
     return scn;
 }
@@ -39,20 +54,91 @@ rmScenario* rm_scenario_new()
 /// any memory used by attached requests.
 void rm_scenario_free(rmScenario *scenario)
 {
+    guint i;
+
     // Free all requests
     g_slist_foreach(scenario->requests, (GFunc) rm_scenario_free_requests, NULL);
     g_slist_free(scenario->requests);
+    for (i = 0; scenario->requestTable != NULL && i < scenario->requestCount; i++) {
+        rm_request_free(&scenario->requestTable[i]);
+    }
+    if (scenario->arena) rm_arena_free(scenario->arena);
+
+    rm_gslist_free_full(scenario->feeders, (GDestroyNotify) rm_feeder_free);
+    rm_var_table_free(scenario->variables);
+    if (scenario->scripts) rm_scripts_free(scenario->scripts);
+    if (scenario->profile) rm_load_profile_free(scenario->profile);
+
+    // Request bodies may point into the scenario's storage
+    if (scenario->storage) scenario->storageFree(scenario->storage);
 
     g_free(scenario);
 }
 
-/// Append a request to a scenario's list of requests
+/// Append a request to a scenario's list of requests. Each request gets a
+/// stable index, which is its position in the scenario, and is used to
+/// look up per-request statistics. The request should be fully set up before
+/// it is added to the scenario, and is compiled when the scenario is frozen.
+/// The tail of the list is kept, so that appending does not walk the list and
+/// loading large scenarios takes linear time.
 void rm_scenario_add_request(rmScenario *scenario, rmRequest *request)
 {
+    GSList *node;
+
     g_assert(scenario != NULL);
     g_assert(request != NULL);
+    g_assert(scenario->requestTable == NULL); // not frozen yet
+
+    request->index = scenario->requestCount++;
+
+    node = g_slist_append(NULL, (gpointer) request);
+    if (scenario->lastRequest == NULL) {
+        scenario->requests = node;
+    } else {
+        scenario->lastRequest->next = node;
+    }
+    scenario->lastRequest = node;
+}
+
+/// Freeze a loaded scenario for running. Requests are moved from the list
+/// they were loaded into to a table in the scenario's arena, in order,
+/// together with their headers, names and bodies (see rm_request_freeze()),
+/// and compiled into templates (see rm_request_compile()). Requests are
+/// allocated one by one as they are loaded, in between all the memory the
+/// loader uses, while clients go through them in order, over and over; laid
+/// out in a single block they are walked sequentially, and shared by all
+/// threads. The table is aligned to a cache line, and nothing in the arena
+/// is written to once frozen, so that threads reading it never invalidate
+/// each other's cache lines. No requests can be added to a frozen scenario.
+void rm_scenario_freeze(rmScenario *scenario)
+{
+    GSList *node;
+    guint   i;
+
+    g_assert(scenario->requestTable == NULL); // not frozen yet
+
+    scenario->arena        = rm_arena_new();
+    scenario->requestTable = rm_arena_alloc(scenario->arena,
+        sizeof(rmRequest) * MAX(scenario->requestCount, 1), RM_CACHE_LINE_SIZE);
+
+    for (node = scenario->requests, i = 0; node; node = node->next, i++) {
+        rm_request_freeze((rmRequest *) node->data, &scenario->requestTable[i], scenario->arena);
+        rm_request_compile(&scenario->requestTable[i]);
+    }
+
+    g_slist_free(scenario->requests);
+    scenario->requests    = NULL;
+    scenario->lastRequest = NULL;
+}
+
+/// Add a data feeder to a scenario, defining a variable for each of its
+/// columns. The scenario takes ownership of the feeder, even if it fails to
+/// add it.
+gboolean rm_scenario_add_feeder(rmScenario *scenario, rmFeeder *feeder, GError **error)
+{
+    scenario->feeders = g_slist_append(scenario->feeders, feeder);
 
-    scenario->requests = g_slist_append(scenario->requests, (gpointer) request);
+    return rm_feeder_bind(feeder, scenario->variables, error);
 }
 
 // vim:ts=4:expandtab:cindent:sw=2
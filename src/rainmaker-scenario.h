@@ -12,18 +12,41 @@
 #ifndef RAINMAKER_SCENARIO_H_
 
 #include "rainmaker-request.h"
+#include "rainmaker-template.h"
+#include "rainmaker-feeder.h"
+#include "rainmaker-arena.h"
+#include "rainmaker-script.h"
+#include "rainmaker-profile.h"
 
-/// Scenario struct
+/// Scenario struct. Requests are added to a list while the scenario is
+/// loaded, and then frozen into a table, which is what requests are run from.
 typedef struct _rmScenario {
-    GSList     *requests;
+    GSList     *requests;           ///< requests being loaded, until frozen
+    GSList     *lastRequest;        ///< tail of the request list, to append in constant time
+    rmRequest  *requestTable;       ///< all requests in order, once frozen
+    guint       requestCount;
     gboolean    persistCookies;
     gboolean    failOnHttpError;
     gboolean    failOnHttpRedirect;
     gboolean    failOnTcpError;
+    gboolean    keepAlive;          ///< keep connections open between requests
+    guint       maxConnsPerHost;    ///< max connections per host per client, 0 for default
+    guint       maxRequestsPerConn; ///< close connections after this many requests, 0 for no limit
+    gboolean    discardResponseBody; ///< drop response body data as it arrives instead of keeping it
+    gboolean    failOnExpectation;  ///< fail the client when a response does not meet an expectation
+    rmVarTable     *variables;      ///< variables requests can reference
+    GSList         *feeders;        ///< data feeders setting variable values
+    gpointer        storage;        ///< memory request bodies point into, if loaded from a compiled scenario
+    GDestroyNotify  storageFree;
+    rmArena        *arena;          ///< memory frozen requests live in
+    rmScripts      *scripts;        ///< scripts run by hooks, if any
+    rmLoadProfile  *profile;        ///< load profile the scenario is run by, if any
 } rmScenario;
 
 rmScenario*   rm_scenario_new();
 void          rm_scenario_add_request(rmScenario *scenario, rmRequest *request);
+gboolean      rm_scenario_add_feeder(rmScenario *scenario, rmFeeder *feeder, GError **error);
+void          rm_scenario_freeze(rmScenario *scenario);
 void          rm_scenario_free(rmScenario *scenario);
 
 #define RAINMAKER_SCENARIO_H_
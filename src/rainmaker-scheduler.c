@@ -0,0 +1,619 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <time.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-scheduler.h"
+#include "rainmaker-worker.h"
+#include "rainmaker-client.h"
+#include "rainmaker-scoreboard.h"
+
+/// Get the monotonic clock time in nanoseconds
+static gint64 monotonic_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// Create a new scheduler with a fixed number of workers. Each worker gets
+/// enough slots to run its fair share of the expected number of clients
+/// concurrently. If a raw engine is provided, requests are sent using it
+/// instead of libsoup. The raw engine is not owned by the scheduler. If the
+/// scenario has a load profile, clients are started by the profile.
+rmScheduler* rm_scheduler_new(rmScenario *scenario, guint workers, guint clients,
+                              rmRawEngine *raw, SoupLogger *logger)
+{
+    rmScheduler *sched;
+    guint        i, slots;
+
+    g_assert(workers > 0);
+
+    sched = g_malloc0(sizeof(rmScheduler));
+    sched->scenario    = scenario;
+    sched->workerCount = workers;
+    sched->workers     = g_malloc(sizeof(rmWorker *) * workers);
+    sched->timer       = g_timer_new();
+    sched->raw         = raw;
+    sched->profile     = scenario->profile;
+
+    if (sched->profile != NULL) {
+        sched->idleLock   = g_mutex_new();
+        sched->stageStats = g_malloc0(sizeof(rmStageStats) * sched->profile->stageCount);
+        g_queue_init(&sched->idle);
+    }
+
+    slots = MAX((clients + workers - 1) / workers, 1);
+    for (i = 0; i < workers; i++) {
+        sched->workers[i] = rm_worker_new(i, sched, slots, logger);
+    }
+
+    return sched;
+}
+
+/// Add a client to the scheduler. All of the client's iterations are added
+/// to the pending work, and the client is queued for its first iteration on
+/// one of the workers, in a round-robin fashion. With a load profile, the
+/// client is put in the idle pool instead, until the profile starts it. The
+/// scheduler takes ownership of the client.
+void rm_scheduler_add_client(rmScheduler *sched, rmClient *client)
+{
+    rmWorker *worker;
+
+    sched->clients = g_slist_prepend(sched->clients, client);
+
+    if (sched->profile != NULL) {
+        g_queue_push_tail(&sched->idle, client);
+        sched->clientCount++;
+        return;
+    }
+
+    worker = sched->workers[sched->clientCount % sched->workerCount];
+
+    sched->clientCount++;
+    sched->pending += client->iterations;
+
+    rm_scheduler_push(sched, worker, client);
+}
+
+/// Create a range of clients and add them to the scheduler. Clients are
+/// numbered starting at first, out of a total number of clients which may be
+/// spread over several agents, so that partitioned data feeders give each
+/// client its own rows across all agents. In open-loop mode, the total rate is
+/// split evenly between all clients, and clients are spread evenly over the
+/// send interval.
+void rm_scheduler_create_clients(rmScheduler *sched, guint first, guint count, guint total,
+                                 guint repeat, gboolean keepCookies, gdouble rate)
+{
+    rmClient *client;
+    guint     i;
+
+    for (i = first; i < first + count; i++) {
+        client = rm_client_new(i, sched->scenario, repeat, keepCookies);
+        client->clientCount = total;
+        if (rate > 0) {
+            rm_client_set_schedule(client, sched->timer, total / rate, i / rate);
+        }
+
+        rm_scheduler_add_client(sched, client);
+    }
+}
+
+/// Bound the run by a duration, in seconds: clients run iterations back to
+/// back until the duration is over, and are then stopped, cancelling the
+/// iterations they are running. Clients must be created for one iteration.
+/// With a load profile, the run stops at the end of the profile or once the
+/// duration is over, whichever comes first. Responses received during the
+/// warm-up time at the start of the run are recorded apart, in the workers'
+/// warm-up scoreboards. Either may be 0 for none. Must be called before the
+/// run starts.
+void rm_scheduler_set_duration(rmScheduler *sched, gdouble duration, gdouble warmup)
+{
+    g_assert(duration >= 0 && warmup >= 0);
+
+    sched->duration = duration;
+    sched->warmup   = warmup;
+}
+
+/// Log every response received during the run to a sample log, which must
+/// have a ring for each worker. The log is not owned by the scheduler, and
+/// must be started and stopped around the run. Must be called before the run
+/// starts.
+void rm_scheduler_set_sample_log(rmScheduler *sched, rmSampleLog *log)
+{
+    guint i;
+
+    g_assert(log->ringCount >= sched->workerCount);
+
+    for (i = 0; i < sched->workerCount; i++) {
+        sched->workers[i]->samples = rm_sample_log_ring(log, i);
+    }
+}
+
+/// Get the time elapsed since the run started on the monotonic clock, in
+/// seconds
+static gdouble driver_elapsed(rmScheduler *sched)
+{
+    return (monotonic_nsec() - sched->origin) / 1e9;
+}
+
+/// Sleep until a given time since the start of the run. Sleeps are set to
+/// absolute times on the monotonic clock, so that they don't drift, and are
+/// cut into slices so that the driver notices when the run is stopped.
+/// Never sleeps past the end of a duration bounded run. Returns FALSE if the
+/// run is stopping, or the duration is over by the given time.
+static gboolean driver_sleep_until(rmScheduler *sched, gdouble at)
+{
+    struct timespec ts;
+    gint64          deadline, now, wake;
+    gboolean        expires = (sched->duration > 0 && at >= sched->duration);
+
+    deadline = sched->origin + (gint64) ((expires ? sched->duration : at) * 1e9);
+    while ((now = monotonic_nsec()) < deadline) {
+        if (g_atomic_int_get(&sched->stopping)) return FALSE;
+
+        wake = MIN(deadline, now + (gint64) RM_SCHEDULER_DRIVER_SLICE * 1000000);
+        ts.tv_sec  = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    return (! expires && ! g_atomic_int_get(&sched->stopping));
+}
+
+/// Record how late an event due at a given time happened
+static void driver_record_lag(rmScheduler *sched, rmStageStats *stats, gdouble due)
+{
+    gdouble lag = MAX(driver_elapsed(sched) - due, 0);
+
+    stats->events++;
+    stats->lagTotal += lag;
+    stats->lagMax    = MAX(stats->lagMax, lag);
+}
+
+/// Wake up all workers, so that idle ones see the run is over and stop
+static void scheduler_wake_all(rmScheduler *sched)
+{
+    guint i;
+
+    for (i = 0; i < sched->workerCount; i++) {
+        rm_worker_wake(sched->workers[i]);
+    }
+}
+
+/// Start a client from the idle pool for one iteration, queueing it on the
+/// next worker in a round-robin fashion, and waking that worker up. Called
+/// by the driver with the idle lock held. Returns FALSE if all clients are
+/// busy, or the run is stopping, as it does once its duration is over.
+static gboolean driver_start_client(rmScheduler *sched)
+{
+    rmClient *client;
+    rmWorker *worker;
+
+    if (g_atomic_int_get(&sched->stopping)) return FALSE;
+
+    client = (rmClient *) g_queue_pop_head(&sched->idle);
+    if (client == NULL) return FALSE;
+
+    worker = sched->workers[sched->nextWorker++ % sched->workerCount];
+    client->iterations = 1;
+    g_atomic_int_inc(&sched->active);
+
+    rm_scheduler_push(sched, worker, client);
+    rm_worker_wake(worker);
+
+    return TRUE;
+}
+
+/// Set the number of clients running. Clients are started from the idle
+/// pool, or retired once their running iteration completes; a client about
+/// to retire is kept on instead of starting another one.
+static void driver_set_clients(rmScheduler *sched, rmStageStats *stats, guint clients)
+{
+    gint running;
+
+    g_mutex_lock(sched->idleLock);
+
+    running = g_atomic_int_get(&sched->active) - sched->retiring;
+    for (; running < (gint) clients; running++) {
+        if (sched->retiring > 0) {
+            sched->retiring--;
+        } else if (driver_start_client(sched)) {
+            stats->started++;
+        } else {
+            break;
+        }
+    }
+
+    if (running > (gint) clients) {
+        stats->retired   += running - clients;
+        sched->retiring  += running - clients;
+    }
+
+    g_mutex_unlock(sched->idleLock);
+}
+
+/// Start an iteration in a rate stage, on any idle client
+static void driver_start_iteration(rmScheduler *sched, rmStageStats *stats)
+{
+    g_mutex_lock(sched->idleLock);
+
+    if (driver_start_client(sched)) {
+        stats->started++;
+    } else {
+        stats->missed++;
+    }
+
+    g_mutex_unlock(sched->idleLock);
+}
+
+/// Load profile driver thread main function. Goes through the stages in
+/// order, working out when the next client should start or retire, or when
+/// the next iteration should start, and sleeping until then. When the
+/// driver is late, clients stages catch up by jumping to the current number
+/// of clients, and rate stages start the iterations which are due right away.
+/// Once all stages are over, all clients are retired.
+static gpointer scheduler_driver_main(rmScheduler *sched)
+{
+    const rmLoadProfile *profile = sched->profile;
+    const rmLoadStage   *stage;
+    rmStageStats        *stats;
+    guint                i, clients = 0, next = 0;
+    guint64              arrivals;
+    gdouble              at;
+
+    for (i = 0; i < profile->stageCount; i++) {
+        stage = &profile->stages[i];
+        stats = &sched->stageStats[i];
+
+        // Clients running when a rate stage starts go back to the idle pool
+        // when their iteration completes, and need not be retired
+        g_mutex_lock(sched->idleLock);
+        g_atomic_int_set(&sched->stage, i);
+        if (stage->type == RM_STAGE_RATE) sched->retiring = 0;
+        g_mutex_unlock(sched->idleLock);
+
+        if (stage->type == RM_STAGE_RATE) clients = 0;
+        arrivals = 0;
+
+        for (;;) {
+            if (stage->type == RM_STAGE_CLIENTS) {
+                at = rm_load_stage_next_change(stage, clients, driver_elapsed(sched) - stage->start, &next);
+            } else {
+                at = rm_load_stage_arrival(stage, arrivals + 1);
+            }
+            if (at < 0 || at >= stage->duration) break;
+            if (! driver_sleep_until(sched, stage->start + at)) break;
+
+            driver_record_lag(sched, stats, stage->start + at);
+            if (stage->type == RM_STAGE_CLIENTS) {
+                driver_set_clients(sched, stats, next);
+                clients = next;
+            } else {
+                driver_start_iteration(sched, stats);
+                arrivals++;
+            }
+        }
+
+        if (! driver_sleep_until(sched, stage->start + stage->duration)) break;
+    }
+
+    // Let running iterations complete, and have all clients retire after them
+    g_mutex_lock(sched->idleLock);
+    g_atomic_int_set(&sched->stopping, 1);
+    g_mutex_unlock(sched->idleLock);
+
+    scheduler_wake_all(sched);
+
+    return NULL;
+}
+
+/// Run all workers and wait for all pending iterations to complete. With a
+/// load profile, the profile driver is started along with the workers, and
+/// the run is over once all stages are over and running iterations complete.
+gboolean rm_scheduler_run(rmScheduler *sched, GError **error)
+{
+    guint    i;
+    gboolean started = TRUE;
+
+    g_timer_start(sched->timer);
+    sched->origin = monotonic_nsec();
+
+    for (i = 0; i < sched->workerCount; i++) {
+        if (! rm_worker_start(sched->workers[i], error)) {
+            // Drop all work so that started workers stop right away
+            g_atomic_int_set(&sched->pending, 0);
+            g_atomic_int_set(&sched->stopping, 1);
+            started = FALSE;
+            break;
+        }
+    }
+
+    if (started && sched->profile != NULL) {
+        sched->driver = g_thread_create((GThreadFunc) scheduler_driver_main, (gpointer) sched, TRUE, error);
+        if (sched->driver == NULL) {
+            g_atomic_int_set(&sched->stopping, 1);
+            started = FALSE;
+        }
+    }
+
+    if (sched->driver != NULL) {
+        g_thread_join(sched->driver);
+        sched->driver = NULL;
+    }
+
+    for (i = 0; i < sched->workerCount; i++) {
+        rm_worker_join(sched->workers[i]);
+    }
+
+    g_timer_stop(sched->timer);
+
+    return started;
+}
+
+/// Queue a client for its next iteration on the tail of a worker's deque
+void rm_scheduler_push(rmScheduler *sched, rmWorker *worker, rmClient *client)
+{
+    g_assert(client->iterations > 0);
+
+    g_mutex_lock(worker->dequeLock);
+    g_queue_push_tail(&worker->deque, client);
+    g_mutex_unlock(worker->dequeLock);
+}
+
+/// Get the next client to run an iteration on a worker. Will take the most
+/// recently queued client from the worker's own deque, or if it is empty,
+/// steal the least recently queued client from another worker's deque.
+/// Returns NULL if there is no work waiting anywhere, or the run's duration
+/// is over.
+rmClient* rm_scheduler_next(rmScheduler *sched, rmWorker *worker)
+{
+    rmClient *client;
+    rmWorker *victim;
+    guint     i;
+
+    if (g_atomic_int_get(&sched->expired)) return NULL;
+
+    g_mutex_lock(worker->dequeLock);
+    client = (rmClient *) g_queue_pop_tail(&worker->deque);
+    g_mutex_unlock(worker->dequeLock);
+
+    // Look for work to steal, starting from the next worker
+    for (i = 1; client == NULL && i < sched->workerCount; i++) {
+        victim = sched->workers[(worker->id + i) % sched->workerCount];
+
+        g_mutex_lock(victim->dequeLock);
+        client = (rmClient *) g_queue_pop_head(&victim->deque);
+        g_mutex_unlock(victim->dequeLock);
+
+        if (client != NULL) worker->stolen++;
+    }
+
+    return client;
+}
+
+/// Wake up workers with idle slots to steal the clients left waiting on a
+/// worker with no idle slots, one worker per waiting client. Called by the
+/// worker, from its own thread.
+void rm_scheduler_share(rmScheduler *sched, rmWorker *worker)
+{
+    rmWorker *thief;
+    guint     i, waiting;
+
+    if (sched->workerCount < 2) return;
+
+    g_mutex_lock(worker->dequeLock);
+    waiting = g_queue_get_length(&worker->deque);
+    g_mutex_unlock(worker->dequeLock);
+
+    for (i = 1; waiting > 0 && i < sched->workerCount; i++) {
+        thief = sched->workers[(worker->id + i) % sched->workerCount];
+        if (g_atomic_int_get(&thief->hungry)) {
+            rm_worker_wake(thief);
+            waiting--;
+        }
+    }
+}
+
+/// Mark a number of iterations as done. This is called when an iteration
+/// completes, and when the remaining iterations of a failed client are
+/// dropped. Once no iterations are left, all workers are woken up to stop.
+void rm_scheduler_iterations_done(rmScheduler *sched, guint count)
+{
+    gint pending;
+
+    pending = g_atomic_int_exchange_and_add(&sched->pending, - (gint) count);
+    if (pending > 0 && pending <= (gint) count) {
+        scheduler_wake_all(sched);
+    }
+}
+
+/// Called by a worker when a client started by the load profile completes an
+/// iteration. While a clients stage runs, the client is queued for another
+/// iteration on the same worker, unless it is to retire; otherwise it goes
+/// back to the idle pool. Failed clients are dropped.
+void rm_scheduler_release(rmScheduler *sched, rmWorker *worker, rmClient *client)
+{
+    const rmLoadStage *stage;
+
+    g_mutex_lock(sched->idleLock);
+    stage = &sched->profile->stages[g_atomic_int_get(&sched->stage)];
+
+    if (! client->failed && stage->type == RM_STAGE_CLIENTS && sched->retiring == 0 &&
+        ! g_atomic_int_get(&sched->stopping)) {
+
+        client->iterations = 1;
+        rm_scheduler_push(sched, worker, client);
+
+    } else {
+        if (stage->type == RM_STAGE_CLIENTS && sched->retiring > 0) sched->retiring--;
+        if (! client->failed) g_queue_push_tail(&sched->idle, client);
+        g_atomic_int_add(&sched->active, -1);
+    }
+
+    g_mutex_unlock(sched->idleLock);
+
+    // The last client to go back to the idle pool once the profile is over
+    // ends the run
+    if (rm_scheduler_is_done(sched)) {
+        scheduler_wake_all(sched);
+    }
+}
+
+/// Check if a client which completed its iterations should go on with
+/// another one, as it does in a duration bounded run until the deadline
+gboolean rm_scheduler_loops(rmScheduler *sched)
+{
+    return (sched->duration > 0 && ! g_atomic_int_get(&sched->stopping));
+}
+
+/// Called by each worker once the run's duration is over: no more iterations
+/// start, and clients go back to the idle pool (with a load profile) or are
+/// done once their running iteration completes
+void rm_scheduler_expire(rmScheduler *sched)
+{
+    if (sched->idleLock) g_mutex_lock(sched->idleLock);
+    g_atomic_int_set(&sched->stopping, 1);
+    g_atomic_int_set(&sched->expired, 1);
+    if (sched->idleLock) g_mutex_unlock(sched->idleLock);
+}
+
+/// Drop the clients queued on a worker once the run's duration is over, along
+/// with the iterations they were queued for. With a load profile, clients go
+/// back to the idle pool.
+void rm_scheduler_drop_queued(rmScheduler *sched, rmWorker *worker)
+{
+    rmClient *client;
+
+    g_assert(g_atomic_int_get(&sched->expired));
+
+    // The deque lock is not held while releasing a client, as the driver
+    // takes the idle lock before the deque lock
+    for (;;) {
+        g_mutex_lock(worker->dequeLock);
+        client = (rmClient *) g_queue_pop_head(&worker->deque);
+        g_mutex_unlock(worker->dequeLock);
+        if (client == NULL) break;
+
+        if (sched->profile != NULL) {
+            client->iterations = 0;
+            rm_scheduler_release(sched, worker, client);
+        } else {
+            rm_scheduler_iterations_done(sched, client->iterations);
+            client->iterations = 0;
+        }
+    }
+}
+
+/// Check if all work has been completed. With a load profile, that is once
+/// the profile is over and all clients are back in the idle pool.
+gboolean rm_scheduler_is_done(rmScheduler *sched)
+{
+    if (sched->profile != NULL) {
+        return (g_atomic_int_get(&sched->stopping) && g_atomic_int_get(&sched->active) <= 0);
+    }
+
+    return (g_atomic_int_get(&sched->pending) <= 0);
+}
+
+/// Get the time elapsed since the run started, in seconds. Safe to call from
+/// any thread.
+gdouble rm_scheduler_elapsed(rmScheduler *sched)
+{
+    return g_timer_elapsed(sched->timer, NULL);
+}
+
+/// Add a snapshot of the running totals of all workers into a scoreboard. This
+/// can be called from any thread while the scheduler is running. Unlike final
+/// results, snapshots include responses received during the warm-up.
+void rm_scheduler_snapshot(rmScoreboard *target, rmScheduler *sched)
+{
+    guint i, j;
+
+    for (i = 0; i < sched->workerCount; i++) {
+        rm_scoreboard_snapshot(target, sched->workers[i]->scoreboard);
+        if (sched->workers[i]->warmupScoreboard) {
+            rm_scoreboard_snapshot(target, sched->workers[i]->warmupScoreboard);
+        }
+        for (j = 0; sched->profile && j < sched->profile->stageCount; j++) {
+            rm_scoreboard_snapshot(target, sched->workers[i]->stageScoreboards[j]);
+        }
+    }
+}
+
+/// Merge all worker scoreboards into a total scoreboard, including those of
+/// all load profile stages, but not the warm-up scoreboards. Responses received
+/// during the warm-up are left out, but a client failing during the warm-up
+/// still fails the run, and script errors raised during it are still counted.
+void rm_scheduler_merge_scoreboards(rmScheduler *sched, rmScoreboard *total)
+{
+    rmScoreboard *warmup;
+    guint         i, j;
+
+    for (i = 0; i < sched->workerCount; i++) {
+        rm_scoreboard_merge(total, sched->workers[i]->scoreboard);
+        if ((warmup = sched->workers[i]->warmupScoreboard) != NULL) {
+            total->failed        = (total->failed || warmup->failed);
+            total->scriptErrors += warmup->scriptErrors;
+        }
+        for (j = 0; sched->profile && j < sched->profile->stageCount; j++) {
+            rm_scoreboard_merge(total, sched->workers[i]->stageScoreboards[j]);
+        }
+    }
+}
+
+/// Merge the scoreboards of all workers for one load profile stage. Responses
+/// are counted in the stage their iteration started in.
+void rm_scheduler_merge_stage(rmScheduler *sched, guint stage, rmScoreboard *total)
+{
+    guint i;
+
+    g_assert(sched->profile != NULL && stage < sched->profile->stageCount);
+
+    for (i = 0; i < sched->workerCount; i++) {
+        rm_scoreboard_merge(total, sched->workers[i]->stageScoreboards[stage]);
+    }
+}
+
+/// Merge the warm-up scoreboards of all workers
+void rm_scheduler_merge_warmup(rmScheduler *sched, rmScoreboard *total)
+{
+    guint i;
+
+    for (i = 0; i < sched->workerCount; i++) {
+        if (sched->workers[i]->warmupScoreboard) {
+            rm_scoreboard_merge(total, sched->workers[i]->warmupScoreboard);
+        }
+    }
+}
+
+/// Free the scheduler, all its workers and clients
+void rm_scheduler_free(rmScheduler *sched)
+{
+    guint i;
+
+    for (i = 0; i < sched->workerCount; i++) {
+        rm_worker_free(sched->workers[i]);
+    }
+    g_free(sched->workers);
+
+    rm_gslist_free_full(sched->clients, (GDestroyNotify) rm_client_free);
+    if (sched->profile != NULL) {
+        g_queue_clear(&sched->idle);
+        g_mutex_free(sched->idleLock);
+        g_free(sched->stageStats);
+    }
+    g_timer_destroy(sched->timer);
+    g_free(sched);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
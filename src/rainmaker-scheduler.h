@@ -0,0 +1,110 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_SCHEDULER_H_
+#define RAINMAKER_SCHEDULER_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-client.h"
+#include "rainmaker-worker.h"
+#include "rainmaker-scoreboard.h"
+#include "rainmaker-raw.h"
+
+/// What the load profile driver did during a stage. Only written by the
+/// driver thread.
+typedef struct _rmStageStats {
+    guint    started;   ///< clients started, or iterations started by a rate stage
+    guint    retired;   ///< clients retired
+    guint    missed;    ///< iterations a rate stage could not start, as all clients were busy
+    guint    events;    ///< clients started or retired and iterations started, on time or not
+    gdouble  lagTotal;  ///< total time events happened after they were due, in seconds
+    gdouble  lagMax;
+} rmStageStats;
+
+/// The scheduler spreads scenario iterations over a fixed pool of workers.
+/// Each scenario iteration of each client is a unit of work. Clients waiting
+/// to run their next iteration are kept in per-worker deques: a worker takes
+/// work from the tail of its own deque, and steals from the head of other
+/// workers' deques when its own deque is empty. Workers with idle slots don't
+/// poll for work: a worker with all slots busy wakes them up while clients
+/// are left waiting in its deque, and all workers are woken up once the run
+/// is over.
+///
+/// Scenarios with a load profile are run by a driver thread instead: clients
+/// wait in an idle pool, and the driver sleeps until the exact time the next
+/// client should start or retire (or, in rate stages, the next iteration
+/// should start), then queues clients on workers and wakes them up. Running
+/// clients go on with another iteration, or back to the idle pool, as the
+/// running stage says, when their iteration completes.
+///
+/// A run may also be bounded by a duration. Clients then run iterations back
+/// to back until the run's deadline, when each worker drops the clients
+/// queued on it and cancels the iterations it is running. Samples recorded
+/// during the warm-up time at the start of the run are kept apart.
+typedef struct _rmScheduler {
+    rmScenario    *scenario;
+    rmWorker     **workers;
+    guint          workerCount;
+    GSList        *clients;
+    guint          clientCount;
+    volatile gint  pending;     ///< iterations not yet completed
+    GTimer        *timer;       ///< started when the run starts
+    rmRawEngine   *raw;         ///< raw engine, or NULL to use libsoup
+    volatile gint  stopping;    ///< set once no more iterations are to start: the profile or duration is over, or the run failed to start
+    gdouble        duration;    ///< time the run stops at, or 0 to run until all iterations complete
+    gdouble        warmup;      ///< time samples are recorded apart until, or 0
+    volatile gint  expired;     ///< set once the run's duration is over
+
+    // Load profile runs only
+    rmLoadProfile *profile;     ///< the scenario's load profile, or NULL to run a fixed number of iterations
+    GThread       *driver;      ///< thread starting and retiring clients
+    GMutex        *idleLock;    ///< guards the idle pool, active and retiring
+    GQueue         idle;        ///< clients waiting to be started
+    volatile gint  active;      ///< clients started and not back in the idle pool yet
+    gint           retiring;    ///< clients to retire once their running iteration completes
+    volatile gint  stage;       ///< index of the running stage
+    guint          nextWorker;  ///< worker the next client started is queued on
+    gint64         origin;      ///< monotonic time the run started, in ns
+    rmStageStats  *stageStats;  ///< what the driver did in each stage
+} rmScheduler;
+
+/// Longest time (in ms) the load profile driver sleeps at once, so that it
+/// notices when the run is stopped
+#ifndef RM_SCHEDULER_DRIVER_SLICE
+#define RM_SCHEDULER_DRIVER_SLICE 100
+#endif
+
+rmScheduler*  rm_scheduler_new(rmScenario *scenario, guint workers, guint clients,
+                               rmRawEngine *raw, SoupLogger *logger);
+void          rm_scheduler_add_client(rmScheduler *sched, rmClient *client);
+void          rm_scheduler_create_clients(rmScheduler *sched, guint first, guint count, guint total,
+                                          guint repeat, gboolean keepCookies, gdouble rate);
+void          rm_scheduler_set_duration(rmScheduler *sched, gdouble duration, gdouble warmup);
+void          rm_scheduler_set_sample_log(rmScheduler *sched, rmSampleLog *log);
+gboolean      rm_scheduler_run(rmScheduler *sched, GError **error);
+void          rm_scheduler_push(rmScheduler *sched, rmWorker *worker, rmClient *client);
+rmClient*     rm_scheduler_next(rmScheduler *sched, rmWorker *worker);
+void          rm_scheduler_share(rmScheduler *sched, rmWorker *worker);
+void          rm_scheduler_iterations_done(rmScheduler *sched, guint count);
+void          rm_scheduler_release(rmScheduler *sched, rmWorker *worker, rmClient *client);
+gboolean      rm_scheduler_loops(rmScheduler *sched);
+void          rm_scheduler_expire(rmScheduler *sched);
+void          rm_scheduler_drop_queued(rmScheduler *sched, rmWorker *worker);
+gboolean      rm_scheduler_is_done(rmScheduler *sched);
+gdouble       rm_scheduler_elapsed(rmScheduler *sched);
+void          rm_scheduler_snapshot(rmScoreboard *target, rmScheduler *sched);
+void          rm_scheduler_merge_scoreboards(rmScheduler *sched, rmScoreboard *total);
+void          rm_scheduler_merge_stage(rmScheduler *sched, guint stage, rmScoreboard *total);
+void          rm_scheduler_merge_warmup(rmScheduler *sched, rmScoreboard *total);
+void          rm_scheduler_free(rmScheduler *sched);
+
+#endif // RAINMAKER_SCHEDULER_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
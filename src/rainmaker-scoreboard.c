@@ -10,39 +10,359 @@
 
 #include "rainmaker-scoreboard.h"
 
-rmScoreboard *rm_scoreboard_new()
+/// Create a new scoreboard, with room for statistics for a number of scenario
+/// requests. Per-request latency histograms are only allocated once a response
+/// is recorded for the request.
+rmScoreboard *rm_scoreboard_new(guint requests)
 {
     rmScoreboard *sb;
+    guint         i;
 
     sb = g_malloc0(sizeof(rmScoreboard));
-    sb->stopwatch = g_timer_new();
+    sb->latency      = rm_histogram_new();
+    sb->corrected    = rm_histogram_new();
+    sb->connectTime  = rm_histogram_new();
+    sb->firstByte    = rm_histogram_new();
+    sb->requestCount = requests;
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        sb->phases[i] = rm_histogram_new();
+    }
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        sb->hooks[i] = rm_histogram_new();
+    }
+    sb->perRequest   = g_malloc0(sizeof(rmRequestStats) * requests);
 
     return sb;
 }
 
-void rm_scoreboard_merge(rmScoreboard *target, rmScoreboard *src)
+/// Merge the per-request statistics of one scoreboard into another
+static void merge_request_stats(rmRequestStats *target, rmRequestStats *src)
 {
     gint i;
 
+    if (src->requests == 0) return;
+
+    target->requests += src->requests;
+    for (i = 0; i < 6; i++) {
+        target->resp_codes[i] += src->resp_codes[i];
+    }
+
+    if (target->latency == NULL) {
+        target->latency = rm_histogram_new();
+    }
+    rm_histogram_merge(target->latency, src->latency);
+
+    target->expectFailed += src->expectFailed;
+    target->extractMissed += src->extractMissed;
+    if (src->expectFailures != NULL) {
+        if (target->expectFailures == NULL) {
+            target->expectCount    = src->expectCount;
+            target->expectFailures = g_malloc0(sizeof(guint) * src->expectCount);
+        }
+        g_assert(target->expectCount == src->expectCount);
+
+        for (i = 0; i < (gint) src->expectCount; i++) {
+            target->expectFailures[i] += src->expectFailures[i];
+        }
+    }
+}
+
+/// Merge one scoreboard into another. Everything is merged, even if no
+/// request was recorded: a client may fail, or a script hook raise errors,
+/// before its first request is sent.
+void rm_scoreboard_merge(rmScoreboard *target, rmScoreboard *src)
+{
+    guint i;
+
     g_assert(target != NULL);
     g_assert(src != NULL);
+    g_assert(target->requestCount == src->requestCount);
+
+    target->requests += src->requests;
+    target->elapsed  += src->elapsed;
+
+    for (i = 0; i < 6; i++) {
+        target->resp_codes[i] += src->resp_codes[i];
+    }
+
+    target->missedSlots += src->missedSlots;
+    target->connections += src->connections;
+    target->expectFailed += src->expectFailed;
+    target->extracted += src->extracted;
+    target->extractMissed += src->extractMissed;
+    target->extractTime += src->extractTime;
+    target->bytesReceived += src->bytesReceived;
+    rm_histogram_merge(target->latency, src->latency);
+    rm_histogram_merge(target->corrected, src->corrected);
+    rm_histogram_merge(target->connectTime, src->connectTime);
+    rm_histogram_merge(target->firstByte, src->firstByte);
+
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        rm_histogram_merge(target->phases[i], src->phases[i]);
+    }
+
+    target->scriptErrors += src->scriptErrors;
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        rm_histogram_merge(target->hooks[i], src->hooks[i]);
+    }
+
+    for (i = 0; i < src->requestCount; i++) {
+        merge_request_stats(&target->perRequest[i], &src->perRequest[i]);
+    }
+
+    target->failed = (target->failed || src->failed);
+}
+
+/// Add a snapshot of the live totals of a scoreboard which is being written to
+/// by a running worker into another scoreboard. Nothing is locked; counters
+/// are read atomically, and histogram buckets are read as they are, so the
+/// snapshot may be off by the few responses recorded while it was taken.
+/// The 64 bit byte counter and extraction time can't be read atomically with
+/// glib, and may be torn on 32 bit hosts. Per-request statistics are not included.
+void rm_scoreboard_snapshot(rmScoreboard *target, rmScoreboard *src)
+{
+    gint i;
+
+    target->requests += (guint) g_atomic_int_get((volatile gint *) &src->requests);
+    for (i = 0; i < 6; i++) {
+        target->resp_codes[i] += (guint) g_atomic_int_get((volatile gint *) &src->resp_codes[i]);
+    }
+
+    target->missedSlots += (guint) g_atomic_int_get((volatile gint *) &src->missedSlots);
+    target->connections += (guint) g_atomic_int_get((volatile gint *) &src->connections);
+    target->expectFailed += (guint) g_atomic_int_get((volatile gint *) &src->expectFailed);
+    target->extracted += (guint) g_atomic_int_get((volatile gint *) &src->extracted);
+    target->extractMissed += (guint) g_atomic_int_get((volatile gint *) &src->extractMissed);
+    target->scriptErrors += (guint) g_atomic_int_get((volatile gint *) &src->scriptErrors);
+    target->extractTime += src->extractTime;
+    target->bytesReceived += src->bytesReceived;
+    rm_histogram_merge(target->latency, src->latency);
+    rm_histogram_merge(target->corrected, src->corrected);
+    rm_histogram_merge(target->connectTime, src->connectTime);
+    rm_histogram_merge(target->firstByte, src->firstByte);
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        rm_histogram_merge(target->phases[i], src->phases[i]);
+    }
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        rm_histogram_merge(target->hooks[i], src->hooks[i]);
+    }
+}
+
+/// Append a compact binary representation of a scoreboard, including all its
+/// histograms and per-request statistics, to a buffer. This is used by agents
+/// to send their results to the coordinator, where they are read back with
+/// rm_scoreboard_deserialize() and merged with rm_scoreboard_merge().
+void rm_scoreboard_serialize(const rmScoreboard *sb, GByteArray *buf)
+{
+    const rmRequestStats *stats;
+    guint                 i, j;
+
+    rm_wire_put_uint(buf, sb->requests);
+    for (i = 0; i < 6; i++) {
+        rm_wire_put_uint(buf, sb->resp_codes[i]);
+    }
+    rm_wire_put_double(buf, sb->elapsed);
+    rm_wire_put_uint(buf, sb->missedSlots);
+    rm_wire_put_uint(buf, sb->connections);
+    rm_wire_put_uint(buf, sb->failed);
+    rm_wire_put_uint(buf, sb->bytesReceived);
+    rm_wire_put_uint(buf, sb->expectFailed);
+    rm_wire_put_uint(buf, sb->extracted);
+    rm_wire_put_uint(buf, sb->extractMissed);
+    rm_wire_put_double(buf, sb->extractTime);
+    rm_wire_put_uint(buf, sb->scriptErrors);
+    rm_histogram_serialize(sb->latency, buf);
+    rm_histogram_serialize(sb->corrected, buf);
+    rm_histogram_serialize(sb->connectTime, buf);
+    rm_histogram_serialize(sb->firstByte, buf);
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        rm_histogram_serialize(sb->phases[i], buf);
+    }
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        rm_histogram_serialize(sb->hooks[i], buf);
+    }
+
+    rm_wire_put_uint(buf, sb->requestCount);
+    for (i = 0; i < sb->requestCount; i++) {
+        stats = &sb->perRequest[i];
+        rm_wire_put_uint(buf, stats->requests);
+        if (stats->requests == 0) continue;
+
+        for (j = 0; j < 6; j++) {
+            rm_wire_put_uint(buf, stats->resp_codes[j]);
+        }
+        rm_wire_put_uint(buf, stats->latency != NULL);
+        if (stats->latency != NULL) {
+            rm_histogram_serialize(stats->latency, buf);
+        }
 
-    if (src->requests) {
-        target->requests += src->requests;
-        target->elapsed  += src->elapsed;
+        rm_wire_put_uint(buf, stats->expectFailed);
+        rm_wire_put_uint(buf, stats->extractMissed);
+        rm_wire_put_uint(buf, (stats->expectFailures ? stats->expectCount : 0));
+        for (j = 0; stats->expectFailures && j < stats->expectCount; j++) {
+            rm_wire_put_uint(buf, stats->expectFailures[j]);
+        }
+    }
+}
+
+/// Read a scoreboard written by rm_scoreboard_serialize() into a new
+/// scoreboard. Returns NULL if the data is malformed.
+rmScoreboard* rm_scoreboard_deserialize(rmWireReader *reader)
+{
+    rmScoreboard   *sb;
+    rmRequestStats *stats;
+    guint64         requestCount, expectCount;
+    guint           i, j;
+
+    sb = rm_scoreboard_new(0);
+    sb->requests = (guint) rm_wire_get_uint(reader);
+    for (i = 0; i < 6; i++) {
+        sb->resp_codes[i] = (guint) rm_wire_get_uint(reader);
+    }
+    sb->elapsed     = rm_wire_get_double(reader);
+    sb->missedSlots = (guint) rm_wire_get_uint(reader);
+    sb->connections = (guint) rm_wire_get_uint(reader);
+    sb->failed      = (rm_wire_get_uint(reader) != 0);
+    sb->bytesReceived = rm_wire_get_uint(reader);
+    sb->expectFailed  = (guint) rm_wire_get_uint(reader);
+    sb->extracted     = (guint) rm_wire_get_uint(reader);
+    sb->extractMissed = (guint) rm_wire_get_uint(reader);
+    sb->extractTime   = rm_wire_get_double(reader);
+    sb->scriptErrors  = (guint) rm_wire_get_uint(reader);
+
+    if (! (rm_histogram_deserialize(sb->latency, reader) &&
+           rm_histogram_deserialize(sb->corrected, reader) &&
+           rm_histogram_deserialize(sb->connectTime, reader) &&
+           rm_histogram_deserialize(sb->firstByte, reader))) {
+        rm_scoreboard_free(sb);
+        return NULL;
+    }
+
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        if (! rm_histogram_deserialize(sb->phases[i], reader)) {
+            rm_scoreboard_free(sb);
+            return NULL;
+        }
+    }
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        if (! rm_histogram_deserialize(sb->hooks[i], reader)) {
+            rm_scoreboard_free(sb);
+            return NULL;
+        }
+    }
+
+    // Every request takes at least one byte, which bounds the allocation
+    requestCount = rm_wire_get_uint(reader);
+    if (reader->failed || requestCount > reader->length - reader->pos) {
+        rm_scoreboard_free(sb);
+        return NULL;
+    }
+
+    g_free(sb->perRequest);
+    sb->requestCount = (guint) requestCount;
+    sb->perRequest   = g_malloc0(sizeof(rmRequestStats) * sb->requestCount);
+
+    for (i = 0; i < sb->requestCount && ! reader->failed; i++) {
+        stats = &sb->perRequest[i];
+        stats->requests = (guint) rm_wire_get_uint(reader);
+        if (stats->requests == 0) continue;
 
-        for (i = 0; i < 6; i++) {
-            target->resp_codes[i] += src->resp_codes[i];
+        for (j = 0; j < 6; j++) {
+            stats->resp_codes[j] = (guint) rm_wire_get_uint(reader);
         }
+        if (rm_wire_get_uint(reader)) {
+            stats->latency = rm_histogram_new();
+            if (! rm_histogram_deserialize(stats->latency, reader)) break;
+        }
+
+        stats->expectFailed  = (guint) rm_wire_get_uint(reader);
+        stats->extractMissed = (guint) rm_wire_get_uint(reader);
+        expectCount = rm_wire_get_uint(reader);
+        if (reader->failed || expectCount > reader->length - reader->pos) {
+            reader->failed = TRUE;
+            break;
+        }
+
+        if (expectCount > 0) {
+            stats->expectCount    = (guint) expectCount;
+            stats->expectFailures = g_malloc0(sizeof(guint) * stats->expectCount);
+            for (j = 0; j < stats->expectCount; j++) {
+                stats->expectFailures[j] = (guint) rm_wire_get_uint(reader);
+            }
+        }
+    }
 
-        target->failed = (target->failed || src->failed);
+    if (reader->failed) {
+        rm_scoreboard_free(sb);
+        return NULL;
     }
+
+    return sb;
+}
+
+/// Count a failed expectation on the response to a scenario request. Failure
+/// counters are allocated for the request's expectations on the first failure.
+void rm_scoreboard_count_expectation(rmScoreboard *sb, guint request, guint expectation, guint expectCount)
+{
+    rmRequestStats *stats;
+
+    g_assert(request < sb->requestCount);
+    g_assert(expectation < expectCount);
+
+    stats = &sb->perRequest[request];
+    if (G_UNLIKELY(stats->expectFailures == NULL)) {
+        stats->expectCount    = expectCount;
+        stats->expectFailures = g_malloc0(sizeof(guint) * expectCount);
+    }
+
+    stats->expectFailures[expectation]++;
 }
 
 void rm_scoreboard_free(rmScoreboard *sb)
 {
-    g_timer_destroy(sb->stopwatch);
+    guint i;
+
+    for (i = 0; i < sb->requestCount; i++) {
+        if (sb->perRequest[i].latency) rm_histogram_free(sb->perRequest[i].latency);
+        g_free(sb->perRequest[i].expectFailures);
+    }
+    g_free(sb->perRequest);
+
+    rm_histogram_free(sb->latency);
+    rm_histogram_free(sb->corrected);
+    rm_histogram_free(sb->connectTime);
+    rm_histogram_free(sb->firstByte);
+    for (i = 0; i < RM_PHASE_COUNT; i++) {
+        rm_histogram_free(sb->phases[i]);
+    }
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        rm_histogram_free(sb->hooks[i]);
+    }
     g_free(sb);
 }
 
+/// Get the short name of a request phase, as used in reports
+const gchar* rm_scoreboard_phase_name(rmPhase phase)
+{
+    static const gchar *names[RM_PHASE_COUNT] = {
+        "dns", "connect", "tls", "send", "wait", "transfer"
+    };
+
+    g_return_val_if_fail(phase < RM_PHASE_COUNT, NULL);
+
+    return names[phase];
+}
+
+/// Get the name of a script hook, as used in scenarios and reports
+const gchar* rm_scoreboard_hook_name(rmScriptHook hook)
+{
+    static const gchar *names[RM_HOOK_COUNT] = {
+        "preIteration", "postIteration", "preSend", "postComplete"
+    };
+
+    g_return_val_if_fail(hook < RM_HOOK_COUNT, NULL);
+
+    return names[hook];
+}
+
 // vim:ts=4:expandtab:cindent:sw=2
@@ -11,17 +11,74 @@
 
 #include <glib.h>
 
+#include "rainmaker-histogram.h"
+#include "rainmaker-wire.h"
+
+/// Phases of a request's lifecycle, each timed separately. The DNS, connect
+/// and TLS phases only happen when a new connection is opened for a request.
+typedef enum {
+    RM_PHASE_DNS,       ///< resolving the server's address
+    RM_PHASE_CONNECT,   ///< opening the TCP connection
+    RM_PHASE_TLS,       ///< TLS handshake
+    RM_PHASE_SEND,      ///< from connection ready to request fully written
+    RM_PHASE_WAIT,      ///< from request written to first response byte
+    RM_PHASE_TRANSFER,  ///< from first response byte to end of response
+    RM_PHASE_COUNT
+} rmPhase;
+
+/// Script hooks, each timed separately (see rainmaker-script.h)
+typedef enum {
+    RM_HOOK_PRE_ITERATION,   ///< before the first request of each iteration
+    RM_HOOK_POST_ITERATION,  ///< after the last request of each iteration
+    RM_HOOK_PRE_SEND,        ///< before sending a request
+    RM_HOOK_POST_COMPLETE,   ///< after receiving a request's response
+    RM_HOOK_COUNT
+} rmScriptHook;
+
+/// Statistics for a single scenario request
+typedef struct _rmRequestStats {
+    guint         requests;
+    guint         resp_codes[6];
+    rmHistogram  *latency;        ///< allocated when the first response is recorded
+    guint         expectFailed;   ///< responses failing any expectation
+    guint        *expectFailures; ///< failures by expectation index, allocated on the first failure
+    guint         expectCount;
+    guint         extractMissed;  ///< values not found by extraction rules
+} rmRequestStats;
+
 typedef struct _rmScoreboard {
-    guint     requests;
-    guint     resp_codes[6];
-    gdouble   elapsed;
-    GTimer   *stopwatch;
-    gboolean  failed;
+    guint           requests;
+    guint           resp_codes[6];
+    gdouble         elapsed;
+    rmHistogram    *latency;      ///< response time histogram, in usec
+    rmHistogram    *corrected;    ///< open-loop mode: time from intended send to response
+    guint           missedSlots;
+    guint           connections;  ///< connections opened
+    rmHistogram    *connectTime;  ///< time to open a connection, in usec
+    guint64         bytesReceived; ///< response body bytes received
+    rmHistogram    *firstByte;    ///< time from sending a request to the first byte of its response, in usec
+    rmHistogram    *phases[RM_PHASE_COUNT]; ///< time spent in each request phase, in usec
+    guint           expectFailed; ///< responses failing any expectation
+    guint           extracted;    ///< values extracted from responses
+    guint           extractMissed; ///< values not found by extraction rules
+    gdouble         extractTime;  ///< time spent extracting values
+    rmHistogram    *hooks[RM_HOOK_COUNT]; ///< time spent running each script hook, in nsec
+    guint           scriptErrors; ///< errors raised by script hooks
+    rmRequestStats *perRequest;   ///< per-request statistics, indexed by request index
+    guint           requestCount;
+    gboolean        failed;
 } rmScoreboard;
 
-rmScoreboard* rm_scoreboard_new();
+rmScoreboard* rm_scoreboard_new(guint requests);
 void          rm_scoreboard_merge(rmScoreboard *target, rmScoreboard *src);
+void          rm_scoreboard_snapshot(rmScoreboard *target, rmScoreboard *src);
+void          rm_scoreboard_serialize(const rmScoreboard *sb, GByteArray *buf);
+rmScoreboard* rm_scoreboard_deserialize(rmWireReader *reader);
+void          rm_scoreboard_count_expectation(rmScoreboard *sb, guint request, guint expectation,
+                                              guint expectCount);
 void          rm_scoreboard_free(rmScoreboard *sb);
+const gchar*  rm_scoreboard_phase_name(rmPhase phase);
+const gchar*  rm_scoreboard_hook_name(rmScriptHook hook);
 
 #endif // RAINMAKER_SCOREBOARD_H_
 
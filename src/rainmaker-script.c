@@ -0,0 +1,610 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <string.h>
+#include <time.h>
+
+#include "rainmaker-script.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+rmScripts* rm_scripts_new()
+{
+    rmScripts *scripts;
+
+    scripts = g_malloc0(sizeof(rmScripts));
+    scripts->sources  = g_ptr_array_new();
+    scripts->bytecode = g_ptr_array_new();
+
+    return scripts;
+}
+
+void rm_scripts_free(rmScripts *scripts)
+{
+    guint i;
+
+    for (i = 0; i < scripts->sources->len; i++) {
+        g_free(g_ptr_array_index(scripts->sources, i));
+        g_byte_array_free((GByteArray *) g_ptr_array_index(scripts->bytecode, i), TRUE);
+    }
+    g_ptr_array_free(scripts->sources, TRUE);
+    g_ptr_array_free(scripts->bytecode, TRUE);
+
+    g_free(scripts->preIteration);
+    g_free(scripts->postIteration);
+    g_free(scripts);
+}
+
+/// Check that a scenario's scripts run, and define all the hook functions
+/// named by the scenario and its requests, by loading them into an
+/// interpreter as workers do
+gboolean rm_scripts_check(const rmScripts *scripts, const rmRequest *requests, guint count, GError **error)
+{
+    rmScriptState *state;
+
+    if ((state = rm_script_state_new(scripts, requests, count, error)) == NULL) {
+        return FALSE;
+    }
+    rm_script_state_free(state);
+
+    return TRUE;
+}
+
+#ifdef HAVE_LUA
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+/// Get the context of the running hook, in a library function
+#define HOOK_CONTEXT(L) (((rmScriptState *) lua_touserdata(L, lua_upvalueindex(1)))->context)
+
+/// Name scripts are known by in error messages
+#define SCRIPT_NAME_FORMAT "=script #%u"
+
+/// Get the monotonic clock time in nanoseconds, as hooks often take less than
+/// a microsecond to run
+static guint64 monotonic_nsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((guint64) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static gboolean is_lua_type(const gchar *type)
+{
+    return (type == NULL || strcmp(type, "text/x-lua") == 0 || strcmp(type, "application/x-lua") == 0 ||
+            strcmp(type, "text/lua") == 0);
+}
+
+/// lua_Writer appending compiled bytecode to a byte array
+static int write_bytecode(lua_State *L, const void *data, size_t size, void *buf)
+{
+    g_byte_array_append((GByteArray *) buf, (const guint8 *) data, size);
+    return 0;
+}
+
+/// Compile a script and add it to a scenario's scripts. Scripts run in the
+/// order they are added, when an interpreter is set up.
+gboolean rm_scripts_add(rmScripts *scripts, const gchar *type, const gchar *source, gsize length,
+    GError **error)
+{
+    lua_State  *L;
+    GByteArray *bytecode;
+    gchar      *name;
+
+    if (! is_lua_type(type)) {
+        g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_UNSUPPORTED,
+            "unsupported script type '%s', scripts must be in Lua (text/x-lua)", type);
+        return FALSE;
+    }
+
+    // Precompiled chunks can break out of the interpreter's sandbox, and
+    // scenarios may come from a coordinator
+    if (length > 0 && source[0] == LUA_SIGNATURE[0]) {
+        g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_COMPILE,
+            "scripts must be Lua source, not precompiled bytecode");
+        return FALSE;
+    }
+
+    L    = luaL_newstate();
+    name = g_strdup_printf(SCRIPT_NAME_FORMAT, scripts->sources->len + 1);
+    if (luaL_loadbuffer(L, source, length, name) != 0) {
+        g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_COMPILE, "%s", lua_tostring(L, -1));
+        lua_close(L);
+        g_free(name);
+        return FALSE;
+    }
+
+    bytecode = g_byte_array_new();
+#if LUA_VERSION_NUM >= 503
+    lua_dump(L, write_bytecode, bytecode, 0);
+#else
+    lua_dump(L, write_bytecode, bytecode);
+#endif
+    lua_close(L);
+    g_free(name);
+
+    g_ptr_array_add(scripts->sources, g_strndup(source, length));
+    g_ptr_array_add(scripts->bytecode, bytecode);
+
+    return TRUE;
+}
+
+/// Look up a variable by name, raising an error if there is no such variable
+static guint check_variable(lua_State *L, const rmScriptContext *ctx)
+{
+    const gchar *name;
+    gint         var;
+
+    name = luaL_checkstring(L, 1);
+    if ((var = rm_var_table_lookup(ctx->variables, name)) < 0) {
+        luaL_error(L, "variable '%s' is not defined", name);
+    }
+
+    return (guint) var;
+}
+
+/// Get the request of a request hook, raising an error in iteration hooks
+static const rmRequest* check_request(lua_State *L, const rmScriptContext *ctx)
+{
+    if (ctx->request == NULL) {
+        luaL_error(L, "there is no request in %s hooks", rm_scoreboard_hook_name(ctx->hook));
+    }
+
+    return ctx->request;
+}
+
+/// rm.get(name): the value of a variable, nil if it has none
+static int lib_get(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+    guint            var = check_variable(L, ctx);
+
+    if (ctx->values[var].data != NULL) {
+        lua_pushlstring(L, ctx->values[var].data, ctx->values[var].length);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/// rm.set(name, value): set the value of a variable, or clear it if nil.
+/// The value is copied into the client's storage for the variable.
+static int lib_set(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+    guint            var = check_variable(L, ctx);
+    const gchar     *value;
+    size_t           length;
+    GString         *owned;
+
+    if (lua_isnoneornil(L, 2)) {
+        ctx->values[var].data   = NULL;
+        ctx->values[var].length = 0;
+        return 0;
+    }
+
+    value = luaL_checklstring(L, 2, &length);
+    if ((owned = ctx->owned[var]) == NULL) {
+        owned = ctx->owned[var] = g_string_sized_new(length);
+    }
+    g_string_truncate(owned, 0);
+    g_string_append_len(owned, value, length);
+    ctx->values[var].data   = owned->str;
+    ctx->values[var].length = owned->len;
+
+    return 0;
+}
+
+/// rm.client(): the client's id, and the number of iterations it completed
+static int lib_client(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+
+    lua_pushinteger(L, ctx->client);
+    lua_pushinteger(L, ctx->iteration);
+
+    return 2;
+}
+
+/// rm.request(): the method, URL, name and index of the request. In
+/// postComplete hooks, the URL is the one the request was sent to, which
+/// variables referenced by the request's URL have been rendered into.
+static int lib_request(lua_State *L)
+{
+    rmScriptContext *ctx     = HOOK_CONTEXT(L);
+    const rmRequest *request = check_request(L, ctx);
+    gchar           *url;
+
+    if (ctx->hook == RM_HOOK_POST_COMPLETE && ctx->msg != NULL) {
+        url = soup_uri_to_string(soup_message_get_uri(ctx->msg), FALSE);
+    } else {
+        url = soup_uri_to_string(request->url, FALSE);
+    }
+    lua_pushstring(L, request->methodName);
+    lua_pushstring(L, url);
+    g_free(url);
+    if (request->name != NULL) {
+        lua_pushstring(L, request->name);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_pushinteger(L, request->index);
+
+    return 4;
+}
+
+/// rm.body(): the request body, nil if the request has none, references
+/// variables, or is sent in parts (file uploads and generated bodies)
+static int lib_body(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+
+    check_request(L, ctx);
+    if (ctx->body != NULL) {
+        lua_pushlstring(L, ctx->body, ctx->bodyLength);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/// rm.set_header(name, value): set a header of the request about to be sent,
+/// replacing any header with the same name. Only in preSend hooks.
+static int lib_set_header(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+    const gchar     *name, *value;
+
+    name  = luaL_checkstring(L, 1);
+    value = luaL_checkstring(L, 2);
+    if (ctx->hook != RM_HOOK_PRE_SEND || ctx->msg == NULL) {
+        luaL_error(L, "request headers can only be set in preSend hooks");
+    }
+    soup_message_headers_replace(ctx->msg->request_headers, name, value);
+
+    return 0;
+}
+
+/// rm.status(): the response status code. Only in postComplete hooks.
+static int lib_status(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+
+    if (ctx->hook != RM_HOOK_POST_COMPLETE) {
+        luaL_error(L, "the response status is only known in postComplete hooks");
+    }
+    lua_pushinteger(L, ctx->status);
+
+    return 1;
+}
+
+/// rm.response_header(name): a response header, nil if the response has no
+/// such header. Only in postComplete hooks.
+static int lib_response_header(lua_State *L)
+{
+    rmScriptContext *ctx  = HOOK_CONTEXT(L);
+    const gchar     *name = luaL_checkstring(L, 1);
+    const gchar     *value = NULL;
+
+    if (ctx->hook != RM_HOOK_POST_COMPLETE) {
+        luaL_error(L, "response headers are only known in postComplete hooks");
+    }
+    if (ctx->msg != NULL) {
+        value = soup_message_headers_get_one(ctx->msg->response_headers, name);
+    }
+
+    if (value != NULL) {
+        lua_pushstring(L, value);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/// rm.response_body(): the response body, nil if the scenario discards
+/// response bodies. Only in postComplete hooks.
+static int lib_response_body(lua_State *L)
+{
+    rmScriptContext *ctx = HOOK_CONTEXT(L);
+
+    if (ctx->hook != RM_HOOK_POST_COMPLETE) {
+        luaL_error(L, "the response body is only known in postComplete hooks");
+    }
+
+    if (ctx->msg != NULL && ctx->msg->response_body->data != NULL) {
+        lua_pushlstring(L, ctx->msg->response_body->data, (size_t) ctx->msg->response_body->length);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+static const luaL_Reg library[] = {
+    { "get",             lib_get },
+    { "set",             lib_set },
+    { "client",          lib_client },
+    { "request",         lib_request },
+    { "body",            lib_body },
+    { "set_header",      lib_set_header },
+    { "status",          lib_status },
+    { "response_header", lib_response_header },
+    { "response_body",   lib_response_body },
+    { NULL, NULL }
+};
+
+/// Standard libraries scripts may use. The io, os, package and debug libraries
+/// are left out: scenarios may come from a coordinator, and their scripts
+/// must not read files or run programs on the machine running them.
+static const luaL_Reg sandboxLibraries[] = {
+    { "",                luaopen_base },
+    { LUA_TABLIBNAME,    luaopen_table },
+    { LUA_STRLIBNAME,    luaopen_string },
+    { LUA_MATHLIBNAME,   luaopen_math },
+    { NULL, NULL }
+};
+
+/// Base library functions which load code from files or strings, and which
+/// are removed from the sandbox
+static const gchar *sandboxRemoved[] = {
+    "dofile", "loadfile", "load", "loadstring", NULL
+};
+
+/// Open the standard libraries scripts may use in an interpreter
+static void open_sandbox(lua_State *L)
+{
+    const luaL_Reg  *lib;
+    const gchar    **name;
+
+    for (lib = sandboxLibraries; lib->name != NULL; lib++) {
+#if LUA_VERSION_NUM >= 502
+        luaL_requiref(L, (*lib->name ? lib->name : "_G"), lib->func, 1);
+        lua_pop(L, 1);
+#else
+        lua_pushcfunction(L, lib->func);
+        lua_pushstring(L, lib->name);
+        lua_call(L, 1, 0);
+#endif
+    }
+
+    for (name = sandboxRemoved; *name != NULL; name++) {
+        lua_pushnil(L);
+        lua_setglobal(L, *name);
+    }
+}
+
+/// Set up the 'rm' library in an interpreter. Library functions find the
+/// context of the running hook through the state they are bound to.
+static void open_library(lua_State *L, rmScriptState *state)
+{
+    const luaL_Reg *fn;
+
+    lua_newtable(L);
+    for (fn = library; fn->name != NULL; fn++) {
+        lua_pushlightuserdata(L, state);
+        lua_pushcclosure(L, fn->func, 1);
+        lua_setfield(L, -2, fn->name);
+    }
+    lua_setglobal(L, "rm");
+}
+
+/// Look up a hook function by name, and keep a reference to it, so that it is
+/// not looked up each time it is called
+static gboolean ref_hook(lua_State *L, const gchar *name, gint *ref, GError **error)
+{
+    lua_getglobal(L, name);
+    if (! lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_HOOK,
+            "hook function '%s' is not defined by any script", name);
+        return FALSE;
+    }
+
+    *ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    return TRUE;
+}
+
+/// Create an interpreter for a scenario's scripts: the scripts are loaded from
+/// their bytecode and run, after which the hook functions of the scenario and
+/// its requests are looked up.
+rmScriptState* rm_script_state_new(const rmScripts *scripts, const rmRequest *requests, guint count,
+    GError **error)
+{
+    rmScriptState *state;
+    lua_State     *L;
+    GByteArray    *bytecode;
+    gchar          name[32];
+    gboolean       ok = TRUE;
+    guint          i;
+
+    g_assert(scripts != NULL);
+
+    state = g_malloc0(sizeof(rmScriptState));
+    state->lua          = L = luaL_newstate();
+    state->requestCount = count;
+    state->names        = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        state->refs[i] = g_malloc0(sizeof(gint) * (i >= RM_HOOK_PRE_SEND ? MAX(count, 1) : 1));
+    }
+
+    open_sandbox(L);
+    open_library(L, state);
+
+    for (i = 0; ok && i < scripts->bytecode->len; i++) {
+        bytecode = (GByteArray *) g_ptr_array_index(scripts->bytecode, i);
+        g_snprintf(name, sizeof(name), SCRIPT_NAME_FORMAT, i + 1);
+        if (luaL_loadbuffer(L, (const char *) bytecode->data, bytecode->len, name) != 0 ||
+            lua_pcall(L, 0, 0, 0) != 0) {
+
+            g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_RUNTIME, "%s", lua_tostring(L, -1));
+            ok = FALSE;
+        }
+    }
+
+    if (ok && scripts->preIteration != NULL) {
+        ok = ref_hook(L, scripts->preIteration, &state->refs[RM_HOOK_PRE_ITERATION][0], error);
+    }
+    if (ok && scripts->postIteration != NULL) {
+        ok = ref_hook(L, scripts->postIteration, &state->refs[RM_HOOK_POST_ITERATION][0], error);
+    }
+
+    for (i = 0; ok && i < count; i++) {
+        if (requests[i].preSend != NULL) {
+            ok = ref_hook(L, requests[i].preSend, &state->refs[RM_HOOK_PRE_SEND][i], error);
+        }
+        if (ok && requests[i].postComplete != NULL) {
+            ok = ref_hook(L, requests[i].postComplete, &state->refs[RM_HOOK_POST_COMPLETE][i], error);
+        }
+
+        // The first request with a name is the one jumped to
+        if (requests[i].name != NULL && g_hash_table_lookup(state->names, requests[i].name) == NULL) {
+            g_hash_table_insert(state->names, requests[i].name, GUINT_TO_POINTER(i + 1));
+        }
+    }
+
+    if (! ok) {
+        rm_script_state_free(state);
+        return NULL;
+    }
+
+    return state;
+}
+
+/// Read where a postComplete hook returned to go next: nothing (or true) to
+/// go on as usual, false to end the iteration, or the name or index of a
+/// request to go to
+static gboolean read_next(lua_State *L, rmScriptState *state, gint *next, GError **error)
+{
+    lua_Number index;
+    guint      named;
+
+    switch (lua_type(L, -1)) {
+        case LUA_TNIL:
+            *next = RM_SCRIPT_NEXT;
+            return TRUE;
+
+        case LUA_TBOOLEAN:
+            *next = (lua_toboolean(L, -1) ? RM_SCRIPT_NEXT : RM_SCRIPT_END);
+            return TRUE;
+
+        case LUA_TNUMBER:
+            index = lua_tonumber(L, -1);
+            if (index >= 0 && index < state->requestCount && index == (guint) index) {
+                *next = (gint) index;
+                return TRUE;
+            }
+            break;
+
+        case LUA_TSTRING:
+            named = GPOINTER_TO_UINT(g_hash_table_lookup(state->names, lua_tostring(L, -1)));
+            if (named > 0) {
+                *next = (gint) named - 1;
+                return TRUE;
+            }
+            break;
+    }
+
+    g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_RUNTIME,
+        "postComplete hook returned '%s', which is not a request name or index",
+        (lua_isstring(L, -1) ? lua_tostring(L, -1) : lua_typename(L, lua_type(L, -1))));
+
+    return FALSE;
+}
+
+/// Run a hook, if one is set for the hook's request (or for iterations), and
+/// record the time it took in the scoreboard. For postComplete hooks, next is
+/// set to the index of the request to go to next, or to RM_SCRIPT_NEXT or
+/// RM_SCRIPT_END. Errors raised by the hook are returned, and counted.
+gboolean rm_script_state_run(rmScriptState *state, rmScriptHook hook, rmScriptContext *context,
+    rmScoreboard *sb, gint *next, GError **error)
+{
+    lua_State *L = (lua_State *) state->lua;
+    gboolean   ok = TRUE;
+    guint64    started;
+    gint       ref;
+
+    ref = state->refs[hook][(hook >= RM_HOOK_PRE_SEND ? context->request->index : 0)];
+    if (ref == 0) return TRUE;
+
+    context->hook  = hook;
+    state->context = context;
+    started        = monotonic_nsec();
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    if (lua_pcall(L, 0, 1, 0) != 0) {
+        g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_RUNTIME, "%s hook: %s",
+            rm_scoreboard_hook_name(hook), lua_tostring(L, -1));
+        ok = FALSE;
+    } else if (hook == RM_HOOK_POST_COMPLETE) {
+        ok = read_next(L, state, next, error);
+    }
+    lua_pop(L, 1);
+
+    rm_histogram_record(sb->hooks[hook], monotonic_nsec() - started);
+    state->context = NULL;
+    if (! ok) sb->scriptErrors++;
+
+    return ok;
+}
+
+void rm_script_state_free(rmScriptState *state)
+{
+    guint i;
+
+    lua_close((lua_State *) state->lua);
+    for (i = 0; i < RM_HOOK_COUNT; i++) {
+        g_free(state->refs[i]);
+    }
+    g_hash_table_destroy(state->names);
+    g_free(state);
+}
+
+#else // HAVE_LUA
+
+gboolean rm_scripts_add(rmScripts *scripts, const gchar *type, const gchar *source, gsize length,
+    GError **error)
+{
+    g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_UNAVAILABLE,
+        "scripts are not supported, rainmaker was built without Lua");
+    return FALSE;
+}
+
+rmScriptState* rm_script_state_new(const rmScripts *scripts, const rmRequest *requests, guint count,
+    GError **error)
+{
+    g_set_error(error, RM_ERROR_SCRIPT, RM_ERROR_SCRIPT_UNAVAILABLE,
+        "scripts are not supported, rainmaker was built without Lua");
+    return NULL;
+}
+
+gboolean rm_script_state_run(rmScriptState *state, rmScriptHook hook, rmScriptContext *context,
+    rmScoreboard *sb, gint *next, GError **error)
+{
+    g_return_val_if_reached(FALSE);
+}
+
+void rm_script_state_free(rmScriptState *state)
+{
+    g_free(state);
+}
+
+#endif // HAVE_LUA
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,88 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_SCRIPT_H_
+#define RAINMAKER_SCRIPT_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-request.h"
+#include "rainmaker-template.h"
+#include "rainmaker-scoreboard.h"
+
+/// Error Quark for script related errors
+#define RM_ERROR_SCRIPT g_quark_from_static_string("rainmaker-script-error")
+
+/// Script error codes
+enum {
+    RM_ERROR_SCRIPT_UNAVAILABLE,  ///< rainmaker was built without Lua
+    RM_ERROR_SCRIPT_UNSUPPORTED,  ///< script language is not supported
+    RM_ERROR_SCRIPT_COMPILE,
+    RM_ERROR_SCRIPT_HOOK,         ///< hook function is not defined
+    RM_ERROR_SCRIPT_RUNTIME
+};
+
+/// Values a postComplete hook sets next to, other than a request index
+#define RM_SCRIPT_NEXT  -1  ///< go on as usual
+#define RM_SCRIPT_END   -2  ///< end the iteration
+
+/// Scripts of a scenario, in Lua. Each script is compiled to bytecode once,
+/// when the scenario is loaded. Scripts define functions, which are called as
+/// hooks: before and after each iteration, and before sending and after
+/// receiving the response of requests naming them (see rmScriptHook).
+typedef struct _rmScripts {
+    GPtrArray *sources;        ///< source of each script
+    GPtrArray *bytecode;       ///< compiled bytecode of each script, as GByteArrays
+    gchar     *preIteration;   ///< name of the function run at the start of each iteration, if any
+    gchar     *postIteration;  ///< name of the function run at the end of each iteration, if any
+} rmScripts;
+
+/// What a hook is called for, which scripts can access through the 'rm'
+/// library. Request hooks have a request and, unless run by the raw engine, a
+/// message; postComplete hooks also have the response status.
+typedef struct _rmScriptContext {
+    rmScriptHook       hook;        ///< hook being run, set by rm_script_state_run()
+    guint              client;      ///< client id
+    guint              iteration;   ///< iterations the client has completed
+    const rmVarTable  *variables;
+    rmValue           *values;      ///< the client's variable values
+    GString          **owned;       ///< storage for values set by scripts, by variable number
+    const rmRequest   *request;
+    SoupMessage       *msg;
+    const gchar       *body;        ///< request body, if sent as a whole
+    gsize              bodyLength;
+    guint              status;
+} rmScriptContext;
+
+/// An interpreter running the scripts of a scenario. Each worker thread has
+/// its own, which loads the scripts' bytecode once when the worker starts,
+/// so that hooks run without any lock, and without compiling anything.
+typedef struct _rmScriptState {
+    gpointer          lua;         ///< the interpreter (lua_State)
+    gint             *refs[RM_HOOK_COUNT]; ///< hook functions by request index (one for iteration hooks), 0 if none
+    guint             requestCount;
+    GHashTable       *names;       ///< request index by request name, for postComplete hooks to jump to
+    rmScriptContext  *context;     ///< context of the running hook
+} rmScriptState;
+
+rmScripts*      rm_scripts_new();
+gboolean        rm_scripts_add(rmScripts *scripts, const gchar *type, const gchar *source, gsize length,
+                               GError **error);
+gboolean        rm_scripts_check(const rmScripts *scripts, const rmRequest *requests, guint count,
+                                 GError **error);
+void            rm_scripts_free(rmScripts *scripts);
+rmScriptState*  rm_script_state_new(const rmScripts *scripts, const rmRequest *requests, guint count,
+                                    GError **error);
+gboolean        rm_script_state_run(rmScriptState *state, rmScriptHook hook, rmScriptContext *context,
+                                    rmScoreboard *sb, gint *next, GError **error);
+void            rm_script_state_free(rmScriptState *state);
+
+#endif // RAINMAKER_SCRIPT_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
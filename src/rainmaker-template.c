@@ -0,0 +1,194 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+
+#include "rainmaker-template.h"
+
+rmVarTable* rm_var_table_new()
+{
+    rmVarTable *vars;
+
+    vars = g_malloc(sizeof(rmVarTable));
+    vars->index = g_hash_table_new(g_str_hash, g_str_equal);
+    vars->names = g_ptr_array_new();
+
+    return vars;
+}
+
+/// Add a variable to the table, unless it is already there, and return its
+/// number
+guint rm_var_table_add(rmVarTable *vars, const gchar *name)
+{
+    gchar *copy;
+    gint   var;
+
+    if ((var = rm_var_table_lookup(vars, name)) >= 0) {
+        return (guint) var;
+    }
+
+    copy = g_strdup(name);
+    g_ptr_array_add(vars->names, copy);
+    g_hash_table_insert(vars->index, copy, GUINT_TO_POINTER(vars->names->len));
+
+    return vars->names->len - 1;
+}
+
+/// Look up a variable by name. Returns -1 if there is no such variable.
+gint rm_var_table_lookup(const rmVarTable *vars, const gchar *name)
+{
+    return (gint) GPOINTER_TO_UINT(g_hash_table_lookup(vars->index, name)) - 1;
+}
+
+void rm_var_table_free(rmVarTable *vars)
+{
+    guint i;
+
+    for (i = 0; i < vars->names->len; i++) {
+        g_free(g_ptr_array_index(vars->names, i));
+    }
+    g_ptr_array_free(vars->names, TRUE);
+    g_hash_table_destroy(vars->index);
+    g_free(vars);
+}
+
+static void add_segment(GArray *segments, const gchar *literal, gsize length, guint variable)
+{
+    rmTemplateSegment segment;
+
+    if (literal != NULL && length == 0) return;
+
+    segment.literal  = literal;
+    segment.length   = length;
+    segment.variable = variable;
+    g_array_append_val(segments, segment);
+}
+
+/// Compile text into a template. Variables are referenced as ${name}, and
+/// must be in the variable table; $${ stands for a literal ${. Returns NULL
+/// without setting an error if the text references no variables, in which
+/// case it can be used as is.
+rmTemplate* rm_template_compile(const gchar *text, gsize length, const rmVarTable *vars, guint flags,
+    GError **error)
+{
+    rmTemplate  *tmpl;
+    GArray      *segments;
+    const gchar *start, *pos, *end, *close;
+    gchar       *name;
+    gint         var;
+
+    if (text == NULL || g_strstr_len(text, length, "${") == NULL) return NULL;
+
+    tmpl = g_malloc0(sizeof(rmTemplate));
+    tmpl->source = g_malloc(length + 1);
+    tmpl->flags  = flags;
+    memcpy(tmpl->source, text, length);
+    tmpl->source[length] = '\0';
+
+    segments = g_array_new(FALSE, FALSE, sizeof(rmTemplateSegment));
+    start = pos = tmpl->source;
+    end   = tmpl->source + length;
+
+    while ((pos = g_strstr_len(pos, end - pos, "${")) != NULL) {
+        if (pos > start && pos[-1] == '$') {
+            // Escaped: the literal goes on from the second '$'
+            add_segment(segments, start, pos - 1 - start, 0);
+            start = pos;
+            pos  += 2;
+            continue;
+        }
+
+        close = memchr(pos + 2, '}', end - pos - 2);
+        if (close == NULL || close == pos + 2) {
+            g_set_error(error, RM_ERROR_TEMPLATE, RM_ERROR_TEMPLATE_SYNTAX,
+                "unterminated or empty variable reference in '%s'", tmpl->source);
+            g_array_free(segments, TRUE);
+            rm_template_free(tmpl);
+            return NULL;
+        }
+
+        name = g_strndup(pos + 2, close - pos - 2);
+        var  = rm_var_table_lookup(vars, name);
+        if (var < 0) {
+            g_set_error(error, RM_ERROR_TEMPLATE, RM_ERROR_TEMPLATE_UNKNOWN_VARIABLE,
+                "reference to undefined variable '%s'", name);
+            g_free(name);
+            g_array_free(segments, TRUE);
+            rm_template_free(tmpl);
+            return NULL;
+        }
+        g_free(name);
+
+        add_segment(segments, start, pos - start, 0);
+        add_segment(segments, NULL, 0, (guint) var);
+        start = pos = close + 1;
+    }
+    add_segment(segments, start, end - start, 0);
+
+    tmpl->segmentCount = segments->len;
+    tmpl->segments     = (rmTemplateSegment *) g_array_free(segments, FALSE);
+
+    return tmpl;
+}
+
+/// Append a value to a string, encoded as in an application/x-www-form-
+/// urlencoded body
+static void append_form_encoded(GString *out, const gchar *data, gsize length)
+{
+    static const gchar hex[] = "0123456789ABCDEF";
+    gsize              i;
+    guchar             c;
+
+    for (i = 0; i < length; i++) {
+        c = (guchar) data[i];
+        if (g_ascii_isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            g_string_append_c(out, c);
+        } else {
+            g_string_append_c(out, '%');
+            g_string_append_c(out, hex[c >> 4]);
+            g_string_append_c(out, hex[c & 0xf]);
+        }
+    }
+}
+
+/// Render a template into a string, appending to it. Variables with no value
+/// render as empty strings. Strings are expected to be reused between calls,
+/// so that rendering does not allocate memory once they have grown enough.
+void rm_template_render(const rmTemplate *tmpl, const rmValue *values, GString *out)
+{
+    const rmTemplateSegment *segment;
+    const rmValue           *value;
+    guint                    i;
+
+    for (i = 0; i < tmpl->segmentCount; i++) {
+        segment = &tmpl->segments[i];
+        if (segment->literal != NULL) {
+            g_string_append_len(out, segment->literal, segment->length);
+            continue;
+        }
+
+        value = &values[segment->variable];
+        if (value->data == NULL) continue;
+
+        if (tmpl->flags & RM_TEMPLATE_FORM_ENCODE) {
+            append_form_encoded(out, value->data, value->length);
+        } else {
+            g_string_append_len(out, value->data, value->length);
+        }
+    }
+}
+
+void rm_template_free(rmTemplate *tmpl)
+{
+    g_free(tmpl->segments);
+    g_free(tmpl->source);
+    g_free(tmpl);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
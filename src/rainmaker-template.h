@@ -0,0 +1,72 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_TEMPLATE_H_
+#define RAINMAKER_TEMPLATE_H_
+
+#include <glib.h>
+
+/// Error Quark for template related errors
+#define RM_ERROR_TEMPLATE g_quark_from_static_string("rainmaker-template-error")
+
+/// Template error codes
+enum {
+    RM_ERROR_TEMPLATE_SYNTAX,
+    RM_ERROR_TEMPLATE_UNKNOWN_VARIABLE,
+    RM_ERROR_TEMPLATE_DUPLICATE_VARIABLE
+};
+
+/// Template flags
+enum {
+    RM_TEMPLATE_FORM_ENCODE = 1 << 0   ///< form-encode variable values when rendering
+};
+
+/// The value of a variable. Values are not owned by the variable table, and
+/// usually point into a mapped data file.
+typedef struct _rmValue {
+    const gchar *data;
+    gsize        length;
+} rmValue;
+
+/// Variables that can be referenced from templates. Each variable gets a
+/// number when the scenario is loaded, and clients keep variable values in
+/// an array indexed by this number.
+typedef struct _rmVarTable {
+    GHashTable *index;   ///< variable name to variable number + 1
+    GPtrArray  *names;
+} rmVarTable;
+
+/// A segment of a template: either literal text or a variable reference
+typedef struct _rmTemplateSegment {
+    const gchar *literal;    ///< literal text, NULL for a variable reference
+    gsize        length;
+    guint        variable;
+} rmTemplateSegment;
+
+/// A compiled template: a list of literal and variable segments, rendered in
+/// a single pass with no parsing or lookups
+typedef struct _rmTemplate {
+    gchar             *source;    ///< copy of the template text, literal segments point into it
+    rmTemplateSegment *segments;
+    guint              segmentCount;
+    guint              flags;
+} rmTemplate;
+
+rmVarTable*  rm_var_table_new();
+guint        rm_var_table_add(rmVarTable *vars, const gchar *name);
+gint         rm_var_table_lookup(const rmVarTable *vars, const gchar *name);
+void         rm_var_table_free(rmVarTable *vars);
+
+rmTemplate*  rm_template_compile(const gchar *text, gsize length, const rmVarTable *vars, guint flags,
+                                 GError **error);
+void         rm_template_render(const rmTemplate *tmpl, const rmValue *values, GString *out);
+void         rm_template_free(rmTemplate *tmpl);
+
+#endif // RAINMAKER_TEMPLATE_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
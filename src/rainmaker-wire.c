@@ -0,0 +1,122 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <string.h>
+
+#include "rainmaker-wire.h"
+
+/// Append an unsigned integer as a varint
+void rm_wire_put_uint(GByteArray *buf, guint64 value)
+{
+    guint8 bytes[10];
+    guint  len = 0;
+
+    do {
+        bytes[len] = (guint8) (value & 0x7f);
+        value >>= 7;
+        if (value) bytes[len] |= 0x80;
+        len++;
+    } while (value);
+
+    g_byte_array_append(buf, bytes, len);
+}
+
+/// Append a double
+void rm_wire_put_double(GByteArray *buf, gdouble value)
+{
+    union {
+        gdouble d;
+        guint64 u;
+    } conv;
+    guint64 le;
+
+    conv.d = value;
+    le = GUINT64_TO_LE(conv.u);
+    g_byte_array_append(buf, (const guint8 *) &le, sizeof(le));
+}
+
+/// Append a block of data, prefixed by its length
+void rm_wire_put_data(GByteArray *buf, gconstpointer data, gsize length)
+{
+    rm_wire_put_uint(buf, length);
+    g_byte_array_append(buf, data, length);
+}
+
+void rm_wire_reader_init(rmWireReader *reader, gconstpointer data, gsize length)
+{
+    reader->data   = data;
+    reader->length = length;
+    reader->pos    = 0;
+    reader->failed = FALSE;
+}
+
+/// Read a varint. Varints longer than 64 bits are treated as an error.
+guint64 rm_wire_get_uint(rmWireReader *reader)
+{
+    guint64 value = 0;
+    guint   shift = 0;
+    guint8  byte;
+
+    do {
+        if (reader->failed || reader->pos >= reader->length || shift > 63) {
+            reader->failed = TRUE;
+            return 0;
+        }
+
+        byte   = reader->data[reader->pos++];
+        value |= ((guint64) (byte & 0x7f)) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return value;
+}
+
+/// Read a double
+gdouble rm_wire_get_double(rmWireReader *reader)
+{
+    union {
+        gdouble d;
+        guint64 u;
+    } conv;
+    guint64 le;
+
+    if (reader->failed || reader->length - reader->pos < sizeof(le)) {
+        reader->failed = TRUE;
+        return 0;
+    }
+
+    memcpy(&le, reader->data + reader->pos, sizeof(le));
+    reader->pos += sizeof(le);
+    conv.u = GUINT64_FROM_LE(le);
+
+    return conv.d;
+}
+
+/// Read a block of data. Returns a pointer into the reader's buffer and sets
+/// length to the length of the block, or returns NULL on error.
+const guint8* rm_wire_get_data(rmWireReader *reader, gsize *length)
+{
+    const guint8 *data;
+    guint64       len;
+
+    len = rm_wire_get_uint(reader);
+    if (reader->failed || len > reader->length - reader->pos) {
+        reader->failed = TRUE;
+        *length = 0;
+        return NULL;
+    }
+
+    data = reader->data + reader->pos;
+    reader->pos += len;
+    *length = (gsize) len;
+
+    return data;
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
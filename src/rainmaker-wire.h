@@ -0,0 +1,41 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_WIRE_H_
+#define RAINMAKER_WIRE_H_
+
+#include <glib.h>
+
+/// Helpers for the compact binary encoding used between the coordinator and
+/// agents. Integers are encoded as little-endian base 128 varints, so small
+/// counters (the common case) take a single byte. Doubles are sent as their
+/// 64 bit IEEE 754 representation, little-endian.
+///
+/// Values are written by appending to a GByteArray, and read through a reader
+/// which keeps the read position. Reading past the end of the data does not
+/// fail right away, but marks the reader as failed and returns zeros, so a
+/// message can be decoded in one go and checked once at the end.
+typedef struct _rmWireReader {
+    const guint8 *data;
+    gsize         length;
+    gsize         pos;
+    gboolean      failed;
+} rmWireReader;
+
+void          rm_wire_put_uint(GByteArray *buf, guint64 value);
+void          rm_wire_put_double(GByteArray *buf, gdouble value);
+void          rm_wire_put_data(GByteArray *buf, gconstpointer data, gsize length);
+
+void          rm_wire_reader_init(rmWireReader *reader, gconstpointer data, gsize length);
+guint64       rm_wire_get_uint(rmWireReader *reader);
+gdouble       rm_wire_get_double(rmWireReader *reader);
+const guint8* rm_wire_get_data(rmWireReader *reader, gsize *length);
+
+#endif // RAINMAKER_WIRE_H_
+
+// vim:ts=4:expandtab:cindent:sw=2
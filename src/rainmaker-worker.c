@@ -0,0 +1,373 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-worker.h"
+#include "rainmaker-scheduler.h"
+#include "rainmaker-client.h"
+#include "rainmaker-scoreboard.h"
+
+static void worker_fill_slots(rmWorker *worker);
+
+/// Create a new worker with a fixed number of slots. The worker's main context
+/// and the slot sessions (or raw engine connections, if the scheduler uses
+/// the raw engine) are created right away, but nothing runs until the worker
+/// thread is started.
+rmWorker* rm_worker_new(guint id, struct _rmScheduler *scheduler, guint slots, SoupLogger *logger)
+{
+    rmWorker *worker;
+    guint     i;
+
+    g_assert(slots > 0);
+
+    worker = g_malloc0(sizeof(rmWorker));
+    worker->id         = id;
+    worker->scheduler  = scheduler;
+    worker->context    = g_main_context_new();
+    worker->loop       = g_main_loop_new(worker->context, FALSE);
+    worker->dequeLock  = g_mutex_new();
+    worker->scoreboard = rm_scoreboard_new(scheduler->scenario->requestCount);
+    worker->slotCount  = slots;
+    worker->slots      = g_malloc0(sizeof(rmWorkerSlot) * slots);
+    g_queue_init(&worker->deque);
+
+    if (scheduler->profile) {
+        worker->stageScoreboards = g_malloc(sizeof(rmScoreboard *) * scheduler->profile->stageCount);
+        for (i = 0; i < scheduler->profile->stageCount; i++) {
+            worker->stageScoreboards[i] = rm_scoreboard_new(scheduler->scenario->requestCount);
+        }
+    }
+
+    if (scheduler->raw) {
+        worker->poller = rm_raw_poller_new(worker->context);
+    }
+
+    for (i = 0; i < slots; i++) {
+        worker->slots[i].worker = worker;
+        if (scheduler->raw) {
+            worker->slots[i].raw = rm_raw_conn_new(scheduler->raw, worker->poller);
+        } else {
+            worker->slots[i].session = soup_session_async_new_with_options(
+                                           SOUP_SESSION_ASYNC_CONTEXT, worker->context, NULL);
+            if (scheduler->scenario->maxConnsPerHost > 0) {
+                g_object_set(worker->slots[i].session,
+                    SOUP_SESSION_MAX_CONNS_PER_HOST, scheduler->scenario->maxConnsPerHost, NULL);
+            }
+            if (logger) {
+                soup_session_add_feature(worker->slots[i].session, (SoupSessionFeature *) logger);
+            }
+        }
+        worker->freeSlots = g_slist_prepend(worker->freeSlots, &worker->slots[i]);
+    }
+
+    return worker;
+}
+
+/// Destroy a timer source, if set
+static void worker_remove_timer(GSource **timer)
+{
+    if (*timer) {
+        g_source_destroy(*timer);
+        g_source_unref(*timer);
+        *timer = NULL;
+    }
+}
+
+/// Stop the worker's main loop. Called from the worker thread.
+static void worker_stop(rmWorker *worker)
+{
+    worker->stopped = TRUE;
+    worker->runTime = rm_scheduler_elapsed(worker->scheduler);
+
+    worker_remove_timer(&worker->warmupTimer);
+    worker_remove_timer(&worker->deadlineTimer);
+
+    g_main_loop_quit(worker->loop);
+}
+
+/// Get the scoreboard iterations running on the worker record into: the
+/// warm-up scoreboard during the warm-up, otherwise the worker's scoreboard,
+/// or that of the running load profile stage
+static rmScoreboard* worker_scoreboard(rmWorker *worker)
+{
+    if (worker->warming) return worker->warmupScoreboard;
+
+    if (worker->stageScoreboards != NULL) {
+        return worker->stageScoreboards[g_atomic_int_get(&worker->scheduler->stage)];
+    }
+
+    return worker->scoreboard;
+}
+
+/// Called from the worker thread when a client has completed an iteration.
+/// Frees the slot, and queues the client for its next iteration if it has
+/// any left, if the run goes on until its deadline, or if the load profile
+/// says so. Clients are queued on the
+/// worker that ran their last iteration, but they may be stolen by other
+/// workers before they get to run again.
+static void worker_iteration_done(rmClient *client, rmWorkerSlot *slot)
+{
+    rmWorker *worker = slot->worker;
+    guint     done   = 1;
+
+    worker->iterations++;
+    worker->busyTime += rm_scheduler_elapsed(worker->scheduler) - slot->started;
+
+    slot->client      = NULL;
+    worker->freeSlots = g_slist_prepend(worker->freeSlots, slot);
+
+    if (worker->scheduler->profile != NULL) {
+        rm_scheduler_release(worker->scheduler, worker, client);
+    } else {
+        if (client->failed) {
+            // Drop iterations the failed client will not run
+            done += client->iterations;
+            client->iterations = 0;
+        } else {
+            if (client->iterations == 0 && rm_scheduler_loops(worker->scheduler)) {
+                client->iterations = 1;
+                done = 0;
+            }
+            if (client->iterations > 0) {
+                rm_scheduler_push(worker->scheduler, worker, client);
+            }
+        }
+
+        rm_scheduler_iterations_done(worker->scheduler, done);
+    }
+
+    worker_fill_slots(worker);
+}
+
+/// Start as many client iterations as there are free slots, taking clients
+/// from the worker's deque or stealing them from other workers. A worker left
+/// with idle slots sleeps until another worker has clients waiting for it, or
+/// the run is over. Will stop the worker once there is no work left anywhere.
+static void worker_fill_slots(rmWorker *worker)
+{
+    rmWorkerSlot *slot;
+    rmClient     *client;
+
+    while (worker->freeSlots != NULL) {
+        client = rm_scheduler_next(worker->scheduler, worker);
+        if (client == NULL) {
+            // Say the worker is hungry before looking one last time, so that
+            // a client queued meanwhile is either found now, or seen by the
+            // worker queueing it, which then wakes this one up
+            g_atomic_int_set(&worker->hungry, 1);
+            client = rm_scheduler_next(worker->scheduler, worker);
+            if (client == NULL) break;
+        }
+        g_atomic_int_set(&worker->hungry, 0);
+
+        slot = (rmWorkerSlot *) worker->freeSlots->data;
+        worker->freeSlots = g_slist_delete_link(worker->freeSlots, worker->freeSlots);
+
+        slot->client  = client;
+        slot->started = rm_scheduler_elapsed(worker->scheduler);
+
+        rm_client_run_iteration(client, slot->session, slot->raw, &slot->connRequests, worker_scoreboard(worker),
+            worker->samples, worker->script, (rmClientDoneFunc) worker_iteration_done, slot);
+    }
+
+    if (rm_scheduler_is_done(worker->scheduler)) {
+        if (! worker->stopped) worker_stop(worker);
+
+    } else if (worker->freeSlots == NULL) {
+        // All slots are busy - offer clients left waiting to hungry workers
+        rm_scheduler_share(worker->scheduler, worker);
+    }
+}
+
+/// Called in the worker thread when it is woken up
+static gboolean worker_wakeup(rmWorker *worker)
+{
+    g_atomic_int_set(&worker->wakeup, 0);
+    worker_fill_slots(worker);
+
+    return FALSE;
+}
+
+/// Wake a worker up to look for work. Called by the load profile driver, so
+/// that clients start when they are due, by workers with clients they can't
+/// run yet, and by the scheduler once the run is over, so that idle workers
+/// stop. Safe to call from any thread.
+void rm_worker_wake(rmWorker *worker)
+{
+    GSource *source;
+
+    if (! g_atomic_int_compare_and_exchange(&worker->wakeup, 0, 1)) return;
+
+    source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_HIGH);
+    g_source_set_callback(source, (GSourceFunc) worker_wakeup, worker, NULL);
+    g_source_attach(source, worker->context);
+    g_source_unref(source);
+}
+
+/// Called at the end of the warm-up. Responses received from now on, including
+/// those of running iterations, are recorded into the worker's scoreboard (or
+/// the running stage's).
+static gboolean worker_warmup_over(rmWorker *worker)
+{
+    guint i;
+
+    g_source_unref(worker->warmupTimer);
+    worker->warmupTimer = NULL;
+    worker->warming     = FALSE;
+
+    for (i = 0; i < worker->slotCount; i++) {
+        if (worker->slots[i].client != NULL) {
+            worker->slots[i].client->scoreboard = worker_scoreboard(worker);
+        }
+    }
+
+    return FALSE;
+}
+
+/// Called once the run's duration is over: no more iterations start, the
+/// clients queued on the worker are dropped, and running iterations are
+/// cancelled. The worker stops once all other workers are done as well.
+static gboolean worker_deadline(rmWorker *worker)
+{
+    guint i;
+
+    g_source_unref(worker->deadlineTimer);
+    worker->deadlineTimer = NULL;
+
+    rm_scheduler_expire(worker->scheduler);
+    rm_scheduler_drop_queued(worker->scheduler, worker);
+
+    for (i = 0; i < worker->slotCount; i++) {
+        if (worker->slots[i].client != NULL) {
+            rm_client_cancel(worker->slots[i].client);
+        }
+    }
+
+    if (! worker->stopped) worker_fill_slots(worker);
+
+    return FALSE;
+}
+
+/// Set a timer firing at a given time since the start of the run
+static GSource* worker_add_timer(rmWorker *worker, gdouble at, GSourceFunc func)
+{
+    GSource *timer;
+    gdouble  wait;
+
+    // Round up to the next millisecond so that the timer never fires early
+    wait  = MAX(at - rm_scheduler_elapsed(worker->scheduler), 0);
+    timer = g_timeout_source_new((guint) (wait * 1000) + 1);
+    g_source_set_priority(timer, G_PRIORITY_HIGH);
+    g_source_set_callback(timer, func, worker, NULL);
+    g_source_attach(timer, worker->context);
+
+    return timer;
+}
+
+/// Worker thread main function: fill all slots and run the main loop until
+/// all work is done, or the run's duration is over
+static gpointer worker_thread_main(rmWorker *worker)
+{
+    rmScheduler *sched = worker->scheduler;
+
+    g_main_context_push_thread_default(worker->context);
+
+    if (worker->warming) {
+        worker->warmupTimer = worker_add_timer(worker, sched->warmup, (GSourceFunc) worker_warmup_over);
+    }
+    if (sched->duration > 0) {
+        worker->deadlineTimer = worker_add_timer(worker, sched->duration, (GSourceFunc) worker_deadline);
+    }
+
+    worker_fill_slots(worker);
+    if (! worker->stopped) {
+        g_main_loop_run(worker->loop);
+    }
+
+    g_main_context_pop_thread_default(worker->context);
+
+    return NULL;
+}
+
+/// Start the worker thread. If the scenario has scripts, the worker's
+/// interpreter is set up first, loading the scripts' precompiled bytecode.
+/// If the run has a warm-up, the worker's warm-up scoreboard is created.
+gboolean rm_worker_start(rmWorker *worker, GError **error)
+{
+    rmScenario *scenario = worker->scheduler->scenario;
+
+    g_assert(worker->thread == NULL);
+
+    if (worker->scheduler->warmup > 0 && worker->warmupScoreboard == NULL) {
+        worker->warmupScoreboard = rm_scoreboard_new(scenario->requestCount);
+        worker->warming          = TRUE;
+    }
+
+    if (scenario->scripts != NULL && worker->script == NULL) {
+        worker->script = rm_script_state_new(scenario->scripts, scenario->requestTable,
+            scenario->requestCount, error);
+        if (worker->script == NULL) return FALSE;
+    }
+
+    worker->thread = g_thread_create((GThreadFunc) worker_thread_main, (gpointer) worker, TRUE, error);
+
+    return (worker->thread != NULL);
+}
+
+/// Wait for the worker thread to finish
+void rm_worker_join(rmWorker *worker)
+{
+    if (worker->thread != NULL) {
+        g_thread_join(worker->thread);
+        worker->thread = NULL;
+    }
+}
+
+/// Get the worker's utilization - the fraction of the worker's slot time which
+/// was spent running iterations
+gdouble rm_worker_utilization(rmWorker *worker)
+{
+    if (worker->runTime <= 0) return 0;
+
+    return worker->busyTime / (worker->runTime * worker->slotCount);
+}
+
+/// Free a worker and its slots. The worker must not be running. Clients are
+/// owned by the scheduler and are not freed.
+void rm_worker_free(rmWorker *worker)
+{
+    guint i;
+
+    g_assert(worker->thread == NULL);
+
+    for (i = 0; i < worker->slotCount; i++) {
+        if (worker->slots[i].session) g_object_unref(worker->slots[i].session);
+        if (worker->slots[i].raw) rm_raw_conn_free(worker->slots[i].raw);
+    }
+    g_free(worker->slots);
+    if (worker->poller) rm_raw_poller_free(worker->poller);
+    g_slist_free(worker->freeSlots);
+
+    g_queue_clear(&worker->deque);
+    g_mutex_free(worker->dequeLock);
+    rm_scoreboard_free(worker->scoreboard);
+    for (i = 0; worker->stageScoreboards && i < worker->scheduler->profile->stageCount; i++) {
+        rm_scoreboard_free(worker->stageScoreboards[i]);
+    }
+    g_free(worker->stageScoreboards);
+    if (worker->warmupScoreboard) rm_scoreboard_free(worker->warmupScoreboard);
+    if (worker->script) rm_script_state_free(worker->script);
+    g_main_loop_unref(worker->loop);
+    g_main_context_unref(worker->context);
+    g_free(worker);
+}
+
+// vim:ts=4:expandtab:cindent:sw=2
@@ -0,0 +1,87 @@
+/// ---------------------------------------------------------------------------
+/// Rainmaker HTTP load testing tool
+/// Copyright (c) 2010-2011 Shahar Evron
+///
+/// Rainmaker is free / open source software, available under the terms of the
+/// New BSD License. See COPYING for license details.
+/// ---------------------------------------------------------------------------
+
+#ifndef RAINMAKER_WORKER_H_
+#define RAINMAKER_WORKER_H_
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "rainmaker-scenario.h"
+#include "rainmaker-client.h"
+#include "rainmaker-scoreboard.h"
+#include "rainmaker-raw.h"
+#include "rainmaker-script.h"
+
+struct _rmScheduler;
+struct _rmWorker;
+
+/// A slot can run one client iteration at a time. Each slot has its own
+/// session (or raw engine connection), so that clients running in different
+/// slots don't share cookies or connections.
+typedef struct _rmWorkerSlot {
+    struct _rmWorker *worker;
+    SoupSession      *session;
+    rmRawConn        *raw;
+    rmClient         *client;    ///< client running in this slot, or NULL
+    gdouble           started;   ///< time the running iteration started
+    guint             connRequests; ///< requests sent on the session's current connection
+} rmWorkerSlot;
+
+/// A worker is an OS thread running a main loop, which drives a fixed number
+/// of slots using asynchronous sessions. Each worker has its own deque of
+/// clients waiting to run an iteration; when it runs out of those, it steals
+/// from other workers (see rainmaker-scheduler.c), or sleeps until there is
+/// work to steal. All iterations running on
+/// a worker record into the worker's scoreboard, as they all run in the same
+/// thread. For the same reason, each worker runs script hooks in its own
+/// interpreter, which no other thread touches. With a load profile, the
+/// worker has a scoreboard for each stage, and iterations record into the one
+/// of the stage running when they start. During the warm-up of a run, if it
+/// has one, iterations record into the worker's warm-up scoreboard instead.
+typedef struct _rmWorker {
+    guint                 id;
+    struct _rmScheduler  *scheduler;
+    GThread              *thread;
+    GMainContext         *context;
+    GMainLoop            *loop;
+    gboolean              stopped;
+    GSource              *warmupTimer;   ///< fires at the end of the warm-up
+    GSource              *deadlineTimer; ///< fires once the run's duration is over
+    rmRawPoller          *poller;     ///< raw engine only
+    GMutex               *dequeLock;
+    GQueue                deque;      ///< clients waiting for a slot
+    rmWorkerSlot         *slots;
+    guint                 slotCount;
+    GSList               *freeSlots;
+    rmScoreboard         *scoreboard;
+    rmScoreboard        **stageScoreboards; ///< scoreboard of each load profile stage, if any
+    rmScoreboard         *warmupScoreboard; ///< scoreboard of the warm-up, if any
+    gboolean              warming;    ///< the warm-up is not over yet
+    volatile gint         wakeup;     ///< set while a wake up is pending
+    volatile gint         hungry;     ///< set while the worker has idle slots and found no work
+    rmScriptState        *script;     ///< interpreter running the scenario's scripts, if any
+    rmSampleRing         *samples;    ///< ring clients running on the worker log responses to, if any
+
+    // Utilization statistics
+    guint                 iterations; ///< iterations run by the worker
+    guint                 stolen;     ///< iterations stolen from other workers
+    gdouble               busyTime;   ///< total slot time spent running iterations
+    gdouble               runTime;    ///< time the worker was running
+} rmWorker;
+
+rmWorker*     rm_worker_new(guint id, struct _rmScheduler *scheduler, guint slots, SoupLogger *logger);
+gboolean      rm_worker_start(rmWorker *worker, GError **error);
+void          rm_worker_join(rmWorker *worker);
+void          rm_worker_wake(rmWorker *worker);
+gdouble       rm_worker_utilization(rmWorker *worker);
+void          rm_worker_free(rmWorker *worker);
+
+#endif // RAINMAKER_WORKER_H_
+
+// vim:ts=4:expandtab:cindent:sw=2